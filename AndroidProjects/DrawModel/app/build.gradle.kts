@@ -44,8 +44,42 @@ android {
 }
 
 // タスクを追加
+tasks.register("compileShaders") {
+    description = "シェーダーを NDK の glslc で SPIR-V にコンパイルします"
+    val shaderDir = file("../../../DrawModel/res")
+    val shaders = fileTree(shaderDir) {
+        include("*.vert", "*.frag", "*.comp", "*.mesh")
+    }
+    inputs.files(shaders, fileTree(shaderDir) { include("*.glsl") })
+    outputs.files(shaders.map { File(it.path + ".spv") })
+    doLast {
+        val osName = System.getProperty("os.name").lowercase()
+        val hostTag = when {
+            osName.contains("windows") -> "windows-x86_64"
+            osName.contains("mac") -> "darwin-x86_64"
+            else -> "linux-x86_64"
+        }
+        val glslc = File(android.ndkDirectory, "shader-tools/$hostTag/glslc" + if (osName.contains("windows")) ".exe" else "")
+        // .spv はリポジトリに含めないため、glslc が無い場合はビルドを失敗させる.
+        check(glslc.exists()) { "glslc が見つかりません: ${glslc.path}" }
+        shaders.forEach { shader ->
+            // メッシュシェーダーは Vulkan 1.3、サブグループ演算を使うものは Vulkan 1.1、それ以外は Vulkan 1.0 向け (compileShader.bat と同じ).
+            val targetEnv = when {
+                shader.extension == "mesh" -> "vulkan1.3"
+                shader.nameWithoutExtension.endsWith("_subgroup") -> "vulkan1.1"
+                else -> "vulkan1.0"
+            }
+            project.exec {
+                workingDir = shaderDir
+                commandLine(glslc.absolutePath, "-fshader-stage=${shader.extension}", "--target-env=$targetEnv",
+                    shader.name, "-o", shader.name + ".spv")
+            }
+        }
+    }
+}
 tasks.register<Copy>("copyResToAssets") {
     description = "リソースデータをコピーします"
+    dependsOn("compileShaders")
     from(File("../../../DrawModel/res")) // コピー元のディレクトリ
     into(File("src/main/assets/res")) // コピー先のassetsディレクトリ
 }
@@ -0,0 +1,107 @@
+﻿#include "BasePlatform.h"
+#include "Model.h"
+#include "GpuCulling.h"
+#include "ThreadPool.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <algorithm>
+
+// ModelLoader の読み込み時間を、変換の直列・並列とキャッシュの有無で比較する.
+//  使い方: ModelLoadBenchmark [モデルファイル] [回数]
+//  res/ を参照するため、DrawModel ディレクトリ (またはその1つ下) で実行する.
+namespace
+{
+  struct Measurement
+  {
+    ModelLoader::LoadStats stats;   // 各項目の中央値.
+    size_t meshCount = 0;
+    bool success = false;
+  };
+
+  double Median(std::vector<double> values)
+  {
+    std::sort(values.begin(), values.end());
+    return values.empty() ? 0.0 : values[values.size() / 2];
+  }
+
+  // アプリケーションの読み込みと同じ設定で iterations 回読み込む.
+  Measurement Measure(const char* modelFile, int iterations, bool parallelImport, bool useCache)
+  {
+    Measurement result;
+    std::vector<double> total, import, convert, cacheWrite;
+    for (int i = 0; i < iterations; ++i)
+    {
+      ModelLoader loader;
+      loader.SetBuildMeshlets(true);
+      loader.SetOptimizeMeshes(true);
+      loader.SetLodCount(GpuCulling::MaxLodCount);
+      loader.SetParallelImport(parallelImport);
+      loader.SetUseCache(useCache);
+
+      std::vector<ModelMesh> meshes;
+      std::vector<ModelMaterial> materials;
+      std::vector<ModelEmbeddedTextureData> embeddedTextures;
+      std::vector<ModelNode> nodes;
+      std::vector<ModelAnimation> animations;
+      if (!loader.Load(modelFile, meshes, materials, embeddedTextures, nodes, animations))
+      {
+        return result;
+      }
+      const auto& stats = loader.GetLoadStats();
+      total.push_back(stats.milliseconds);
+      import.push_back(stats.importMilliseconds);
+      convert.push_back(stats.convertMilliseconds);
+      cacheWrite.push_back(stats.cacheWriteMilliseconds);
+      result.stats.cacheHit = stats.cacheHit;
+      result.stats.nativeGltf = stats.nativeGltf;
+      result.stats.threadCount = stats.threadCount;
+      result.meshCount = meshes.size();
+    }
+    result.stats.milliseconds = Median(total);
+    result.stats.importMilliseconds = Median(import);
+    result.stats.convertMilliseconds = Median(convert);
+    result.stats.cacheWriteMilliseconds = Median(cacheWrite);
+    result.success = true;
+    return result;
+  }
+
+  void Print(const char* label, const Measurement& m)
+  {
+    if (!m.success)
+    {
+      printf("%-16s failed\n", label);
+      return;
+    }
+    printf("%-16s total %9.2f ms  import %9.2f ms  convert %9.2f ms  cache write %7.2f ms  (threads %u%s%s)\n",
+      label, m.stats.milliseconds, m.stats.importMilliseconds, m.stats.convertMilliseconds,
+      m.stats.cacheWriteMilliseconds, m.stats.threadCount,
+      m.stats.cacheHit ? ", cache hit" : "", m.stats.nativeGltf ? ", native glTF" : "");
+  }
+}
+
+int main(int argc, char* argv[])
+{
+  const char* modelFile = argc > 1 ? argv[1] : "res/model/alicia-solid.vrm.glb";
+  const int iterations = argc > 2 ? std::max(atoi(argv[2]), 1) : 5;
+
+  // シングルトンの生成が計測に含まれないよう、スレッドプールは先に作っておく.
+  GetThreadPool();
+  printf("%s (%d iterations, median)\n", modelFile, iterations);
+
+  auto serial = Measure(modelFile, iterations, false, false);
+  Print("Serial", serial);
+  auto parallel = Measure(modelFile, iterations, true, false);
+  Print("Parallel", parallel);
+  if (serial.success && parallel.success && parallel.stats.convertMilliseconds > 0.0)
+  {
+    printf("Convert speedup: %.2fx, Meshes: %zu\n",
+      serial.stats.convertMilliseconds / parallel.stats.convertMilliseconds, parallel.meshCount);
+  }
+
+  // 1回目でキャッシュを書き出し (既にあれば読み込み)、以降はキャッシュからの読み込みを計る.
+  Print("Cache (first)", Measure(modelFile, 1, true, true));
+  Print("Cache (warm)", Measure(modelFile, iterations, true, true));
+
+  return (serial.success && parallel.success) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
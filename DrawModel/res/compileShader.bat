@@ -0,0 +1,22 @@
+@echo off
+
+for %%f in (*.*) do (
+  if "%%~xf"==".vert" (
+    glslangValidator -S vert %%~f --target-env vulkan1.0 -o %%~f.spv
+  )
+  if "%%~xf"==".frag" (
+    glslangValidator -S frag %%~f --target-env vulkan1.0 -o %%~f.spv
+  )
+  if "%%~xf"==".comp" (
+    echo %%~nf| findstr /e "_subgroup" >nul
+    if errorlevel 1 (
+      glslangValidator -S comp %%~f --target-env vulkan1.0 -o %%~f.spv
+    ) else (
+      glslangValidator -S comp %%~f --target-env vulkan1.1 -o %%~f.spv
+    )
+  )
+  if "%%~xf"==".mesh" (
+    glslangValidator -S mesh %%~f --target-env vulkan1.3 -o %%~f.spv
+  )
+)
+@echo on
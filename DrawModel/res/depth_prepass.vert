@@ -0,0 +1,78 @@
+#version 450
+
+// 深度プリパス. 位置だけの頂点ストリームを読み、深度のみを書き込む (フラグメントシェーダーなし).
+// 位置の計算は shader.vert と同じ式・同じ invariant 指定にして、EQUAL 比較で一致させる.
+
+layout(location=0) in vec3 inPos;
+
+invariant gl_Position;
+
+layout(set=0, binding=0)
+uniform SceneParameters
+{
+  mat4 matView;
+  mat4 matProj;
+  vec4 lightDir;
+  uint instanceStride;  // firstInstance = メッシュ番号 * instanceStride.
+};
+
+struct MeshParameters
+{
+  mat4 matWorld;
+  //----
+  vec4 baseColor; // diffuse + alpha
+  vec4 specular;  // specular + shininess
+  vec4 ambient;
+  vec4 positionScale;  // 量子化された位置の復元用.
+  vec4 positionOffset;
+  int mode;
+  int vertexFlags;
+  int skinnedVertexOffset;  // スキニング後の頂点の番号 = 頂点番号 + skinnedVertexOffset.
+};
+
+layout(set=0, binding=1)
+readonly buffer MeshParameterBuffer
+{
+  MeshParameters meshParams[];
+};
+
+layout(set=0, binding=3)
+readonly buffer InstanceTransformBuffer
+{
+  mat4 instanceTransforms[];
+};
+
+layout(set=0, binding=4)
+readonly buffer VisibleInstanceBuffer
+{
+  uint visibleInstances[];
+};
+
+struct SkinnedVertex
+{
+  vec4 position;
+  vec4 normal;
+};
+layout(set=0, binding=5)
+readonly buffer SkinnedVertexBuffer
+{
+  SkinnedVertex skinnedVertices[];
+};
+
+const int VERTEX_DECODE_SKINNED = 0x02;
+
+void main()
+{
+  uint meshIndex = uint(gl_InstanceIndex) / instanceStride;
+  uint instanceIndex = visibleInstances[uint(gl_InstanceIndex) % instanceStride];
+  MeshParameters mesh = meshParams[meshIndex];
+  mat4 matWorld = instanceTransforms[instanceIndex] * mesh.matWorld;
+  vec3 position = inPos * mesh.positionScale.xyz + mesh.positionOffset.xyz;
+  if ((mesh.vertexFlags & VERTEX_DECODE_SKINNED) != 0)
+  {
+    position = skinnedVertices[gl_VertexIndex + mesh.skinnedVertexOffset].position.xyz;
+  }
+
+  vec4 worldPosition = matWorld * vec4(position, 1);
+  gl_Position = matProj * matView * worldPosition;
+}
@@ -2,6 +2,7 @@
 
 layout(location=0) in vec3 inNormal;
 layout(location=1) in vec2 inTexcoord0;
+layout(location=2) flat in int inMeshIndex;
 layout(location=0) out vec4 outColor;
 
 layout(set=0,binding=2)
@@ -13,17 +14,27 @@ uniform SceneParameters
   mat4 matView;
   mat4 matProj;
   vec4 lightDir;
+  uint instanceStride;  // firstInstance = メッシュ番号 * instanceStride.
 };
 
-layout(set=0, binding=1)
-uniform MeshParameters
+struct MeshParameters
 {
   mat4 matWorld;
   //----
   vec4 baseColor; // diffuse + alpha
   vec4 specular;  // specular + shininess
   vec4 ambient;
+  vec4 positionScale;  // 量子化された位置の復元用.
+  vec4 positionOffset;
   int mode;
+  int vertexFlags;
+};
+
+// 全メッシュのパラメータ. 描画時の firstInstance にメッシュ番号が入っている.
+layout(set=0, binding=1)
+readonly buffer MeshParameterBuffer
+{
+  MeshParameters meshParams[];
 };
 
 
@@ -33,7 +44,7 @@ void main()
   float dotNL = max(dot(toLightDir, inNormal), 0.5);
   vec4 diffuse = texture(gTexDiffuse, inTexcoord0);
 
-  if(mode == 1)
+  if(meshParams[inMeshIndex].mode == 1)
   {
     // AlphaMask
     if(diffuse.a  < 0.5) {
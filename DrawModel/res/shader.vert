@@ -6,6 +6,10 @@ layout(location=2) in vec2 inTexcoord0;
 
 layout(location=0) out vec3 outNormal;
 layout(location=1) out vec2 outTexcoord0;
+layout(location=2) flat out int outMeshIndex;
+
+// 深度プリパス (depth_prepass.vert) と同じ深度になるよう、位置の計算を不変にする.
+invariant gl_Position;
 
 layout(set=0, binding=0)
 uniform SceneParameters
@@ -13,25 +17,97 @@ uniform SceneParameters
   mat4 matView;
   mat4 matProj;
   vec4 lightDir;
+  uint instanceStride;  // firstInstance = メッシュ番号 * instanceStride.
 };
 
-layout(set=0, binding=1)
-uniform MeshParameters
+struct MeshParameters
 {
   mat4 matWorld;
   //----
   vec4 baseColor; // diffuse + alpha
   vec4 specular;  // specular + shininess
   vec4 ambient;
+  vec4 positionScale;  // 量子化された位置の復元用.
+  vec4 positionOffset;
   int mode;
+  int vertexFlags;
+  int skinnedVertexOffset;  // スキニング後の頂点の番号 = 頂点番号 + skinnedVertexOffset.
+};
+
+// 全メッシュのパラメータ. メッシュ番号は描画時の firstInstance から求める.
+layout(set=0, binding=1)
+readonly buffer MeshParameterBuffer
+{
+  MeshParameters meshParams[];
+};
+
+// インスタンスごとの変換行列.
+layout(set=0, binding=3)
+readonly buffer InstanceTransformBuffer
+{
+  mat4 instanceTransforms[];
+};
+
+// 可視判定を通ったインスタンスの番号. インスタンスID から参照する.
+layout(set=0, binding=4)
+readonly buffer VisibleInstanceBuffer
+{
+  uint visibleInstances[];
+};
+
+// コンピュートシェーダーでスキニングした頂点 (モデル空間). VERTEX_DECODE_SKINNED のメッシュが参照する.
+struct SkinnedVertex
+{
+  vec4 position;
+  vec4 normal;
+};
+layout(set=0, binding=5)
+readonly buffer SkinnedVertexBuffer
+{
+  SkinnedVertex skinnedVertices[];
 };
 
+const int VERTEX_DECODE_NORMAL_OCT16 = 0x01;
+const int VERTEX_DECODE_SKINNED = 0x02;
+
+// 八面体エンコードされた法線の復元.
+vec3 DecodeOctahedral(vec2 e)
+{
+  vec3 n = vec3(e.xy, 1.0 - abs(e.x) - abs(e.y));
+  if (n.z < 0.0)
+  {
+    vec2 signNotZero = vec2(n.x >= 0.0 ? 1.0 : -1.0, n.y >= 0.0 ? 1.0 : -1.0);
+    n.xy = (1.0 - abs(n.yx)) * signNotZero;
+  }
+  return normalize(n);
+}
+
 void main()
 {
-  vec4 worldPosition = matWorld * vec4(inPos, 1);
-  vec3 worldNormal = mat3(matWorld) * inNormal;
+  // gl_InstanceIndex = メッシュ番号 * instanceStride + インスタンスID.
+  //  インスタンシングしない時は instanceStride = 1 で、インスタンス0 (単位行列) を使う.
+  uint meshIndex = uint(gl_InstanceIndex) / instanceStride;
+  uint instanceIndex = visibleInstances[uint(gl_InstanceIndex) % instanceStride];
+  MeshParameters mesh = meshParams[meshIndex];
+  mat4 matWorld = instanceTransforms[instanceIndex] * mesh.matWorld;
+  vec3 position = inPos * mesh.positionScale.xyz + mesh.positionOffset.xyz;
+  vec3 normal = inNormal;
+  if ((mesh.vertexFlags & VERTEX_DECODE_NORMAL_OCT16) != 0)
+  {
+    normal = DecodeOctahedral(inNormal.xy);
+  }
+  if ((mesh.vertexFlags & VERTEX_DECODE_SKINNED) != 0)
+  {
+    SkinnedVertex skinned = skinnedVertices[gl_VertexIndex + mesh.skinnedVertexOffset];
+    position = skinned.position.xyz;
+    normal = skinned.normal.xyz;
+  }
+
+  vec4 worldPosition = matWorld * vec4(position, 1);
+  vec3 worldNormal = mat3(matWorld) * normal;
   gl_Position = matProj * matView * worldPosition;
   
   outNormal = worldNormal * 0.5 + 0.5;
   outTexcoord0 = inTexcoord0;
+  outMeshIndex = int(meshIndex);
 }
@@ -0,0 +1,211 @@
+// 1回のディスパッチでミップマップを最大12段作成する. (単一パスのダウンサンプラー)
+// 各ワークグループが入力の 64x64 を受け持ち、共有メモリ上で6段下 (1x1) まで縮小する.
+// 全ワークグループの6段目が揃った後、最後に終わったワークグループが6段目の 64x64 から残りの6段を作る.
+// 段の間でバリアやディスパッチを挟まないため、小さい段でも GPU が空かない.
+// 6段目を他のワークグループから参照するため、出力は coherent で宣言する.
+//
+// このファイルはフォーマットごとのシェーダーから include する. include する側で以下を定義する.
+//  SPD_FORMAT     : 出力イメージのフォーマット修飾子. (rgba8, rgba16f, r32f)
+//  SPD_REDUCE_MAX : 1 ならば 2x2 の最大値、0 ならば平均を取る.
+//  SPD_USE_SUBGROUP : 1 ならば3段目をサブグループのクアッド演算で作る. (省略時は 0)
+//                     GL_KHR_shader_subgroup_quad を有効にし、Vulkan 1.1 向けにコンパイルすること.
+//
+// 出力の配列は定数でのみ添字を指定する. (shaderStorageImageArrayDynamicIndexing を必要としないため)
+// 段 n の大きさは max(srcSize >> n, 1) とし、範囲外となる位置は段の端の値で置き換える.
+
+#ifndef SPD_USE_SUBGROUP
+#define SPD_USE_SUBGROUP 0
+#endif
+
+layout(local_size_x=256,local_size_y=1,local_size_z=1) in;
+
+layout(set=0, binding=0) uniform sampler2D srcLevel;
+layout(set=0, binding=1, SPD_FORMAT) uniform coherent image2D dstLevels[12];
+layout(set=0, binding=2) buffer Counter
+{
+  uint finishedGroups;
+};
+
+layout(push_constant)
+uniform DownsampleParameters
+{
+  uvec2 srcSize;
+  uint  levelCount;   // 作成する段数. (1 ～ 12)
+  uint  groupCount;   // ディスパッチした全ワークグループ数.
+};
+
+shared vec4 sharedValues[16 * 16];
+shared uint isLastGroup;
+
+vec4 Reduce4(vec4 a, vec4 b, vec4 c, vec4 d)
+{
+#if SPD_REDUCE_MAX
+  return max(max(a, b), max(c, d));
+#else
+  return (a + b + c + d) * 0.25;
+#endif
+}
+
+ivec2 LevelSize(uint level)
+{
+  return ivec2(max(srcSize >> level, uvec2(1)));
+}
+
+#define STORE_LEVEL(index) \
+  if (all(lessThan(pos, imageSize(dstLevels[index])))) { imageStore(dstLevels[index], pos, value); } \
+  break
+
+// level は 1 から数えた段.
+void StoreLevel(uint level, ivec2 pos, vec4 value)
+{
+  if (level > levelCount)
+  {
+    return;
+  }
+  switch (level)
+  {
+  case 1u: STORE_LEVEL(0);
+  case 2u: STORE_LEVEL(1);
+  case 3u: STORE_LEVEL(2);
+  case 4u: STORE_LEVEL(3);
+  case 5u: STORE_LEVEL(4);
+  case 6u: STORE_LEVEL(5);
+  case 7u: STORE_LEVEL(6);
+  case 8u: STORE_LEVEL(7);
+  case 9u: STORE_LEVEL(8);
+  case 10u: STORE_LEVEL(9);
+  case 11u: STORE_LEVEL(10);
+  case 12u: STORE_LEVEL(11);
+  }
+}
+
+// 前半は入力の段、後半は6段目を読む. どちらも範囲外は端に寄せる.
+vec4 LoadInput(bool fromSource, ivec2 pos)
+{
+  if (fromSource)
+  {
+    return texelFetch(srcLevel, min(pos, ivec2(srcSize) - 1), 0);
+  }
+  return imageLoad(dstLevels[5], min(pos, imageSize(dstLevels[5]) - 1));
+}
+
+// タイル内の位置 local を、段 level の範囲に収まるよう寄せる. dim はタイルの大きさ.
+ivec2 ClampLocal(ivec2 local, uvec2 tile, uint level, int dim)
+{
+  ivec2 limit = max(LevelSize(level) - 1 - ivec2(tile) * dim, ivec2(0));
+  return min(local, limit);
+}
+
+// 64x64 の領域を6段縮小し、firstLevel の段から順に書き込む.
+//  スレッド1つが2段下 (16x16) の1テクセルを受け持ち、1段下の 2x2 を入力の 4x4 から作る.
+//  3段目以降は共有メモリ上で 2x2 をまとめ、段ごとに担当するスレッドを 1/4 に減らす.
+//  サブグループを使う場合は、2段目で 2x2 となる4テクセルを連続した4スレッド (クアッド) に割り当て、
+//  3段目をクアッド内の値の交換で作る. 共有メモリの読み書きとバリアが1段分減る.
+void DownsampleTile(uvec2 tile, uint firstLevel, bool fromSource)
+{
+  uint index = gl_LocalInvocationIndex;
+#if SPD_USE_SUBGROUP
+  uint quad = index / 4u;
+  ivec2 pos2 = ivec2((quad % 8u) * 2u + (index & 1u), (quad / 8u) * 2u + ((index >> 1) & 1u));
+#else
+  ivec2 pos2 = ivec2(index % 16, index / 16);
+#endif
+
+  vec4 values[4];
+  for (int i = 0; i < 4; ++i)
+  {
+    ivec2 pos1 = pos2 * 2 + ivec2(i & 1, i >> 1);
+    ivec2 src = ivec2(tile) * 64 + pos1 * 2;
+    values[i] = Reduce4(
+      LoadInput(fromSource, src), LoadInput(fromSource, src + ivec2(1, 0)),
+      LoadInput(fromSource, src + ivec2(0, 1)), LoadInput(fromSource, src + ivec2(1, 1)));
+    StoreLevel(firstLevel, ivec2(tile) * 32 + pos1, values[i]);
+  }
+  // 1段目の右・下の列が範囲外ならば、端の値を使う.
+  ivec2 edge = ClampLocal(pos2 * 2 + 1, tile, firstLevel, 32) - pos2 * 2;
+  if (edge.x <= 0)
+  {
+    values[1] = values[0];
+    values[3] = values[2];
+  }
+  if (edge.y <= 0)
+  {
+    values[2] = values[0];
+    values[3] = values[1];
+  }
+  vec4 value = Reduce4(values[0], values[1], values[2], values[3]);
+  StoreLevel(firstLevel + 1, ivec2(tile) * 16 + pos2, value);
+#if SPD_USE_SUBGROUP
+  // 2段目の右・下の列が範囲外ならば、クアッド内の端の値で置き換えてからまとめる.
+  ivec2 clamped = ClampLocal(pos2, tile, firstLevel + 1, 16);
+  vec4 neighbor = subgroupQuadSwapHorizontal(value);
+  if (clamped.x < pos2.x)
+  {
+    value = neighbor;
+  }
+  neighbor = subgroupQuadSwapVertical(value);
+  if (clamped.y < pos2.y)
+  {
+    value = neighbor;
+  }
+  value = Reduce4(value, subgroupQuadSwapHorizontal(value), subgroupQuadSwapVertical(value), subgroupQuadSwapDiagonal(value));
+  if ((index & 3u) == 0u)
+  {
+    StoreLevel(firstLevel + 2, ivec2(tile) * 8 + ivec2(quad % 8u, quad / 8u), value);
+    sharedValues[quad] = value;
+  }
+  barrier();
+  const int firstSharedLevel = 3;
+#else
+  sharedValues[index] = value;
+  barrier();
+  const int firstSharedLevel = 2;
+#endif
+
+  for (int level = firstSharedLevel, dim = 32 >> firstSharedLevel; level < 6; ++level, dim /= 2)
+  {
+    bool active = index < uint(dim * dim);
+    if (active)
+    {
+      ivec2 pos = ivec2(index % dim, index / dim);
+      int srcDim = dim * 2;
+      uint inputLevel = firstLevel + level - 1;
+      ivec2 p00 = pos * 2;
+      ivec2 p11 = ClampLocal(p00 + 1, tile, inputLevel, srcDim);
+      value = Reduce4(
+        sharedValues[p00.y * srcDim + p00.x], sharedValues[p00.y * srcDim + p11.x],
+        sharedValues[p11.y * srcDim + p00.x], sharedValues[p11.y * srcDim + p11.x]);
+      StoreLevel(firstLevel + level, ivec2(tile) * dim + pos, value);
+    }
+    // 全スレッドが読み終えてから書き戻す.
+    barrier();
+    if (active)
+    {
+      sharedValues[index] = value;
+    }
+    barrier();
+  }
+}
+
+void main()
+{
+  DownsampleTile(gl_WorkGroupID.xy, 1u, true);
+  if (levelCount <= 6)
+  {
+    return;
+  }
+
+  // 6段目の書き込みを他のワークグループから見えるようにしてから、終わったワークグループを数える.
+  memoryBarrierImage();
+  barrier();
+  if (gl_LocalInvocationIndex == 0)
+  {
+    isLastGroup = (atomicAdd(finishedGroups, 1u) == groupCount - 1u) ? 1u : 0u;
+  }
+  barrier();
+  if (isLastGroup == 0u)
+  {
+    return;
+  }
+  DownsampleTile(uvec2(0), 7u, false);
+}
@@ -0,0 +1,187 @@
+﻿#include "Animation.h"
+#include "SimdConfig.h"
+
+#include <cmath>
+#include <algorithm>
+
+namespace
+{
+  // 時刻を挟む2つのキーと補間係数. 範囲外は端のキーに固定する.
+  struct KeyPair
+  {
+    size_t first;
+    size_t second;
+    float  t;
+  };
+  KeyPair FindKeys(const std::vector<float>& times, float time)
+  {
+    auto itr = std::upper_bound(times.begin(), times.end(), time);
+    if (itr == times.begin())
+    {
+      return { 0, 0, 0.0f };
+    }
+    if (itr == times.end())
+    {
+      const auto last = times.size() - 1;
+      return { last, last, 0.0f };
+    }
+    const auto second = size_t(itr - times.begin());
+    const auto first = second - 1;
+    const float span = times[second] - times[first];
+    return { first, second, span > 0.0f ? (time - times[first]) / span : 0.0f };
+  }
+
+  // 4要素の線形補間.
+  inline glm::vec4 Lerp4(const glm::vec4& a, const glm::vec4& b, float t)
+  {
+    glm::vec4 r;
+#if defined(SIMD_SSE2)
+    __m128 va = _mm_loadu_ps(&a.x);
+    __m128 vb = _mm_loadu_ps(&b.x);
+    _mm_storeu_ps(&r.x, _mm_add_ps(va, _mm_mul_ps(_mm_sub_ps(vb, va), _mm_set1_ps(t))));
+#elif defined(SIMD_NEON)
+    float32x4_t va = vld1q_f32(&a.x);
+    float32x4_t vb = vld1q_f32(&b.x);
+    vst1q_f32(&r.x, vmlaq_n_f32(va, vsubq_f32(vb, va), t));
+#else
+    r = a + (b - a) * t;
+#endif
+    return r;
+  }
+
+  // クォータニオンの補間. 隣り合うキーの間の回転は小さいため、正規化した線形補間 (nlerp) で近似する.
+  //  遠回りしないよう、内積が負の場合は b の符号を反転してから補間する.
+  inline glm::vec4 Nlerp(const glm::vec4& a, const glm::vec4& b, float t)
+  {
+    glm::vec4 r;
+#if defined(SIMD_SSE2)
+    auto dot4 = [](__m128 x, __m128 y) {
+      __m128 d = _mm_mul_ps(x, y);
+      d = _mm_add_ps(d, _mm_shuffle_ps(d, d, _MM_SHUFFLE(2, 3, 0, 1)));
+      return _mm_add_ps(d, _mm_shuffle_ps(d, d, _MM_SHUFFLE(1, 0, 3, 2)));
+    };
+    __m128 va = _mm_loadu_ps(&a.x);
+    __m128 vb = _mm_loadu_ps(&b.x);
+    // 全要素に入った内積の符号ビットをそのまま b に適用する.
+    vb = _mm_xor_ps(vb, _mm_and_ps(dot4(va, vb), _mm_set1_ps(-0.0f)));
+    __m128 q = _mm_add_ps(va, _mm_mul_ps(_mm_sub_ps(vb, va), _mm_set1_ps(t)));
+    _mm_storeu_ps(&r.x, _mm_div_ps(q, _mm_sqrt_ps(dot4(q, q))));
+#elif defined(SIMD_NEON)
+    auto dot4 = [](float32x4_t x, float32x4_t y) {
+      float32x4_t m = vmulq_f32(x, y);
+      float32x2_t s = vadd_f32(vget_low_f32(m), vget_high_f32(m));
+      return vget_lane_f32(vpadd_f32(s, s), 0);
+    };
+    float32x4_t va = vld1q_f32(&a.x);
+    float32x4_t vb = vld1q_f32(&b.x);
+    if (dot4(va, vb) < 0.0f)
+    {
+      vb = vnegq_f32(vb);
+    }
+    float32x4_t q = vmlaq_n_f32(va, vsubq_f32(vb, va), t);
+    vst1q_f32(&r.x, vmulq_n_f32(q, 1.0f / std::sqrt(dot4(q, q))));
+#else
+    const glm::vec4 c = glm::dot(a, b) < 0.0f ? -b : b;
+    r = a + (c - a) * t;
+    r = r / std::sqrt(glm::dot(r, r));
+#endif
+    return r;
+  }
+
+  glm::vec4 SampleTrack(const std::vector<float>& times, const std::vector<glm::vec3>& values, float time)
+  {
+    const auto keys = FindKeys(times, time);
+    return Lerp4(glm::vec4(values[keys.first], 0.0f), glm::vec4(values[keys.second], 0.0f), keys.t);
+  }
+
+  // 平行移動・回転 (x, y, z, w)・スケールから T * R * S の行列を作る.
+  glm::mat4 ComposeTransform(const glm::vec4& t, const glm::vec4& q, const glm::vec4& s)
+  {
+    const float xx = q.x * q.x, yy = q.y * q.y, zz = q.z * q.z;
+    const float xy = q.x * q.y, xz = q.x * q.z, yz = q.y * q.z;
+    const float wx = q.w * q.x, wy = q.w * q.y, wz = q.w * q.z;
+
+    glm::mat4 m;
+    m[0] = glm::vec4(1.0f - 2.0f * (yy + zz), 2.0f * (xy + wz), 2.0f * (xz - wy), 0.0f) * s.x;
+    m[1] = glm::vec4(2.0f * (xy - wz), 1.0f - 2.0f * (xx + zz), 2.0f * (yz + wx), 0.0f) * s.y;
+    m[2] = glm::vec4(2.0f * (xz + wy), 2.0f * (yz - wx), 1.0f - 2.0f * (xx + yy), 0.0f) * s.z;
+    m[3] = glm::vec4(t.x, t.y, t.z, 1.0f);
+    return m;
+  }
+
+  // 列優先の行列の積 (a * b). 結果の各列は a の列を b の列の要素で重み付けした和.
+  inline void MultiplyMatrix(const glm::mat4& a, const glm::mat4& b, glm::mat4& out)
+  {
+#if defined(SIMD_SSE2)
+    const __m128 a0 = _mm_loadu_ps(&a[0].x);
+    const __m128 a1 = _mm_loadu_ps(&a[1].x);
+    const __m128 a2 = _mm_loadu_ps(&a[2].x);
+    const __m128 a3 = _mm_loadu_ps(&a[3].x);
+    for (int c = 0; c < 4; ++c)
+    {
+      const __m128 col = _mm_loadu_ps(&b[c].x);
+      __m128 r = _mm_mul_ps(a0, _mm_shuffle_ps(col, col, _MM_SHUFFLE(0, 0, 0, 0)));
+      r = _mm_add_ps(r, _mm_mul_ps(a1, _mm_shuffle_ps(col, col, _MM_SHUFFLE(1, 1, 1, 1))));
+      r = _mm_add_ps(r, _mm_mul_ps(a2, _mm_shuffle_ps(col, col, _MM_SHUFFLE(2, 2, 2, 2))));
+      r = _mm_add_ps(r, _mm_mul_ps(a3, _mm_shuffle_ps(col, col, _MM_SHUFFLE(3, 3, 3, 3))));
+      _mm_storeu_ps(&out[c].x, r);
+    }
+#elif defined(SIMD_NEON)
+    const float32x4_t a0 = vld1q_f32(&a[0].x);
+    const float32x4_t a1 = vld1q_f32(&a[1].x);
+    const float32x4_t a2 = vld1q_f32(&a[2].x);
+    const float32x4_t a3 = vld1q_f32(&a[3].x);
+    for (int c = 0; c < 4; ++c)
+    {
+      const float32x4_t col = vld1q_f32(&b[c].x);
+      float32x4_t r = vmulq_n_f32(a0, vgetq_lane_f32(col, 0));
+      r = vmlaq_n_f32(r, a1, vgetq_lane_f32(col, 1));
+      r = vmlaq_n_f32(r, a2, vgetq_lane_f32(col, 2));
+      r = vmlaq_n_f32(r, a3, vgetq_lane_f32(col, 3));
+      vst1q_f32(&out[c].x, r);
+    }
+#else
+    out = a * b;
+#endif
+  }
+}
+
+void SampleAnimation(const ModelAnimation& animation, float time, std::vector<ModelNode>& nodes)
+{
+  if (animation.duration > 0.0f)
+  {
+    time = std::fmod(time, animation.duration);
+    if (time < 0.0f)
+    {
+      time += animation.duration;
+    }
+  }
+
+  for (const auto& channel : animation.channels)
+  {
+    const auto position = SampleTrack(channel.positionTimes, channel.positions, time);
+    const auto scale = SampleTrack(channel.scaleTimes, channel.scales, time);
+    const auto keys = FindKeys(channel.rotationTimes, time);
+    const auto rotation = Nlerp(channel.rotations[keys.first], channel.rotations[keys.second], keys.t);
+    nodes[channel.nodeIndex].transform = ComposeTransform(position, rotation, scale);
+  }
+}
+
+void ComputeJointMatrices(const std::vector<glm::mat4>& nodeTransforms, const std::vector<ModelJoint>& joints, glm::mat4* outMatrices)
+{
+  for (size_t i = 0; i < joints.size(); ++i)
+  {
+    MultiplyMatrix(nodeTransforms[joints[i].nodeIndex], joints[i].inverseBindMatrix, outMatrices[i]);
+  }
+}
+
+const char* GetAnimationSimdName()
+{
+#if defined(SIMD_SSE2)
+  return "SSE2";
+#elif defined(SIMD_NEON)
+  return "NEON";
+#else
+  return "Scalar";
+#endif
+}
@@ -0,0 +1,22 @@
+﻿#pragma once
+#include <vector>
+#include <cstdint>
+
+#define GLM_FORCE_DEPTH_ZERO_TO_ONE
+#include "glm/glm.hpp"
+
+#include "Model.h"
+
+// キーフレームアニメーションの CPU でのサンプリングと、スキニング用のジョイント行列の計算.
+//  キーの補間と行列の積は SSE2 / NEON のうちコンパイル対象で使えるものを使用する.
+
+// time (秒) の姿勢をサンプリングし、チャンネルを持つノードの相対変換を書き換える.
+//  time はアニメーションの長さでループさせる.
+void SampleAnimation(const ModelAnimation& animation, float time, std::vector<ModelNode>& nodes);
+
+// ジョイント行列 (ジョイントのモデル空間での変換 * 逆バインド行列) を joints の順に outMatrices へ書き込む.
+//  nodeTransforms は ComputeNodeTransforms の結果.
+void ComputeJointMatrices(const std::vector<glm::mat4>& nodeTransforms, const std::vector<ModelJoint>& joints, glm::mat4* outMatrices);
+
+// 使用している SIMD 命令セットの名前.
+const char* GetAnimationSimdName();
@@ -8,6 +8,17 @@
 #include "Model.h"
 
 #include "TextureUtility.h"
+#include "MeshOptimizer.h"
+#include "Animation.h"
+#include "ThreadPool.h"
+#include "ModelCache.h"
+#include "MipDownsampler.h"
+
+#include <chrono>
+#include <numeric>
+#include <algorithm>
+#include <cfloat>
+#include <iterator>
 
 #if defined(PLATFORM_WINDOWS) || defined(PLATFORM_LINUX)
 #include "GLFW/glfw3.h"
@@ -25,8 +36,48 @@ extern "C"
 #define IMGUI_IMPL_VULKAN_HAS_DYNAMIC_RENDERING
 #include "backends/imgui_impl_vulkan.h"
 
+namespace
+{
+  // インスタンス番号から XZ 平面上の格子位置を求める.
+  //  0 番を中心に外周へ四角く渦巻き状に並べるため、先頭から何個取っても正方形に近い範囲に収まる.
+  glm::vec3 GetInstancePosition(uint32_t index, float spacing)
+  {
+    int x = 0, z = 0;
+    if (index > 0)
+    {
+      int ring = int(std::ceil((std::sqrt(double(index) + 1.0) - 1.0) / 2.0));
+      int side = ring * 2;
+      int offset = (side + 1) * (side + 1) - 1 - int(index);  // リングの最後からの距離.
+      if (offset < side) { x = ring - offset; z = -ring; }
+      else if ((offset -= side) < side) { x = -ring; z = -ring + offset; }
+      else if ((offset -= side) < side) { x = -ring + offset; z = ring; }
+      else { offset -= side; x = ring; z = ring - offset; }
+    }
+    return glm::vec3(float(x) * spacing, 0.0f, float(z) * spacing);
+  }
+
+  // AABB を行列で変換し、8頂点を包み直す.
+  void TransformBounds(const glm::vec3& boundsMin, const glm::vec3& boundsMax, const glm::mat4& matrix,
+    glm::vec3& outMin, glm::vec3& outMax)
+  {
+    outMin = glm::vec3(FLT_MAX);
+    outMax = glm::vec3(-FLT_MAX);
+    for (int corner = 0; corner < 8; ++corner)
+    {
+      glm::vec3 p(
+        (corner & 1) ? boundsMax.x : boundsMin.x,
+        (corner & 2) ? boundsMax.y : boundsMin.y,
+        (corner & 4) ? boundsMax.z : boundsMin.z);
+      p = glm::vec3(matrix * glm::vec4(p, 1.0f));
+      outMin = glm::min(outMin, p);
+      outMax = glm::max(outMax, p);
+    }
+  }
+}
+
 void Application::Initialize()
 {
+  m_startTime = std::chrono::steady_clock::now();
   InitializeWindow();
   InitializeGfxDevice();
 
@@ -60,13 +111,46 @@ void Application::Initialize()
   int width, height;
   window->GetWindowSize(width, height);
   m_depthBuffer.format = VK_FORMAT_D32_SFLOAT;
-  m_depthBuffer.depth = gfxDevice->CreateImage2D(width, height, m_depthBuffer.format, VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, 1);
+  // オクルージョンカリング用の深度ピラミッドの作成元としてシェーダーからも参照する.
+  m_depthBuffer.depth = gfxDevice->CreateImage2D(width, height, m_depthBuffer.format,
+    VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT | VK_IMAGE_USAGE_SAMPLED_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, 1);
+  // テクスチャと深度ピラミッドのミップマップ作成で共有する.
+  GetMipDownsampler()->Initialize();
+  m_depthPyramid.Initialize(m_depthBuffer.depth.view, uint32_t(width), uint32_t(height));
 
   if (!gfxDevice->IsSupportVulkan13())
   {
     // Vulkan 1.3 をサポートしていない状況では RenderPass を使った実装にする.
     PrepareRenderPass();
   }
+  else
+  {
+    // Dynamic Rendering では深度バッファを常に DEPTH_ATTACHMENT_OPTIMAL として扱う.
+    auto commandBuffer = gfxDevice->AllocateCommandBuffer();
+    VkImageMemoryBarrier2 barrier{
+      .sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER_2,
+      .srcStageMask = VK_PIPELINE_STAGE_2_NONE,
+      .srcAccessMask = VK_ACCESS_2_NONE,
+      .dstStageMask = VK_PIPELINE_STAGE_2_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_2_LATE_FRAGMENT_TESTS_BIT,
+      .dstAccessMask = VK_ACCESS_2_DEPTH_STENCIL_ATTACHMENT_READ_BIT | VK_ACCESS_2_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT,
+      .oldLayout = VK_IMAGE_LAYOUT_UNDEFINED,
+      .newLayout = VK_IMAGE_LAYOUT_DEPTH_ATTACHMENT_OPTIMAL,
+      .image = m_depthBuffer.depth.image,
+      .subresourceRange = {
+        .aspectMask = VK_IMAGE_ASPECT_DEPTH_BIT,
+        .baseMipLevel = 0, .levelCount = 1,
+        .baseArrayLayer = 0, .layerCount = 1,
+      },
+    };
+    VkDependencyInfo info{
+      .sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO,
+      .imageMemoryBarrierCount = 1,
+      .pImageMemoryBarriers = &barrier,
+    };
+    vkCmdPipelineBarrier2(commandBuffer, &info);
+    gfxDevice->SubmitOneShot(commandBuffer);
+    m_depthBuffer.depth.layout = VK_IMAGE_LAYOUT_DEPTH_ATTACHMENT_OPTIMAL;
+  }
 
   ImGui_ImplVulkan_LoadFunctions(
     [](const char* functionName, void* userArgs) {
@@ -114,33 +198,41 @@ void Application::Initialize()
 
   // アプリケーションコード初期化.
   PrepareModelDrawPipelines();
+  m_drawProfiler.Initialize();
 
   m_lightDir = glm::vec3(0.0f,-1.0f,-0.2f);
 
 
   PrepareSceneUniformBuffer();
-  
-  PrepareModelData();
+
+  // 読み込み中のテクスチャの代わりに使う白のテクスチャ.
+  DecodedTexture white{
+    .width = 1,
+    .height = 1,
+    .pixels = { 0xFF, 0xFF, 0xFF, 0xFF },
+    .mipOffsets = { 0 },
+  };
+  CreateTextureFromDecoded(m_placeholderTexture, white);
+
+  // モデルはバックグラウンドで読み込み、準備できたものから描画する.
+  StartModelLoad();
 }
 
 void Application::Shutdown()
 {
+  StopModelLoad();
+
   auto& gfxDevice = GetGfxDevice();
   gfxDevice->WaitForIdle();
 
   DestroyModelData();
   DestroySceneUniformBuffer();
+  gfxDevice->DestroyImage(m_placeholderTexture);
 
   auto vkDevice = gfxDevice->GetVkDevice();
 
-  //vkDestroyPipeline(vkDevice, m_drawOpaquePipeline, nullptr);
-  vkDestroyPipeline(vkDevice, m_drawMaskPipeline, nullptr);
-  vkDestroyPipeline(vkDevice, m_drawBlendPipeline, nullptr);
-  m_drawOpaquePipeline = VK_NULL_HANDLE;
-  m_drawMaskPipeline = VK_NULL_HANDLE;
-  m_drawBlendPipeline = VK_NULL_HANDLE;
-  vkDestroyPipelineLayout(vkDevice, m_pipelineLayout, nullptr);
-  m_pipelineLayout = VK_NULL_HANDLE;
+  DestroyModelDrawPipelines();
+  m_drawProfiler.Destroy();
 
   vkDestroyRenderPass(vkDevice, m_renderPass, nullptr);
   m_renderPass = VK_NULL_HANDLE;
@@ -151,9 +243,8 @@ void Application::Shutdown()
   }
   m_framebuffers.clear();
 
-  vkDestroyDescriptorSetLayout(vkDevice, m_modelDescriptorSetLayout, nullptr);
-  m_modelDescriptorSetLayout = VK_NULL_HANDLE;
-
+  m_depthPyramid.Destroy();
+  GetMipDownsampler()->Destroy();
   gfxDevice->DestroyImage(m_depthBuffer.depth);
 
   // ImGui 終了の処理.
@@ -236,6 +327,9 @@ void Application::Process()
   gfxDevice->NewFrame();
   auto commandBuffer = gfxDevice->GetCurrentCommandBuffer();
 
+  // 読み込みの済んだジオメトリ・テクスチャを反映する.
+  UpdateModelStreaming();
+
   static bool isFirstFrame = true;
   if (isFirstFrame)
   {
@@ -262,15 +356,98 @@ void Application::Process()
 
   bool useDynamicRendering = gfxDevice->IsSupportVulkan13();
 
-  if (useDynamicRendering)
+  // モデルを描画する前に、シーン共通のパラメータを更新.
+  SceneParameters sceneParams;
+  //sceneParams.matView = glm::lookAtRH(glm::vec3(0, 1.0f,5.0f), glm::vec3(0, 0.5f,0), glm::vec3(0,1,0));
+  //sceneParams.matView = glm::lookAtRH(glm::vec3(4, 2.5f, 0.0f), glm::vec3(0, 2.0f, 0), glm::vec3(0, 1, 0));
+  //sceneParams.matView = glm::lookAtRH(glm::vec3(4, 1.0f,0.0f), glm::vec3(0, 0.5f,0), glm::vec3(0,1,0));
+  sceneParams.matView = glm::lookAtRH(glm::vec3(2, 1.0f, 0.0f), glm::vec3(0, 1.0f, 0), glm::vec3(0, 1, 0));
+ 
+  const float fovY = glm::radians(45.0f);
+  sceneParams.matProj = glm::perspectiveFovRH(fovY, float(width), float(height), 0.1f, 500.0f);
+  sceneParams.lightDir = glm::vec4(m_lightDir, 0);
+  const auto matViewProj = sceneParams.matProj * sceneParams.matView;
+
+  // LOD の選択に使うカメラ位置と、距離1の位置で1単位が何ピクセルになるか.
+  m_cameraPosition = glm::vec3(glm::inverse(sceneParams.matView)[3]);
+  m_lodPixelScale = float(height) / (2.0f * std::tan(fovY * 0.5f));
+
+  // インスタンスのカリング結果で描画時の instanceCount が決まる.
+  UpdateInstances(matViewProj);
+  sceneParams.instanceStride = m_instanceStride;
+  memcpy(
+    m_sceneUniformBuffers[gfxDevice->GetFrameIndex()].mapped,
+    &sceneParams, sizeof(sceneParams));
+
+  UpdateAnimation();
+  UpdateDrawParameters();
+  UpdateMeshBounds();
+  QueryMeshes(sceneParams.matView);
+
+  // このフレームスロットで前回計測した結果を、その時のプリパス設定の側に記録する.
+  //  GPU 時間は揺れが大きいため平滑化する.
+  const auto frameIndex = gfxDevice->GetFrameIndex();
+  if (m_drawProfiler.BeginFrame(commandBuffer))
   {
-    BeginRender();
+    const auto& result = m_drawProfiler.GetResult();
+    auto& profile = m_prepassProfiles[m_profiledWithPrepass[frameIndex] ? 1 : 0];
+    profile.gpuMilliseconds = profile.valid ? glm::mix(profile.gpuMilliseconds, result.gpuMilliseconds, 0.1) : result.gpuMilliseconds;
+    profile.frameMilliseconds = 1000.0 / ImGui::GetIO().Framerate;
+    profile.overdraw = double(result.fragmentInvocations) / (double(width) * double(height));
+    profile.valid = true;
+  }
+  m_profiledWithPrepass[frameIndex] = IsDepthPrepassActive();
+
+  // スキニングは全ての描画パスより前に1度だけ行い、各パスは結果を参照する.
+  UpdateSkinning(commandBuffer);
+
+  // GPU 駆動描画ではカリングと描画コマンドの生成をレンダリング開始前に行う.
+  //  インスタンシング描画は CPU からの発行のみ対応.
+  //  どちらも GPU 側で全メッシュを扱うため、全ジオメトリの転送が済むまでは CPU でカリングして描く.
+  bool useMeshletDraw = IsMeshletDrawActive();
+  bool useGpuDrivenDraw = !useMeshletDraw && m_useGpuDrivenDraw && IsGeometryResident() &&
+    gfxDevice->IsSupportDrawIndirectCount() && !m_model.drawBuckets.empty() && !m_useInstancing;
+  // オクルージョンカリングは描画を途中で区切るため Dynamic Rendering 使用時のみ.
+  bool useOcclusionCulling = useGpuDrivenDraw && useDynamicRendering && m_useOcclusionCulling;
+  if (useMeshletDraw)
+  {
+    m_meshletCulling.Dispatch(commandBuffer, m_model.matWorld, matViewProj, m_cameraPosition, m_useFrustumCulling, m_useConeCulling);
+  }
+  else if (useGpuDrivenDraw)
+  {
+    GpuCulling::LodSelection lodSelection{
+      .cameraPosition = m_cameraPosition,
+      .pixelScale = m_useLod ? m_lodPixelScale : 0.0f,
+      .pixelError = m_lodPixelError,
+    };
+    m_gpuCulling.Dispatch(commandBuffer, m_model.matWorld, sceneParams.matView, sceneParams.matProj,
+      m_useFrustumCulling, lodSelection, useOcclusionCulling);
+  }
+  else if (m_modelResident)
+  {
+    CullMeshes(matViewProj);
+    // 転送の済んでいないジオメトリのメッシュは描かない.
+    for (uint32_t meshIndex = 0; meshIndex < m_model.meshes.size() && !IsGeometryResident(); ++meshIndex)
+    {
+      if (m_model.meshes[meshIndex].geometryIndex >= m_residentGeometryCount)
+      {
+        m_meshVisibility[meshIndex] = 0;
+      }
+    }
+    SelectMeshLods();
+    if (m_useSortedDrawList)
+    {
+      BuildRenderQueue(sceneParams.matView);
+    }
+  }
 
+  // オクルージョンカリングの2パス目では1パス目の描画結果を読み込んで続きを描く.
+  auto beginRendering = [&](VkAttachmentLoadOp loadOp) {
     VkRenderingAttachmentInfo colorAttachmentInfo{
       .sType = VK_STRUCTURE_TYPE_RENDERING_ATTACHMENT_INFO,
       .imageView = gfxDevice->GetCurrentSwapchainImageView(),
       .imageLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL,
-      .loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR,
+      .loadOp = loadOp,
       .storeOp = VK_ATTACHMENT_STORE_OP_STORE,
       .clearValue = clearValue,
     };
@@ -279,7 +456,7 @@ void Application::Process()
       .sType = VK_STRUCTURE_TYPE_RENDERING_ATTACHMENT_INFO,
       .imageView = m_depthBuffer.depth.view,
       .imageLayout = VK_IMAGE_LAYOUT_DEPTH_ATTACHMENT_OPTIMAL,
-      .loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR,
+      .loadOp = loadOp,
       .storeOp = VK_ATTACHMENT_STORE_OP_STORE,
       .clearValue = clearDepth,
     };
@@ -296,6 +473,12 @@ void Application::Process()
     };
 
     vkCmdBeginRendering(commandBuffer, &renderingInfo);
+  };
+
+  if (useDynamicRendering)
+  {
+    BeginRender();
+    beginRendering(VK_ATTACHMENT_LOAD_OP_CLEAR);
   }
   else
   {
@@ -334,30 +517,411 @@ void Application::Process()
   vkCmdSetViewport(commandBuffer, 0, 1, &viewport);
   vkCmdSetScissor(commandBuffer, 0, 1, &scissor);
 
-  // モデルを描画する前に、シーン共通のパラメータを更新.
-  SceneParameters sceneParams;
-  //sceneParams.matView = glm::lookAtRH(glm::vec3(0, 1.0f,5.0f), glm::vec3(0, 0.5f,0), glm::vec3(0,1,0));
-  //sceneParams.matView = glm::lookAtRH(glm::vec3(4, 2.5f, 0.0f), glm::vec3(0, 2.0f, 0), glm::vec3(0, 1, 0));
-  //sceneParams.matView = glm::lookAtRH(glm::vec3(4, 1.0f,0.0f), glm::vec3(0, 0.5f,0), glm::vec3(0,1,0));
-  sceneParams.matView = glm::lookAtRH(glm::vec3(2, 1.0f, 0.0f), glm::vec3(0, 1.0f, 0), glm::vec3(0, 1, 0));
- 
-  sceneParams.matProj = glm::perspectiveFovRH(glm::radians(45.0f), float(width), float(height), 0.1f, 500.0f);
-  sceneParams.lightDir = glm::vec4(m_lightDir, 0);
-  memcpy(
-    m_sceneUniformBuffers[gfxDevice->GetFrameIndex()].mapped,
-    &sceneParams, sizeof(sceneParams));
+  m_drawProfiler.BeginSection(commandBuffer);
+  DrawModel(0);
+  m_drawProfiler.EndSection(commandBuffer);
 
-  DrawModel();
+  if (useOcclusionCulling)
+  {
+    // 1パス目の深度から深度ピラミッドを作り、遮蔽と判定したメッシュを再判定して描く.
+    vkCmdEndRendering(commandBuffer);
+    BuildDepthPyramid();
+    m_gpuCulling.DispatchLate(commandBuffer);
+    beginRendering(VK_ATTACHMENT_LOAD_OP_LOAD);
+    m_drawProfiler.BeginSection(commandBuffer);
+    DrawModel(1);
+    m_drawProfiler.EndSection(commandBuffer);
+  }
 
   // ImGui によるGui構築
 
   ImGui::Begin("Information");
-  ImGui::Text("FPS: %.2f", ImGui::GetIO().Framerate);
+  ImGui::Text("FPS: %.2f (%.3f ms)", ImGui::GetIO().Framerate, 1000.0f / ImGui::GetIO().Framerate);
   ImGui::Text(useDynamicRendering ? "USE Dynamic Rendering" : "USE RenderPass");
+  {
+    const auto& modelStats = m_modelDescriptorAllocator.GetStats();
+    const auto& frameStats = gfxDevice->GetFrameDescriptorAllocator().GetStats();
+    ImGui::Text("DescriptorSets(Model): %u / %u (Pools: %u)", modelStats.allocatedSets, modelStats.capacitySets, modelStats.poolCount);
+    ImGui::Text("DescriptorSets(Frame): %u / %u (Pools: %u)", frameStats.allocatedSets, frameStats.capacitySets, frameStats.poolCount);
+  }
   {
     float* v = reinterpret_cast<float*>(&m_lightDir);
     ImGui::InputFloat3("LightDir", v);
   }
+  bool reloadModel = false;
+  {
+    ImGui::Text("Vertex: %zu KB, Index: %zu KB (LOD: %zu KB) (Stride: %u)",
+      m_geometryStats.vertexBytes / 1024, m_geometryStats.indexBytes / 1024, m_geometryStats.lodIndexBytes / 1024, m_vertexLayout.GetStride());
+    ImGui::Text("Float32 Layout: %zu KB", m_geometryStats.float32Bytes / 1024);
+    reloadModel |= ImGui::Checkbox("Packed Vertex", &m_usePackedVertex);
+    reloadModel |= ImGui::Checkbox("Optimize Index Order", &m_useMeshOptimization);
+    reloadModel |= ImGui::Checkbox("Preserve Node Hierarchy", &m_usePreserveHierarchy);
+    ImGui::Text("Nodes: %zu, Mesh Instances: %zu (Geometries: %u)",
+      m_model.nodes.size(), m_model.meshes.size(), m_model.geometryCount);
+    reloadModel |= ImGui::Combo("Vertex Weld", &m_weldMode, "None\0Exact\0Epsilon\0");
+    reloadModel |= ImGui::Checkbox("Model Cache", &m_useModelCache);
+    ImGui::SameLine();
+    reloadModel |= ImGui::Button("Reload");
+    ImGui::Text("Load: %.1f ms (%s), Cold %.1f ms / Warm %.1f ms",
+      m_modelLoadStats.milliseconds, m_modelLoadStats.cacheHit ? "Cache" : (m_modelLoadStats.nativeGltf ? "glTF" : "assimp"),
+      m_modelLoadMilliseconds[0], m_modelLoadMilliseconds[1]);
+    reloadModel |= ImGui::Checkbox("Parallel Import", &m_useParallelImport);
+    ImGui::SameLine();
+    reloadModel |= ImGui::Checkbox("Native glTF Loader", &m_useNativeGltf);
+    ImGui::SameLine();
+    reloadModel |= ImGui::Checkbox("GPU Mipmaps", &m_useGpuMipmaps);
+    if (m_useGpuMipmaps)
+    {
+      reloadModel |= ImGui::Combo("GPU Mipmap Method", &m_gpuMipmapMethod, "Blit\0Compute (Single Pass)\0");
+    }
+    else
+    {
+      reloadModel |= ImGui::Combo("CPU Mipmap Filter", &m_cpuMipmapFilter, "Box\0Kaiser\0");
+      reloadModel |= ImGui::Checkbox("Gamma Correct Mipmaps", &m_useGammaCorrectMipmaps);
+    }
+    // 同じ大きさのテクスチャで、ブリットとコンピュートシェーダーの GPU 時間を比べる.
+    if (ImGui::Button("Mipmap Benchmark"))
+    {
+      m_mipmapBenchmark = RunMipmapBenchmark();
+    }
+    if (!m_mipmapBenchmark.empty())
+    {
+      ImGui::Text("Compute: %s", GetMipDownsampler()->IsUsingSubgroup() ? "Subgroup Quad" : "Shared Memory");
+    }
+    for (const auto& result : m_mipmapBenchmark)
+    {
+      ImGui::Text("%s %ux%u (%u levels): Blit %.3f ms, Compute %.3f ms (x%.2f)",
+        result.formatName, result.size, result.size, result.levelCount,
+        result.blitMilliseconds, result.computeMilliseconds,
+        result.blitMilliseconds / std::max(result.computeMilliseconds, 1.0e-6));
+    }
+    // stb_image_resize による段ごとの縮小と、CPU の各縮小方法を比べる.
+    if (ImGui::Button("CPU Mipmap Benchmark"))
+    {
+      m_cpuMipmapBenchmark = RunCpuMipmapBenchmark();
+    }
+    for (const auto& result : m_cpuMipmapBenchmark)
+    {
+      ImGui::Text("%ux%u: stb %.2f ms, Box(%s) %.2f ms / Parallel %.2f ms (x%.2f) %s",
+        result.size, result.size, result.stbMilliseconds, GetMipmapSimdName(),
+        result.boxMilliseconds, result.parallelBoxMilliseconds,
+        result.stbMilliseconds / std::max(result.parallelBoxMilliseconds, 1.0e-6), result.matched ? "OK" : "MISMATCH");
+      ImGui::Text("  Gamma %.2f ms, Kaiser %.2f ms", result.gammaBoxMilliseconds, result.kaiserMilliseconds);
+    }
+    if (ImGui::Button("glTF Loader Benchmark"))
+    {
+      RunGltfBenchmark();
+    }
+    for (const auto& result : m_gltfBenchmark)
+    {
+      ImGui::Text("%s: glTF %.1f ms%s, assimp %.1f ms (Meshes: %u / %u)",
+        result.file.c_str(), result.milliseconds[0], result.nativeGltf ? "" : " (fallback)", result.milliseconds[1],
+        result.meshCount[0], result.meshCount[1]);
+    }
+    {
+      const auto& stream = m_streamingStats;
+      ImGui::Text("First Frame: %.1f ms, First Mesh: %.1f ms, Geometry: %.1f ms, Complete: %.1f ms",
+        stream.firstFrameMilliseconds, stream.firstGeometryMilliseconds, stream.geometryMilliseconds, stream.completeMilliseconds);
+      if (!stream.complete)
+      {
+        ImGui::Text("Streaming: Geometry %u / %u, Textures %u / %u",
+          m_residentGeometryCount, m_model.geometryCount, stream.resolvedTextures, stream.textureCount);
+      }
+      const auto& samplerStats = gfxDevice->GetSamplerCache().GetStats();
+      ImGui::Text("Textures: %zu, Images: %zu (Deduped: %u), Samplers: %u (Requests: %u)",
+        m_model.textures.size(), m_model.textureImages.size(), stream.dedupedImages,
+        samplerStats.samplerCount, samplerStats.requestCount);
+      ImGui::Text("Mipmaps: CPU %.1f ms, Upload %.1f ms (GPU Levels: %u), Staging: %.1f MB",
+        stream.cpuMipMilliseconds, stream.uploadMilliseconds, stream.gpuMipCount,
+        double(stream.stagingBytes) / (1024.0 * 1024.0));
+    }
+    if (!m_modelLoadStats.cacheHit)
+    {
+      ImGui::Text("Import: %.1f ms, Convert: %.1f ms (Threads: %u), Cache Write: %.1f ms",
+        m_modelLoadStats.importMilliseconds, m_modelLoadStats.convertMilliseconds, m_modelLoadStats.threadCount,
+        m_modelLoadStats.cacheWriteMilliseconds);
+    }
+
+    // ACMR は三角形数、ATVR は頂点数 (まとめる前後それぞれ) で重み付けした全体の値.
+    double triangles = 0.0, vertices = 0.0, sourceVertices = 0.0;
+    double acmr[2] = {}, atvr[2] = {};
+    for (const auto& info : m_meshCacheInfos)
+    {
+      triangles += info.triangleCount;
+      vertices += info.vertexCount;
+      sourceVertices += info.sourceVertexCount;
+      acmr[0] += double(info.source.acmr) * info.triangleCount;
+      acmr[1] += double(info.optimized.acmr) * info.triangleCount;
+      atvr[0] += double(info.source.atvr) * info.sourceVertexCount;
+      atvr[1] += double(info.optimized.atvr) * info.vertexCount;
+    }
+    if (triangles > 0.0 && vertices > 0.0)
+    {
+      ImGui::Text("Vertices: %.0f -> %.0f (%.1f%%)", sourceVertices, vertices, vertices / sourceVertices * 100.0);
+      ImGui::Text("ACMR: %.3f -> %.3f, ATVR: %.3f -> %.3f (Cache: %u)",
+        acmr[0] / triangles, acmr[1] / triangles, atvr[0] / sourceVertices, atvr[1] / vertices, VertexCacheSize);
+    }
+    if (ImGui::TreeNode("Vertex Cache (Per Mesh)"))
+    {
+      for (size_t i = 0; i < m_meshCacheInfos.size(); ++i)
+      {
+        const auto& info = m_meshCacheInfos[i];
+        ImGui::Text("%zu: ACMR %.3f -> %.3f, ATVR %.3f -> %.3f (Tri: %u, Vtx: %u -> %u)",
+          i, info.source.acmr, info.optimized.acmr, info.source.atvr, info.optimized.atvr, info.triangleCount,
+          info.sourceVertexCount, info.vertexCount);
+      }
+      ImGui::TreePop();
+    }
+  }
+  {
+    ImGui::Text("Draws: %u, Binds: Pipeline %u / DescriptorSet %u (Meshes: %zu)",
+      m_drawStats.drawCalls, m_drawStats.pipelineBinds, m_drawStats.descriptorSetBinds, m_model.meshes.size());
+    if (m_drawStats.instancedMeshes > 0)
+    {
+      ImGui::Text("Instanced Meshes: %u", m_drawStats.instancedMeshes);
+    }
+    if (!useGpuDrivenDraw && !useMeshletDraw)
+    {
+      ImGui::Text("Triangles: %.2f M (%.1f M/s)", double(m_drawStats.triangles) / 1.0e6,
+        double(m_drawStats.triangles) * ImGui::GetIO().Framerate / 1.0e6);
+    }
+    ImGui::Checkbox("State Sorted Draw List", &m_useSortedDrawList);
+    ImGui::Checkbox("LOD", &m_useLod);
+    if (m_useLod)
+    {
+      ImGui::SliderFloat("LOD Pixel Error", &m_lodPixelError, 0.25f, 16.0f, "%.2f", ImGuiSliderFlags_Logarithmic);
+    }
+    if (!useGpuDrivenDraw && !useMeshletDraw)
+    {
+      const auto& lodDraws = m_drawStats.lodDraws;
+      ImGui::Text("LOD Draws: %u / %u / %u / %u", lodDraws[0], lodDraws[1], lodDraws[2], lodDraws[3]);
+    }
+    ImGui::Checkbox("Frustum Culling", &m_useFrustumCulling);
+    ImGui::Checkbox("Depth Prepass (Opaque)", &m_useDepthPrepass);
+    if (IsDepthPrepassActive())
+    {
+      ImGui::Text("Prepass Draws: %u", m_drawStats.prepassDrawCalls);
+    }
+    if (m_drawProfiler.IsSupported())
+    {
+      // オーバードローはフラグメントシェーダー起動数 / 画面のピクセル数. (プリパスは起動しない)
+      for (int i = 0; i < 2; ++i)
+      {
+        const auto& profile = m_prepassProfiles[i];
+        if (!profile.valid)
+        {
+          ImGui::Text("Prepass %s: -", i ? "ON " : "OFF");
+          continue;
+        }
+        if (m_drawProfiler.HasFragmentStatistics())
+        {
+          ImGui::Text("Prepass %s: GPU %.3f ms, Frame %.3f ms, Overdraw %.2f",
+            i ? "ON " : "OFF", profile.gpuMilliseconds, profile.frameMilliseconds, profile.overdraw);
+        }
+        else
+        {
+          ImGui::Text("Prepass %s: GPU %.3f ms, Frame %.3f ms",
+            i ? "ON " : "OFF", profile.gpuMilliseconds, profile.frameMilliseconds);
+        }
+      }
+    }
+    else
+    {
+      ImGui::Text("Draw Profiler: not supported (timestamp)");
+    }
+    if (useDynamicRendering)
+    {
+      ImGui::Checkbox("Occlusion Culling (GPU Driven)", &m_useOcclusionCulling);
+      if (m_depthPyramid.IsSinglePassAvailable())
+      {
+        bool singlePass = m_depthPyramid.IsUsingSinglePass();
+        if (ImGui::Checkbox("Single Pass Depth Pyramid", &singlePass))
+        {
+          m_depthPyramid.SetUseSinglePass(singlePass);
+        }
+      }
+    }
+    else
+    {
+      ImGui::Text("Occlusion Culling: not supported (RenderPass)");
+    }
+    if (gfxDevice->IsSupportDrawIndirectCount())
+    {
+      ImGui::Checkbox("GPU Driven Draw", &m_useGpuDrivenDraw);
+    }
+    else
+    {
+      ImGui::Text("GPU Driven Draw: not supported");
+    }
+    if (m_meshletCulling.IsInitialized())
+    {
+      ImGui::Checkbox("Meshlet Draw", &m_useMeshletDraw);
+      if (gfxDevice->IsSupportMeshShader())
+      {
+        ImGui::Checkbox("Mesh Shader", &m_useMeshShader);
+      }
+      else
+      {
+        ImGui::Text("Mesh Shader: not supported");
+      }
+      ImGui::Checkbox("Meshlet Cone Culling", &m_useConeCulling);
+    }
+
+    if (useMeshletDraw)
+    {
+      // CPU で同じ判定をして比較するのは、ボタンを押した時 (と読み込み直後) の1フレームだけ.
+      //  視錐台・裏面で除外した数はその時の CPU の判定結果.
+      const auto& meshletStats = m_meshletCulling.GetStats();
+      ImGui::Text("Meshlets(%s): %u (Total: %u) (Index: %zu KB)",
+        IsMeshShaderDrawActive() ? "Mesh Shader" : "Indirect",
+        meshletStats.gpuVisibleCount, meshletStats.meshletCount, m_geometryStats.meshletIndexBytes / 1024);
+      if (ImGui::Button("Validate Meshlet Count"))
+      {
+        m_meshletCulling.RequestValidation();
+      }
+      ImGui::SameLine();
+      switch (meshletStats.validation)
+      {
+      case MeshletCulling::VALIDATION_NONE:
+        ImGui::Text("-");
+        break;
+      case MeshletCulling::VALIDATION_PENDING:
+        ImGui::Text("Pending");
+        break;
+      default:
+        ImGui::Text("GPU %u / CPU %u %s (Culled: Frustum %u, Cone %u)",
+          meshletStats.validatedGpuCount, meshletStats.cpuVisibleCount,
+          meshletStats.validation == MeshletCulling::VALIDATION_MATCHED ? "OK" : "MISMATCH",
+          meshletStats.cpuFrustumCulled, meshletStats.cpuConeCulled);
+        break;
+      }
+    }
+    else if (useGpuDrivenDraw)
+    {
+      // GPU の出力した描画数を読み戻して表示する.
+      //  CPU で判定した数との比較は、ボタンを押した時 (と読み込み直後) の1フレームだけ行う.
+      const auto& cullStats = m_gpuCulling.GetStats();
+      ImGui::Text("Visible(GPU): %u (Total: %u)", cullStats.gpuVisibleCount, cullStats.meshCount);
+      if (ImGui::Button("Validate Culling Count"))
+      {
+        m_gpuCulling.RequestValidation();
+      }
+      ImGui::SameLine();
+      switch (cullStats.validation)
+      {
+      case GpuCulling::VALIDATION_NONE:
+        ImGui::Text("-");
+        break;
+      case GpuCulling::VALIDATION_PENDING:
+        ImGui::Text("Pending");
+        break;
+      default:
+        ImGui::Text("GPU %u / CPU %u %s", cullStats.validatedGpuCount, cullStats.validatedCpuCount,
+          cullStats.validation == GpuCulling::VALIDATION_MATCHED ? "OK" : "MISMATCH");
+        break;
+      }
+      if (useOcclusionCulling)
+      {
+        ImGui::Text("Occluded: %u (Early: %u, Late Visible: %u) Pyramid: %ux%u",
+          cullStats.occludedCount, cullStats.earlyOccludedCount, cullStats.lateVisibleCount,
+          m_depthPyramid.GetWidth(), m_depthPyramid.GetHeight());
+      }
+    }
+    else
+    {
+      ImGui::Checkbox("BVH Culling", &m_useBvhCulling);
+      ImGui::Text("Visible(CPU): %u, Culled: %u (%.3f ms, %s)",
+        m_cpuCullingStats.visibleCount, m_cpuCullingStats.culledCount, m_cpuCullingStats.milliseconds,
+        m_useBvhCulling ? "BVH" : FrustumCuller::GetSimdName());
+    }
+    ImGui::Text("BVH: %u nodes, Depth: %u (Build: %.3f ms)",
+      m_meshBvh.GetNodeCount(), m_meshBvh.GetDepth(), m_meshQuery.bvhBuildMilliseconds);
+    if (!m_model.dynamicMeshes.empty())
+    {
+      ImGui::Text("Dynamic Bounds: %zu meshes (Update + Refit: %.3f ms)",
+        m_model.dynamicMeshes.size(), m_meshQuery.boundsUpdateMilliseconds);
+    }
+    if (m_meshQuery.pickedMesh != UINT32_MAX)
+    {
+      ImGui::Text("Center Ray: Mesh %u (%.2f)", m_meshQuery.pickedMesh, m_meshQuery.pickedDistance);
+    }
+    else
+    {
+      ImGui::Text("Center Ray: None");
+    }
+    if (m_meshQuery.nearestMesh != UINT32_MAX)
+    {
+      ImGui::Text("Nearest: Mesh %u (%.2f) Query: %.3f ms", m_meshQuery.nearestMesh, m_meshQuery.nearestDistance, m_meshQuery.milliseconds);
+    }
+
+    // 現在のカメラの視錐台でランダムな AABB を判定して SIMD の効果を計測する.
+    if (ImGui::Button("Culling Benchmark (100k boxes)"))
+    {
+      m_cullingBenchmark = RunCullingBenchmark(100000, ExtractFrustum(matViewProj));
+    }
+    if (m_cullingBenchmark.boxCount > 0)
+    {
+      const auto& bench = m_cullingBenchmark;
+      ImGui::Text("%s: %.3f ms, Scalar: %.3f ms (x%.2f) Visible: %u %s",
+        FrustumCuller::GetSimdName(), bench.simdMilliseconds, bench.scalarMilliseconds,
+        bench.scalarMilliseconds / std::max(bench.simdMilliseconds, 1.0e-6),
+        bench.visibleCount, bench.matched ? "OK" : "MISMATCH");
+    }
+    // 同じ配置で BVH の構築と各問い合わせを計測する.
+    if (ImGui::Button("BVH Benchmark (100k boxes)"))
+    {
+      m_bvhBenchmark = RunBvhBenchmark(100000, ExtractFrustum(matViewProj));
+    }
+    if (m_bvhBenchmark.boxCount > 0)
+    {
+      const auto& bench = m_bvhBenchmark;
+      ImGui::Text("Build: %.2f ms (%u nodes, Depth: %u)", bench.buildMilliseconds, bench.nodeCount, bench.depth);
+      ImGui::Text("Cull: %.3f ms, Flat: %.3f ms (x%.2f) Visible: %u %s",
+        bench.cullMilliseconds, bench.flatCullMilliseconds,
+        bench.flatCullMilliseconds / std::max(bench.cullMilliseconds, 1.0e-6),
+        bench.visibleCount, bench.matched ? "OK" : "MISMATCH");
+      ImGui::Text("Ray: %.2f M/s, Nearest: %.2f M/s", bench.raysPerSecond * 1.0e-6, bench.nearestPerSecond * 1.0e-6);
+    }
+  }
+  {
+    if (m_skinning.GetVertexCount() > 0)
+    {
+      ImGui::Checkbox("GPU Skinning", &m_useSkinning);
+      ImGui::Checkbox("Play Animation", &m_playAnimation);
+      ImGui::SliderFloat("Animation Speed", &m_animationSpeed, 0.0f, 4.0f, "%.2f");
+      if (m_model.animations.size() > 1)
+      {
+        ImGui::SliderInt("Animation", &m_animationIndex, 0, int(m_model.animations.size()) - 1);
+      }
+      if (!m_model.animations.empty())
+      {
+        const auto& animation = m_model.animations[m_animationIndex];
+        ImGui::Text("Animation: %s (%.2f s, Channels: %zu)",
+          animation.name.c_str(), animation.duration, animation.channels.size());
+      }
+      else
+      {
+        ImGui::Text("Animation: none");
+        ImGui::Checkbox("Joint Sway (Debug)", &m_useJointSway);
+      }
+      ImGui::Text("Skinned Vertices: %u, Joints: %u", m_skinning.GetVertexCount(), m_skinning.GetJointCount());
+      ImGui::Text("CPU: Sampling %.3f ms, Joint Matrices %.3f ms (%s)",
+        m_skinningStats.animationMilliseconds, m_skinningStats.jointMatrixMilliseconds, GetAnimationSimdName());
+    }
+    else
+    {
+      ImGui::Text("Skinning: no skinned mesh");
+    }
+  }
+  {
+    ImGui::Checkbox("Instancing", &m_useInstancing);
+    if (m_useInstancing)
+    {
+      ImGui::SliderInt("Instance Count", &m_instanceCount, 1, int(MaxInstanceCount), "%d", ImGuiSliderFlags_Logarithmic);
+      ImGui::Text("Visible Instances: %u / %u (%.3f ms)",
+        m_visibleInstanceCount, m_instanceStride, m_instanceCullingMilliseconds);
+    }
+  }
   ImGui::End();
 
   // ImGui の描画処理.
@@ -375,7 +939,17 @@ void Application::Process()
   EndRender();
 
   gfxDevice->Submit();
+  if (m_frameCount == 0)
+  {
+    m_streamingStats.firstFrameMilliseconds =
+      std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - m_startTime).count();
+  }
   m_frameCount++;
+
+  if (reloadModel)
+  {
+    ReloadModel();
+  }
 }
 
 void Application::BeginRender()
@@ -388,6 +962,60 @@ void Application::BeginRender()
     VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL, VK_ACCESS_2_COLOR_ATTACHMENT_WRITE_BIT);
 }
 
+void Application::BuildDepthPyramid()
+{
+  auto& gfxDevice = GetGfxDevice();
+  auto commandBuffer = gfxDevice->GetCurrentCommandBuffer();
+
+  // 深度の書き込み完了を待ってシェーダーから読む. カラーは続きを描くため書き込みの順序だけ保証する.
+  auto depthBarrier = [&](VkImageLayout oldLayout, VkImageLayout newLayout,
+    VkPipelineStageFlags2 srcStage, VkAccessFlags2 srcAccess, VkPipelineStageFlags2 dstStage, VkAccessFlags2 dstAccess) {
+    VkImageMemoryBarrier2 barrier{
+      .sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER_2,
+      .srcStageMask = srcStage,
+      .srcAccessMask = srcAccess,
+      .dstStageMask = dstStage,
+      .dstAccessMask = dstAccess,
+      .oldLayout = oldLayout,
+      .newLayout = newLayout,
+      .image = m_depthBuffer.depth.image,
+      .subresourceRange = {
+        .aspectMask = VK_IMAGE_ASPECT_DEPTH_BIT,
+        .baseMipLevel = 0, .levelCount = 1,
+        .baseArrayLayer = 0, .layerCount = 1,
+      },
+    };
+    VkMemoryBarrier2 colorBarrier{
+      .sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER_2,
+      .srcStageMask = VK_PIPELINE_STAGE_2_COLOR_ATTACHMENT_OUTPUT_BIT,
+      .srcAccessMask = VK_ACCESS_2_COLOR_ATTACHMENT_WRITE_BIT,
+      .dstStageMask = VK_PIPELINE_STAGE_2_COLOR_ATTACHMENT_OUTPUT_BIT,
+      .dstAccessMask = VK_ACCESS_2_COLOR_ATTACHMENT_READ_BIT | VK_ACCESS_2_COLOR_ATTACHMENT_WRITE_BIT,
+    };
+    VkDependencyInfo info{
+      .sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO,
+      .memoryBarrierCount = 1,
+      .pMemoryBarriers = &colorBarrier,
+      .imageMemoryBarrierCount = 1,
+      .pImageMemoryBarriers = &barrier,
+    };
+    vkCmdPipelineBarrier2(commandBuffer, &info);
+    m_depthBuffer.depth.layout = newLayout;
+  };
+
+  const auto depthTestStages = VK_PIPELINE_STAGE_2_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_2_LATE_FRAGMENT_TESTS_BIT;
+  const auto depthAccess = VK_ACCESS_2_DEPTH_STENCIL_ATTACHMENT_READ_BIT | VK_ACCESS_2_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+  depthBarrier(VK_IMAGE_LAYOUT_DEPTH_ATTACHMENT_OPTIMAL, VK_IMAGE_LAYOUT_DEPTH_READ_ONLY_OPTIMAL,
+    depthTestStages, VK_ACCESS_2_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT,
+    VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT, VK_ACCESS_2_SHADER_SAMPLED_READ_BIT);
+
+  m_depthPyramid.Build(commandBuffer);
+
+  depthBarrier(VK_IMAGE_LAYOUT_DEPTH_READ_ONLY_OPTIMAL, VK_IMAGE_LAYOUT_DEPTH_ATTACHMENT_OPTIMAL,
+    VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT, VK_ACCESS_2_NONE,
+    depthTestStages, depthAccess);
+}
+
 void Application::EndRender()
 {
   auto& gfxDevice = GetGfxDevice();
@@ -493,20 +1121,28 @@ void Application::PrepareModelDrawPipelines()
   auto& gfxDevice = GetGfxDevice();
   auto vkDevice = gfxDevice->GetVkDevice();
 
+  // シーンとメッシュのパラメータはメッシュシェーダーからも参照する.
+  //  VK_SHADER_STAGE_ALL_GRAPHICS にはメッシュシェーダーが含まれないため個別に追加する.
+  VkShaderStageFlags parameterStages = VK_SHADER_STAGE_ALL_GRAPHICS;
+  if (gfxDevice->IsSupportMeshShader())
+  {
+    parameterStages |= VK_SHADER_STAGE_MESH_BIT_EXT;
+  }
+
   std::vector<VkDescriptorSetLayoutBinding> layoutBindings{
     // シーン全体で使用するユニフォームバッファ.
     {
       .binding = 0,
       .descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER,
       .descriptorCount = 1,
-      .stageFlags = VK_SHADER_STAGE_ALL_GRAPHICS
+      .stageFlags = parameterStages
     },
-    // マテリアルで使用するユニフォームバッファ.
+    // 全メッシュのパラメータ(マテリアル情報含む)を格納するストレージバッファ.
     {
       .binding = 1,
-      .descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER,
+      .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
       .descriptorCount = 1,
-      .stageFlags = VK_SHADER_STAGE_ALL_GRAPHICS
+      .stageFlags = parameterStages
     },
     // ベース(ディフューズテクスチャ).
     {
@@ -515,6 +1151,27 @@ void Application::PrepareModelDrawPipelines()
       .descriptorCount = 1,
       .stageFlags = VK_SHADER_STAGE_ALL_GRAPHICS
     },
+    // インスタンスの変換行列.
+    {
+      .binding = 3,
+      .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+      .descriptorCount = 1,
+      .stageFlags = VK_SHADER_STAGE_VERTEX_BIT
+    },
+    // 可視インスタンスの番号.
+    {
+      .binding = 4,
+      .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+      .descriptorCount = 1,
+      .stageFlags = VK_SHADER_STAGE_VERTEX_BIT
+    },
+    // スキニング後の頂点.
+    {
+      .binding = 5,
+      .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+      .descriptorCount = 1,
+      .stageFlags = parameterStages
+    },
   };
   VkDescriptorSetLayoutCreateInfo dsLayoutCI{
     .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO,
@@ -522,6 +1179,7 @@ void Application::PrepareModelDrawPipelines()
     .pBindings = layoutBindings.data(),
   };
   vkCreateDescriptorSetLayout(gfxDevice->GetVkDevice(), &dsLayoutCI, nullptr, &m_modelDescriptorSetLayout);
+  m_modelPoolSizeRatios = DescriptorAllocator::MakePoolSizeRatios(layoutBindings);
 
 
   VkPipelineLayoutCreateInfo layoutCI{
@@ -531,33 +1189,15 @@ void Application::PrepareModelDrawPipelines()
   };
   vkCreatePipelineLayout(vkDevice, &layoutCI, nullptr, &m_pipelineLayout);
 
-  std::array<VkVertexInputBindingDescription, 3> vertexBindingDescs = { {
-    { // POSITION
-      .binding = 0, .stride = sizeof(glm::vec3), .inputRate = VK_VERTEX_INPUT_RATE_VERTEX,
-    },
-    { // NORMAL
-      .binding = 1, .stride = sizeof(glm::vec3), .inputRate = VK_VERTEX_INPUT_RATE_VERTEX,
-    },
-    { // UV
-      .binding = 2, .stride = sizeof(glm::vec2), .inputRate = VK_VERTEX_INPUT_RATE_VERTEX,
-    },
-  } };
-  std::array<VkVertexInputAttributeDescription, 3> vertInputAttribs = { {
-    { // POSITION
-      .location = 0, .binding = 0, .format = VK_FORMAT_R32G32B32_SFLOAT, .offset = 0,
-    },
-    { // NORMAL
-      .location = 1, .binding = 1, .format = VK_FORMAT_R32G32B32_SFLOAT, .offset = 0,
-    },
-    { // UV
-      .location = 2, .binding = 2, .format = VK_FORMAT_R32G32_SFLOAT, .offset = 0,
-    },
-  } };
+  // 頂点は1つのバッファにインターリーブして格納している.
+  VkVertexInputBindingDescription vertexBindingDesc;
+  std::vector<VkVertexInputAttributeDescription> vertInputAttribs;
+  m_vertexLayout.GetVertexInputDescriptions(0, vertexBindingDesc, vertInputAttribs);
 
   VkPipelineVertexInputStateCreateInfo vertexInput{
     .sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO,
-    .vertexBindingDescriptionCount = uint32_t(vertexBindingDescs.size()),
-    .pVertexBindingDescriptions = vertexBindingDescs.data(),
+    .vertexBindingDescriptionCount = 1,
+    .pVertexBindingDescriptions = &vertexBindingDesc,
     .vertexAttributeDescriptionCount = uint32_t(vertInputAttribs.size()),
     .pVertexAttributeDescriptions = vertInputAttribs.data(),
   };
@@ -683,6 +1323,15 @@ void Application::PrepareModelDrawPipelines()
   assert(res == VK_SUCCESS);
   gfxDevice->SetObjectName(uint64_t(m_drawOpaquePipeline), "名前を付けてみたよ", VK_OBJECT_TYPE_PIPELINE);
 
+  // 深度プリパスの後に描く不透明描画パイプラインを作る.
+  //  深度はプリパスで書き込み済みのため、一致するフラグメントだけをシェーディングする.
+  depthStencil.depthWriteEnable = VK_FALSE;
+  depthStencil.depthCompareOp = VK_COMPARE_OP_EQUAL;
+  res = vkCreateGraphicsPipelines(vkDevice, VK_NULL_HANDLE, 1, &pipelineCreateInfo, nullptr, &m_drawOpaqueEqualPipeline);
+  assert(res == VK_SUCCESS);
+  depthStencil.depthWriteEnable = VK_TRUE;
+  depthStencil.depthCompareOp = VK_COMPARE_OP_LESS_OR_EQUAL;
+
   // アルファ抜き描画パイプラインを作る.
   blendAttachment.colorBlendOp = VK_BLEND_OP_ADD;
   blendAttachment.srcColorBlendFactor = VK_BLEND_FACTOR_SRC_ALPHA;
@@ -704,375 +1353,2063 @@ void Application::PrepareModelDrawPipelines()
   res = vkCreateGraphicsPipelines(vkDevice, VK_NULL_HANDLE, 1, &pipelineCreateInfo, nullptr, &m_drawBlendPipeline);
   assert(res == VK_SUCCESS);
 
-  for (auto& m : shaderStages)
+  // 深度プリパスのパイプラインを作る.
+  //  位置だけの頂点ストリームを読み、フラグメントシェーダーとカラー出力は持たない.
   {
-    gfxDevice->DestroyShaderModule(m.module);
-  }
-
-}
+    VkVertexInputBindingDescription positionBindingDesc;
+    std::vector<VkVertexInputAttributeDescription> positionAttribs;
+    m_vertexLayout.GetPositionInputDescriptions(0, positionBindingDesc, positionAttribs);
+    VkPipelineVertexInputStateCreateInfo positionInput{
+      .sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO,
+      .vertexBindingDescriptionCount = 1,
+      .pVertexBindingDescriptions = &positionBindingDesc,
+      .vertexAttributeDescriptionCount = uint32_t(positionAttribs.size()),
+      .pVertexAttributeDescriptions = positionAttribs.data(),
+    };
+    VkPipelineColorBlendAttachmentState noColorAttachment{
+      .colorWriteMask = 0,
+    };
+    VkPipelineColorBlendStateCreateInfo noColorState{
+      .sType = VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO,
+      .attachmentCount = 1,
+      .pAttachments = &noColorAttachment
+    };
+    auto prepassDepthStencil = depthStencil;
+    prepassDepthStencil.depthWriteEnable = VK_TRUE;
+
+    std::vector<char> prepassSpv;
+    GetFileLoader()->Load("res/depth_prepass.vert.spv", prepassSpv);
+    VkPipelineShaderStageCreateInfo prepassStage{
+      .sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO,
+      .stage = VK_SHADER_STAGE_VERTEX_BIT,
+      .module = gfxDevice->CreateShaderModule(prepassSpv.data(), prepassSpv.size()),
+      .pName = "main",
+    };
+    auto prepassPipelineCI = pipelineCreateInfo;
+    prepassPipelineCI.stageCount = 1;
+    prepassPipelineCI.pStages = &prepassStage;
+    prepassPipelineCI.pVertexInputState = &positionInput;
+    prepassPipelineCI.pDepthStencilState = &prepassDepthStencil;
+    prepassPipelineCI.pColorBlendState = &noColorState;
+    res = vkCreateGraphicsPipelines(vkDevice, VK_NULL_HANDLE, 1, &prepassPipelineCI, nullptr, &m_depthPrepassPipeline);
+    assert(res == VK_SUCCESS);
+    gfxDevice->DestroyShaderModule(prepassStage.module);
+  }
+
+  // メッシュシェーダーでメッシュレットを描画するパイプラインを作る.
+  //  頂点入力は使わず、フラグメントシェーダーと各ステートは上記と共有する.
+  if (gfxDevice->IsSupportMeshShader())
+  {
+    std::vector<VkDescriptorSetLayoutBinding> meshletBindings;
+    // メッシュレット情報, 頂点番号, 三角形, 可視メッシュレット番号, 頂点バッファ.
+    for (uint32_t binding = 0; binding < 5; ++binding)
+    {
+      meshletBindings.push_back({
+        .binding = binding,
+        .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+        .descriptorCount = 1,
+        .stageFlags = VK_SHADER_STAGE_MESH_BIT_EXT,
+      });
+    }
+    VkDescriptorSetLayoutCreateInfo meshletLayoutCI{
+      .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO,
+      .bindingCount = uint32_t(meshletBindings.size()),
+      .pBindings = meshletBindings.data(),
+    };
+    vkCreateDescriptorSetLayout(vkDevice, &meshletLayoutCI, nullptr, &m_meshletDescriptorSetLayout);
+
+    VkDescriptorSetLayout meshletSetLayouts[] = { m_modelDescriptorSetLayout, m_meshletDescriptorSetLayout };
+    VkPushConstantRange pushConstantRange{
+      .stageFlags = VK_SHADER_STAGE_MESH_BIT_EXT,
+      .offset = 0,
+      .size = sizeof(MeshletCulling::DrawConstants),
+    };
+    VkPipelineLayoutCreateInfo meshletPipelineLayoutCI{
+      .sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO,
+      .setLayoutCount = uint32_t(std::size(meshletSetLayouts)),
+      .pSetLayouts = meshletSetLayouts,
+      .pushConstantRangeCount = 1,
+      .pPushConstantRanges = &pushConstantRange,
+    };
+    vkCreatePipelineLayout(vkDevice, &meshletPipelineLayoutCI, nullptr, &m_meshletPipelineLayout);
+
+    std::vector<char> meshSpv;
+    GetFileLoader()->Load("res/meshlet.mesh.spv", meshSpv);
+    std::array<VkPipelineShaderStageCreateInfo, 2> meshletStages{ {
+      {
+        .sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO,
+        .stage = VK_SHADER_STAGE_MESH_BIT_EXT,
+        .module = gfxDevice->CreateShaderModule(meshSpv.data(), meshSpv.size()),
+        .pName = "main",
+      },
+      shaderStages[1],
+    } };
+    auto meshletPipelineCI = pipelineCreateInfo;
+    meshletPipelineCI.stageCount = uint32_t(meshletStages.size());
+    meshletPipelineCI.pStages = meshletStages.data();
+    meshletPipelineCI.pVertexInputState = nullptr;
+    meshletPipelineCI.pInputAssemblyState = nullptr;
+    meshletPipelineCI.layout = m_meshletPipelineLayout;
+
+    // 直前のアルファブレンドの設定から作る.
+    res = vkCreateGraphicsPipelines(vkDevice, VK_NULL_HANDLE, 1, &meshletPipelineCI, nullptr, &m_meshletBlendPipeline);
+    assert(res == VK_SUCCESS);
+
+    depthStencil.depthWriteEnable = VK_TRUE;
+    res = vkCreateGraphicsPipelines(vkDevice, VK_NULL_HANDLE, 1, &meshletPipelineCI, nullptr, &m_meshletMaskPipeline);
+    assert(res == VK_SUCCESS);
+
+    blendAttachment.srcColorBlendFactor = VK_BLEND_FACTOR_ONE;
+    blendAttachment.dstColorBlendFactor = VK_BLEND_FACTOR_ZERO;
+    blendAttachment.srcAlphaBlendFactor = VK_BLEND_FACTOR_ONE;
+    blendAttachment.dstAlphaBlendFactor = VK_BLEND_FACTOR_ZERO;
+    res = vkCreateGraphicsPipelines(vkDevice, VK_NULL_HANDLE, 1, &meshletPipelineCI, nullptr, &m_meshletOpaquePipeline);
+    assert(res == VK_SUCCESS);
+
+    gfxDevice->DestroyShaderModule(meshletStages[0].module);
+  }
+
+  for (auto& m : shaderStages)
+  {
+    gfxDevice->DestroyShaderModule(m.module);
+  }
+
+}
+
+void Application::DestroyModelDrawPipelines()
+{
+  auto& gfxDevice = GetGfxDevice();
+  auto vkDevice = gfxDevice->GetVkDevice();
+
+  vkDestroyPipeline(vkDevice, m_drawOpaquePipeline, nullptr);
+  vkDestroyPipeline(vkDevice, m_drawMaskPipeline, nullptr);
+  vkDestroyPipeline(vkDevice, m_drawBlendPipeline, nullptr);
+  vkDestroyPipeline(vkDevice, m_drawOpaqueEqualPipeline, nullptr);
+  vkDestroyPipeline(vkDevice, m_depthPrepassPipeline, nullptr);
+  m_drawOpaquePipeline = VK_NULL_HANDLE;
+  m_drawMaskPipeline = VK_NULL_HANDLE;
+  m_drawBlendPipeline = VK_NULL_HANDLE;
+  m_drawOpaqueEqualPipeline = VK_NULL_HANDLE;
+  m_depthPrepassPipeline = VK_NULL_HANDLE;
+  vkDestroyPipelineLayout(vkDevice, m_pipelineLayout, nullptr);
+  m_pipelineLayout = VK_NULL_HANDLE;
+
+  if (m_meshletPipelineLayout != VK_NULL_HANDLE)
+  {
+    vkDestroyPipeline(vkDevice, m_meshletOpaquePipeline, nullptr);
+    vkDestroyPipeline(vkDevice, m_meshletMaskPipeline, nullptr);
+    vkDestroyPipeline(vkDevice, m_meshletBlendPipeline, nullptr);
+    m_meshletOpaquePipeline = VK_NULL_HANDLE;
+    m_meshletMaskPipeline = VK_NULL_HANDLE;
+    m_meshletBlendPipeline = VK_NULL_HANDLE;
+    vkDestroyPipelineLayout(vkDevice, m_meshletPipelineLayout, nullptr);
+    m_meshletPipelineLayout = VK_NULL_HANDLE;
+    vkDestroyDescriptorSetLayout(vkDevice, m_meshletDescriptorSetLayout, nullptr);
+    m_meshletDescriptorSetLayout = VK_NULL_HANDLE;
+  }
+
+  vkDestroyDescriptorSetLayout(vkDevice, m_modelDescriptorSetLayout, nullptr);
+  m_modelDescriptorSetLayout = VK_NULL_HANDLE;
+}
+
+void Application::StartModelLoad()
+{
+  assert(!m_modelLoadThread.joinable());
+  m_modelLoadStartTime = std::chrono::steady_clock::now();
+  m_streamingStats.firstGeometryMilliseconds = 0.0;
+  m_streamingStats.geometryMilliseconds = 0.0;
+  m_streamingStats.completeMilliseconds = 0.0;
+  m_streamingStats.textureCount = 0;
+  m_streamingStats.resolvedTextures = 0;
+  m_streamingStats.dedupedImages = 0;
+  m_streamingStats.cpuMipMilliseconds = 0.0;
+  m_streamingStats.uploadMilliseconds = 0.0;
+  m_streamingStats.stagingBytes = 0;
+  m_streamingStats.gpuMipCount = 0;
+  m_streamingStats.complete = false;
+  m_cancelModelLoad = false;
+  m_modelGeometryUploaded = false;
+
+  // UI から書き換えられるため、設定は開始時の値を渡す.
+  ModelLoadSettings settings{
+    .useMeshOptimization = m_useMeshOptimization,
+    .usePreserveHierarchy = m_usePreserveHierarchy,
+    .useModelCache = m_useModelCache,
+    .useParallelImport = m_useParallelImport,
+    .useNativeGltf = m_useNativeGltf,
+    .useGpuMipmaps = m_useGpuMipmaps,
+    .cpuMipmapFilter = m_cpuMipmapFilter,
+    .useGammaCorrectMipmaps = m_useGammaCorrectMipmaps,
+    .weldMode = m_weldMode,
+  };
+  // シングルトンの生成が競合しないよう、スレッドプールはここで作っておく.
+  GetThreadPool();
+  m_modelLoadThread = std::thread([this, settings]() { LoadModelAsync(settings); });
+}
+
+void Application::StopModelLoad()
+{
+  if (!m_modelLoadThread.joinable())
+  {
+    return;
+  }
+  // デコード中のテクスチャもミップマップ作成の区切りで中断するため、残りの処理を待たずに戻る.
+  {
+    std::lock_guard<std::mutex> lock(m_modelLoadMutex);
+    m_cancelModelLoad = true;
+  }
+  m_modelLoadCondition.notify_all();
+  m_modelLoadThread.join();
+
+  m_pendingModel.reset();
+  m_pendingTextures.clear();
+}
+
+void Application::LoadModelAsync(const ModelLoadSettings& settings)
+{
+  ModelLoader loader;
+  auto source = std::make_unique<ModelSource>();
+  std::vector<ModelEmbeddedTextureData> embeddedTextures;
+  //const char* modelFile = "res/model/BoxTextured.glb";
+  //const char* modelFile = "res/model/teapot.glb";
+  //const char* modelFile = "res/model/sponza/Sponza.gltf";
+  const char* modelFile = "res/model/alicia-solid.vrm.glb";
+
+  // メッシュレット単位のカリング・描画用に分割しておく.
+  loader.SetBuildMeshlets(true);
+  loader.SetLodCount(GpuCulling::MaxLodCount);
+  loader.SetOptimizeMeshes(settings.useMeshOptimization);
+  loader.SetWeldMode(ModelLoader::WeldMode(settings.weldMode));
+  loader.SetPreserveHierarchy(settings.usePreserveHierarchy);
+  loader.SetUseCache(settings.useModelCache);
+  loader.SetParallelImport(settings.useParallelImport);
+  loader.SetUseNativeGltf(settings.useNativeGltf);
+  if (!loader.Load(modelFile, source->meshes, source->materials, embeddedTextures, source->nodes, source->animations))
+  {
+    fprintf(stderr, "Failed to load %s.\n", modelFile);
+    return;
+  }
+  source->loadStats = loader.GetLoadStats();
+  if (m_cancelModelLoad)
+  {
+    return;
+  }
+  // 空のバッファは作れないため、メッシュが無いモデルはメインスレッドへ渡さない.
+  //  モデルは常駐しないままとなり、描画は行われない.
+  if (source->meshes.empty())
+  {
+    fprintf(stderr, "%s has no meshes.\n", modelFile);
+    return;
+  }
+
+  // 簡略化メッシュ (LOD) は ModelLoader が生成し、キャッシュにも含まれている.
+  auto& meshes = source->meshes;
+  source->meshCacheInfos.resize(meshes.size());
+  for (size_t meshIndex = 0; meshIndex < meshes.size(); ++meshIndex)
+  {
+    const auto& mesh = meshes[meshIndex];
+    source->meshCacheInfos[meshIndex] = MeshCacheInfo{
+      .source = mesh.sourceCacheStats,
+      .optimized = mesh.optimizedCacheStats,
+      .triangleCount = uint32_t(mesh.indices.size() / 3),
+      .vertexCount = uint32_t(mesh.positions.size()),
+      .sourceVertexCount = mesh.sourceVertexCount,
+    };
+  }
+
+  // マテリアルが参照するテクスチャをパス (埋め込みは "*番号") で重複を除いて並べる.
+  //  メインスレッドはこの並びで textures を作る.
+  std::vector<int> textureEmbeddedIndices;
+  {
+    std::unordered_map<std::string, uint32_t> indices;
+    for (const auto& material : source->materials)
+    {
+      const auto& texDiffuse = material.texDiffuse;
+      if (indices.try_emplace(texDiffuse.filePath, uint32_t(source->texturePaths.size())).second)
+      {
+        source->texturePaths.push_back(texDiffuse.filePath);
+        textureEmbeddedIndices.push_back(texDiffuse.embeddedIndex);
+      }
+    }
+  }
+  const auto texturePaths = source->texturePaths;
+
+  // ジオメトリを渡し、メインスレッドが転送を終えるまで待つ.
+  //  スレッドプールはジオメトリの変換でも使うため、テクスチャのデコードはその後に行う.
+  {
+    std::unique_lock<std::mutex> lock(m_modelLoadMutex);
+    m_pendingModel = std::move(source);
+    m_modelLoadCondition.wait(lock, [this]() { return m_modelGeometryUploaded || m_cancelModelLoad; });
+  }
+
+  // 内容で重複を除くため、デコードの前に全テクスチャのデータを揃えてハッシュを求める.
+  //  同じ画像が別のパスや別の埋め込みとして参照されていても、デコード・転送は1度だけ行う.
+  const auto textureCount = texturePaths.size();
+  std::vector<std::vector<char>> fileData(textureCount);
+  std::vector<uint64_t> hashes(textureCount);
+  std::vector<uint8_t> available(textureCount);
+  auto textureData = [&](size_t textureIndex) -> const std::vector<char>& {
+    const auto embeddedIndex = textureEmbeddedIndices[textureIndex];
+    return embeddedIndex >= 0 ? embeddedTextures[embeddedIndex].data : fileData[textureIndex];
+  };
+  GetThreadPool()->ParallelFor(textureCount, [&](size_t textureIndex) {
+    if (m_cancelModelLoad)
+    {
+      return;
+    }
+    const auto embeddedIndex = textureEmbeddedIndices[textureIndex];
+    if (embeddedIndex >= 0)
+    {
+      available[textureIndex] = size_t(embeddedIndex) < embeddedTextures.size();
+    }
+    else
+    {
+      available[textureIndex] = GetFileLoader()->Load(texturePaths[textureIndex], fileData[textureIndex]);
+    }
+    if (available[textureIndex])
+    {
+      const auto& data = textureData(textureIndex);
+      hashes[textureIndex] = ComputeContentHash(data.data(), data.size());
+    }
+  });
+  if (m_cancelModelLoad)
+  {
+    return;
+  }
+
+  // ハッシュが同じものを1つの画像にまとめる. ハッシュが一致しても内容が異なる場合は別の画像とする.
+  //  読めなかったテクスチャはそれぞれ1つずつとし、デコードの失敗として扱う.
+  std::vector<std::vector<uint32_t>> images;
+  std::unordered_map<uint64_t, uint32_t> imageIndices;
+  for (uint32_t textureIndex = 0; textureIndex < uint32_t(textureCount); ++textureIndex)
+  {
+    if (available[textureIndex])
+    {
+      auto [itr, inserted] = imageIndices.try_emplace(hashes[textureIndex], uint32_t(images.size()));
+      if (!inserted && textureData(images[itr->second][0]) == textureData(textureIndex))
+      {
+        images[itr->second].push_back(textureIndex);
+        continue;
+      }
+    }
+    images.push_back({ textureIndex });
+  }
+
+  GetThreadPool()->ParallelFor(images.size(), [&](size_t imageIndex) {
+    if (m_cancelModelLoad)
+    {
+      return;
+    }
+    StreamedTexture texture;
+    texture.textures = images[imageIndex];
+    const auto first = texture.textures[0];
+    if (available[first])
+    {
+      const auto& data = textureData(first);
+      // テクスチャごとに並列に処理しているため、1枚の中では分けない.
+      MipmapOptions mipOptions{
+        .filter = MipmapFilter(settings.cpuMipmapFilter),
+        .gammaCorrect = settings.useGammaCorrectMipmaps,
+        .parallel = false,
+        .cancel = &m_cancelModelLoad,
+      };
+      texture.success = DecodeTexture(texture.image, data.data(), data.size(), !settings.useGpuMipmaps, mipOptions);
+    }
+    if (m_cancelModelLoad)
+    {
+      return;
+    }
+    std::lock_guard<std::mutex> lock(m_modelLoadMutex);
+    m_pendingTextures.push_back(std::move(texture));
+  });
+}
+
+void Application::UpdateModelStreaming()
+{
+  auto& gfxDevice = GetGfxDevice();
+  auto vkDevice = gfxDevice->GetVkDevice();
+  auto commandBuffer = gfxDevice->GetCurrentCommandBuffer();
+
+  // NewFrame で、このフレームスロットの前回のコマンドは完了している.
+  ReleaseFrameUploads(gfxDevice->GetFrameIndex());
+
+  std::unique_ptr<ModelSource> source;
+  std::vector<StreamedTexture> textures;
+  {
+    std::lock_guard<std::mutex> lock(m_modelLoadMutex);
+    source = std::move(m_pendingModel);
+    if (m_modelResident)
+    {
+      auto count = std::min<size_t>(m_pendingTextures.size(), MaxTextureUploadsPerFrame);
+      std::move(m_pendingTextures.begin(), m_pendingTextures.begin() + count, std::back_inserter(textures));
+      m_pendingTextures.erase(m_pendingTextures.begin(), m_pendingTextures.begin() + count);
+    }
+  }
+
+  auto elapsed = [this]() {
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - m_modelLoadStartTime).count();
+  };
+  if (source)
+  {
+    // 全ディスクリプタセットは仮のテクスチャを参照した状態で作られる.
+    //  ジオメトリはステージングへ書き込むまでで、転送は UploadGeometryChunk で毎フレーム少しずつ行う.
+    PrepareModelData(*source);
+    m_modelResident = true;
+    m_streamingStats.textureCount = uint32_t(m_model.textures.size());
+    {
+      std::lock_guard<std::mutex> lock(m_modelLoadMutex);
+      m_modelGeometryUploaded = true;
+    }
+    m_modelLoadCondition.notify_all();
+  }
+  if (m_modelResident && !IsGeometryResident())
+  {
+    UploadGeometryChunk(commandBuffer);
+    if (m_streamingStats.firstGeometryMilliseconds == 0.0)
+    {
+      m_streamingStats.firstGeometryMilliseconds = elapsed();
+    }
+    if (IsGeometryResident())
+    {
+      m_streamingStats.geometryMilliseconds = elapsed();
+    }
+  }
+
+  // デコードできた画像の転送をこのフレームのコマンドに記録して、それを使う全テクスチャに設定し、
+  //  参照するマテリアルのディスクリプタセットを全フレーム分更新対象にする.
+  //  転送は同じコマンドバッファの描画より前に記録されるため、このフレームの描画から使える.
+  //  デコードに失敗したものは仮のテクスチャのまま描く.
+  const auto allFrames = (1u << gfxDevice->InflightFrames) - 1;
+  auto& frameUploads = m_frameUploads[gfxDevice->GetFrameIndex()];
+  for (const auto& texture : textures)
+  {
+    GpuImage image{};
+    TextureUploadStats uploadStats;
+    TextureUploadResources uploadResources;
+    if (texture.success && RecordTextureUpload(commandBuffer, image, texture.image, uploadResources, &uploadStats, GpuMipmapMethod(m_gpuMipmapMethod)))
+    {
+      frameUploads.textures.push_back(uploadResources);
+      m_streamingStats.cpuMipMilliseconds += texture.image.mipMilliseconds + uploadStats.cpuMipMilliseconds;
+      m_streamingStats.uploadMilliseconds += uploadStats.milliseconds;
+      m_streamingStats.stagingBytes += uploadStats.stagingBytes;
+      m_streamingStats.gpuMipCount += uploadStats.gpuMipCount;
+      const auto imageIndex = int32_t(m_model.textureImages.size());
+      m_model.textureImages.push_back(image);
+      for (auto textureIndex : texture.textures)
+      {
+        auto& info = m_model.textures[textureIndex];
+        info.imageIndex = imageIndex;
+        info.descriptorInfo.imageView = image.view;
+        info.descriptorInfo.imageLayout = image.layout;
+      }
+      m_streamingStats.dedupedImages += uint32_t(texture.textures.size()) - 1;
+      for (uint32_t materialIndex = 0; materialIndex < m_model.materials.size(); ++materialIndex)
+      {
+        if (GetDiffuseTexture(m_model.materials[materialIndex]).imageIndex == imageIndex)
+        {
+          m_model.drawInfos[materialIndex].dirtyFrames = allFrames;
+        }
+      }
+    }
+    m_streamingStats.resolvedTextures += uint32_t(texture.textures.size());
+  }
+  if (m_modelResident && !m_streamingStats.complete && IsGeometryResident() &&
+    m_streamingStats.resolvedTextures == m_streamingStats.textureCount)
+  {
+    m_streamingStats.completeMilliseconds = elapsed();
+    m_streamingStats.complete = true;
+  }
+
+  // 使用中のディスクリプタセットは書き換えられないため、このフレームのセットだけを更新する.
+  //  (NewFrame で、このフレームスロットの前回のコマンドは完了している)
+  const auto frameBit = 1u << gfxDevice->GetFrameIndex();
+  for (uint32_t materialIndex = 0; materialIndex < m_model.drawInfos.size(); ++materialIndex)
+  {
+    auto& drawInfo = m_model.drawInfos[materialIndex];
+    if ((drawInfo.dirtyFrames & frameBit) == 0 || drawInfo.descriptorSets[gfxDevice->GetFrameIndex()] == VK_NULL_HANDLE)
+    {
+      continue;
+    }
+    VkWriteDescriptorSet dsDiffuseTex{
+      .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+      .dstSet = drawInfo.descriptorSets[gfxDevice->GetFrameIndex()],
+      .dstBinding = 2,
+      .descriptorCount = 1,
+      .descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
+      .pImageInfo = &GetDiffuseTexture(m_model.materials[materialIndex]).descriptorInfo,
+    };
+    vkUpdateDescriptorSets(vkDevice, 1, &dsDiffuseTex, 0, nullptr);
+    drawInfo.dirtyFrames &= ~frameBit;
+  }
+}
+
+void Application::UploadGeometryChunk(VkCommandBuffer commandBuffer)
+{
+  // 読み込んだ順に、合計が上限を超えるまでのジオメトリの転送を記録する. (最低1つは転送する)
+  //  ステージングではジオメトリが順に並んでいるため、各バッファ1回のコピーで済む.
+  const auto& upload = m_geometryUpload;
+  const auto first = m_residentGeometryCount;
+  auto uploadBytes = [&](uint32_t begin, uint32_t end) {
+    return (upload.vertexOffsets[end] - upload.vertexOffsets[begin]) +
+      (upload.positionOffsets[end] - upload.positionOffsets[begin]) +
+      (upload.indexOffsets[end] - upload.indexOffsets[begin]);
+  };
+  auto last = first + 1;
+  while (last < m_model.geometryCount && uploadBytes(first, last + 1) <= MaxGeometryUploadBytesPerFrame)
+  {
+    ++last;
+  }
+  auto copyRange = [&](const GpuBuffer& src, const GpuBuffer& dst, const std::vector<size_t>& offsets) {
+    VkBufferCopy region{
+      .srcOffset = offsets[first],
+      .dstOffset = offsets[first],
+      .size = offsets[last] - offsets[first],
+    };
+    if (region.size > 0)
+    {
+      vkCmdCopyBuffer(commandBuffer, src.buffer, dst.buffer, 1, &region);
+    }
+  };
+  copyRange(upload.vertexStaging, m_model.vertexBuffer, upload.vertexOffsets);
+  copyRange(upload.positionStaging, m_model.positionBuffer, upload.positionOffsets);
+  copyRange(upload.indexStaging, m_model.indexBuffer, upload.indexOffsets);
+
+  // このフレームの描画 (メッシュシェーダーのストレージバッファとしての読み込みを含む) より前に転送を終える.
+  VkMemoryBarrier2 barrier{
+    .sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER_2,
+    .srcStageMask = VK_PIPELINE_STAGE_2_TRANSFER_BIT,
+    .srcAccessMask = VK_ACCESS_2_TRANSFER_WRITE_BIT,
+    .dstStageMask = VK_PIPELINE_STAGE_2_ALL_GRAPHICS_BIT,
+    .dstAccessMask = VK_ACCESS_2_VERTEX_ATTRIBUTE_READ_BIT | VK_ACCESS_2_INDEX_READ_BIT | VK_ACCESS_2_SHADER_STORAGE_READ_BIT,
+  };
+  VkDependencyInfo info{
+    .sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO,
+    .memoryBarrierCount = 1,
+    .pMemoryBarriers = &barrier,
+  };
+  if (vkCmdPipelineBarrier2)
+  {
+    vkCmdPipelineBarrier2(commandBuffer, &info);
+  }
+  else
+  {
+    vkCmdPipelineBarrier2KHR(commandBuffer, &info);
+  }
+  m_residentGeometryCount = last;
+
+  // 全て転送したら、ステージングはこのフレームのコマンドの完了後に破棄する.
+  if (IsGeometryResident())
+  {
+    auto& frameUploads = m_frameUploads[GetGfxDevice()->GetFrameIndex()];
+    frameUploads.buffers.push_back(m_geometryUpload.vertexStaging);
+    frameUploads.buffers.push_back(m_geometryUpload.positionStaging);
+    frameUploads.buffers.push_back(m_geometryUpload.indexStaging);
+    m_geometryUpload = GeometryUpload{};
+  }
+}
+
+void Application::ReleaseFrameUploads(uint32_t frameIndex)
+{
+  auto& gfxDevice = GetGfxDevice();
+  auto& frameUploads = m_frameUploads[frameIndex];
+  for (auto& buffer : frameUploads.buffers)
+  {
+    gfxDevice->DestroyBuffer(buffer);
+  }
+  for (auto& resources : frameUploads.textures)
+  {
+    ReleaseTextureUpload(resources);
+  }
+  frameUploads.buffers.clear();
+  frameUploads.textures.clear();
+}
+
+void Application::PrepareModelData(ModelSource& loaded)
+{
+  auto& modelMeshes = loaded.meshes;
+  assert(!modelMeshes.empty());
+  m_modelLoadStats = loaded.loadStats;
+  m_modelLoadMilliseconds[m_modelLoadStats.cacheHit ? 1 : 0] = m_modelLoadStats.milliseconds;
+  m_meshCacheInfos = std::move(loaded.meshCacheInfos);
+
+  auto& gfxDevice = GetGfxDevice();
+  auto vkDevice = gfxDevice->GetVkDevice();
+
+  // テクスチャはデコードが済んだものから差し替えるため、ここでは仮のテクスチャを参照させておく.
+  //  サンプラーはテクスチャごとに最初に参照したマテリアルの設定とし、設定が同じものは共有する.
+  for (const auto& filePath : loaded.texturePaths)
+  {
+    m_model.textureIndices.emplace(filePath, uint32_t(m_model.textures.size()));
+    m_model.textures.emplace_back().filePath = filePath;
+  }
+  m_model.materials = std::move(loaded.materials);
+  for (const auto& material : m_model.materials)
+  {
+    auto& info = GetDiffuseTexture(material);
+    if (info.descriptorInfo.sampler != VK_NULL_HANDLE)
+    {
+      continue;
+    }
+    const auto& texDiffuse = material.texDiffuse;
+    VkSamplerCreateInfo samplerCI{
+      .sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO,
+      .magFilter = VK_FILTER_LINEAR,
+      .minFilter = VK_FILTER_LINEAR,
+      .mipmapMode = VK_SAMPLER_MIPMAP_MODE_LINEAR,
+      .addressModeU = texDiffuse.addressModeU,
+      .addressModeV = texDiffuse.addressModeV,
+      .addressModeW = VK_SAMPLER_ADDRESS_MODE_REPEAT,
+      .minLod = 0.0f,
+      .maxLod = VK_LOD_CLAMP_NONE,
+    };
+    info.descriptorInfo = {
+      .sampler = gfxDevice->GetSamplerCache().Acquire(samplerCI),
+      .imageView = m_placeholderTexture.view,
+      .imageLayout = m_placeholderTexture.layout,
+    };
+  }
+
+  std::vector<VkDescriptorSetLayout> setLayouts(gfxDevice->InflightFrames, m_modelDescriptorSetLayout);
+  // メッシュ数に応じて必要なプールは追加されていくため、初期サイズは小さめで良い.
+  m_modelDescriptorAllocator.Initialize(vkDevice, 64, m_modelPoolSizeRatios);
+
+  // 全メッシュを1つのバッファに詰めるため、インデックスの型はモデル全体で揃える.
+  //  インデックスはメッシュ内のローカル値のため、各メッシュが 16bit で収まれば良い.
+  auto layout = m_vertexLayout;
+  layout.allowIndex16 = m_vertexLayout.allowIndex16 &&
+    std::all_of(modelMeshes.begin(), modelMeshes.end(), [](const auto& m) { return m.positions.size() < 65536; });
+
+  m_geometryStats = GeometryStats{};
+  const auto float32Stride = VertexLayout::Float32().GetStride();
+  const auto stride = layout.GetStride();
+  // 頂点・インデックスは、先に全メッシュの配置を決めてからステージングメモリへ直接書き込む.
+  //  ここでは各メッシュの書き込み先 (バイト単位の位置) だけを求めておく.
+  std::vector<PackedMesh> packedMeshes(modelMeshes.size());
+  struct PackedRange
+  {
+    size_t vertexByteOffset;
+    size_t indexByteOffset;
+  };
+  std::vector<PackedRange> packedRanges(modelMeshes.size());
+  size_t vertexBytes = 0, indexBytes = 0;
+  // 読み込んだメッシュごとのジオメトリとメッシュレット情報.
+  //  ノードに配置するメッシュはこれを複製して作り、メッシュレットはバケットが決まってから並べ直す.
+  std::vector<PolygonMesh> geometries;
+  std::vector<std::vector<MeshletCulling::MeshletInfo>> geometryMeshlets(modelMeshes.size());
+  std::vector<uint32_t> meshletVertices, meshletTriangles;
+  std::vector<GpuSkinning::SourceVertex> skinVertices;
+  for (size_t meshIndex = 0; meshIndex < modelMeshes.size(); ++meshIndex)
+  {
+    // 頂点レイアウトに従った配置を決める.
+    const auto& mesh = modelMeshes[meshIndex];
+    auto& packed = packedMeshes[meshIndex];
+    PlanPackedMesh(mesh, layout, packed);
+    m_model.indexType = packed.indexType;
+    packedRanges[meshIndex] = { .vertexByteOffset = vertexBytes, .indexByteOffset = indexBytes };
+
+    const auto indexStride = packed.GetIndexStride();
+    auto& dstMesh = geometries.emplace_back();
+    dstMesh.geometryIndex = uint32_t(geometries.size() - 1);
+    dstMesh.nodeIndex = 0;
+    dstMesh.firstIndex = uint32_t(indexBytes / indexStride);
+    dstMesh.vertexOffset = int32_t(vertexBytes / stride);
+    dstMesh.vertexCount = packed.vertexCount;
+    dstMesh.indexCount = packed.indexCount;
+    dstMesh.materialIndex = mesh.materialIndex;
+    dstMesh.positionScale = packed.positionScale;
+    dstMesh.positionOffset = packed.positionOffset;
+    dstMesh.decodeFlags = packed.decodeFlags;
+    dstMesh.bounds = ComputeBoundingSphere(mesh.positions);
+    dstMesh.localBounds = dstMesh.bounds;
+    dstMesh.localBoundsMin = mesh.boundsMin;
+    dstMesh.localBoundsMax = mesh.boundsMax;
+
+    // スキンを持つジオメトリは、バインドポーズの頂点をスキニング用に並べておく.
+    //  ジョイントの番号は全スキンのジョイント行列を通した番号に直す.
+    if (mesh.IsSkinned())
+    {
+      const auto jointBase = uint32_t(m_model.joints.size());
+      dstMesh.decodeFlags |= VERTEX_DECODE_SKINNED;
+      dstMesh.skinnedVertexOffset = int32_t(skinVertices.size()) - dstMesh.vertexOffset;
+      for (size_t v = 0; v < mesh.positions.size(); ++v)
+      {
+        const auto& joints = mesh.jointIndices[v];
+        skinVertices.push_back(GpuSkinning::SourceVertex{
+          .position = glm::vec4(mesh.positions[v], 1.0f),
+          .normal = glm::vec4(mesh.normals[v], 0.0f),
+          .joints = glm::uvec4(joints.x + jointBase, joints.y + jointBase, joints.z + jointBase, joints.w + jointBase),
+          .weights = mesh.jointWeights[v],
+        });
+      }
+      m_model.joints.insert(m_model.joints.end(), mesh.joints.begin(), mesh.joints.end());
+
+      // ジョイントごとに、影響を受ける頂点のバインドポーズでの AABB を求めておく.
+      //  スキニング後の頂点は各ジョイントで変換した位置の重み付き平均のため、
+      //  それぞれの AABB をジョイント行列で変換して合わせた範囲に必ず収まる.
+      std::vector<glm::vec3> jointMin(mesh.joints.size(), glm::vec3(FLT_MAX));
+      std::vector<glm::vec3> jointMax(mesh.joints.size(), glm::vec3(-FLT_MAX));
+      for (size_t v = 0; v < mesh.positions.size(); ++v)
+      {
+        for (int i = 0; i < 4; ++i)
+        {
+          auto joint = mesh.jointIndices[v][i];
+          if (mesh.jointWeights[v][i] > 0.0f && joint < mesh.joints.size())
+          {
+            jointMin[joint] = glm::min(jointMin[joint], mesh.positions[v]);
+            jointMax[joint] = glm::max(jointMax[joint], mesh.positions[v]);
+          }
+        }
+      }
+      dstMesh.firstJointBounds = uint32_t(m_model.jointBounds.size());
+      for (uint32_t joint = 0; joint < mesh.joints.size(); ++joint)
+      {
+        if (jointMin[joint].x <= jointMax[joint].x)
+        {
+          m_model.jointBounds.push_back({ .joint = jointBase + joint, .boundsMin = jointMin[joint], .boundsMax = jointMax[joint] });
+        }
+      }
+      dstMesh.jointBoundsCount = uint32_t(m_model.jointBounds.size()) - dstMesh.firstJointBounds;
+    }
+    assert(packed.lods.size() <= GpuCulling::MaxLodCount);
+    dstMesh.lodCount = uint32_t(packed.lods.size());
+    for (uint32_t lod = 0; lod < dstMesh.lodCount; ++lod)
+    {
+      dstMesh.lods[lod] = {
+        .firstIndex = dstMesh.firstIndex + packed.lods[lod].firstIndex,
+        .indexCount = packed.lods[lod].indexCount,
+        .error = packed.lods[lod].error,
+      };
+    }
+
+    // メッシュレットの頂点番号は頂点バッファ全体での番号に直して格納する.
+    const auto geometryIndex = dstMesh.geometryIndex;
+    const auto vertexListBase = uint32_t(meshletVertices.size());
+    const auto triangleBase = uint32_t(meshletTriangles.size());
+    for (const auto& meshlet : mesh.meshlets)
+    {
+      geometryMeshlets[geometryIndex].push_back(MeshletCulling::MeshletInfo{
+        .boundingSphere = glm::vec4(meshlet.center, meshlet.radius),
+        .cone = glm::vec4(meshlet.coneAxis, meshlet.coneCutoff),
+        .meshIndex = 0,
+        .firstIndex = dstMesh.firstIndex + packed.meshletFirstIndex + meshlet.triangleOffset * 3,
+        .indexCount = meshlet.triangleCount * 3,
+        .vertexOffset = dstMesh.vertexOffset,
+        .vertexListOffset = vertexListBase + meshlet.vertexOffset,
+        .triangleOffset = triangleBase + meshlet.triangleOffset,
+        .vertexCount = meshlet.vertexCount,
+        .triangleCount = meshlet.triangleCount,
+      });
+    }
+    for (auto v : mesh.meshletVertices)
+    {
+      meshletVertices.push_back(uint32_t(dstMesh.vertexOffset) + v);
+    }
+    meshletTriangles.insert(meshletTriangles.end(), mesh.meshletTriangles.begin(), mesh.meshletTriangles.end());
+
+    vertexBytes += size_t(packed.vertexCount) * stride;
+    indexBytes += packed.GetIndexBytes();
+
+    const auto meshletIndexBytes = size_t(packed.meshletIndexCount) * indexStride;
+    m_geometryStats.float32Bytes += size_t(packed.vertexCount) * float32Stride + size_t(packed.indexCount) * sizeof(uint32_t);
+    m_geometryStats.lodIndexBytes += packed.GetIndexBytes() - size_t(packed.indexCount) * indexStride - meshletIndexBytes;
+    m_geometryStats.meshletIndexBytes += meshletIndexBytes;
+  }
+  m_geometryStats.vertexBytes = vertexBytes;
+  m_geometryStats.indexBytes = indexBytes;
+
+  // 頂点・インデックス・深度プリパス用の位置を、マップしたステージングメモリへ直接変換する.
+  //  メッシュごとに書き込み先が分かれているため並列に処理できる. 中間の配列は作らない.
+  //  GPU への転送は UploadGeometryChunk で複数フレームに分けて行うため、ステージングはそれまで残しておく.
+  {
+    // メッシュシェーダーは頂点バッファをストレージバッファとして読む.
+    VkBufferUsageFlags vertexUsage = VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+    if (gfxDevice->IsSupportMeshShader())
+    {
+      vertexUsage |= VK_BUFFER_USAGE_STORAGE_BUFFER_BIT;
+    }
+    const auto positionSize = layout.GetPositionSize();
+    const auto positionBytes = vertexBytes / stride * positionSize;
+    m_model.vertexBuffer = gfxDevice->CreateBuffer(vertexBytes, vertexUsage, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+    m_model.indexBuffer = gfxDevice->CreateBuffer(indexBytes,
+      VK_BUFFER_USAGE_INDEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+    m_model.positionBuffer = gfxDevice->CreateBuffer(positionBytes,
+      VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+
+    auto& upload = m_geometryUpload;
+    upload.vertexStaging = gfxDevice->CreateBuffer(vertexBytes, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT);
+    upload.indexStaging = gfxDevice->CreateBuffer(indexBytes, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT);
+    upload.positionStaging = gfxDevice->CreateBuffer(positionBytes, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT);
+    auto* vertexDst = static_cast<uint8_t*>(upload.vertexStaging.mapped);
+    auto* indexDst = static_cast<uint8_t*>(upload.indexStaging.mapped);
+    auto* positionDst = static_cast<uint8_t*>(upload.positionStaging.mapped);
+    GetThreadPool()->ParallelFor(modelMeshes.size(), [&](size_t meshIndex) {
+      const auto& range = packedRanges[meshIndex];
+      WritePackedVertices(modelMeshes[meshIndex], layout, packedMeshes[meshIndex],
+        vertexDst + range.vertexByteOffset, positionDst + range.vertexByteOffset / stride * positionSize);
+      WritePackedIndices(modelMeshes[meshIndex], packedMeshes[meshIndex], indexDst + range.indexByteOffset);
+    });
+    // HOST_COHERENT でない場合に備えて、書き込んだ内容をデバイスから見えるようにする.
+    for (const auto* staging : { &upload.vertexStaging, &upload.indexStaging, &upload.positionStaging })
+    {
+      VkMappedMemoryRange memRange{
+        .sType = VK_STRUCTURE_TYPE_MAPPED_MEMORY_RANGE,
+        .memory = staging->memory,
+        .offset = 0,
+        .size = VK_WHOLE_SIZE,
+      };
+      vkFlushMappedMemoryRanges(vkDevice, 1, &memRange);
+    }
+
+    // ジオメトリ単位で転送を区切るため、それぞれの先頭位置を残しておく.
+    for (const auto& range : packedRanges)
+    {
+      upload.vertexOffsets.push_back(range.vertexByteOffset);
+      upload.positionOffsets.push_back(range.vertexByteOffset / stride * positionSize);
+      upload.indexOffsets.push_back(range.indexByteOffset);
+    }
+    upload.vertexOffsets.push_back(vertexBytes);
+    upload.positionOffsets.push_back(positionBytes);
+    upload.indexOffsets.push_back(indexBytes);
+    m_residentGeometryCount = 0;
+  }
+
+  // ノードが参照するメッシュごとに描画単位を作る. ジオメトリは共有し、配置するノードと境界だけを持つ.
+  //  同じジオメトリのものは番号を連続させ、インスタンス描画でまとめられるようにする.
+  m_model.nodes = std::move(loaded.nodes);
+  if (m_model.nodes.empty())
+  {
+    auto& root = m_model.nodes.emplace_back();
+    root.meshes.resize(modelMeshes.size());
+    std::iota(root.meshes.begin(), root.meshes.end(), 0u);
+  }
+  ComputeNodeTransforms(m_model.nodes, m_model.nodeTransforms);
+  m_model.geometryCount = uint32_t(geometries.size());
+
+  // アニメーションは毎フレーム読み込み時の姿勢から適用し直す.
+  m_model.animations = std::move(loaded.animations);
+  m_model.restTransforms.clear();
+  for (const auto& node : m_model.nodes)
+  {
+    m_model.restTransforms.push_back(node.transform);
+  }
+  for (const auto& joint : m_model.joints)
+  {
+    m_model.jointNodes.push_back(joint.nodeIndex);
+  }
+  std::sort(m_model.jointNodes.begin(), m_model.jointNodes.end());
+  m_model.jointNodes.erase(std::unique(m_model.jointNodes.begin(), m_model.jointNodes.end()), m_model.jointNodes.end());
+  m_animationIndex = std::min(m_animationIndex, std::max(int(m_model.animations.size()) - 1, 0));
+  m_jointMatrices.resize(m_model.joints.size());
+  m_skinning.Initialize(skinVertices, uint32_t(m_model.joints.size()));
+
+  std::vector<std::vector<uint32_t>> geometryNodes(geometries.size());
+  for (uint32_t nodeIndex = 0; nodeIndex < m_model.nodes.size(); ++nodeIndex)
+  {
+    for (auto geometryIndex : m_model.nodes[nodeIndex].meshes)
+    {
+      geometryNodes[geometryIndex].push_back(nodeIndex);
+    }
+  }
+  // アニメーションのチャンネルを持つノードとその子孫は変換が変わるため、置かれたメッシュの境界は毎フレーム求め直す.
+  //  親は子より前に並ぶため、前から順に親の状態を引き継げば良い.
+  //  アニメーションを持たないモデルのジョイントは確認用の揺れで動くことがあるため含める.
+  std::vector<uint8_t> animatedNodes(m_model.nodes.size(), 0);
+  if (m_model.animations.empty())
+  {
+    for (auto nodeIndex : m_model.jointNodes)
+    {
+      animatedNodes[nodeIndex] = 1;
+    }
+  }
+  for (const auto& animation : m_model.animations)
+  {
+    for (const auto& channel : animation.channels)
+    {
+      if (channel.nodeIndex < animatedNodes.size())
+      {
+        animatedNodes[channel.nodeIndex] = 1;
+      }
+    }
+  }
+  for (size_t nodeIndex = 0; nodeIndex < m_model.nodes.size(); ++nodeIndex)
+  {
+    auto parent = m_model.nodes[nodeIndex].parent;
+    if (parent >= 0 && animatedNodes[parent])
+    {
+      animatedNodes[nodeIndex] = 1;
+    }
+  }
+
+  std::vector<std::vector<MeshletCulling::MeshletInfo>> meshMeshlets;
+  auto& meshBoundsMin = m_model.meshBoundsMin;
+  auto& meshBoundsMax = m_model.meshBoundsMax;
+  for (uint32_t geometryIndex = 0; geometryIndex < geometries.size(); ++geometryIndex)
+  {
+    const auto& source = modelMeshes[geometryIndex];
+    for (auto nodeIndex : geometryNodes[geometryIndex])
+    {
+      // スキンを持つメッシュはジョイントの変換でモデル空間に置かれるため、ノードの変換は使わない.
+      const auto matNode = source.IsSkinned() ? glm::mat4(1.0f) : m_model.nodeTransforms[nodeIndex];
+      const bool dynamicBounds = source.IsSkinned() || animatedNodes[nodeIndex];
+      const auto meshIndex = uint32_t(m_model.meshes.size());
+      auto& dstMesh = m_model.meshes.emplace_back(geometries[geometryIndex]);
+      dstMesh.nodeIndex = nodeIndex;
+      dstMesh.bounds = TransformBoundingSphere(dstMesh.localBounds, matNode);
+      if (dynamicBounds)
+      {
+        m_model.dynamicMeshes.push_back(meshIndex);
+      }
+
+      auto& boundsMin = meshBoundsMin.emplace_back();
+      auto& boundsMax = meshBoundsMax.emplace_back();
+      TransformBounds(dstMesh.localBoundsMin, dstMesh.localBoundsMax, matNode, boundsMin, boundsMax);
+
+      // メッシュレットの境界球とコーンもモデル空間へ移す. (コーンの広がりは回転・一様スケールを前提とする)
+      auto& meshlets = meshMeshlets.emplace_back(geometryMeshlets[geometryIndex]);
+      for (auto& info : meshlets)
+      {
+        auto sphere = TransformBoundingSphere(
+          BoundingSphere{ .center = glm::vec3(info.boundingSphere), .radius = info.boundingSphere.w }, matNode);
+        info.boundingSphere = glm::vec4(sphere.center, sphere.radius);
+        auto axis = glm::vec3(matNode * glm::vec4(glm::vec3(info.cone), 0.0f));
+        float axisLength = glm::length(axis);
+        info.cone = axisLength > 0.0f ? glm::vec4(axis / axisLength, info.cone.w) : glm::vec4(0.0f, 0.0f, 1.0f, 1.0f);
+        info.meshIndex = meshIndex;
+        // スキニングで三角形の向きが変わるため、裏面判定は行わない.
+        if (source.IsSkinned())
+        {
+          info.cone = glm::vec4(0.0f, 0.0f, 1.0f, 1.0f);
+        }
+        // 読み込み時の変換で求めた境界は使えないため、毎フレーム更新するメッシュの境界で判定する.
+        if (dynamicBounds)
+        {
+          info.flags |= MeshletCulling::MESHLET_FLAG_USE_MESH_BOUNDS;
+        }
+      }
+    }
+  }
+  for (const auto& mesh : m_model.meshes)
+  {
+    m_model.meshSpheres.push_back(glm::vec4(mesh.bounds.center, mesh.bounds.radius));
+  }
+
+  // CPU カリング用にメッシュの AABB を SoA で保持しておく.
+  m_meshCuller.Clear();
+  m_meshCuller.Reserve(m_model.meshes.size());
+  for (uint32_t meshIndex = 0; meshIndex < m_model.meshes.size(); ++meshIndex)
+  {
+    m_meshCuller.AddBox(meshBoundsMin[meshIndex], meshBoundsMax[meshIndex]);
+  }
+  {
+    auto start = std::chrono::high_resolution_clock::now();
+    m_meshBvh.Build(meshBoundsMin, meshBoundsMax);
+    auto end = std::chrono::high_resolution_clock::now();
+    m_meshQuery = MeshQuery{ .bvhBuildMilliseconds = std::chrono::duration<double, std::milli>(end - start).count() };
+  }
+  m_meshVisibility.assign(m_model.meshes.size(), 1);
+  m_meshLods.assign(m_model.meshes.size(), 0);
+
+  // インスタンシング用のデータ.
+  //  モデルは Y 軸回転するため、XZ は回転しても収まる半径で範囲を決める.
+  {
+    glm::vec3 boundsMin(FLT_MAX), boundsMax(-FLT_MAX);
+    for (uint32_t meshIndex = 0; meshIndex < m_model.meshes.size(); ++meshIndex)
+    {
+      if (m_model.meshes[meshIndex].vertexCount == 0)
+      {
+        continue;
+      }
+      boundsMin = glm::min(boundsMin, meshBoundsMin[meshIndex]);
+      boundsMax = glm::max(boundsMax, meshBoundsMax[meshIndex]);
+    }
+    if (boundsMin.x > boundsMax.x)
+    {
+      boundsMin = boundsMax = glm::vec3(0.0f);
+    }
+    float radius = 0.0f;
+    for (auto x : { boundsMin.x, boundsMax.x })
+    {
+      for (auto z : { boundsMin.z, boundsMax.z })
+      {
+        radius = std::max(radius, std::sqrt(x * x + z * z));
+      }
+    }
+    m_instances.boundsMin = glm::vec3(-radius, boundsMin.y, -radius);
+    m_instances.boundsMax = glm::vec3(radius, boundsMax.y, radius);
+    m_instances.spacing = std::max(radius * 2.0f * 1.2f, 0.01f);
+
+    std::vector<glm::mat4> transforms(MaxInstanceCount);
+    for (uint32_t i = 0; i < MaxInstanceCount; ++i)
+    {
+      transforms[i] = glm::translate(glm::mat4(1.0f), GetInstancePosition(i, m_instances.spacing));
+    }
+    m_instances.transformBuffer = gfxDevice->CreateBuffer(sizeof(glm::mat4) * transforms.size(),
+      VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, transforms.data());
+
+    for (int i = 0; i < gfxDevice->InflightFrames; ++i)
+    {
+      auto& buffer = m_instances.visibleBuffers.emplace_back();
+      buffer = gfxDevice->CreateBuffer(sizeof(uint32_t) * MaxInstanceCount,
+        VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+        VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+    }
+    m_instanceCuller.Clear();
+  }
+
+
+  // 全メッシュのパラメータを格納するバッファ. 毎フレーム CPU から更新する.
+  //  ノードがメッシュを参照しない場合でも作れるよう、最低1要素分は確保しておく.
+  for (int i = 0; i < gfxDevice->InflightFrames; ++i)
+  {
+    auto& buffer = m_model.drawParameterBuffers.emplace_back();
+    buffer = gfxDevice->CreateBuffer(sizeof(DrawParameters) * std::max<size_t>(m_model.meshes.size(), 1),
+      VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+      VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+  }
+
+  // 描画バケットの構築.
+  //  アルファモードの描画順に、同じマテリアルを使うメッシュをまとめる.
+  auto modeList = { ModelMaterial::ALPHA_MODE_OPAQUE, ModelMaterial::ALPHA_MODE_MASK, ModelMaterial::ALPHA_MODE_BLEND };
+  for (auto mode : modeList)
+  {
+    for (uint32_t materialIndex = 0; materialIndex < m_model.materials.size(); ++materialIndex)
+    {
+      if (m_model.materials[materialIndex].alphaMode != mode)
+      {
+        continue;
+      }
+      DrawBucket bucket{
+        .mode = mode,
+        .materialIndex = materialIndex,
+        .commandOffset = uint32_t(m_model.bucketMeshes.size()),
+        .meshCount = 0,
+      };
+      for (uint32_t meshIndex = 0; meshIndex < m_model.meshes.size(); ++meshIndex)
+      {
+        if (m_model.meshes[meshIndex].materialIndex == materialIndex)
+        {
+          m_model.bucketMeshes.push_back(meshIndex);
+          bucket.meshCount++;
+        }
+      }
+      if (bucket.meshCount > 0)
+      {
+        m_model.drawBuckets.push_back(bucket);
+      }
+    }
+  }
+
+  // GPU カリング用のメッシュ情報. 描画コマンドはバケットの範囲に詰めて出力される.
+  if (gfxDevice->IsSupportDrawIndirectCount() && !m_model.drawBuckets.empty())
+  {
+    std::vector<GpuCulling::MeshInfo> cullMeshes(m_model.meshes.size());
+    std::vector<GpuCulling::Bucket> cullBuckets;
+    for (uint32_t bucketIndex = 0; bucketIndex < m_model.drawBuckets.size(); ++bucketIndex)
+    {
+      const auto& bucket = m_model.drawBuckets[bucketIndex];
+      cullBuckets.push_back({ .commandOffset = bucket.commandOffset, .maxCount = bucket.meshCount });
+      for (uint32_t i = 0; i < bucket.meshCount; ++i)
+      {
+        auto meshIndex = m_model.bucketMeshes[bucket.commandOffset + i];
+        const auto& mesh = m_model.meshes[meshIndex];
+        auto& info = cullMeshes[meshIndex];
+        info = GpuCulling::MeshInfo{
+          .boundingSphere = m_model.meshSpheres[meshIndex],
+          .vertexOffset = mesh.vertexOffset,
+          .bucket = bucketIndex,
+          .commandOffset = bucket.commandOffset,
+          .lodCount = mesh.lodCount,
+        };
+        for (uint32_t lod = 0; lod < mesh.lodCount; ++lod)
+        {
+          info.firstIndex[lod] = mesh.lods[lod].firstIndex;
+          info.indexCount[lod] = mesh.lods[lod].indexCount;
+          info.lodError[lod] = mesh.lods[lod].error;
+        }
+      }
+    }
+    m_gpuCulling.Initialize(cullMeshes, cullBuckets, m_depthPyramid);
+  }
+
+  // メッシュレットのカリング用情報. バケットはメッシュ単位の描画と同じ並びで、範囲はメッシュレット数で決まる.
+  bool canDrawMeshlets = gfxDevice->IsSupportMeshShader() || gfxDevice->IsSupportDrawIndirectCount();
+  if (canDrawMeshlets && !m_model.drawBuckets.empty() && !meshletTriangles.empty())
+  {
+    std::vector<MeshletCulling::MeshletInfo> meshlets;
+    std::vector<MeshletCulling::Bucket> meshletBuckets;
+    for (uint32_t bucketIndex = 0; bucketIndex < m_model.drawBuckets.size(); ++bucketIndex)
+    {
+      const auto& bucket = m_model.drawBuckets[bucketIndex];
+      MeshletCulling::Bucket meshletBucket{ .commandOffset = uint32_t(meshlets.size()), .maxCount = 0 };
+      for (uint32_t i = 0; i < bucket.meshCount; ++i)
+      {
+        auto meshIndex = m_model.bucketMeshes[bucket.commandOffset + i];
+        for (auto info : meshMeshlets[meshIndex])
+        {
+          info.bucket = bucketIndex;
+          info.commandOffset = meshletBucket.commandOffset;
+          meshlets.push_back(info);
+          meshletBucket.maxCount++;
+        }
+      }
+      meshletBuckets.push_back(meshletBucket);
+    }
+    m_meshletCulling.Initialize(meshlets, meshletVertices, meshletTriangles, meshletBuckets, m_model.meshSpheres,
+      m_model.vertexBuffer.buffer, m_meshletDescriptorSetLayout);
+  }
+
+  // マテリアルごとにディスクリプタセットを構築.
+  m_model.drawInfos.resize(m_model.materials.size());
+  for (uint32_t materialIndex = 0; materialIndex < m_model.materials.size(); ++materialIndex)
+  {
+    auto& info = m_model.drawInfos[materialIndex];
+    const auto& material = m_model.materials[materialIndex];
+    info.descriptorSets.resize(gfxDevice->InflightFrames);
+    if (!m_modelDescriptorAllocator.Allocate(setLayouts.data(), uint32_t(setLayouts.size()), info.descriptorSets.data()))
+    {
+      // セットが無いマテリアルのメッシュは描画しない.
+      fprintf(stderr, "Failed to allocate descriptor sets for material %u.\n", materialIndex);
+      continue;
+    }
+
+    for (uint32_t frameIndex = 0; frameIndex < info.descriptorSets.size(); ++frameIndex)
+    {
+      auto descriptorSet = info.descriptorSets[frameIndex];
+
+      std::vector<VkWriteDescriptorSet> writeDescs;
+      VkDescriptorBufferInfo sceneUniformBuffer{
+        .buffer = m_sceneUniformBuffers[frameIndex].buffer,
+        .offset = 0,
+        .range = VK_WHOLE_SIZE
+      };
+      auto& dsSceneUBO = writeDescs.emplace_back();
+      dsSceneUBO = VkWriteDescriptorSet{
+        .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+        .dstSet = descriptorSet,
+        .dstBinding = 0,
+        .descriptorCount = 1,
+        .descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER,
+        .pBufferInfo = &sceneUniformBuffer
+      };
+
+      auto& dsMeshParams = writeDescs.emplace_back();
+      VkDescriptorBufferInfo meshParameterBuffer{
+        .buffer = m_model.drawParameterBuffers[frameIndex].buffer,
+        .offset = 0,
+        .range = VK_WHOLE_SIZE
+      };
+      dsMeshParams = VkWriteDescriptorSet{
+        .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+        .dstSet = descriptorSet,
+        .dstBinding = 1,
+        .descriptorCount = 1,
+        .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+        .pBufferInfo = &meshParameterBuffer
+      };
+
+      auto& dsInstanceTransforms = writeDescs.emplace_back();
+      VkDescriptorBufferInfo instanceTransformBuffer{
+        .buffer = m_instances.transformBuffer.buffer,
+        .offset = 0,
+        .range = VK_WHOLE_SIZE
+      };
+      dsInstanceTransforms = VkWriteDescriptorSet{
+        .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+        .dstSet = descriptorSet,
+        .dstBinding = 3,
+        .descriptorCount = 1,
+        .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+        .pBufferInfo = &instanceTransformBuffer
+      };
+
+      auto& dsVisibleInstances = writeDescs.emplace_back();
+      VkDescriptorBufferInfo visibleInstanceBuffer{
+        .buffer = m_instances.visibleBuffers[frameIndex].buffer,
+        .offset = 0,
+        .range = VK_WHOLE_SIZE
+      };
+      dsVisibleInstances = VkWriteDescriptorSet{
+        .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+        .dstSet = descriptorSet,
+        .dstBinding = 4,
+        .descriptorCount = 1,
+        .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+        .pBufferInfo = &visibleInstanceBuffer
+      };
+
+      auto& dsSkinnedVertices = writeDescs.emplace_back();
+      VkDescriptorBufferInfo skinnedVertexBuffer{
+        .buffer = m_skinning.GetSkinnedVertexBuffer(frameIndex),
+        .offset = 0,
+        .range = VK_WHOLE_SIZE
+      };
+      dsSkinnedVertices = VkWriteDescriptorSet{
+        .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+        .dstSet = descriptorSet,
+        .dstBinding = 5,
+        .descriptorCount = 1,
+        .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+        .pBufferInfo = &skinnedVertexBuffer
+      };
+
+      auto& dsDiffuseTex = writeDescs.emplace_back();
+      dsDiffuseTex = VkWriteDescriptorSet{
+        .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+        .dstSet = descriptorSet,
+        .dstBinding = 2,
+        .descriptorCount = 1,
+        .descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
+        .pImageInfo = &GetDiffuseTexture(material).descriptorInfo,
+      };
+
+      vkUpdateDescriptorSets(vkDevice, uint32_t(writeDescs.size()), writeDescs.data(), 0, nullptr);
+    }
+  }
+}
+
+void Application::DestroyModelData()
+{
+  auto& gfxDevice = GetGfxDevice();
+  for (auto& buffer : m_model.drawParameterBuffers)
+  {
+    gfxDevice->DestroyBuffer(buffer);
+  }
+  m_model.drawParameterBuffers.clear();
+  gfxDevice->DestroyBuffer(m_instances.transformBuffer);
+  for (auto& buffer : m_instances.visibleBuffers)
+  {
+    gfxDevice->DestroyBuffer(buffer);
+  }
+  m_instances.visibleBuffers.clear();
+  m_instanceCuller.Clear();
+  m_modelDescriptorAllocator.Destroy();
+  m_gpuCulling.Destroy();
+  m_meshletCulling.Destroy();
+  m_skinning.Destroy();
+
+  gfxDevice->DestroyBuffer(m_model.vertexBuffer);
+  gfxDevice->DestroyBuffer(m_model.positionBuffer);
+  gfxDevice->DestroyBuffer(m_model.indexBuffer);
+  // 転送途中のステージングと、完了を待っていたフレームの転送のリソース. (呼び出し側でアイドルを待っている)
+  for (auto* staging : { &m_geometryUpload.vertexStaging, &m_geometryUpload.positionStaging, &m_geometryUpload.indexStaging })
+  {
+    if (staging->buffer != VK_NULL_HANDLE)
+    {
+      gfxDevice->DestroyBuffer(*staging);
+    }
+  }
+  m_geometryUpload = GeometryUpload{};
+  m_residentGeometryCount = 0;
+  for (uint32_t frameIndex = 0; frameIndex < uint32_t(gfxDevice->InflightFrames); ++frameIndex)
+  {
+    ReleaseFrameUploads(frameIndex);
+  }
+  m_modelResident = false;
+  m_model.meshes.clear();
+  m_meshCacheInfos.clear();
+  m_model.materials.clear();
+  m_model.drawInfos.clear();
+  m_model.drawBuckets.clear();
+  m_model.bucketMeshes.clear();
+  m_model.nodes.clear();
+  m_model.nodeTransforms.clear();
+  m_model.geometryCount = 0;
+  m_model.animations.clear();
+  m_model.joints.clear();
+  m_model.jointNodes.clear();
+  m_model.restTransforms.clear();
+  m_model.jointBounds.clear();
+  m_model.meshBoundsMin.clear();
+  m_model.meshBoundsMax.clear();
+  m_model.meshSpheres.clear();
+  m_model.dynamicMeshes.clear();
+  m_jointMatrices.clear();
+  m_meshCuller.Clear();
+  m_meshBvh.Clear();
+  m_meshQuery = MeshQuery{};
+  m_meshVisibility.clear();
+  m_meshLods.clear();
+  // サンプラーは SamplerCache が持つため、ここでは破棄しない.
+  for (auto& image : m_model.textureImages)
+  {
+    gfxDevice->DestroyImage(image);
+  }
+  m_model.textureImages.clear();
+  m_model.textures.clear();
+  m_model.textureIndices.clear();
+}
+
+void Application::ReloadModel()
+{
+  // 頂点レイアウトの変更はパイプラインとモデルデータの両方を作り直す.
+  //  読み込み途中のものは中断してから破棄する.
+  StopModelLoad();
+  auto& gfxDevice = GetGfxDevice();
+  gfxDevice->WaitForIdle();
+
+  DestroyModelData();
+  DestroyModelDrawPipelines();
+
+  m_vertexLayout = m_usePackedVertex ? VertexLayout::Packed() : VertexLayout::Float32();
+  PrepareModelDrawPipelines();
+  StartModelLoad();
+}
+
+void Application::RunGltfBenchmark()
+{
+  // 表示中のモデルと同じ設定で、キャッシュだけを使わずに読み込む. 読めないファイルは結果に含めない.
+  const char* modelFiles[] = {
+    "res/model/BoxTextured.glb",
+    "res/model/sponza/Sponza.gltf",
+    "res/model/alicia-solid.vrm.glb",
+  };
+  m_gltfBenchmark.clear();
+  for (const auto* modelFile : modelFiles)
+  {
+    GltfBenchmarkResult result{ .file = std::filesystem::path(modelFile).filename().string() };
+    bool loaded = true;
+    for (int mode = 0; mode < 2 && loaded; ++mode)
+    {
+      ModelLoader loader;
+      loader.SetBuildMeshlets(true);
+      loader.SetLodCount(GpuCulling::MaxLodCount);
+      loader.SetOptimizeMeshes(m_useMeshOptimization);
+      loader.SetWeldMode(ModelLoader::WeldMode(m_weldMode));
+      loader.SetPreserveHierarchy(m_usePreserveHierarchy);
+      loader.SetParallelImport(m_useParallelImport);
+      loader.SetUseCache(false);
+      loader.SetUseNativeGltf(mode == 0);
+
+      std::vector<ModelMesh> meshes;
+      std::vector<ModelMaterial> materials;
+      std::vector<ModelEmbeddedTextureData> embeddedData;
+      std::vector<ModelNode> nodes;
+      std::vector<ModelAnimation> animations;
+      loaded = loader.Load(modelFile, meshes, materials, embeddedData, nodes, animations);
+      result.milliseconds[mode] = loader.GetLoadStats().milliseconds;
+      result.meshCount[mode] = uint32_t(meshes.size());
+      if (mode == 0)
+      {
+        result.nativeGltf = loader.GetLoadStats().nativeGltf;
+      }
+    }
+    if (loaded)
+    {
+      m_gltfBenchmark.push_back(result);
+    }
+  }
+}
+
+void Application::PrepareSceneUniformBuffer()
+{
+  auto& gfxDevice = GetGfxDevice();
+  m_sceneUniformBuffers.resize(gfxDevice->InflightFrames);
+
+  for (auto& buffer : m_sceneUniformBuffers)
+  {
+    buffer = gfxDevice->CreateBuffer(sizeof(SceneParameters), 
+      VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT,
+      VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+  }
+}
+
+void Application::DestroySceneUniformBuffer()
+{
+  auto& gfxDevice = GetGfxDevice();
+  for (auto& buffer : m_sceneUniformBuffers)
+  {
+    gfxDevice->DestroyBuffer(buffer);
+  }
+  m_sceneUniformBuffers.clear();
+}
+
+void Application::UpdateAnimation()
+{
+  if (m_model.animations.empty() && m_model.jointNodes.empty())
+  {
+    return;
+  }
+  auto deltaTime = std::min(ImGui::GetIO().DeltaTime, 1.0f);
+  if (m_playAnimation)
+  {
+    m_animationTime += deltaTime * m_animationSpeed;
+  }
+
+  // チャンネルを持たないノードが前のアニメーションの姿勢のまま残らないよう、読み込み時の姿勢から適用する.
+  auto start = std::chrono::high_resolution_clock::now();
+  for (size_t i = 0; i < m_model.nodes.size(); ++i)
+  {
+    m_model.nodes[i].transform = m_model.restTransforms[i];
+  }
+  if (!m_model.animations.empty())
+  {
+    SampleAnimation(m_model.animations[m_animationIndex], m_animationTime, m_model.nodes);
+  }
+  else if (m_useJointSway)
+  {
+    // アニメーションを持たないモデル (VRM など) は、確認用に各ジョイントを小さく揺らせる.
+    const auto matSway = glm::rotate(glm::mat4(1.0f), std::sin(m_animationTime * 2.0f) * glm::radians(8.0f), glm::vec3(0, 0, 1));
+    for (auto nodeIndex : m_model.jointNodes)
+    {
+      m_model.nodes[nodeIndex].transform = m_model.restTransforms[nodeIndex] * matSway;
+    }
+  }
+  auto end = std::chrono::high_resolution_clock::now();
+  m_skinningStats.animationMilliseconds = std::chrono::duration<double, std::milli>(end - start).count();
+}
 
-void Application::PrepareModelData()
+void Application::UpdateSkinning(VkCommandBuffer commandBuffer)
 {
-  ModelLoader loader;
-  std::vector<ModelMesh> modelMeshes;
-  std::vector<ModelMaterial> modelMaterials;
-  std::vector<ModelEmbeddedTextureData> modelEmbeddedTextures;
-  //const char* modelFile = "res/model/BoxTextured.glb";
-  //const char* modelFile = "res/model/teapot.glb";
-  //const char* modelFile = "res/model/sponza/Sponza.gltf";
-  const char* modelFile = "res/model/alicia-solid.vrm.glb";
-
-  if (!loader.Load(modelFile, modelMeshes, modelMaterials, modelEmbeddedTextures))
+  if (!m_useSkinning || m_skinning.GetVertexCount() == 0)
   {
-    //OutputDebugStringA("failed.\n");
-    fprintf(stderr,"ERROR\n");
+    return;
   }
+  // ジョイント行列は UpdateDrawParameters で求めたものを使う.
+  m_skinning.Dispatch(commandBuffer, m_jointMatrices.data());
+}
 
+void Application::UpdateDrawParameters()
+{
+  if (!m_modelResident)
+  {
+    return;
+  }
   auto& gfxDevice = GetGfxDevice();
-  auto vkDevice = gfxDevice->GetVkDevice();
+  auto frameIndex = gfxDevice->GetFrameIndex();
+
+  auto deltaTime = std::min(ImGui::GetIO().DeltaTime, 1.0f);
+  static float angle = 0.0;
+  angle += deltaTime * 0.1f;
+  if (angle > 360.0f) { angle -= 360.f; }
+  if (angle < -360.0f) { angle += 360.f; }
+
+  // モデルのワールド行列を更新.
+  m_model.matWorld = glm::rotate(glm::mat4(1.0f), angle, glm::vec3(0, 1, 0));
 
-  for (const auto& embeddedInfo : modelEmbeddedTextures)
+  // ノードの変換は階層をたどって毎フレーム求める. (ノード数に比例するだけで頂点には触れない)
+  ComputeNodeTransforms(m_model.nodes, m_model.nodeTransforms);
+  // ジョイント行列はスキニングとカリング用の境界の両方で使う.
+  if (m_useSkinning && !m_model.joints.empty())
   {
-    auto& texture = m_model.embeddedTextures.emplace_back();
-    auto success = CreateTextureFromMemory(texture.textureImage, embeddedInfo.data.data(), embeddedInfo.data.size());
-    assert(success);
+    auto start = std::chrono::high_resolution_clock::now();
+    ComputeJointMatrices(m_model.nodeTransforms, m_model.joints, m_jointMatrices.data());
+    auto end = std::chrono::high_resolution_clock::now();
+    m_skinningStats.jointMatrixMilliseconds = std::chrono::duration<double, std::milli>(end - start).count();
   }
 
-  for (const auto& material : modelMaterials)
+  // ワールド行列とマテリアル情報を全メッシュ分ストレージバッファに書き込む.
+  auto writePtr = reinterpret_cast<DrawParameters*>(m_model.drawParameterBuffers[frameIndex].mapped);
+  for (uint32_t i = 0; i < m_model.meshes.size(); ++i)
   {
-    auto& dstMaterial = m_model.materials.emplace_back();
-    dstMaterial = material;
-
-    const auto& texDiffuse = dstMaterial.texDiffuse;
-    auto texItr = FindModelTexture(texDiffuse.filePath, m_model);
-    if (texItr == m_model.textureList.end())
-    {
+    const auto& mesh = m_model.meshes[i];
+    const auto& material = m_model.materials[mesh.materialIndex];
+
+    // スキンを持つメッシュはスキニングの結果がモデル空間のため、ノードの変換は掛けない.
+    //  スキニングを止めた場合はバインドポーズのまま描く.
+    const bool skinned = (mesh.decodeFlags & VERTEX_DECODE_SKINNED) != 0;
+    DrawParameters params{};
+    params.matWorld = skinned ? m_model.matWorld : m_model.matWorld * m_model.nodeTransforms[mesh.nodeIndex];
+    params.baseColor = glm::vec4(material.diffuse, material.alpha);
+    params.specular = glm::vec4(material.specular, material.shininess);
+    params.ambient = glm::vec4(material.ambient, 0.0f);
+    params.positionScale = mesh.positionScale;
+    params.positionOffset = mesh.positionOffset;
+    params.mode = material.alphaMode;
+    params.vertexFlags = m_useSkinning ? mesh.decodeFlags : mesh.decodeFlags & ~uint32_t(VERTEX_DECODE_SKINNED);
+    params.skinnedVertexOffset = mesh.skinnedVertexOffset;
+    memcpy(&writePtr[i], &params, sizeof(DrawParameters));
+  }
+}
 
-      bool success;
-      
-      if (texDiffuse.embeddedIndex == -1)
-      {
-        // 新規追加.
-        auto& info = m_model.textureList.emplace_back();
-        info.filePath = texDiffuse.filePath;
-
-        std::vector<char> fileData;
-        success = GetFileLoader()->Load(texDiffuse.filePath, fileData);
-        assert(success);
-
-        success = CreateTextureFromMemory(info.textureImage, fileData.data(), fileData.size());
-        assert(success);
-
-        auto modeU = texDiffuse.addressModeU;
-        auto modeV = texDiffuse.addressModeV;
-        VkSamplerCreateInfo samplerCI{
-          .sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO,
-          .magFilter = VK_FILTER_LINEAR,
-          .minFilter = VK_FILTER_LINEAR,
-          .mipmapMode = VK_SAMPLER_MIPMAP_MODE_LINEAR,
-          .addressModeU = modeU,
-          .addressModeV = modeV,
-          .addressModeW = VK_SAMPLER_ADDRESS_MODE_REPEAT,
-          .minLod = 0.0f,
-          .maxLod = VK_LOD_CLAMP_NONE,
-        };
+void Application::UpdateMeshBounds()
+{
+  if (!m_modelResident || m_model.dynamicMeshes.empty())
+  {
+    return;
+  }
+  auto start = std::chrono::high_resolution_clock::now();
 
-        auto res = vkCreateSampler(vkDevice, &samplerCI, nullptr, &info.sampler);
-        assert(res == VK_SUCCESS);
-        info.descriptorInfo = {
-          .sampler = info.sampler,
-          .imageView = info.textureImage.view,
-          .imageLayout = info.textureImage.layout,
-        };
-      }
-      else
+  // アニメーションするノードに置かれたメッシュとスキンを持つメッシュの境界を、今の変換で求め直す.
+  for (auto meshIndex : m_model.dynamicMeshes)
+  {
+    auto& mesh = m_model.meshes[meshIndex];
+    auto& boundsMin = m_model.meshBoundsMin[meshIndex];
+    auto& boundsMax = m_model.meshBoundsMax[meshIndex];
+    const bool skinned = (mesh.decodeFlags & VERTEX_DECODE_SKINNED) != 0;
+    if (!skinned)
+    {
+      const auto& matNode = m_model.nodeTransforms[mesh.nodeIndex];
+      TransformBounds(mesh.localBoundsMin, mesh.localBoundsMax, matNode, boundsMin, boundsMax);
+      mesh.bounds = TransformBoundingSphere(mesh.localBounds, matNode);
+    }
+    else if (m_useSkinning && mesh.jointBoundsCount > 0)
+    {
+      // ジョイントごとの AABB をジョイント行列で変換して合わせる.
+      boundsMin = glm::vec3(FLT_MAX);
+      boundsMax = glm::vec3(-FLT_MAX);
+      for (uint32_t i = 0; i < mesh.jointBoundsCount; ++i)
       {
-        // 埋め込みテクスチャを参照.
-        auto& embTexture = m_model.embeddedTextures[texDiffuse.embeddedIndex];
-        
-        auto modeU = texDiffuse.addressModeU;
-        auto modeV = texDiffuse.addressModeV;
-        VkSamplerCreateInfo samplerCI{
-          .sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO,
-          .magFilter = VK_FILTER_LINEAR,
-          .minFilter = VK_FILTER_LINEAR,
-          .mipmapMode = VK_SAMPLER_MIPMAP_MODE_LINEAR,
-          .addressModeU = modeU,
-          .addressModeV = modeV,
-          .addressModeW = VK_SAMPLER_ADDRESS_MODE_REPEAT,
-        };
-
-        auto res = vkCreateSampler(vkDevice, &samplerCI, nullptr, &embTexture.sampler);
-        assert(res == VK_SUCCESS);
-        embTexture.descriptorInfo = {
-          .sampler = embTexture.sampler,
-          .imageView = embTexture.textureImage.view,
-          .imageLayout = embTexture.textureImage.layout,
-        };
+        const auto& jointBounds = m_model.jointBounds[mesh.firstJointBounds + i];
+        glm::vec3 jointMin, jointMax;
+        TransformBounds(jointBounds.boundsMin, jointBounds.boundsMax, m_jointMatrices[jointBounds.joint], jointMin, jointMax);
+        boundsMin = glm::min(boundsMin, jointMin);
+        boundsMax = glm::max(boundsMax, jointMax);
       }
+      mesh.bounds = BoundingSphere{ .center = (boundsMin + boundsMax) * 0.5f, .radius = glm::length(boundsMax - boundsMin) * 0.5f };
     }
-
+    else
+    {
+      // スキニングしない場合はバインドポーズのまま描かれる.
+      boundsMin = mesh.localBoundsMin;
+      boundsMax = mesh.localBoundsMax;
+      mesh.bounds = mesh.localBounds;
+    }
+    m_model.meshSpheres[meshIndex] = glm::vec4(mesh.bounds.center, mesh.bounds.radius);
+    m_meshCuller.SetBox(meshIndex, boundsMin, boundsMax);
   }
+  // 木の構造は読み込み時のまま、境界だけを包み直す.
+  m_meshBvh.Refit(m_model.meshBoundsMin, m_model.meshBoundsMax);
 
-  std::vector<VkDescriptorSetLayout> setLayouts(gfxDevice->InflightFrames, m_modelDescriptorSetLayout);
-
-  for (const auto& mesh : modelMeshes)
-  {
-    VkMemoryPropertyFlags memFlags = VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT;
-    VkBufferUsageFlags usage = VK_BUFFER_USAGE_VERTEX_BUFFER_BIT;
-    auto& dstMesh = m_model.meshes.emplace_back();
-    size_t bufferSize = 0;
-    bufferSize = mesh.positions.size() * sizeof(glm::vec3);
-    dstMesh.position = gfxDevice->CreateBuffer(bufferSize, usage, memFlags, mesh.positions.data());
-
-    bufferSize = mesh.normals.size() * sizeof(glm::vec3);
-    dstMesh.normal = gfxDevice->CreateBuffer(bufferSize, usage, memFlags, mesh.normals.data());
+  // GPU のカリングはフレームごとの境界を参照するため、どちらの経路で描く場合も書き込んでおく.
+  m_gpuCulling.UpdateMeshBounds(m_model.meshSpheres);
+  m_meshletCulling.UpdateMeshBounds(m_model.meshSpheres);
 
-    bufferSize = mesh.texcoords.size() * sizeof(glm::vec2);
-    dstMesh.texcoord0 = gfxDevice->CreateBuffer(bufferSize, usage, memFlags, mesh.texcoords.data());
-
-    bufferSize = mesh.indices.size() * sizeof(uint32_t);
-    dstMesh.indices = gfxDevice->CreateBuffer(bufferSize, VK_BUFFER_USAGE_INDEX_BUFFER_BIT, memFlags, mesh.indices.data());
+  auto end = std::chrono::high_resolution_clock::now();
+  m_meshQuery.boundsUpdateMilliseconds = std::chrono::duration<double, std::milli>(end - start).count();
+}
 
-    dstMesh.vertexCount = uint32_t(mesh.positions.size());
-    dstMesh.indexCount = uint32_t(mesh.indices.size());
-    dstMesh.materialIndex = mesh.materialIndex;
+void Application::UpdateInstances(const glm::mat4& matViewProj)
+{
+  if (!m_modelResident)
+  {
+    return;
   }
+  auto& gfxDevice = GetGfxDevice();
+  auto frameIndex = gfxDevice->GetFrameIndex();
+  auto visibleIndices = reinterpret_cast<uint32_t*>(m_instances.visibleBuffers[frameIndex].mapped);
 
+  if (!m_useInstancing)
+  {
+    // 通常の描画はインスタンス0 (原点・単位行列) を1つだけ描く.
+    m_instanceStride = 1;
+    m_visibleInstanceCount = 1;
+    visibleIndices[0] = 0;
+    return;
+  }
 
-  for (uint32_t i = 0; i < m_model.meshes.size(); ++i)
+  const auto instanceCount = uint32_t(std::clamp(m_instanceCount, 1, int(MaxInstanceCount)));
+  if (m_instanceCuller.GetCount() != instanceCount)
   {
-    auto& mesh = m_model.meshes[i];
-    auto& material = m_model.materials[mesh.materialIndex];
+    // インスタンスは平行移動のみのため、AABB は固定で良い.
+    m_instanceCuller.Clear();
+    m_instanceCuller.Reserve(instanceCount);
+    for (uint32_t i = 0; i < instanceCount; ++i)
+    {
+      auto position = GetInstancePosition(i, m_instances.spacing);
+      m_instanceCuller.AddBox(position + m_instances.boundsMin, position + m_instances.boundsMax);
+    }
+  }
+  m_instanceStride = instanceCount;
 
-    auto& info = m_model.drawInfos.emplace_back();
-    info.descriptorSets.resize(gfxDevice->InflightFrames);
+  auto start = std::chrono::high_resolution_clock::now();
+  if (m_useFrustumCulling)
+  {
+    m_visibleInstanceCount = m_instanceCuller.Cull(ExtractFrustum(matViewProj), m_visibleInstances);
+  }
+  else
+  {
+    m_visibleInstances.resize(instanceCount);
+    std::iota(m_visibleInstances.begin(), m_visibleInstances.end(), 0u);
+    m_visibleInstanceCount = instanceCount;
+  }
 
-    // マテリアルとの関連付けしてディスクリプタセットを構築.
-    VkDescriptorSetAllocateInfo allocInfo{
-      .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO,
-      .descriptorPool = gfxDevice->GetDescriptorPool(),
-      .descriptorSetCount = uint32_t(setLayouts.size()),
-      .pSetLayouts = setLayouts.data(),
-    };
-    auto res = vkAllocateDescriptorSets(vkDevice, &allocInfo, info.descriptorSets.data());
-    assert(res == VK_SUCCESS);
+  // LOD を使う場合はカメラに近い順に並べる.
+  //  各メッシュの LOD は距離で決まるため、LOD ごとに連続した範囲として描画できる.
+  m_visibleInstanceDistances.clear();
+  if (m_useLod && m_visibleInstanceCount > 0)
+  {
+    const auto center = glm::vec3(0.0f, (m_instances.boundsMin.y + m_instances.boundsMax.y) * 0.5f, 0.0f);
+    const auto radius = glm::length(m_instances.boundsMax - m_instances.boundsMin) * 0.5f;
+    m_instanceSortQueue.Clear();
+    m_visibleInstanceDistances.resize(m_visibleInstanceCount);
+    for (uint32_t i = 0; i < m_visibleInstanceCount; ++i)
+    {
+      auto position = GetInstancePosition(m_visibleInstances[i], m_instances.spacing) + center;
+      float distance = std::max(glm::length(position - m_cameraPosition) - radius, 1.0e-3f);
+      m_visibleInstanceDistances[i] = distance;
+      m_instanceSortQueue.Push(RenderQueue::MakeOpaqueKey(0, 0, distance), i);
+    }
+    m_instanceSortQueue.Sort();
 
-    for (int j = 0; j < gfxDevice->InflightFrames; ++j)
+    m_sortedInstances.resize(m_visibleInstanceCount);
+    m_sortedInstanceDistances.resize(m_visibleInstanceCount);
+    const auto& items = m_instanceSortQueue.GetItems();
+    for (uint32_t i = 0; i < m_visibleInstanceCount; ++i)
     {
-      auto bufferSize = sizeof(DrawParameters);
-      auto& ubo = info.modelMeshUniforms.emplace_back();
-      ubo = gfxDevice->CreateBuffer(bufferSize, VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+      m_sortedInstances[i] = m_visibleInstances[items[i].index];
+      m_sortedInstanceDistances[i] = m_visibleInstanceDistances[items[i].index];
     }
+    m_visibleInstances.swap(m_sortedInstances);
+    m_visibleInstanceDistances.swap(m_sortedInstanceDistances);
   }
+  memcpy(visibleIndices, m_visibleInstances.data(), sizeof(uint32_t) * m_visibleInstanceCount);
+  auto end = std::chrono::high_resolution_clock::now();
+  m_instanceCullingMilliseconds = std::chrono::duration<double, std::milli>(end - start).count();
+}
 
-  // ディスクリプタセット書込み.
-  for (uint32_t i = 0; i < m_model.drawInfos.size(); ++i)
+void Application::CullMeshes(const glm::mat4& matViewProj)
+{
+  const auto meshCount = m_meshCuller.GetCount();
+  // インスタンシング時はメッシュ単位では判定できないため、インスタンスの判定のみ行う.
+  if (!m_useFrustumCulling || m_useInstancing)
   {
-    auto& info = m_model.drawInfos[i];
-    auto& targetMesh = m_model.meshes[i];
-    auto& material = m_model.materials[targetMesh.materialIndex];
-
-    for (uint32_t frameIndex = 0; frameIndex < info.descriptorSets.size(); ++frameIndex)
-    {
-      auto descriptorSet = info.descriptorSets[frameIndex];
+    m_meshVisibility.assign(meshCount, 1);
+    m_cpuCullingStats = CpuCullingStats{ .visibleCount = meshCount };
+    return;
+  }
 
-      std::vector<VkWriteDescriptorSet> writeDescs;
-      VkDescriptorBufferInfo sceneUniformBuffer{
-        .buffer = m_sceneUniformBuffers[frameIndex].buffer,
-        .offset = 0,
-        .range = VK_WHOLE_SIZE
-      };
-      auto& dsSceneUBO = writeDescs.emplace_back();
-      dsSceneUBO = VkWriteDescriptorSet{
-        .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
-        .dstSet = descriptorSet,
-        .dstBinding = 0,
-        .descriptorCount = 1,
-        .descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER,
-        .pBufferInfo = &sceneUniformBuffer
-      };
+  auto start = std::chrono::high_resolution_clock::now();
 
-      auto& dsMeshUBO = writeDescs.emplace_back();
-      VkDescriptorBufferInfo meshUniformBuffer{
-        .buffer = info.modelMeshUniforms[frameIndex].buffer,
-        .offset = 0,
-        .range = VK_WHOLE_SIZE
-      };
-      dsMeshUBO = VkWriteDescriptorSet{
-        .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
-        .dstSet = descriptorSet,
-        .dstBinding = 1,
-        .descriptorCount = 1,
-        .descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER,
-        .pBufferInfo = &meshUniformBuffer
-      };
+  // ワールド空間の視錐台をモデル空間へ移して、AABB を変換せずに判定する.
+  auto frustum = TransformFrustum(ExtractFrustum(matViewProj), m_model.matWorld);
+  auto visibleCount = m_useBvhCulling ? m_meshBvh.Cull(frustum, m_visibleMeshes) : m_meshCuller.Cull(frustum, m_visibleMeshes);
 
+  m_meshVisibility.assign(meshCount, 0);
+  for (auto meshIndex : m_visibleMeshes)
+  {
+    m_meshVisibility[meshIndex] = 1;
+  }
 
-      const auto& texDiffuse = material.texDiffuse;
-      auto& dsDiffuseTex = writeDescs.emplace_back();
-      if (texDiffuse.embeddedIndex == -1)
-      {
-        auto itrTexDiffuse = FindModelTexture(material.texDiffuse.filePath, m_model);
-        dsDiffuseTex = VkWriteDescriptorSet{
-          .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
-          .dstSet = descriptorSet,
-          .dstBinding = 2,
-          .descriptorCount = 1,
-          .descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
-          .pImageInfo = &itrTexDiffuse->descriptorInfo,
-        };
-      }
-      else
-      {
-        auto& embeddedTex = m_model.embeddedTextures[material.texDiffuse.embeddedIndex];
-        dsDiffuseTex = VkWriteDescriptorSet{
-          .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
-          .dstSet = descriptorSet,
-          .dstBinding = 2,
-          .descriptorCount = 1,
-          .descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
-          .pImageInfo = &embeddedTex.descriptorInfo,
-        };
-      }
+  auto end = std::chrono::high_resolution_clock::now();
+  m_cpuCullingStats.visibleCount = visibleCount;
+  m_cpuCullingStats.culledCount = meshCount - visibleCount;
+  m_cpuCullingStats.milliseconds = std::chrono::duration<double, std::milli>(end - start).count();
+}
 
-      vkUpdateDescriptorSets(vkDevice, uint32_t(writeDescs.size()), writeDescs.data(), 0, nullptr);
-    }
+void Application::QueryMeshes(const glm::mat4& matView)
+{
+  if (!m_modelResident || m_meshBvh.GetCount() == 0)
+  {
+    return;
   }
+  auto start = std::chrono::high_resolution_clock::now();
+
+  // カメラの位置と視線をモデル空間へ移す.
+  //  方向は正規化せずに変換するため、レイの距離はワールド空間の長さになる.
+  const auto matInvWorld = glm::inverse(m_model.matWorld);
+  const auto matInvView = glm::inverse(matView);
+  auto origin = glm::vec3(matInvWorld * glm::vec4(m_cameraPosition, 1.0f));
+  auto direction = glm::vec3(matInvWorld * glm::vec4(-glm::vec3(matInvView[2]), 0.0f));
+
+  MeshBvh::RayHit hit;
+  m_meshBvh.Raycast(origin, direction, FLT_MAX, hit);
+  m_meshQuery.pickedMesh = hit.index;
+  m_meshQuery.pickedDistance = hit.distance;
+  m_meshBvh.FindNearest(origin, hit);
+  m_meshQuery.nearestMesh = hit.index;
+  m_meshQuery.nearestDistance = hit.distance;
+
+  auto end = std::chrono::high_resolution_clock::now();
+  m_meshQuery.milliseconds = std::chrono::duration<double, std::milli>(end - start).count();
 }
 
-void Application::DestroyModelData()
+void Application::BuildRenderQueue(const glm::mat4& matView)
 {
-  auto& gfxDevice = GetGfxDevice();
-  auto vkDevice = gfxDevice->GetVkDevice();
-  for (auto& m : m_model.drawInfos)
+  // 可視メッシュのソートキーを作成して並べ替える.
+  //  深度はメッシュの境界球中心のビュー空間での距離を使用する.
+  //  不透明系は同じジオメトリの最も手前の深度を使い、インスタンスを続けて並べてまとめて描けるようにする.
+  m_renderQueue.Clear();
+  const auto matWorldView = matView * m_model.matWorld;
+  auto getViewDepth = [&](const PolygonMesh& mesh) {
+    return -(matWorldView * glm::vec4(mesh.bounds.center, 1.0f)).z;
+  };
+  m_geometryDepths.assign(m_model.geometryCount, FLT_MAX);
+  for (uint32_t meshIndex = 0; meshIndex < m_model.meshes.size(); ++meshIndex)
   {
-    for (auto& ubo : m.modelMeshUniforms)
+    if (m_meshVisibility[meshIndex])
     {
-      gfxDevice->DestroyBuffer(ubo);
+      const auto& mesh = m_model.meshes[meshIndex];
+      m_geometryDepths[mesh.geometryIndex] = std::min(m_geometryDepths[mesh.geometryIndex], getViewDepth(mesh));
     }
-    auto count = uint32_t(m.descriptorSets.size());
-    vkFreeDescriptorSets(vkDevice, gfxDevice->GetDescriptorPool(), count, m.descriptorSets.data());
   }
-  for (auto& m : m_model.meshes)
+  for (uint32_t meshIndex = 0; meshIndex < m_model.meshes.size(); ++meshIndex)
   {
-    gfxDevice->DestroyBuffer(m.position);
-    gfxDevice->DestroyBuffer(m.normal);
-    gfxDevice->DestroyBuffer(m.texcoord0);
-    gfxDevice->DestroyBuffer(m.indices);
+    if (!m_meshVisibility[meshIndex])
+    {
+      continue;
+    }
+    const auto& mesh = m_model.meshes[meshIndex];
+    const auto& material = m_model.materials[mesh.materialIndex];
+
+    uint64_t key;
+    if (material.alphaMode == ModelMaterial::ALPHA_MODE_BLEND)
+    {
+      key = RenderQueue::MakeBlendKey(material.alphaMode, mesh.materialIndex, getViewDepth(mesh));
+    }
+    else
+    {
+      key = RenderQueue::MakeOpaqueKey(material.alphaMode, mesh.materialIndex, m_geometryDepths[mesh.geometryIndex]);
+    }
+    m_renderQueue.Push(key, meshIndex);
   }
-  for (auto& t : m_model.textureList)
+  m_renderQueue.Sort();
+}
+
+void Application::SelectMeshLods()
+{
+  // メッシュの境界球とカメラの距離から LOD を選ぶ.
+  for (uint32_t meshIndex = 0; meshIndex < m_model.meshes.size(); ++meshIndex)
   {
-    gfxDevice->DestroyImage(t.textureImage);
-    vkDestroySampler(vkDevice, t.sampler, nullptr);
+    const auto& mesh = m_model.meshes[meshIndex];
+    auto sphere = TransformBoundingSphere(mesh.bounds, m_model.matWorld);
+    float distance = std::max(glm::length(sphere.center - m_cameraPosition) - sphere.radius, 1.0e-3f);
+
+    uint32_t lod = 0;
+    for (uint32_t i = 1; i < mesh.lodCount; ++i)
+    {
+      if (distance < GetLodSwitchDistance(mesh.lods[i].error))
+      {
+        break;
+      }
+      lod = i;
+    }
+    m_meshLods[meshIndex] = uint8_t(lod);
   }
-  m_model.textureList.clear();
+}
 
-  for (auto& t : m_model.embeddedTextures)
+float Application::GetLodSwitchDistance(float error) const
+{
+  // 画面上の誤差 (error * m_lodPixelScale / distance) が許容値以下になる距離.
+  if (!m_useLod)
   {
-    gfxDevice->DestroyImage(t.textureImage);
-    vkDestroySampler(vkDevice, t.sampler, nullptr);
+    return FLT_MAX;
   }
-  m_model.embeddedTextures.clear();
+  return error * m_lodPixelScale / m_lodPixelError;
 }
 
-void Application::PrepareSceneUniformBuffer()
+bool Application::IsMeshletDrawActive() const
+{
+  // メッシュシェーダーも間接描画も使えない場合はメッシュレットのカリングは初期化されない.
+  return m_useMeshletDraw && m_meshletCulling.IsInitialized() && !m_useInstancing && IsGeometryResident();
+}
+
+bool Application::IsGeometryResident() const
+{
+  return m_residentGeometryCount == m_model.geometryCount;
+}
+
+bool Application::IsMeshShaderDrawActive() const
 {
   auto& gfxDevice = GetGfxDevice();
-  m_sceneUniformBuffers.resize(gfxDevice->InflightFrames);
+  if (!IsMeshletDrawActive() || !gfxDevice->IsSupportMeshShader())
+  {
+    return false;
+  }
+  // 間接描画が使えない場合はメッシュシェーダーのみ.
+  return m_useMeshShader || !gfxDevice->IsSupportDrawIndirectCount();
+}
 
-  for (auto& buffer : m_sceneUniformBuffers)
+VkPipeline Application::GetMeshletPipeline(ModelMaterial::AlphaMode mode) const
+{
+  switch (mode)
   {
-    buffer = gfxDevice->CreateBuffer(sizeof(SceneParameters), 
-      VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT,
-      VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+  default:
+  case ModelMaterial::ALPHA_MODE_OPAQUE:
+    return m_meshletOpaquePipeline;
+  case ModelMaterial::ALPHA_MODE_MASK:
+    return m_meshletMaskPipeline;
+  case ModelMaterial::ALPHA_MODE_BLEND:
+    return m_meshletBlendPipeline;
   }
 }
 
-void Application::DestroySceneUniformBuffer()
+VkPipeline Application::GetModelPipeline(ModelMaterial::AlphaMode mode) const
 {
-  auto& gfxDevice = GetGfxDevice();
-  for (auto& buffer : m_sceneUniformBuffers)
+  switch (mode)
   {
-    gfxDevice->DestroyBuffer(buffer);
+  default:
+  case ModelMaterial::ALPHA_MODE_OPAQUE:
+    return IsDepthPrepassActive() ? m_drawOpaqueEqualPipeline : m_drawOpaquePipeline;
+  case ModelMaterial::ALPHA_MODE_MASK:
+    return m_drawMaskPipeline;
+  case ModelMaterial::ALPHA_MODE_BLEND:
+    return m_drawBlendPipeline;
   }
-  m_sceneUniformBuffers.clear();
 }
 
-void Application::DrawModel()
+bool Application::IsDepthPrepassActive() const
+{
+  return m_useDepthPrepass && !IsMeshletDrawActive();
+}
+
+void Application::DrawModel(uint32_t gpuCullingPhase)
+{
+  // オクルージョンカリングの2パス目は1パス目の数に加算する.
+  if (gpuCullingPhase == 0)
+  {
+    m_drawStats = DrawStats{};
+  }
+  // 読み込み中はジオメトリが無いため何も描かない.
+  if (!m_modelResident)
+  {
+    return;
+  }
+  if (IsDepthPrepassActive())
+  {
+    // 不透明のみ深度を書き込み、続くカラーパスは EQUAL 比較で見える面だけをシェーディングする.
+    const auto drawCalls = m_drawStats.drawCalls;
+    DrawModelPass(gpuCullingPhase, true);
+    m_drawStats.prepassDrawCalls += m_drawStats.drawCalls - drawCalls;
+  }
+  DrawModelPass(gpuCullingPhase, false);
+}
+
+void Application::DrawModelPass(uint32_t gpuCullingPhase, bool depthOnly)
 {
   auto& gfxDevice = GetGfxDevice();
   auto commandBuffer = gfxDevice->GetCurrentCommandBuffer();
   auto frameIndex = gfxDevice->GetFrameIndex();
+  bool useMeshletDraw = IsMeshletDrawActive();
+  bool useGpuDrivenDraw = !useMeshletDraw && m_useGpuDrivenDraw && IsGeometryResident() && gfxDevice->IsSupportDrawIndirectCount() && !m_useInstancing;
+  assert(!depthOnly || !useMeshletDraw);
+
+  // 頂点・インデックスバッファは全メッシュ共通のため最初に1度だけ設定する.
+  //  深度プリパスでは位置だけのストリームを使う. (頂点の並びは同じ)
+  VkDeviceSize offset = 0;
+  const auto& vertexBuffer = depthOnly ? m_model.positionBuffer : m_model.vertexBuffer;
+  vkCmdBindVertexBuffers(commandBuffer, 0, 1, &vertexBuffer.buffer, &offset);
+  vkCmdBindIndexBuffer(commandBuffer, m_model.indexBuffer.buffer, 0, m_model.indexType);
+
+  // firstInstance にメッシュ番号 * m_instanceStride を渡して、シェーダーでパラメータを参照する.
+  //  同じ LOD のインスタンスは1回の描画にまとめて発行する. (インスタンシングしない時は1個)
+  const auto instanceCount = m_visibleInstanceCount;
+  auto drawLod = [&](uint32_t meshIndex, uint32_t lod, uint32_t firstInstance, uint32_t count) {
+    const auto& mesh = m_model.meshes[meshIndex];
+    const auto& range = mesh.lods[lod];
+    vkCmdDrawIndexed(commandBuffer, range.indexCount, count, range.firstIndex, mesh.vertexOffset, meshIndex * m_instanceStride + firstInstance);
+    m_drawStats.drawCalls++;
+    m_drawStats.triangles += uint64_t(range.indexCount / 3) * count;
+    m_drawStats.lodDraws[lod] += count;
+  };
 
-  auto deltaTime = std::min(ImGui::GetIO().DeltaTime, 1.0f);
-  static float angle = 0.0;
-  angle += deltaTime * 0.1f;
-  if (angle > 360.0f) { angle -= 360.f; }
-  if (angle < -360.0f) { angle += 360.f; }
+  // インスタンシングしない時 (instanceStride = 1) は、同じジオメトリ・LOD で番号が連続するメッシュを
+  // 1回の描画にまとめる. gl_InstanceIndex がそのままメッシュ番号になり、各ノードの変換が参照される.
+  struct PendingDraw
+  {
+    uint32_t meshIndex = 0;
+    uint32_t lod = 0;
+    uint32_t count = 0;
+  } pending;
+  auto flushPending = [&]() {
+    if (pending.count > 0)
+    {
+      drawLod(pending.meshIndex, pending.lod, 0, pending.count);
+      m_drawStats.instancedMeshes += pending.count > 1 ? pending.count : 0;
+      pending.count = 0;
+    }
+  };
 
-  // モデルのワールド行列を更新.
-  m_model.matWorld = glm::rotate(glm::mat4(1.0f), angle, glm::vec3(0, 1, 0));
+  // 直前と同じパイプライン・ディスクリプタセットであればバインドを省略する.
+  //  バインドする前に、まとめている途中の描画を発行しておく.
+  VkPipeline currentPipeline = VK_NULL_HANDLE;
+  VkDescriptorSet currentDescriptorSet = VK_NULL_HANDLE;
+  auto bindState = [&](ModelMaterial::AlphaMode mode, uint32_t materialIndex) {
+    auto pipeline = depthOnly ? m_depthPrepassPipeline : GetModelPipeline(mode);
+    auto descriptorSet = m_model.drawInfos[materialIndex].descriptorSets[frameIndex];
+    if (descriptorSet == VK_NULL_HANDLE)
+    {
+      return false;
+    }
+    if (pipeline != currentPipeline || descriptorSet != currentDescriptorSet)
+    {
+      flushPending();
+    }
+    if (pipeline != currentPipeline)
+    {
+      vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline);
+      currentPipeline = pipeline;
+      m_drawStats.pipelineBinds++;
+    }
+    if (descriptorSet != currentDescriptorSet)
+    {
+      vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, m_pipelineLayout, 0, 1, &descriptorSet, 0, nullptr);
+      currentDescriptorSet = descriptorSet;
+      m_drawStats.descriptorSetBinds++;
+    }
+    return true;
+  };
 
-  auto modeList = { ModelMaterial::ALPHA_MODE_OPAQUE, ModelMaterial::ALPHA_MODE_MASK, ModelMaterial::ALPHA_MODE_BLEND };
-  for (auto mode : modeList)
+  auto drawMesh = [&](uint32_t meshIndex, bool allowMerge) {
+    if (!m_useInstancing)
+    {
+      const uint32_t lod = m_meshLods[meshIndex];
+      if (allowMerge && pending.count > 0 && pending.meshIndex + pending.count == meshIndex && pending.lod == lod &&
+        m_model.meshes[pending.meshIndex].geometryIndex == m_model.meshes[meshIndex].geometryIndex)
+      {
+        pending.count++;
+        return;
+      }
+      flushPending();
+      if (!allowMerge)
+      {
+        drawLod(meshIndex, lod, 0, 1);
+        return;
+      }
+      pending = { .meshIndex = meshIndex, .lod = lod, .count = 1 };
+      return;
+    }
+    // インスタンスは近い順に並んでいるため、LOD ごとに連続した範囲に分かれる.
+    //  LOD を使わない時は全て LOD0 となる.
+    const auto& mesh = m_model.meshes[meshIndex];
+    uint32_t first = 0;
+    for (uint32_t lod = 0; lod < mesh.lodCount && first < instanceCount; ++lod)
+    {
+      uint32_t last = instanceCount;
+      if (lod + 1 < mesh.lodCount && !m_visibleInstanceDistances.empty())
+      {
+        auto switchDistance = GetLodSwitchDistance(mesh.lods[lod + 1].error);
+        auto itr = std::lower_bound(m_visibleInstanceDistances.begin(), m_visibleInstanceDistances.end(), switchDistance);
+        last = std::max(first, uint32_t(itr - m_visibleInstanceDistances.begin()));
+      }
+      if (last > first)
+      {
+        drawLod(meshIndex, lod, first, last - first);
+      }
+      first = last;
+    }
+  };
+
+  if (useMeshletDraw && IsMeshShaderDrawActive())
+  {
+    // メッシュシェーダーはパイプラインレイアウトが異なるため、セット0 もこちらのレイアウトでバインドする.
+    const auto positionSize = m_vertexLayout.GetPositionSize();
+    const MeshletCulling::DrawConstants constants{
+      .vertexStride = m_vertexLayout.GetStride() / 4,
+      .positionFormat = uint32_t(m_vertexLayout.position),
+      .normalFormat = uint32_t(m_vertexLayout.normal),
+      .texcoordFormat = uint32_t(m_vertexLayout.texcoord),
+      .normalOffset = positionSize / 4,
+      .texcoordOffset = (positionSize + m_vertexLayout.GetNormalSize()) / 4,
+    };
+    for (uint32_t bucketIndex = 0; bucketIndex < m_model.drawBuckets.size(); ++bucketIndex)
+    {
+      const auto& bucket = m_model.drawBuckets[bucketIndex];
+      auto pipeline = GetMeshletPipeline(bucket.mode);
+      if (pipeline != currentPipeline)
+      {
+        vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline);
+        currentPipeline = pipeline;
+        m_drawStats.pipelineBinds++;
+      }
+      auto descriptorSet = m_model.drawInfos[bucket.materialIndex].descriptorSets[frameIndex];
+      if (descriptorSet == VK_NULL_HANDLE)
+      {
+        continue;
+      }
+      vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, m_meshletPipelineLayout, 0, 1, &descriptorSet, 0, nullptr);
+      m_drawStats.descriptorSetBinds++;
+      m_meshletCulling.DrawMeshTasks(commandBuffer, m_meshletPipelineLayout, bucketIndex, constants);
+      m_drawStats.drawCalls++;
+    }
+    return;
+  }
+  if (useMeshletDraw)
   {
-    VkPipeline usePipeline;
-    switch (mode)
+    // メッシュレット順のインデックスを、可視メッシュレットごとのコマンドで描く.
+    for (uint32_t bucketIndex = 0; bucketIndex < m_model.drawBuckets.size(); ++bucketIndex)
     {
-    default:
-    case ModelMaterial::ALPHA_MODE_OPAQUE:
-      usePipeline = m_drawOpaquePipeline;
-      break;
-    
-    case ModelMaterial::ALPHA_MODE_MASK:
-      usePipeline = m_drawMaskPipeline;
-      break;
+      const auto& bucket = m_model.drawBuckets[bucketIndex];
+      if (!bindState(bucket.mode, bucket.materialIndex))
+      {
+        continue;
+      }
+      m_meshletCulling.DrawBucket(commandBuffer, bucketIndex);
+      m_drawStats.drawCalls++;
+    }
+    return;
+  }
 
-    case ModelMaterial::ALPHA_MODE_BLEND:
-      usePipeline = m_drawBlendPipeline;
-      break;
+  if (useGpuDrivenDraw)
+  {
+    // バケットはアルファモードの描画順に並んでいる.
+    //  描画するメッシュと数はコンピュートシェーダーが決定済み.
+    for (uint32_t bucketIndex = 0; bucketIndex < m_model.drawBuckets.size(); ++bucketIndex)
+    {
+      const auto& bucket = m_model.drawBuckets[bucketIndex];
+      if (depthOnly && bucket.mode != ModelMaterial::ALPHA_MODE_OPAQUE)
+      {
+        continue;
+      }
+      if (!bindState(bucket.mode, bucket.materialIndex))
+      {
+        continue;
+      }
+      m_gpuCulling.DrawBucket(commandBuffer, bucketIndex, gpuCullingPhase);
+      m_drawStats.drawCalls++;
     }
-    vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, usePipeline);
+    return;
+  }
+
+  if (instanceCount == 0)
+  {
+    return;
+  }
 
-    for (uint32_t i = 0; i < m_model.drawInfos.size(); ++i)
+  if (m_useSortedDrawList)
+  {
+    // ソート済みのため、パイプライン・マテリアルが変わる時だけバインドが発生する.
+    for (const auto& item : m_renderQueue.GetItems())
     {
-      const auto& info = m_model.drawInfos[i];
-      const auto& mesh = m_model.meshes[i];
+      const auto& mesh = m_model.meshes[item.index];
       const auto& material = m_model.materials[mesh.materialIndex];
-      if (material.alphaMode != mode)
+      if (depthOnly && material.alphaMode != ModelMaterial::ALPHA_MODE_OPAQUE)
+      {
+        continue;
+      }
+      if (!bindState(material.alphaMode, mesh.materialIndex))
       {
         continue;
       }
+      drawMesh(item.index, true);
+    }
+    flushPending();
+    return;
+  }
 
-      // ワールド行列とマテリアル情報をユニフォームバッファに書き込む.
-      DrawParameters params;
-      params.matWorld = m_model.matWorld;
-      params.baseColor = glm::vec4(material.diffuse, material.alpha);
-      params.specular = glm::vec4(material.specular, material.shininess);
-      params.ambient = glm::vec4(material.ambient, 0.0f);
-      params.mode = material.alphaMode;
-      auto writePtr = info.modelMeshUniforms[frameIndex].mapped;
-      memcpy(writePtr, &params, sizeof(DrawParameters));
-
-      VkBuffer vertexBuffers[] = {
-        mesh.position.buffer,
-        mesh.normal.buffer,
-        mesh.texcoord0.buffer
-      };
-      VkDeviceSize offsets[] = { 0, 0, 0 };
-      vkCmdBindVertexBuffers(commandBuffer, 0, 3, vertexBuffers, offsets);
-      vkCmdBindIndexBuffer(commandBuffer, mesh.indices.buffer, 0, VK_INDEX_TYPE_UINT32);
+  // 比較用: アルファモードごとに全メッシュを走査し、描画ごとにディスクリプタセットを設定する.
+  //  深度プリパスでは不透明だけを描く.
+  auto modeCount = depthOnly ? 1 : 3;
+  const ModelMaterial::AlphaMode modeList[] = { ModelMaterial::ALPHA_MODE_OPAQUE, ModelMaterial::ALPHA_MODE_MASK, ModelMaterial::ALPHA_MODE_BLEND };
+  for (int i = 0; i < modeCount; ++i)
+  {
+    auto mode = modeList[i];
+    vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, depthOnly ? m_depthPrepassPipeline : GetModelPipeline(mode));
+    m_drawStats.pipelineBinds++;
 
-      auto descriptorSet = info.descriptorSets[frameIndex];
+    for (uint32_t meshIndex = 0; meshIndex < m_model.meshes.size(); ++meshIndex)
+    {
+      const auto& mesh = m_model.meshes[meshIndex];
+      const auto& material = m_model.materials[mesh.materialIndex];
+      if (material.alphaMode != mode || !m_meshVisibility[meshIndex])
+      {
+        continue;
+      }
+      auto descriptorSet = m_model.drawInfos[mesh.materialIndex].descriptorSets[frameIndex];
+      if (descriptorSet == VK_NULL_HANDLE)
+      {
+        continue;
+      }
       vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, m_pipelineLayout, 0, 1, &descriptorSet, 0, nullptr);
-      vkCmdDrawIndexed(commandBuffer, mesh.indexCount, 1, 0, 0, 0);
-
+      m_drawStats.descriptorSetBinds++;
+      drawMesh(meshIndex, false);
     }
   }
 }
 
-std::vector<Application::TextureInfo>::const_iterator Application::FindModelTexture(const std::string& filePath, const ModelData& model)
+Application::TextureInfo& Application::GetDiffuseTexture(const ModelMaterial& material)
 {
-  return std::find_if(model.textureList.begin(), model.textureList.end(), [&](const auto& v) { return v.filePath == filePath; });
+  // 埋め込みテクスチャも "*番号" のパスで登録されている.
+  auto itr = m_model.textureIndices.find(material.texDiffuse.filePath);
+  assert(itr != m_model.textureIndices.end());
+  return m_model.textures[itr->second];
 }
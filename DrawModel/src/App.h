@@ -3,6 +3,13 @@
 #include <vector>
 #include <array>
 #include <string>
+#include <memory>
+#include <unordered_map>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <chrono>
 
 #include "BasePlatform.h"
 #include "Window.h"
@@ -17,6 +24,16 @@
 #include "glm/ext.hpp"
 
 #include "Model.h"
+#include "VertexLayout.h"
+#include "Culling.h"
+#include "MeshBvh.h"
+#include "GpuCulling.h"
+#include "DepthPyramid.h"
+#include "MeshletCulling.h"
+#include "RenderQueue.h"
+#include "DrawProfiler.h"
+#include "GpuSkinning.h"
+#include "TextureUtility.h"
 
 class Application
 {
@@ -44,13 +61,42 @@ private:
   void PrepareRenderPass();
 
   void PrepareModelDrawPipelines();
-  void PrepareModelData();
+  void DestroyModelDrawPipelines();
+  struct ModelSource;
+  struct ModelLoadSettings;
+  void StartModelLoad();
+  void StopModelLoad();
+  void LoadModelAsync(const ModelLoadSettings& settings);
+  void UpdateModelStreaming();
+  void UploadGeometryChunk(VkCommandBuffer commandBuffer);
+  void ReleaseFrameUploads(uint32_t frameIndex);
+  void PrepareModelData(ModelSource& loaded);
   void DestroyModelData();
+  void ReloadModel();
+  void RunGltfBenchmark();
 
   void PrepareSceneUniformBuffer();
   void DestroySceneUniformBuffer();
 
-  void DrawModel();
+  void UpdateAnimation();
+  void UpdateDrawParameters();
+  void UpdateMeshBounds();
+  void UpdateSkinning(VkCommandBuffer commandBuffer);
+  void UpdateInstances(const glm::mat4& matViewProj);
+  void CullMeshes(const glm::mat4& matViewProj);
+  void QueryMeshes(const glm::mat4& matView);
+  void SelectMeshLods();
+  void BuildRenderQueue(const glm::mat4& matView);
+  void DrawModel(uint32_t gpuCullingPhase);
+  void DrawModelPass(uint32_t gpuCullingPhase, bool depthOnly);
+  bool IsDepthPrepassActive() const;
+  void BuildDepthPyramid();
+  VkPipeline GetModelPipeline(ModelMaterial::AlphaMode mode) const;
+  VkPipeline GetMeshletPipeline(ModelMaterial::AlphaMode mode) const;
+  bool IsMeshletDrawActive() const;
+  bool IsGeometryResident() const;
+  bool IsMeshShaderDrawActive() const;
+  float GetLodSwitchDistance(float error) const;
 
   bool m_isInitialized = false;
 #if defined(PLATFORM_ANDROID)
@@ -62,6 +108,17 @@ private:
   VkPipeline m_drawOpaquePipeline = VK_NULL_HANDLE;
   VkPipeline m_drawBlendPipeline = VK_NULL_HANDLE;
   VkPipeline m_drawMaskPipeline = VK_NULL_HANDLE;
+  // 深度プリパス用. プリパスは頂点シェーダーのみで、不透明描画はプリパスの深度と EQUAL 比較する.
+  VkPipeline m_depthPrepassPipeline = VK_NULL_HANDLE;
+  VkPipeline m_drawOpaqueEqualPipeline = VK_NULL_HANDLE;
+
+  // メッシュシェーダーでメッシュレットを描画するパイプライン. (VK_EXT_mesh_shader 対応時のみ)
+  //  セット0 はモデル描画と共通で、セット1 にメッシュレットと頂点のバッファを置く.
+  VkDescriptorSetLayout m_meshletDescriptorSetLayout = VK_NULL_HANDLE;
+  VkPipelineLayout m_meshletPipelineLayout = VK_NULL_HANDLE;
+  VkPipeline m_meshletOpaquePipeline = VK_NULL_HANDLE;
+  VkPipeline m_meshletBlendPipeline = VK_NULL_HANDLE;
+  VkPipeline m_meshletMaskPipeline = VK_NULL_HANDLE;
 
   std::vector<VkFramebuffer> m_framebuffers;
   VkRenderPass m_renderPass;
@@ -70,6 +127,10 @@ private:
 
   // モデルを描画する時に使用するディスクリプタセットレイアウト.
   VkDescriptorSetLayout m_modelDescriptorSetLayout = VK_NULL_HANDLE;
+  // モデルのディスクリプタセットはモデルと同じ寿命のためまとめて管理.
+  //  プールの比率は上記レイアウトのバインディングから求める.
+  DescriptorAllocator m_modelDescriptorAllocator;
+  std::vector<DescriptorAllocator::PoolSizeRatio> m_modelPoolSizeRatios;
 
   // ユニフォームバッファーに送るために1要素16バイトアライメントとった状態にしておく.
   struct SceneParameters
@@ -77,6 +138,8 @@ private:
     glm::mat4 matView;
     glm::mat4 matProj;
     glm::vec4 lightDir;
+    uint32_t  instanceStride;   // firstInstance = メッシュ番号 * instanceStride.
+    uint32_t  padding[3];
   };
   // 平行光源.
   //  光がすすむ方向を設定.
@@ -89,19 +152,47 @@ private:
     GpuImage depth;
   } m_depthBuffer;
 
+  // 頂点・インデックスはモデル共通のバッファから切り出して使用する.
+  //  ノードが参照するメッシュごとに1つ作り、同じメッシュを参照するもの同士でジオメトリを共有する.
   struct PolygonMesh {
-    GpuBuffer position;
-    GpuBuffer normal;
-    GpuBuffer texcoord0;
-    GpuBuffer indices;
-
+    uint32_t  geometryIndex;  // 共有するジオメトリ (読み込んだメッシュ) の番号.
+    uint32_t  nodeIndex;      // 配置されるノード.
+    uint32_t  firstIndex;
+    int32_t   vertexOffset;
     uint32_t  indexCount;
     uint32_t  vertexCount;
     uint32_t  materialIndex;
+
+    // 量子化された頂点の復元用パラメータ.
+    glm::vec4 positionScale;
+    glm::vec4 positionOffset;
+    uint32_t  decodeFlags;
+    // スキニング後の頂点の番号 = 頂点番号 + skinnedVertexOffset. (VERTEX_DECODE_SKINNED の時のみ有効)
+    int32_t   skinnedVertexOffset = 0;
+
+    BoundingSphere bounds;  // モデル空間での境界球. (ノードの変換を適用済み. 動くメッシュは毎フレーム求め直す)
+    // ジオメトリの境界. (ノードの変換を適用する前)
+    BoundingSphere localBounds;
+    glm::vec3 localBoundsMin;
+    glm::vec3 localBoundsMax;
+
+    // スキンを持つ場合の、ジョイントごとの境界 (ModelData::jointBounds の範囲).
+    uint32_t  firstJointBounds = 0;
+    uint32_t  jointBoundsCount = 0;
+
+    // LOD ごとのインデックス範囲. 頂点は全 LOD で共有する. (lods[0] が元のメッシュ)
+    struct Lod
+    {
+      uint32_t firstIndex;
+      uint32_t indexCount;
+      float    error;     // モデル空間での誤差.
+    };
+    Lod      lods[GpuCulling::MaxLodCount];
+    uint32_t lodCount;
   };
 
-  // UniformBufferに書き込むための構造体.
-  // アライメントに注意.
+  // StorageBufferに全メッシュ分を並べて書き込むための構造体.
+  // アライメントに注意. (std430 の配列ストライドは16バイト単位)
   // - モデルのワールド行列
   // - 対象メッシュを描画するのに必要となるマテリアル情報.
   struct DrawParameters {
@@ -110,32 +201,364 @@ private:
     glm::vec4 baseColor; // diffuse + alpha
     glm::vec4 specular;  // specular + shininess
     glm::vec4 ambient;
+    glm::vec4 positionScale;
+    glm::vec4 positionOffset;
     uint32_t  mode;
+    uint32_t  vertexFlags;
+    int32_t   skinnedVertexOffset;
+    uint32_t  padding;
   };
+  // マテリアル単位の描画情報.
+  //  メッシュごとのパラメータはストレージバッファから gl_InstanceIndex で参照する.
   struct DrawInfo
   {
-    std::vector<GpuBuffer> modelMeshUniforms;
     std::vector<VkDescriptorSet> descriptorSets;
+    // テクスチャを差し替えた後、まだディスクリプタセットを更新していないフレームのビット.
+    uint32_t dirtyFrames = 0;
+  };
+  // 同じパイプライン・マテリアルで描画するメッシュのまとまり.
+  //  GPU 駆動描画ではこの単位で間接描画を発行する.
+  struct DrawBucket
+  {
+    ModelMaterial::AlphaMode mode;
+    uint32_t materialIndex;
+    uint32_t commandOffset;
+    uint32_t meshCount;
   };
 
+  // マテリアルから参照されるテクスチャ (ファイルのパス・埋め込みの "*番号" ごと).
+  //  内容が同じ画像は1つのイメージを共有し、サンプラーは SamplerCache のものを使う.
   struct TextureInfo {
     std::string filePath;
-    GpuImage    textureImage;
-    VkSampler   sampler;
+    int32_t     imageIndex = -1;    // ModelData::textureImages の番号. 転送前は -1 で、仮のテクスチャを参照する.
 
-    VkDescriptorImageInfo descriptorInfo;
+    VkDescriptorImageInfo descriptorInfo{};
   };
 
   struct ModelData
   {
     std::vector<PolygonMesh> meshes;
     std::vector<ModelMaterial> materials;
-    std::vector<DrawInfo> drawInfos;
-    std::vector<TextureInfo> textureList;
-    std::vector<TextureInfo> embeddedTextures;
+    std::vector<DrawInfo> drawInfos;   // マテリアルごと.
+    std::vector<DrawBucket> drawBuckets;
+    std::vector<uint32_t> bucketMeshes; // バケット順に並べたメッシュ番号.
+
+    // ノードの階層. ノードの変換を書き換えると、次の描画からメッシュのワールド行列に反映される.
+    //  カリング用の境界はアニメーションするノード (dynamicMeshes) のものだけ毎フレーム求め直す.
+    std::vector<ModelNode> nodes;
+    std::vector<glm::mat4> nodeTransforms;  // モデル空間での変換. (毎フレーム計算)
+    uint32_t geometryCount = 0;
+
+    // スキンとアニメーション.
+    //  スキンを持つメッシュはノードの変換を使わず、ジョイントの変換でモデル空間に置かれる.
+    //  カリング用の境界は jointBounds をジョイント行列で変換して毎フレーム求める.
+    std::vector<ModelAnimation> animations;
+    std::vector<ModelJoint> joints;         // 全スキンのジョイント. ジョイント行列はこの並び.
+    std::vector<uint32_t> jointNodes;       // ジョイントとなるノードの番号. (重複なし)
+    std::vector<glm::mat4> restTransforms;  // 読み込み時のノードの相対変換.
+    // ジョイントが影響する頂点の、バインドポーズ (モデル空間) での AABB.
+    struct JointBounds
+    {
+      uint32_t  joint;    // joints の番号.
+      glm::vec3 boundsMin;
+      glm::vec3 boundsMax;
+    };
+    std::vector<JointBounds> jointBounds;
+
+    // カリング用のメッシュの境界 (モデル空間). CPU カリング・BVH・GPU カリングの入力.
+    std::vector<glm::vec3> meshBoundsMin;
+    std::vector<glm::vec3> meshBoundsMax;
+    std::vector<glm::vec4> meshSpheres;     // xyz: 中心, w: 半径.
+    std::vector<uint32_t> dynamicMeshes;    // 境界が毎フレーム変わるメッシュ. (アニメーションするノード・スキン)
+
+    // 全メッシュの DrawParameters. (フレームごと)
+    std::vector<GpuBuffer> drawParameterBuffers;
+    std::vector<TextureInfo> textures;
+    std::unordered_map<std::string, uint32_t> textureIndices;  // パスから textures の番号.
+    std::vector<GpuImage> textureImages;  // 内容の重複を除いた画像.
+
+    // 全メッシュの頂点・インデックスを格納するバッファ.
+    //  頂点は m_vertexLayout に従いインターリーブされている.
+    GpuBuffer vertexBuffer;
+    GpuBuffer indexBuffer;
+    // 位置だけを詰めた頂点バッファ (深度プリパス用). 頂点の並びは vertexBuffer と同じ.
+    GpuBuffer positionBuffer;
+    VkIndexType indexType = VK_INDEX_TYPE_UINT32;
 
     glm::mat4 matWorld = glm::mat4(1.0f);
   } m_model;
 
-  std::vector<TextureInfo>::const_iterator FindModelTexture(const std::string& filePath, const ModelData& model);
+  // モデルの頂点レイアウト.
+  VertexLayout m_vertexLayout = VertexLayout::Packed();
+  bool m_usePackedVertex = true;
+
+  // GPU に転送したジオメトリのサイズ情報.
+  struct GeometryStats
+  {
+    size_t vertexBytes = 0;
+    size_t indexBytes = 0;
+    size_t float32Bytes = 0;  // 全て float/32bit インデックスだった場合のサイズ.
+    size_t lodIndexBytes = 0; // indexBytes のうち LOD1 以降の分.
+    size_t meshletIndexBytes = 0; // indexBytes のうちメッシュレット順のインデックスの分.
+  } m_geometryStats;
+
+  // 読み込み時のインデックス・頂点の並べ替え (頂点キャッシュ・オーバードロー・頂点フェッチ).
+  bool m_useMeshOptimization = true;
+  // ノードの階層を保って読み込むか. 無効時は頂点を変換済みにして比較する.
+  bool m_usePreserveHierarchy = true;
+  // 読み込み時に同じ頂点をまとめる方法. (ModelLoader::WeldMode)
+  int m_weldMode = ModelLoader::WELD_EXACT;
+  // 読み込み結果のバイナリキャッシュを使うか.
+  bool m_useModelCache = true;
+  // assimp のデータからの変換を並列に行うか.
+  bool m_useParallelImport = true;
+  // glTF を assimp を介さずに読むか.
+  bool m_useNativeGltf = true;
+  // テクスチャのミップマップを転送後に GPU で作るか. (false ならワーカースレッドで CPU で作る)
+  bool m_useGpuMipmaps = true;
+  // GPU でミップマップを作る方法. (GpuMipmapMethod)
+  int m_gpuMipmapMethod = GPU_MIPMAP_COMPUTE;
+  std::vector<MipmapBenchmarkResult> m_mipmapBenchmark;
+  // CPU でミップマップを作る場合の縮小方法. (MipmapFilter)
+  int m_cpuMipmapFilter = MIPMAP_FILTER_BOX;
+  bool m_useGammaCorrectMipmaps = false;
+  std::vector<CpuMipmapBenchmarkResult> m_cpuMipmapBenchmark;
+  // サンプルモデルを GltfImporter と assimp それぞれで読み込んだ時間 (キャッシュは使わない).
+  struct GltfBenchmarkResult
+  {
+    std::string file;
+    double milliseconds[2] = {};  // GltfImporter, assimp.
+    uint32_t meshCount[2] = {};
+    bool nativeGltf = false;      // GltfImporter で読めたか. (false ならば assimp で読み直している)
+  };
+  std::vector<GltfBenchmarkResult> m_gltfBenchmark;
+  // 直前の読み込みの情報と、assimp での読み込み (cold) ・キャッシュからの読み込み (warm) それぞれの最後の時間 (ms).
+  ModelLoader::LoadStats m_modelLoadStats;
+  double m_modelLoadMilliseconds[2] = {};
+  // メッシュごとの並べ替え前後の頂点キャッシュ効率.
+  struct MeshCacheInfo
+  {
+    ModelMeshCacheStats source;
+    ModelMeshCacheStats optimized;
+    uint32_t triangleCount = 0;
+    uint32_t vertexCount = 0;
+    uint32_t sourceVertexCount = 0;
+  };
+  std::vector<MeshCacheInfo> m_meshCacheInfos;
+
+  // モデルはワーカースレッドで読み込み、描画を止めずに準備できたものから GPU へ反映する.
+  //  ファイル読み込み・変換・LOD 生成が済むとジオメトリを毎フレーム一定量ずつ転送し、済んだメッシュから描く (テクスチャは仮のもの).
+  //  続けてスレッドプールでテクスチャをデコードし、できたものから毎フレーム数枚ずつ転送して差し替える.
+  struct ModelLoadSettings
+  {
+    bool useMeshOptimization;
+    bool usePreserveHierarchy;
+    bool useModelCache;
+    bool useParallelImport;
+    bool useNativeGltf;
+    bool useGpuMipmaps;
+    int  cpuMipmapFilter;
+    bool useGammaCorrectMipmaps;
+    int  weldMode;
+  };
+  // ワーカースレッドで準備したジオメトリまでのデータ.
+  struct ModelSource
+  {
+    std::vector<ModelMesh> meshes;
+    std::vector<ModelMaterial> materials;
+    std::vector<ModelNode> nodes;
+    std::vector<ModelAnimation> animations;
+    std::vector<std::string> texturePaths;  // マテリアルが参照するテクスチャ. (textures の並び)
+    std::vector<MeshCacheInfo> meshCacheInfos;
+    ModelLoader::LoadStats loadStats;
+  };
+  // デコードの済んだテクスチャ.
+  struct StreamedTexture
+  {
+    std::vector<uint32_t> textures;   // この画像を使う textures の番号. (内容が同じもの)
+    bool     success = false;
+    DecodedTexture image;
+  };
+  std::thread m_modelLoadThread;
+  std::mutex m_modelLoadMutex;
+  std::condition_variable m_modelLoadCondition;
+  // 以下3つは m_modelLoadMutex で保護する.
+  std::unique_ptr<ModelSource> m_pendingModel;      // ワーカー → メイン.
+  std::vector<StreamedTexture> m_pendingTextures;   // ワーカー → メイン.
+  bool m_modelGeometryUploaded = false;             // メイン → ワーカー. テクスチャのデコードはこの後に始める.
+  std::atomic<bool> m_cancelModelLoad{ false };
+  bool m_modelResident = false;   // モデルのデータを準備したか. (ジオメトリは m_residentGeometryCount 個まで転送済み)
+  GpuImage m_placeholderTexture{};  // 読み込み中のテクスチャの代わりに使う白の 1x1.
+
+  // ジオメトリとテクスチャの転送はフレームのコマンドバッファに記録し、完了は待たない.
+  //  ジオメトリは読み込んだ順に1フレームあたり一定の大きさずつ転送し、転送の済んだものから描く.
+  //  テクスチャもステージングとミップマップ作成の負荷を分けるため、1フレームあたりの枚数を抑える.
+  static const size_t MaxGeometryUploadBytesPerFrame = 16 * 1024 * 1024;
+  static const uint32_t MaxTextureUploadsPerFrame = 4;
+  struct GeometryUpload
+  {
+    GpuBuffer vertexStaging{};
+    GpuBuffer positionStaging{};
+    GpuBuffer indexStaging{};
+    // ジオメトリごとのステージング内の位置 (バイト単位). 末尾にそれぞれの全体の大きさを持つ.
+    std::vector<size_t> vertexOffsets;
+    std::vector<size_t> positionOffsets;
+    std::vector<size_t> indexOffsets;
+  } m_geometryUpload;
+  uint32_t m_residentGeometryCount = 0;
+  // 転送のコマンドが参照するステージングなど. フレームスロットごとに、そのスロットの次のフレームで破棄する.
+  struct FrameUploads
+  {
+    std::vector<GpuBuffer> buffers;
+    std::vector<TextureUploadResources> textures;
+  } m_frameUploads[GfxDevice::InflightFrames];
+  struct StreamingStats
+  {
+    double firstFrameMilliseconds = 0.0;  // 起動から最初のフレームの送出まで.
+    double firstGeometryMilliseconds = 0.0;  // 読み込み開始から最初のジオメトリの転送まで. (このフレームから見え始める)
+    double geometryMilliseconds = 0.0;    // 読み込み開始から全ジオメトリの転送まで.
+    double completeMilliseconds = 0.0;    // 読み込み開始から全テクスチャの差し替えまで.
+    uint32_t textureCount = 0;
+    uint32_t resolvedTextures = 0;        // 差し替えた (またはデコードに失敗した) 数.
+    uint32_t dedupedImages = 0;           // 内容が同じため、他のテクスチャとイメージを共有した数.
+    double cpuMipMilliseconds = 0.0;      // CPU でミップマップを作った時間の合計. (ワーカーでの時間を含む)
+    double uploadMilliseconds = 0.0;      // テクスチャの転送の記録 (ステージングへの書き込みを含む) の合計.
+    size_t stagingBytes = 0;
+    uint32_t gpuMipCount = 0;             // GPU で作った段数の合計.
+    bool complete = false;
+  } m_streamingStats;
+  std::chrono::steady_clock::time_point m_startTime;
+  std::chrono::steady_clock::time_point m_modelLoadStartTime;
+
+  // GPU 駆動描画 (コンピュートシェーダーでのカリング + 間接描画).
+  GpuCulling m_gpuCulling;
+  bool m_useGpuDrivenDraw = true;
+  bool m_useFrustumCulling = true;
+
+  // GPU 駆動描画での2パスのオクルージョンカリング. (Dynamic Rendering 使用時のみ)
+  //  描画の途中で深度バッファから深度ピラミッドを作り、次のフレームの1パス目でも参照する.
+  DepthPyramid m_depthPyramid;
+  bool m_useOcclusionCulling = true;
+
+  // メッシュレット単位のカリングと描画.
+  //  メッシュシェーダーが使えればメッシュシェーダーで、使えなければ間接描画で描く. LOD は使わない.
+  MeshletCulling m_meshletCulling;
+  bool m_useMeshletDraw = false;
+  bool m_useMeshShader = true;
+  bool m_useConeCulling = true;
+
+  // 描画順をソートキーで決定し、不要なバインドを省いて描画する.
+  RenderQueue m_renderQueue;
+  bool m_useSortedDrawList = true;
+  // ジオメトリごとの最も手前のインスタンスの深度. 同じジオメトリを続けて並べるために使う.
+  std::vector<float> m_geometryDepths;
+
+  // 1フレームあたりのコマンド発行数.
+  struct DrawStats
+  {
+    uint32_t drawCalls = 0;
+    uint32_t pipelineBinds = 0;
+    uint32_t descriptorSetBinds = 0;
+    uint64_t triangles = 0;   // CPU から発行した描画の三角形数 (インスタンス数込み).
+    uint32_t lodDraws[GpuCulling::MaxLodCount] = {};  // LOD ごとの描画数 (インスタンス数込み).
+    uint32_t prepassDrawCalls = 0;  // drawCalls のうち深度プリパスの分.
+    uint32_t instancedMeshes = 0;   // 他のメッシュとまとめてインスタンス描画したメッシュ数.
+  } m_drawStats;
+
+  // 深度プリパス. 不透明メッシュの深度だけを先に描き、カラーは深度が一致するフラグメントだけシェーディングする.
+  //  メッシュレット描画では使わない. アルファ抜き・半透明はプリパスに含めず、従来どおり描く.
+  bool m_useDepthPrepass = false;
+
+  // モデル描画の GPU 時間とオーバードロー (フラグメントシェーダー起動数 / 画面のピクセル数) を計測し、
+  // プリパスの有無で比較できるようにそれぞれ最後に計測した値を残しておく.
+  DrawProfiler m_drawProfiler;
+  struct DrawProfile
+  {
+    double gpuMilliseconds = 0.0;
+    double frameMilliseconds = 0.0;
+    double overdraw = 0.0;
+    bool   valid = false;
+  } m_prepassProfiles[2];   // [0]: プリパスなし, [1]: プリパスあり.
+  bool m_profiledWithPrepass[GfxDevice::InflightFrames] = {};
+
+  // コンピュートシェーダーでのスキニング.
+  //  アニメーションのサンプリングとジョイント行列の計算は CPU (SIMD) で行い、頂点の変換はフレームに1度だけ GPU で行う.
+  //  インスタンス描画では全インスタンスが同じ姿勢を共有する.
+  GpuSkinning m_skinning;
+  bool  m_useSkinning = true;
+  bool  m_playAnimation = true;
+  bool  m_useJointSway = false;  // アニメーションを持たないモデルのジョイントを揺らす (スキニングの確認用).
+  int   m_animationIndex = 0;
+  float m_animationTime = 0.0f;
+  float m_animationSpeed = 1.0f;
+  std::vector<glm::mat4> m_jointMatrices;
+  struct SkinningStats
+  {
+    double animationMilliseconds = 0.0;   // キーフレームのサンプリング.
+    double jointMatrixMilliseconds = 0.0; // ジョイント行列の計算.
+  } m_skinningStats;
+
+  // CPU での視錐台カリング. メッシュの AABB をモデル空間のまま判定する.
+  //  BVH を使う場合は視錐台の外側にある部分木をまとめて除き、内側の部分木は判定せずに可視とする.
+  FrustumCuller m_meshCuller;
+  MeshBvh m_meshBvh;
+  bool m_useBvhCulling = true;
+  std::vector<uint32_t> m_visibleMeshes;
+  std::vector<uint8_t> m_meshVisibility;  // メッシュ番号ごとの可視フラグ.
+  struct CpuCullingStats
+  {
+    uint32_t visibleCount = 0;
+    uint32_t culledCount = 0;
+    double   milliseconds = 0.0;
+  } m_cpuCullingStats;
+  CullingBenchmarkResult m_cullingBenchmark;
+  BvhBenchmarkResult m_bvhBenchmark;
+
+  // BVH による問い合わせ. 画面中央のレイで最初に当たるメッシュと、カメラに最も近いメッシュ.
+  //  距離はモデル空間の AABB に対するもの.
+  struct MeshQuery
+  {
+    double   bvhBuildMilliseconds = 0.0;
+    double   boundsUpdateMilliseconds = 0.0;  // 動くメッシュの境界の更新と BVH の包み直し.
+    uint32_t pickedMesh = UINT32_MAX;
+    float    pickedDistance = 0.0f;
+    uint32_t nearestMesh = UINT32_MAX;
+    float    nearestDistance = 0.0f;
+    double   milliseconds = 0.0;
+  } m_meshQuery;
+
+  // インスタンシング描画による負荷計測モード.
+  //  モデルを格子状に複製し、メッシュごとに1回のインスタンス描画で可視インスタンスを全て描く.
+  //  インスタンスは中心から渦巻き状に並べるため、数を変えてもまとまった範囲に配置される.
+  static const uint32_t MaxInstanceCount = 100000;
+  struct InstanceData
+  {
+    GpuBuffer transformBuffer;              // 全インスタンスの変換行列 (MaxInstanceCount 個).
+    std::vector<GpuBuffer> visibleBuffers;  // 可視インスタンス番号. (フレームごと)
+    glm::vec3 boundsMin = glm::vec3(0.0f);  // Y軸回転してもはみ出さないモデルの範囲.
+    glm::vec3 boundsMax = glm::vec3(0.0f);
+    float spacing = 1.0f;
+  } m_instances;
+  bool m_useInstancing = false;
+  int  m_instanceCount = 1024;
+  uint32_t m_instanceStride = 1;
+  uint32_t m_visibleInstanceCount = 1;  // 描画時の instanceCount.
+  // インスタンスの AABB (ワールド空間) を保持して視錐台カリングを行う.
+  FrustumCuller m_instanceCuller;
+  std::vector<uint32_t> m_visibleInstances;
+  std::vector<float> m_visibleInstanceDistances;  // m_visibleInstances と同じ並び (近い順).
+  RenderQueue m_instanceSortQueue;
+  std::vector<uint32_t> m_sortedInstances;
+  std::vector<float> m_sortedInstanceDistances;
+  double m_instanceCullingMilliseconds = 0.0;
+
+  // 距離に応じた LOD の選択.
+  //  誤差を画面上のピクセル数に換算し、m_lodPixelError に収まる最も粗い LOD を使う.
+  bool  m_useLod = true;
+  float m_lodPixelError = 1.0f;
+  float m_lodPixelScale = 0.0f;     // 距離1の位置で1単位が何ピクセルになるか.
+  glm::vec3 m_cameraPosition = glm::vec3(0.0f);
+  std::vector<uint8_t> m_meshLods;  // メッシュごとに選択した LOD (インスタンシングしない時).
+
+  TextureInfo& GetDiffuseTexture(const ModelMaterial& material);
 };
\ No newline at end of file
@@ -0,0 +1,330 @@
+﻿#include "Culling.h"
+#include "SimdConfig.h"
+
+#include <cmath>
+#include <cassert>
+#include <algorithm>
+#include <chrono>
+#include <random>
+
+namespace
+{
+  // AABB(中心, 半径)が平面の内側に掛かっているか.
+  //  平面の法線方向への AABB の投影半径を使って判定する.
+  inline bool IsBoxInside(const glm::vec4& plane, float cx, float cy, float cz, float ex, float ey, float ez)
+  {
+    // SIMD 版と結果が一致するよう演算順を揃えている.
+    float d = (plane.x * cx + plane.y * cy) + (plane.z * cz + plane.w);
+    float r = (std::abs(plane.x) * ex + std::abs(plane.y) * ey) + std::abs(plane.z) * ez;
+    return d + r >= 0.0f;
+  }
+}
+
+BoundingSphere ComputeBoundingSphere(const std::vector<glm::vec3>& positions)
+{
+  BoundingSphere sphere;
+  if (positions.empty())
+  {
+    return sphere;
+  }
+
+  glm::vec3 minPos = positions[0], maxPos = positions[0];
+  for (const auto& p : positions)
+  {
+    minPos = glm::min(minPos, p);
+    maxPos = glm::max(maxPos, p);
+  }
+  sphere.center = (minPos + maxPos) * 0.5f;
+
+  // AABB の対角ではなく、実際の頂点までの最大距離を半径にする.
+  float radiusSq = 0.0f;
+  for (const auto& p : positions)
+  {
+    auto d = p - sphere.center;
+    radiusSq = std::max(radiusSq, glm::dot(d, d));
+  }
+  sphere.radius = std::sqrt(radiusSq);
+  return sphere;
+}
+
+Frustum ExtractFrustum(const glm::mat4& m)
+{
+  // glm は列優先のため m[列][行] となる.
+  auto row = [&](int i) { return glm::vec4(m[0][i], m[1][i], m[2][i], m[3][i]); };
+  const auto r0 = row(0), r1 = row(1), r2 = row(2), r3 = row(3);
+
+  Frustum frustum;
+  frustum.planes[Frustum::PLANE_LEFT] = r3 + r0;
+  frustum.planes[Frustum::PLANE_RIGHT] = r3 - r0;
+  frustum.planes[Frustum::PLANE_BOTTOM] = r3 + r1;
+  frustum.planes[Frustum::PLANE_TOP] = r3 - r1;
+  frustum.planes[Frustum::PLANE_NEAR] = r2;
+  frustum.planes[Frustum::PLANE_FAR] = r3 - r2;
+
+  for (auto& plane : frustum.planes)
+  {
+    float length = glm::length(glm::vec3(plane));
+    if (length > 0.0f)
+    {
+      plane /= length;
+    }
+  }
+  return frustum;
+}
+
+BoundingSphere TransformBoundingSphere(const BoundingSphere& sphere, const glm::mat4& matrix)
+{
+  BoundingSphere result;
+  result.center = glm::vec3(matrix * glm::vec4(sphere.center, 1.0f));
+
+  float scale = std::max({
+    glm::length(glm::vec3(matrix[0])),
+    glm::length(glm::vec3(matrix[1])),
+    glm::length(glm::vec3(matrix[2])),
+  });
+  result.radius = sphere.radius * scale;
+  return result;
+}
+
+bool IsVisible(const Frustum& frustum, const BoundingSphere& sphere)
+{
+  for (const auto& plane : frustum.planes)
+  {
+    float distance = glm::dot(glm::vec3(plane), sphere.center) + plane.w;
+    if (distance < -sphere.radius)
+    {
+      return false;
+    }
+  }
+  return true;
+}
+
+Frustum TransformFrustum(const Frustum& frustum, const glm::mat4& matrix)
+{
+  // 平面 p と点 x について dot(p, M * x) = dot(transpose(M) * p, x) となる.
+  Frustum result;
+  for (int i = 0; i < Frustum::PLANE_COUNT; ++i)
+  {
+    const auto& p = frustum.planes[i];
+    result.planes[i] = glm::vec4(
+      glm::dot(matrix[0], p), glm::dot(matrix[1], p), glm::dot(matrix[2], p), glm::dot(matrix[3], p));
+  }
+  return result;
+}
+
+void FrustumCuller::Clear()
+{
+  m_centerX.clear(); m_centerY.clear(); m_centerZ.clear();
+  m_extentX.clear(); m_extentY.clear(); m_extentZ.clear();
+  m_count = 0;
+}
+
+void FrustumCuller::Reserve(size_t count)
+{
+  m_centerX.reserve(count); m_centerY.reserve(count); m_centerZ.reserve(count);
+  m_extentX.reserve(count); m_extentY.reserve(count); m_extentZ.reserve(count);
+}
+
+void FrustumCuller::AddBox(const glm::vec3& boundsMin, const glm::vec3& boundsMax)
+{
+  auto center = (boundsMin + boundsMax) * 0.5f;
+  auto extent = (boundsMax - boundsMin) * 0.5f;
+  m_centerX.push_back(center.x); m_centerY.push_back(center.y); m_centerZ.push_back(center.z);
+  m_extentX.push_back(extent.x); m_extentY.push_back(extent.y); m_extentZ.push_back(extent.z);
+  m_count++;
+}
+
+void FrustumCuller::SetBox(uint32_t index, const glm::vec3& boundsMin, const glm::vec3& boundsMax)
+{
+  assert(index < m_count);
+  auto center = (boundsMin + boundsMax) * 0.5f;
+  auto extent = (boundsMax - boundsMin) * 0.5f;
+  m_centerX[index] = center.x; m_centerY[index] = center.y; m_centerZ[index] = center.z;
+  m_extentX[index] = extent.x; m_extentY[index] = extent.y; m_extentZ[index] = extent.z;
+}
+
+uint32_t FrustumCuller::Cull(const Frustum& frustum, std::vector<uint32_t>& outVisible) const
+{
+  outVisible.resize(m_count);
+  uint32_t visibleCount = 0;
+  uint32_t i = 0;
+  const auto& planes = frustum.planes;
+
+#if defined(SIMD_AVX2)
+  __m256 planeN[Frustum::PLANE_COUNT][4], planeAbs[Frustum::PLANE_COUNT][3];
+  for (int p = 0; p < Frustum::PLANE_COUNT; ++p)
+  {
+    for (int c = 0; c < 4; ++c) { planeN[p][c] = _mm256_set1_ps(planes[p][c]); }
+    for (int c = 0; c < 3; ++c) { planeAbs[p][c] = _mm256_set1_ps(std::abs(planes[p][c])); }
+  }
+  const __m256 zero = _mm256_setzero_ps();
+  for (; i + 8 <= m_count; i += 8)
+  {
+    __m256 cx = _mm256_loadu_ps(&m_centerX[i]), cy = _mm256_loadu_ps(&m_centerY[i]), cz = _mm256_loadu_ps(&m_centerZ[i]);
+    __m256 ex = _mm256_loadu_ps(&m_extentX[i]), ey = _mm256_loadu_ps(&m_extentY[i]), ez = _mm256_loadu_ps(&m_extentZ[i]);
+    __m256 inside = _mm256_castsi256_ps(_mm256_set1_epi32(-1));
+    for (int p = 0; p < Frustum::PLANE_COUNT; ++p)
+    {
+      __m256 d = _mm256_add_ps(
+        _mm256_add_ps(_mm256_mul_ps(planeN[p][0], cx), _mm256_mul_ps(planeN[p][1], cy)),
+        _mm256_add_ps(_mm256_mul_ps(planeN[p][2], cz), planeN[p][3]));
+      __m256 r = _mm256_add_ps(
+        _mm256_add_ps(_mm256_mul_ps(planeAbs[p][0], ex), _mm256_mul_ps(planeAbs[p][1], ey)),
+        _mm256_mul_ps(planeAbs[p][2], ez));
+      inside = _mm256_and_ps(inside, _mm256_cmp_ps(_mm256_add_ps(d, r), zero, _CMP_GE_OQ));
+    }
+    int mask = _mm256_movemask_ps(inside);
+    for (int b = 0; b < 8; ++b)
+    {
+      if (mask & (1 << b)) { outVisible[visibleCount++] = i + b; }
+    }
+  }
+#elif defined(SIMD_SSE2)
+  __m128 planeN[Frustum::PLANE_COUNT][4], planeAbs[Frustum::PLANE_COUNT][3];
+  for (int p = 0; p < Frustum::PLANE_COUNT; ++p)
+  {
+    for (int c = 0; c < 4; ++c) { planeN[p][c] = _mm_set1_ps(planes[p][c]); }
+    for (int c = 0; c < 3; ++c) { planeAbs[p][c] = _mm_set1_ps(std::abs(planes[p][c])); }
+  }
+  const __m128 zero = _mm_setzero_ps();
+  for (; i + 4 <= m_count; i += 4)
+  {
+    __m128 cx = _mm_loadu_ps(&m_centerX[i]), cy = _mm_loadu_ps(&m_centerY[i]), cz = _mm_loadu_ps(&m_centerZ[i]);
+    __m128 ex = _mm_loadu_ps(&m_extentX[i]), ey = _mm_loadu_ps(&m_extentY[i]), ez = _mm_loadu_ps(&m_extentZ[i]);
+    __m128 inside = _mm_castsi128_ps(_mm_set1_epi32(-1));
+    for (int p = 0; p < Frustum::PLANE_COUNT; ++p)
+    {
+      __m128 d = _mm_add_ps(
+        _mm_add_ps(_mm_mul_ps(planeN[p][0], cx), _mm_mul_ps(planeN[p][1], cy)),
+        _mm_add_ps(_mm_mul_ps(planeN[p][2], cz), planeN[p][3]));
+      __m128 r = _mm_add_ps(
+        _mm_add_ps(_mm_mul_ps(planeAbs[p][0], ex), _mm_mul_ps(planeAbs[p][1], ey)),
+        _mm_mul_ps(planeAbs[p][2], ez));
+      inside = _mm_and_ps(inside, _mm_cmpge_ps(_mm_add_ps(d, r), zero));
+    }
+    int mask = _mm_movemask_ps(inside);
+    for (int b = 0; b < 4; ++b)
+    {
+      if (mask & (1 << b)) { outVisible[visibleCount++] = i + b; }
+    }
+  }
+#elif defined(SIMD_NEON)
+  float32x4_t planeN[Frustum::PLANE_COUNT][4], planeAbs[Frustum::PLANE_COUNT][3];
+  for (int p = 0; p < Frustum::PLANE_COUNT; ++p)
+  {
+    for (int c = 0; c < 4; ++c) { planeN[p][c] = vdupq_n_f32(planes[p][c]); }
+    for (int c = 0; c < 3; ++c) { planeAbs[p][c] = vdupq_n_f32(std::abs(planes[p][c])); }
+  }
+  const float32x4_t zero = vdupq_n_f32(0.0f);
+  for (; i + 4 <= m_count; i += 4)
+  {
+    float32x4_t cx = vld1q_f32(&m_centerX[i]), cy = vld1q_f32(&m_centerY[i]), cz = vld1q_f32(&m_centerZ[i]);
+    float32x4_t ex = vld1q_f32(&m_extentX[i]), ey = vld1q_f32(&m_extentY[i]), ez = vld1q_f32(&m_extentZ[i]);
+    uint32x4_t inside = vdupq_n_u32(0xFFFFFFFFu);
+    for (int p = 0; p < Frustum::PLANE_COUNT; ++p)
+    {
+      float32x4_t d = vaddq_f32(
+        vaddq_f32(vmulq_f32(planeN[p][0], cx), vmulq_f32(planeN[p][1], cy)),
+        vaddq_f32(vmulq_f32(planeN[p][2], cz), planeN[p][3]));
+      float32x4_t r = vaddq_f32(
+        vaddq_f32(vmulq_f32(planeAbs[p][0], ex), vmulq_f32(planeAbs[p][1], ey)),
+        vmulq_f32(planeAbs[p][2], ez));
+      inside = vandq_u32(inside, vcgeq_f32(vaddq_f32(d, r), zero));
+    }
+    uint32_t lanes[4];
+    vst1q_u32(lanes, inside);
+    for (int b = 0; b < 4; ++b)
+    {
+      if (lanes[b]) { outVisible[visibleCount++] = i + b; }
+    }
+  }
+#endif
+
+  // 端数(または SIMD が使えない環境)はスカラーで処理.
+  visibleCount += CullRange(frustum, i, outVisible.data() + visibleCount);
+  outVisible.resize(visibleCount);
+  return visibleCount;
+}
+
+uint32_t FrustumCuller::CullScalar(const Frustum& frustum, std::vector<uint32_t>& outVisible) const
+{
+  outVisible.resize(m_count);
+  auto visibleCount = CullRange(frustum, 0, outVisible.data());
+  outVisible.resize(visibleCount);
+  return visibleCount;
+}
+
+uint32_t FrustumCuller::CullRange(const Frustum& frustum, uint32_t first, uint32_t* outVisible) const
+{
+  uint32_t visibleCount = 0;
+  for (uint32_t i = first; i < m_count; ++i)
+  {
+    bool visible = true;
+    for (const auto& plane : frustum.planes)
+    {
+      if (!IsBoxInside(plane, m_centerX[i], m_centerY[i], m_centerZ[i], m_extentX[i], m_extentY[i], m_extentZ[i]))
+      {
+        visible = false;
+        break;
+      }
+    }
+    if (visible)
+    {
+      outVisible[visibleCount++] = i;
+    }
+  }
+  return visibleCount;
+}
+
+const char* FrustumCuller::GetSimdName()
+{
+#if defined(SIMD_AVX2)
+  return "AVX2";
+#elif defined(SIMD_SSE2)
+  return "SSE2";
+#elif defined(SIMD_NEON)
+  return "NEON";
+#else
+  return "Scalar";
+#endif
+}
+
+CullingBenchmarkResult RunCullingBenchmark(uint32_t boxCount, const Frustum& frustum)
+{
+  // 視錐台の周辺に散らばるように配置する. 毎回同じ結果になるよう乱数は固定.
+  std::mt19937 rng(12345);
+  std::uniform_real_distribution<float> position(-50.0f, 50.0f);
+  std::uniform_real_distribution<float> size(0.1f, 2.0f);
+
+  FrustumCuller culler;
+  culler.Reserve(boxCount);
+  for (uint32_t i = 0; i < boxCount; ++i)
+  {
+    glm::vec3 center(position(rng), position(rng), position(rng));
+    glm::vec3 extent(size(rng), size(rng), size(rng));
+    culler.AddBox(center - extent, center + extent);
+  }
+
+  const int iterations = 16;
+  std::vector<uint32_t> simdVisible, scalarVisible;
+  simdVisible.reserve(boxCount);
+  scalarVisible.reserve(boxCount);
+
+  auto measure = [&](auto&& func) {
+    auto start = std::chrono::high_resolution_clock::now();
+    for (int i = 0; i < iterations; ++i)
+    {
+      func();
+    }
+    auto end = std::chrono::high_resolution_clock::now();
+    return std::chrono::duration<double, std::milli>(end - start).count() / iterations;
+  };
+
+  CullingBenchmarkResult result;
+  result.boxCount = boxCount;
+  result.simdMilliseconds = measure([&]() { culler.Cull(frustum, simdVisible); });
+  result.scalarMilliseconds = measure([&]() { culler.CullScalar(frustum, scalarVisible); });
+  result.visibleCount = uint32_t(simdVisible.size());
+  result.matched = simdVisible == scalarVisible;
+  return result;
+}
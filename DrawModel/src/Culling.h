@@ -0,0 +1,85 @@
+﻿#pragma once
+#include <vector>
+#include <cstdint>
+
+#define GLM_FORCE_DEPTH_ZERO_TO_ONE
+#include "glm/glm.hpp"
+
+// メッシュを包む境界球.
+struct BoundingSphere
+{
+  glm::vec3 center = glm::vec3(0.0f);
+  float     radius = 0.0f;
+};
+
+// 視錐台を構成する6平面.
+//  各平面は (法線, 距離) で表し、内側が正となるように正規化している.
+struct Frustum
+{
+  enum {
+    PLANE_LEFT = 0, PLANE_RIGHT,
+    PLANE_BOTTOM, PLANE_TOP,
+    PLANE_NEAR, PLANE_FAR,
+    PLANE_COUNT,
+  };
+  glm::vec4 planes[PLANE_COUNT];
+};
+
+// 頂点群を包む境界球を求める. (AABB の中心を球の中心とする)
+BoundingSphere ComputeBoundingSphere(const std::vector<glm::vec3>& positions);
+
+// ビュー・プロジェクション行列から視錐台平面を取り出す.
+//  クリップ空間の Z は [0,1] の前提.
+Frustum ExtractFrustum(const glm::mat4& matViewProj);
+
+// 行列で変換した後の境界球を求める. 半径は最大の拡大率で拡げる.
+BoundingSphere TransformBoundingSphere(const BoundingSphere& sphere, const glm::mat4& matrix);
+
+// 境界球が視錐台の内側(一部でも)にあるか判定する.
+bool IsVisible(const Frustum& frustum, const BoundingSphere& sphere);
+
+// 視錐台平面を matrix で変換する前の空間へ移す.
+//  ワールド空間の視錐台とワールド行列を渡すと、モデル空間の視錐台が得られる.
+//  平面は正規化されないため AABB の判定にのみ使用する.
+Frustum TransformFrustum(const Frustum& frustum, const glm::mat4& matrix);
+
+// 多数の AABB を SoA 形式で保持し、SIMD でまとめて視錐台カリングを行う.
+//  AVX2 / SSE2 / NEON のうちコンパイル対象で使えるものを使用する.
+//  AVX2 は DRAWMODEL_ENABLE_AVX2 (CMake) または DrawModelEnableAVX2 (vcxproj) を指定した時だけ使う.
+class FrustumCuller
+{
+public:
+  void Clear();
+  void Reserve(size_t count);
+  void AddBox(const glm::vec3& boundsMin, const glm::vec3& boundsMax);
+  // 追加済みのボックスを置き換える. (アニメーションで動くメッシュの更新用)
+  void SetBox(uint32_t index, const glm::vec3& boundsMin, const glm::vec3& boundsMax);
+  uint32_t GetCount() const { return m_count; }
+
+  // 視錐台と交差するボックスの番号を outVisible に詰めて出力し、その数を返す.
+  //  frustum はボックスと同じ座標系であること.
+  uint32_t Cull(const Frustum& frustum, std::vector<uint32_t>& outVisible) const;
+
+  // SIMD を使わない実装. 結果の検証と性能比較用.
+  uint32_t CullScalar(const Frustum& frustum, std::vector<uint32_t>& outVisible) const;
+
+  static const char* GetSimdName();
+
+private:
+  uint32_t CullRange(const Frustum& frustum, uint32_t first, uint32_t* outVisible) const;
+
+  std::vector<float> m_centerX, m_centerY, m_centerZ;
+  std::vector<float> m_extentX, m_extentY, m_extentZ;
+  uint32_t m_count = 0;
+};
+
+// ランダムな AABB を大量に生成して SIMD 版とスカラー版の速度を比較する.
+struct CullingBenchmarkResult
+{
+  uint32_t boxCount = 0;
+  uint32_t visibleCount = 0;
+  double   simdMilliseconds = 0.0;
+  double   scalarMilliseconds = 0.0;
+  bool     matched = false;   // 両者の結果が一致したか.
+};
+CullingBenchmarkResult RunCullingBenchmark(uint32_t boxCount, const Frustum& frustum);
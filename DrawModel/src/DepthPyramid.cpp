@@ -0,0 +1,322 @@
+﻿#include "DepthPyramid.h"
+#include "FileLoader.h"
+
+#include <cassert>
+#include <algorithm>
+
+namespace
+{
+  // v 以下の最大の2のべき乗.
+  uint32_t PreviousPowerOfTwo(uint32_t v)
+  {
+    uint32_t r = 1;
+    while (r * 2 <= v)
+    {
+      r *= 2;
+    }
+    return r;
+  }
+
+  void CmdImageBarrier(VkCommandBuffer commandBuffer, VkImage image,
+    VkPipelineStageFlags2 srcStage, VkAccessFlags2 srcAccess,
+    VkPipelineStageFlags2 dstStage, VkAccessFlags2 dstAccess,
+    VkImageLayout oldLayout, VkImageLayout newLayout,
+    uint32_t baseLevel, uint32_t levelCount)
+  {
+    VkImageMemoryBarrier2 barrier{
+      .sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER_2,
+      .srcStageMask = srcStage,
+      .srcAccessMask = srcAccess,
+      .dstStageMask = dstStage,
+      .dstAccessMask = dstAccess,
+      .oldLayout = oldLayout,
+      .newLayout = newLayout,
+      .image = image,
+      .subresourceRange = {
+        .aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+        .baseMipLevel = baseLevel, .levelCount = levelCount,
+        .baseArrayLayer = 0, .layerCount = 1,
+      },
+    };
+    VkDependencyInfo info{
+      .sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO,
+      .imageMemoryBarrierCount = 1,
+      .pImageMemoryBarriers = &barrier,
+    };
+    if (vkCmdPipelineBarrier2)
+    {
+      vkCmdPipelineBarrier2(commandBuffer, &info);
+    }
+    else
+    {
+      vkCmdPipelineBarrier2KHR(commandBuffer, &info);
+    }
+  }
+}
+
+void DepthPyramid::Initialize(VkImageView depthView, uint32_t depthWidth, uint32_t depthHeight)
+{
+  assert(depthView != VK_NULL_HANDLE && depthWidth > 0 && depthHeight > 0);
+  auto& gfxDevice = GetGfxDevice();
+  auto vkDevice = gfxDevice->GetVkDevice();
+
+  m_depthWidth = depthWidth;
+  m_depthHeight = depthHeight;
+  m_width = PreviousPowerOfTwo(depthWidth);
+  m_height = PreviousPowerOfTwo(depthHeight);
+  m_levelCount = 1;
+  while ((std::max(m_width, m_height) >> m_levelCount) > 0)
+  {
+    m_levelCount++;
+  }
+
+  PreparePipeline();
+
+  m_image = gfxDevice->CreateImage2D(m_width, m_height, VK_FORMAT_R32_SFLOAT,
+    VK_IMAGE_USAGE_STORAGE_BIT | VK_IMAGE_USAGE_SAMPLED_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, m_levelCount);
+
+  // 書き込みと参照を同じレイアウトで行うため GENERAL で固定する.
+  //  最初のフレームは何も遮蔽しないよう最も奥の深度で埋めておく.
+  {
+    auto commandBuffer = gfxDevice->AllocateCommandBuffer();
+    CmdImageBarrier(commandBuffer, m_image.image,
+      VK_PIPELINE_STAGE_2_NONE, VK_ACCESS_2_NONE,
+      VK_PIPELINE_STAGE_2_CLEAR_BIT, VK_ACCESS_2_TRANSFER_WRITE_BIT,
+      VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_GENERAL, 0, m_levelCount);
+    VkClearColorValue farDepth{ .float32 = { 1.0f, 0.0f, 0.0f, 0.0f } };
+    VkImageSubresourceRange range{
+      .aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+      .baseMipLevel = 0, .levelCount = m_levelCount,
+      .baseArrayLayer = 0, .layerCount = 1,
+    };
+    vkCmdClearColorImage(commandBuffer, m_image.image, VK_IMAGE_LAYOUT_GENERAL, &farDepth, 1, &range);
+    CmdImageBarrier(commandBuffer, m_image.image,
+      VK_PIPELINE_STAGE_2_CLEAR_BIT, VK_ACCESS_2_TRANSFER_WRITE_BIT,
+      VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT, VK_ACCESS_2_SHADER_SAMPLED_READ_BIT | VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT,
+      VK_IMAGE_LAYOUT_GENERAL, VK_IMAGE_LAYOUT_GENERAL, 0, m_levelCount);
+    gfxDevice->SubmitOneShot(commandBuffer);
+    m_image.layout = VK_IMAGE_LAYOUT_GENERAL;
+  }
+
+  // texelFetch でのみ参照するため、フィルタは使わない.
+  VkSamplerCreateInfo samplerCI{
+    .sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO,
+    .magFilter = VK_FILTER_NEAREST,
+    .minFilter = VK_FILTER_NEAREST,
+    .mipmapMode = VK_SAMPLER_MIPMAP_MODE_NEAREST,
+    .addressModeU = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE,
+    .addressModeV = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE,
+    .addressModeW = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE,
+    .minLod = 0.0f,
+    .maxLod = VK_LOD_CLAMP_NONE,
+  };
+  auto res = vkCreateSampler(vkDevice, &samplerCI, nullptr, &m_sampler);
+  assert(res == VK_SUCCESS);
+
+  m_levelViews.resize(m_levelCount);
+  for (uint32_t level = 0; level < m_levelCount; ++level)
+  {
+    VkImageViewCreateInfo viewCI{
+      .sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO,
+      .image = m_image.image,
+      .viewType = VK_IMAGE_VIEW_TYPE_2D,
+      .format = VK_FORMAT_R32_SFLOAT,
+      .subresourceRange = {
+        .aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+        .baseMipLevel = level, .levelCount = 1,
+        .baseArrayLayer = 0, .layerCount = 1,
+      },
+    };
+    res = vkCreateImageView(vkDevice, &viewCI, nullptr, &m_levelViews[level]);
+    assert(res == VK_SUCCESS);
+  }
+
+  // 1レベルあたり入力 1つと出力 1つを使用する.
+  m_descriptorAllocator.Initialize(vkDevice, m_levelCount, {
+    { VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 1.0f },
+    { VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, 1.0f },
+  });
+  m_descriptorSets.resize(m_levelCount);
+  for (uint32_t level = 0; level < m_levelCount; ++level)
+  {
+    m_descriptorSets[level] = m_descriptorAllocator.Allocate(m_descriptorSetLayout);
+
+    VkDescriptorImageInfo srcInfo{
+      .sampler = m_sampler,
+      .imageView = level == 0 ? depthView : m_levelViews[level - 1],
+      .imageLayout = level == 0 ? VK_IMAGE_LAYOUT_DEPTH_READ_ONLY_OPTIMAL : VK_IMAGE_LAYOUT_GENERAL,
+    };
+    VkDescriptorImageInfo dstInfo{
+      .imageView = m_levelViews[level],
+      .imageLayout = VK_IMAGE_LAYOUT_GENERAL,
+    };
+    VkWriteDescriptorSet writeDescs[] = {
+      {
+        .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+        .dstSet = m_descriptorSets[level],
+        .dstBinding = 0,
+        .descriptorCount = 1,
+        .descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
+        .pImageInfo = &srcInfo,
+      },
+      {
+        .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+        .dstSet = m_descriptorSets[level],
+        .dstBinding = 1,
+        .descriptorCount = 1,
+        .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE,
+        .pImageInfo = &dstInfo,
+      },
+    };
+    vkUpdateDescriptorSets(vkDevice, 2, writeDescs, 0, nullptr);
+  }
+
+  auto& downsampler = GetMipDownsampler();
+  if (m_levelCount > 1 && downsampler->IsInitialized() && downsampler->IsSupported(MipDownsampler::MODE_DEPTH_MAX))
+  {
+    downsampler->CreateTarget(m_singlePassTarget, m_image.image, MipDownsampler::MODE_DEPTH_MAX, m_width, m_height, m_levelCount);
+  }
+}
+
+void DepthPyramid::Destroy()
+{
+  if (m_pipeline == VK_NULL_HANDLE)
+  {
+    return;
+  }
+  auto& gfxDevice = GetGfxDevice();
+  auto vkDevice = gfxDevice->GetVkDevice();
+
+  for (auto& view : m_levelViews)
+  {
+    vkDestroyImageView(vkDevice, view, nullptr);
+  }
+  m_levelViews.clear();
+  if (m_singlePassTarget.mipCount > 0)
+  {
+    GetMipDownsampler()->DestroyTarget(m_singlePassTarget);
+  }
+  m_descriptorSets.clear();
+  m_descriptorAllocator.Destroy();
+  gfxDevice->DestroyImage(m_image);
+  vkDestroySampler(vkDevice, m_sampler, nullptr);
+  m_sampler = VK_NULL_HANDLE;
+
+  vkDestroyPipeline(vkDevice, m_pipeline, nullptr);
+  vkDestroyPipelineLayout(vkDevice, m_pipelineLayout, nullptr);
+  vkDestroyDescriptorSetLayout(vkDevice, m_descriptorSetLayout, nullptr);
+  m_pipeline = VK_NULL_HANDLE;
+  m_pipelineLayout = VK_NULL_HANDLE;
+  m_descriptorSetLayout = VK_NULL_HANDLE;
+  m_levelCount = 0;
+}
+
+void DepthPyramid::Build(VkCommandBuffer commandBuffer)
+{
+  // 前回作成したピラミッドの参照(カリング)が終わってから書き込む.
+  CmdImageBarrier(commandBuffer, m_image.image,
+    VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT, VK_ACCESS_2_SHADER_SAMPLED_READ_BIT,
+    VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT, VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT,
+    VK_IMAGE_LAYOUT_GENERAL, VK_IMAGE_LAYOUT_GENERAL, 0, m_levelCount);
+
+  vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, m_pipeline);
+
+  // 単一パスの場合は、深度バッファからレベル0 のみを作り、残りはまとめて作る.
+  const bool singlePass = IsUsingSinglePass();
+  const uint32_t levelCount = singlePass ? 1 : m_levelCount;
+  uint32_t srcWidth = m_depthWidth, srcHeight = m_depthHeight;
+  for (uint32_t level = 0; level < levelCount; ++level)
+  {
+    ReduceParameters params{
+      .srcWidth = srcWidth,
+      .srcHeight = srcHeight,
+      .dstWidth = std::max(m_width >> level, 1u),
+      .dstHeight = std::max(m_height >> level, 1u),
+    };
+    vkCmdBindDescriptorSets(commandBuffer,
+      VK_PIPELINE_BIND_POINT_COMPUTE, m_pipelineLayout, 0, 1, &m_descriptorSets[level], 0, nullptr);
+    vkCmdPushConstants(commandBuffer, m_pipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(params), &params);
+    vkCmdDispatch(commandBuffer,
+      (params.dstWidth + ThreadGroupSize - 1) / ThreadGroupSize,
+      (params.dstHeight + ThreadGroupSize - 1) / ThreadGroupSize, 1);
+
+    // 書き込んだレベルを次のレベルの入力にする.
+    CmdImageBarrier(commandBuffer, m_image.image,
+      VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT, VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT,
+      VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT, VK_ACCESS_2_SHADER_SAMPLED_READ_BIT,
+      VK_IMAGE_LAYOUT_GENERAL, VK_IMAGE_LAYOUT_GENERAL, level, 1);
+
+    srcWidth = params.dstWidth;
+    srcHeight = params.dstHeight;
+  }
+
+  if (singlePass)
+  {
+    GetMipDownsampler()->Dispatch(commandBuffer, m_singlePassTarget);
+    CmdImageBarrier(commandBuffer, m_image.image,
+      VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT, VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT,
+      VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT, VK_ACCESS_2_SHADER_SAMPLED_READ_BIT,
+      VK_IMAGE_LAYOUT_GENERAL, VK_IMAGE_LAYOUT_GENERAL, 1, m_levelCount - 1);
+  }
+}
+
+void DepthPyramid::PreparePipeline()
+{
+  auto& gfxDevice = GetGfxDevice();
+  auto vkDevice = gfxDevice->GetVkDevice();
+
+  std::vector<VkDescriptorSetLayoutBinding> layoutBindings{
+    // 入力 (深度バッファまたは前のレベル).
+    {
+      .binding = 0,
+      .descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
+      .descriptorCount = 1,
+      .stageFlags = VK_SHADER_STAGE_COMPUTE_BIT,
+    },
+    // 出力するレベル.
+    {
+      .binding = 1,
+      .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE,
+      .descriptorCount = 1,
+      .stageFlags = VK_SHADER_STAGE_COMPUTE_BIT,
+    },
+  };
+  VkDescriptorSetLayoutCreateInfo dsLayoutCI{
+    .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO,
+    .bindingCount = uint32_t(layoutBindings.size()),
+    .pBindings = layoutBindings.data(),
+  };
+  vkCreateDescriptorSetLayout(vkDevice, &dsLayoutCI, nullptr, &m_descriptorSetLayout);
+
+  VkPushConstantRange pushConstantRange{
+    .stageFlags = VK_SHADER_STAGE_COMPUTE_BIT,
+    .offset = 0,
+    .size = sizeof(ReduceParameters),
+  };
+  VkPipelineLayoutCreateInfo layoutCI{
+    .sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO,
+    .setLayoutCount = 1,
+    .pSetLayouts = &m_descriptorSetLayout,
+    .pushConstantRangeCount = 1,
+    .pPushConstantRanges = &pushConstantRange,
+  };
+  vkCreatePipelineLayout(vkDevice, &layoutCI, nullptr, &m_pipelineLayout);
+
+  std::vector<char> computeSpv;
+  GetFileLoader()->Load("res/depth_reduce.comp.spv", computeSpv);
+  VkPipelineShaderStageCreateInfo computeStage{
+    .sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO,
+    .stage = VK_SHADER_STAGE_COMPUTE_BIT,
+    .module = gfxDevice->CreateShaderModule(computeSpv.data(), computeSpv.size()),
+    .pName = "main",
+  };
+  VkComputePipelineCreateInfo computePipelineCI{
+    .sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO,
+    .stage = computeStage,
+    .layout = m_pipelineLayout,
+  };
+  auto res = vkCreateComputePipelines(vkDevice, VK_NULL_HANDLE, 1, &computePipelineCI, nullptr, &m_pipeline);
+  assert(res == VK_SUCCESS);
+
+  gfxDevice->DestroyShaderModule(computeStage.module);
+}
@@ -0,0 +1,69 @@
+﻿#pragma once
+#include <vector>
+#include <cstdint>
+
+#include "GfxDevice.h"
+#include "MipDownsampler.h"
+
+// 深度バッファから階層深度 (Hi-Z) バッファを作成する.
+//  各ミップは下位レベルの範囲内の最大深度 (最も奥) を持つ.
+//  レベル0 は深度バッファ以下の最大の2のべき乗サイズとし、以降は半分ずつ縮小する.
+class DepthPyramid
+{
+public:
+  // depthView は作成元の深度バッファ. 破棄するまで同じものを使い続ける.
+  void Initialize(VkImageView depthView, uint32_t depthWidth, uint32_t depthHeight);
+  void Destroy();
+  bool IsInitialized() const { return m_pipeline != VK_NULL_HANDLE; }
+
+  // 深度バッファからピラミッドを作成するコマンドを記録する.
+  //  深度バッファは DEPTH_READ_ONLY_OPTIMAL レイアウトにしておくこと.
+  //  作成後はコンピュートシェーダーから参照可能な状態になる.
+  void Build(VkCommandBuffer commandBuffer);
+
+  // レベル1以降を MipDownsampler の1回のディスパッチで作るか. 使えない場合はレベルごとに作る.
+  void SetUseSinglePass(bool enable) { m_useSinglePass = enable; }
+  bool IsSinglePassAvailable() const { return !m_singlePassTarget.passes.empty(); }
+  bool IsUsingSinglePass() const { return m_useSinglePass && IsSinglePassAvailable(); }
+
+  // 参照用. イメージは常に GENERAL レイアウト.
+  VkImageView GetView() const { return m_image.view; }
+  VkSampler GetSampler() const { return m_sampler; }
+  uint32_t GetWidth() const { return m_width; }
+  uint32_t GetHeight() const { return m_height; }
+  uint32_t GetLevelCount() const { return m_levelCount; }
+
+private:
+  void PreparePipeline();
+
+  // シェーダー側の ReduceParameters と一致させる.
+  struct ReduceParameters
+  {
+    uint32_t srcWidth;
+    uint32_t srcHeight;
+    uint32_t dstWidth;
+    uint32_t dstHeight;
+  };
+
+  GpuImage m_image;
+  VkSampler m_sampler = VK_NULL_HANDLE;
+  uint32_t m_width = 0;
+  uint32_t m_height = 0;
+  uint32_t m_depthWidth = 0;
+  uint32_t m_depthHeight = 0;
+  uint32_t m_levelCount = 0;
+  std::vector<VkImageView> m_levelViews;
+
+  // レベルごとのセット. 0 番は深度バッファ、以降は1つ前のレベルを入力とする.
+  std::vector<VkDescriptorSet> m_descriptorSets;
+
+  VkDescriptorSetLayout m_descriptorSetLayout = VK_NULL_HANDLE;
+  VkPipelineLayout m_pipelineLayout = VK_NULL_HANDLE;
+  VkPipeline m_pipeline = VK_NULL_HANDLE;
+  DescriptorAllocator m_descriptorAllocator;
+
+  MipDownsampler::Target m_singlePassTarget;
+  bool m_useSinglePass = true;
+
+  static const uint32_t ThreadGroupSize = 8;
+};
@@ -0,0 +1,136 @@
+﻿#include "DrawProfiler.h"
+
+#include <cassert>
+
+void DrawProfiler::Initialize()
+{
+  auto& gfxDevice = GetGfxDevice();
+  auto vkDevice = gfxDevice->GetVkDevice();
+
+  m_timestampPeriod = gfxDevice->GetTimestampPeriod();
+  m_result = Result{};
+  if (m_timestampPeriod <= 0.0f)
+  {
+    return;
+  }
+
+  // 区間ごとに開始・終了のタイムスタンプ2つと、統計クエリ1つを使用する.
+  for (uint32_t i = 0; i < GfxDevice::InflightFrames; ++i)
+  {
+    VkQueryPoolCreateInfo timestampCI{
+      .sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO,
+      .queryType = VK_QUERY_TYPE_TIMESTAMP,
+      .queryCount = MaxSections * 2,
+    };
+    auto res = vkCreateQueryPool(vkDevice, &timestampCI, nullptr, &m_timestampPool[i]);
+    assert(res == VK_SUCCESS);
+
+    if (gfxDevice->IsSupportPipelineStatistics())
+    {
+      VkQueryPoolCreateInfo statisticsCI{
+        .sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO,
+        .queryType = VK_QUERY_TYPE_PIPELINE_STATISTICS,
+        .queryCount = MaxSections,
+        .pipelineStatistics = VK_QUERY_PIPELINE_STATISTIC_FRAGMENT_SHADER_INVOCATIONS_BIT,
+      };
+      res = vkCreateQueryPool(vkDevice, &statisticsCI, nullptr, &m_statisticsPool[i]);
+      assert(res == VK_SUCCESS);
+    }
+    m_sectionCount[i] = 0;
+  }
+}
+
+void DrawProfiler::Destroy()
+{
+  auto& gfxDevice = GetGfxDevice();
+  auto vkDevice = gfxDevice->GetVkDevice();
+  for (uint32_t i = 0; i < GfxDevice::InflightFrames; ++i)
+  {
+    vkDestroyQueryPool(vkDevice, m_timestampPool[i], nullptr);
+    vkDestroyQueryPool(vkDevice, m_statisticsPool[i], nullptr);
+    m_timestampPool[i] = VK_NULL_HANDLE;
+    m_statisticsPool[i] = VK_NULL_HANDLE;
+    m_sectionCount[i] = 0;
+  }
+}
+
+bool DrawProfiler::BeginFrame(VkCommandBuffer commandBuffer)
+{
+  if (!IsSupported())
+  {
+    return false;
+  }
+  auto& gfxDevice = GetGfxDevice();
+  auto vkDevice = gfxDevice->GetVkDevice();
+  const auto frameIndex = gfxDevice->GetFrameIndex();
+
+  // 前回のコマンドは完了済みのため待機せずに取得できる.
+  bool hasResult = m_sectionCount[frameIndex] > 0;
+  if (hasResult)
+  {
+    const auto sectionCount = m_sectionCount[frameIndex];
+    uint64_t timestamps[MaxSections * 2] = {};
+    vkGetQueryPoolResults(vkDevice, m_timestampPool[frameIndex], 0, sectionCount * 2,
+      sizeof(timestamps), timestamps, sizeof(uint64_t), VK_QUERY_RESULT_64_BIT);
+    uint64_t ticks = 0;
+    for (uint32_t i = 0; i < sectionCount; ++i)
+    {
+      ticks += timestamps[i * 2 + 1] - timestamps[i * 2];
+    }
+    m_result.gpuMilliseconds = double(ticks) * m_timestampPeriod / 1.0e6;
+
+    m_result.fragmentInvocations = 0;
+    if (HasFragmentStatistics())
+    {
+      uint64_t invocations[MaxSections] = {};
+      vkGetQueryPoolResults(vkDevice, m_statisticsPool[frameIndex], 0, sectionCount,
+        sizeof(invocations), invocations, sizeof(uint64_t), VK_QUERY_RESULT_64_BIT);
+      for (uint32_t i = 0; i < sectionCount; ++i)
+      {
+        m_result.fragmentInvocations += invocations[i];
+      }
+    }
+  }
+
+  // クエリのリセットはレンダリングの外で行う必要がある.
+  vkCmdResetQueryPool(commandBuffer, m_timestampPool[frameIndex], 0, MaxSections * 2);
+  if (HasFragmentStatistics())
+  {
+    vkCmdResetQueryPool(commandBuffer, m_statisticsPool[frameIndex], 0, MaxSections);
+  }
+  m_sectionCount[frameIndex] = 0;
+  return hasResult;
+}
+
+void DrawProfiler::BeginSection(VkCommandBuffer commandBuffer)
+{
+  if (!IsSupported())
+  {
+    return;
+  }
+  const auto frameIndex = GetGfxDevice()->GetFrameIndex();
+  const auto section = m_sectionCount[frameIndex];
+  assert(section < MaxSections);
+
+  vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, m_timestampPool[frameIndex], section * 2);
+  if (HasFragmentStatistics())
+  {
+    vkCmdBeginQuery(commandBuffer, m_statisticsPool[frameIndex], section, 0);
+  }
+}
+
+void DrawProfiler::EndSection(VkCommandBuffer commandBuffer)
+{
+  if (!IsSupported())
+  {
+    return;
+  }
+  const auto frameIndex = GetGfxDevice()->GetFrameIndex();
+  const auto section = m_sectionCount[frameIndex]++;
+
+  if (HasFragmentStatistics())
+  {
+    vkCmdEndQuery(commandBuffer, m_statisticsPool[frameIndex], section);
+  }
+  vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, m_timestampPool[frameIndex], section * 2 + 1);
+}
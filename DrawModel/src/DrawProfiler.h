@@ -0,0 +1,42 @@
+﻿#pragma once
+#include <cstdint>
+
+#include "GfxDevice.h"
+
+// GPU 上での描画時間とフラグメントシェーダーの起動数をクエリで計測する.
+//  1フレーム内に複数の区間を置くことができ、結果は区間の合計となる.
+//  結果は同じフレームスロットの再利用時 (NewFrame でのフェンス待機後) に取得するため、数フレーム前の値となる.
+class DrawProfiler
+{
+public:
+  static const uint32_t MaxSections = 4;
+
+  void Initialize();
+  void Destroy();
+  // タイムスタンプが使えない環境では計測しない.
+  bool IsSupported() const { return m_timestampPool[0] != VK_NULL_HANDLE; }
+  bool HasFragmentStatistics() const { return m_statisticsPool[0] != VK_NULL_HANDLE; }
+
+  // フレームの最初 (レンダリング開始前) に呼ぶ.
+  //  このフレームスロットの前回の結果を取得した場合は true を返す.
+  bool BeginFrame(VkCommandBuffer commandBuffer);
+
+  // 計測区間. レンダリング中に開始した区間は同じレンダリング内で終了すること.
+  void BeginSection(VkCommandBuffer commandBuffer);
+  void EndSection(VkCommandBuffer commandBuffer);
+
+  struct Result
+  {
+    double   gpuMilliseconds = 0.0;
+    uint64_t fragmentInvocations = 0;
+  };
+  const Result& GetResult() const { return m_result; }
+
+private:
+  VkQueryPool m_timestampPool[GfxDevice::InflightFrames] = {};
+  VkQueryPool m_statisticsPool[GfxDevice::InflightFrames] = {};
+  uint32_t m_sectionCount[GfxDevice::InflightFrames] = {};
+  float m_timestampPeriod = 0.0f;
+
+  Result m_result;
+};
@@ -2,8 +2,17 @@
 #include "FileLoader.h"
 #include "Window.h"
 
-#if defined(PLATFORM_WINDOWS) || defined(PLATFORM_LINUX)
 #include <fstream>
+
+#if defined(PLATFORM_WINDOWS)
+# define WIN32_LEAN_AND_MEAN
+# define NOMINMAX
+# include <windows.h>
+#else
+# include <fcntl.h>
+# include <unistd.h>
+# include <sys/mman.h>
+# include <sys/stat.h>
 #endif
 
 #if defined(PLATFORM_ANDROID)
@@ -71,7 +80,138 @@ bool FileLoader::Load(std::filesystem::path filePath, std::vector<char>& fileDat
 }
 #endif
 
+bool FileLoader::Save(std::filesystem::path filePath, const void* data, size_t size)
+{
+  std::error_code ec;
+  if (filePath.has_parent_path())
+  {
+    std::filesystem::create_directories(filePath.parent_path(), ec);
+  }
+  // 途中で失敗しても壊れたファイルが残らないよう、一時ファイルに書いてから置き換える.
+  auto tempPath = filePath;
+  tempPath += ".tmp";
+  {
+    std::ofstream outfile(tempPath, std::ios::binary | std::ios::trunc);
+    if (!outfile)
+    {
+      return false;
+    }
+    outfile.write(reinterpret_cast<const char*>(data), std::streamsize(size));
+    if (!outfile)
+    {
+      return false;
+    }
+  }
+  std::filesystem::rename(tempPath, filePath, ec);
+  if (ec)
+  {
+    std::filesystem::remove(tempPath, ec);
+    return false;
+  }
+  return true;
+}
+
+#if defined(PLATFORM_WINDOWS)
+bool FileLoader::Map(std::filesystem::path filePath, MappedFile& mappedFile)
+{
+  mappedFile.Unmap();
+  HANDLE file = CreateFileW(filePath.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+  if (file == INVALID_HANDLE_VALUE)
+  {
+    return false;
+  }
+  LARGE_INTEGER fileSize{};
+  if (!GetFileSizeEx(file, &fileSize) || fileSize.QuadPart == 0)
+  {
+    CloseHandle(file);
+    return false;
+  }
+  HANDLE mapping = CreateFileMappingW(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+  if (mapping == nullptr)
+  {
+    CloseHandle(file);
+    return false;
+  }
+  auto view = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+  if (view == nullptr)
+  {
+    CloseHandle(mapping);
+    CloseHandle(file);
+    return false;
+  }
+  mappedFile.m_data = static_cast<const uint8_t*>(view);
+  mappedFile.m_size = size_t(fileSize.QuadPart);
+  mappedFile.m_fileHandle = file;
+  mappedFile.m_mappingHandle = mapping;
+  return true;
+}
 
+void MappedFile::Unmap()
+{
+  if (m_data == nullptr)
+  {
+    return;
+  }
+  UnmapViewOfFile(m_data);
+  CloseHandle(m_mappingHandle);
+  CloseHandle(m_fileHandle);
+  m_data = nullptr;
+  m_size = 0;
+  m_fileHandle = nullptr;
+  m_mappingHandle = nullptr;
+}
+#else
+bool FileLoader::Map(std::filesystem::path filePath, MappedFile& mappedFile)
+{
+  mappedFile.Unmap();
+  int fd = open(filePath.c_str(), O_RDONLY);
+  if (fd < 0)
+  {
+    return false;
+  }
+  struct stat st{};
+  if (fstat(fd, &st) != 0 || st.st_size == 0)
+  {
+    close(fd);
+    return false;
+  }
+  // マップはファイルを閉じても有効なまま残る.
+  auto view = mmap(nullptr, size_t(st.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (view == MAP_FAILED)
+  {
+    return false;
+  }
+  mappedFile.m_data = static_cast<const uint8_t*>(view);
+  mappedFile.m_size = size_t(st.st_size);
+  return true;
+}
 
+void MappedFile::Unmap()
+{
+  if (m_data == nullptr)
+  {
+    return;
+  }
+  munmap(const_cast<uint8_t*>(m_data), m_size);
+  m_data = nullptr;
+  m_size = 0;
+}
+#endif
 
+#if defined(PLATFORM_WINDOWS) || defined(PLATFORM_LINUX)
+std::filesystem::path FileLoader::GetCachePath(std::filesystem::path fileName)
+{
+  return std::filesystem::path("cache") / fileName;
+}
+#endif
 
+#if defined(PLATFORM_ANDROID)
+std::filesystem::path FileLoader::GetCachePath(std::filesystem::path fileName)
+{
+  // アセットは読み取り専用のため、アプリの内部ストレージに置く.
+  auto& window = GetAppWindow();
+  auto androidApp = reinterpret_cast<android_app*>(window->GetPlatformHandle()->androidApp);
+  return std::filesystem::path(androidApp->activity->internalDataPath) / "cache" / fileName;
+}
+#endif
@@ -1,13 +1,43 @@
-#pragma once
+﻿#pragma once
 #include <memory>
 #include <vector>
 #include <cstdint>
 #include <filesystem>
 
+// 読み取り専用でメモリにマップしたファイル. 破棄時にマップを解除する.
+class MappedFile
+{
+public:
+  MappedFile() = default;
+  ~MappedFile() { Unmap(); }
+  MappedFile(const MappedFile&) = delete;
+  MappedFile& operator=(const MappedFile&) = delete;
+
+  void Unmap();
+
+  const uint8_t* GetData() const { return m_data; }
+  size_t GetSize() const { return m_size; }
+
+private:
+  friend class FileLoader;
+  const uint8_t* m_data = nullptr;
+  size_t m_size = 0;
+  void* m_fileHandle = nullptr;     // Windows のみ使用.
+  void* m_mappingHandle = nullptr;  // Windows のみ使用.
+};
+
 class FileLoader
 {
 public:
   bool Load(std::filesystem::path filePath, std::vector<char>& fileData);
+
+  // アプリが書き込める場所 (GetCachePath の結果) のファイルを扱う.
+  //  アセットとは異なり、Android でも通常のファイルとして読み書きする.
+  bool Save(std::filesystem::path filePath, const void* data, size_t size);
+  bool Map(std::filesystem::path filePath, MappedFile& mappedFile);
+
+  // 読み込み結果のキャッシュなど、実行時に生成するファイルの置き場所.
+  std::filesystem::path GetCachePath(std::filesystem::path fileName);
 };
 
 std::unique_ptr<FileLoader>& GetFileLoader();
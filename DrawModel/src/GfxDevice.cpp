@@ -82,6 +82,9 @@ void GfxDevice::Initialize(const DeviceInitParams& initParams)
   // ディスクリプタプールを作成.
   InitDescriptorPool();
 
+  // 共有するサンプラーのキャッシュ.
+  m_samplerCache.Initialize(m_vkDevice);
+
   // 描画の際に必要になる同期プリミティブの初期化.
   InitSemaphores();
 
@@ -105,6 +108,9 @@ void GfxDevice::Shutdown()
     // ディスクリプタプールの破棄.
     DestroyDescriptorPool();
 
+    // キャッシュしたサンプラーの破棄.
+    m_samplerCache.Destroy();
+
     // コマンドプールの破棄.
     DestroyCommandPool();
 
@@ -141,6 +147,9 @@ void GfxDevice::NewFrame()
   }
   vkResetFences(m_vkDevice, 1, &fence);
 
+  // 前回このフレームで使用したディスクリプタセットはGPU側で使用済みのためリセット.
+  frameInfo.descriptorAllocator.Reset();
+
   // コマンドバッファを開始.
   vkResetCommandBuffer(frameInfo.commandBuffer, 0);
   VkCommandBufferBeginInfo commandBeginInfo{
@@ -622,6 +631,24 @@ VkDescriptorPool GfxDevice::GetDescriptorPool() const
   return m_descriptorPool;
 }
 
+DescriptorAllocator& GfxDevice::GetFrameDescriptorAllocator()
+{
+  return m_frameCommandInfos[m_currentFrameIndex].descriptorAllocator;
+}
+
+const std::vector<DescriptorAllocator::PoolSizeRatio>& GfxDevice::GetDefaultPoolSizeRatios()
+{
+  // フレーム内で確保されるセット (スキニングなど) はストレージバッファを複数使用するため、
+  //  種類ごとに1セットで使用される最大数に合わせておく.
+  static const std::vector<DescriptorAllocator::PoolSizeRatio> ratios = {
+    { VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 1.0f },
+    { VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 1.0f },
+    { VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 4.0f },
+    { VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, 1.0f },
+  };
+  return ratios;
+}
+
 void GfxDevice::SubmitOneShot(VkCommandBuffer commandBuffer)
 {
   vkEndCommandBuffer(commandBuffer);
@@ -817,9 +844,24 @@ void GfxDevice::InitVkDevice()
   VkPhysicalDeviceVulkan13Features vulkan13Features{
     .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_3_FEATURES
   };
+  VkPhysicalDeviceMeshShaderFeaturesEXT meshShaderFeatures{
+    .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MESH_SHADER_FEATURES_EXT
+  };
   physFeatures2.pNext = &vulkan11Features;
   vulkan11Features.pNext = &vulkan12Features;
   vulkan12Features.pNext = &vulkan13Features;
+
+  // メッシュシェーダーは拡張機能が存在する場合のみ機能情報を問い合わせる.
+  uint32_t extensionCount = 0;
+  vkEnumerateDeviceExtensionProperties(m_vkPhysicalDevice, nullptr, &extensionCount, nullptr);
+  std::vector<VkExtensionProperties> extensionProps(extensionCount);
+  vkEnumerateDeviceExtensionProperties(m_vkPhysicalDevice, nullptr, &extensionCount, extensionProps.data());
+  bool hasMeshShaderExtension = std::any_of(extensionProps.begin(), extensionProps.end(),
+    [](const auto& v) { return strcmp(v.extensionName, VK_EXT_MESH_SHADER_EXTENSION_NAME) == 0; });
+  if (hasMeshShaderExtension)
+  {
+    vulkan13Features.pNext = &meshShaderFeatures;
+  }
   vkGetPhysicalDeviceFeatures2(m_vkPhysicalDevice, &physFeatures2);
 
   // 有効にする機能を明示的にセット.
@@ -829,12 +871,41 @@ void GfxDevice::InitVkDevice()
 
   vulkan12Features.descriptorIndexing = VK_FALSE;
 
+  // 間接描画でメッシュ番号を firstInstance で渡すため、関連する機能が揃っているかを確認.
+  m_supportDrawIndirectCount =
+    vulkan12Features.drawIndirectCount == VK_TRUE &&
+    physFeatures2.features.multiDrawIndirect == VK_TRUE &&
+    physFeatures2.features.drawIndirectFirstInstance == VK_TRUE;
+
+  // 計測用のクエリ. 機能は取得した状態のまま有効になる.
+  m_supportPipelineStatistics = physFeatures2.features.pipelineStatisticsQuery == VK_TRUE;
+  {
+    VkPhysicalDeviceProperties props{};
+    vkGetPhysicalDeviceProperties(m_vkPhysicalDevice, &props);
+    m_timestampPeriod = props.limits.timestampComputeAndGraphics ? props.limits.timestampPeriod : 0.0f;
+  }
+
   if (!IsSupportVulkan13())
   {
     // 下記を諦める.
     vulkan13Features.dynamicRendering = VK_FALSE;
   }
 
+  // メッシュシェーダー本体のみ有効にし、タスクシェーダー等の付随する機能は使わない.
+  m_supportMeshShader = hasMeshShaderExtension && meshShaderFeatures.meshShader == VK_TRUE;
+  if (m_supportMeshShader)
+  {
+    meshShaderFeatures = VkPhysicalDeviceMeshShaderFeaturesEXT{
+      .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MESH_SHADER_FEATURES_EXT,
+      .meshShader = VK_TRUE,
+    };
+    extensions.push_back(VK_EXT_MESH_SHADER_EXTENSION_NAME);
+  }
+  else
+  {
+    vulkan13Features.pNext = nullptr;
+  }
+
 
   // VkDeviceの生成.
   const float queuePriorities[] = { 1.0f };
@@ -981,24 +1052,14 @@ void GfxDevice::InitCommandBuffers()
 
 void GfxDevice::InitDescriptorPool()
 {
-  const uint32_t count = 10000;
+  // ImGui が個別に確保・解放するためのプール.
+  //  アプリケーション側のディスクリプタセットは DescriptorAllocator から確保する.
+  const uint32_t count = 64;
   std::vector<VkDescriptorPoolSize> poolSizes = { {
     {
       .type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
       .descriptorCount = count,
     },
-    {
-      .type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER,
-      .descriptorCount = count,
-    },
-    {
-      .type = VK_DESCRIPTOR_TYPE_SAMPLER,
-      .descriptorCount = count,
-    },
-    {
-      .type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
-      .descriptorCount = count,
-    },
   } };
   VkDescriptorPoolCreateInfo descriptorPoolCI{
     .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO,
@@ -1008,6 +1069,12 @@ void GfxDevice::InitDescriptorPool()
     .pPoolSizes = poolSizes.data(),
   };
   vkCreateDescriptorPool(m_vkDevice, &descriptorPoolCI, nullptr, &m_descriptorPool);
+
+  // フレームごとに使い捨てるディスクリプタセット用.
+  for (auto& frame : m_frameCommandInfos)
+  {
+    frame.descriptorAllocator.Initialize(m_vkDevice, 32, GetDefaultPoolSizeRatios());
+  }
 }
 
 void GfxDevice::DestroyVkDevice()
@@ -1069,6 +1136,10 @@ void GfxDevice::DestroyCommandBuffers()
 
 void GfxDevice::DestroyDescriptorPool()
 {
+  for (auto& frame : m_frameCommandInfos)
+  {
+    frame.descriptorAllocator.Destroy();
+  }
   vkDestroyDescriptorPool(m_vkDevice, m_descriptorPool, nullptr);
   m_descriptorPool = VK_NULL_HANDLE;
 }
@@ -1096,3 +1167,214 @@ void GfxDevice::DestroyVkInstance()
   vkDestroyInstance(m_vkInstance, nullptr);
   m_vkInstance = VK_NULL_HANDLE;
 }
+
+void DescriptorAllocator::Initialize(VkDevice device, uint32_t initialSetCount, const std::vector<PoolSizeRatio>& ratios)
+{
+  m_vkDevice = device;
+  m_ratios = ratios;
+  m_setsPerPool = initialSetCount;
+  m_stats = Stats{};
+
+  m_readyPools.push_back(CreatePool(m_setsPerPool));
+}
+
+std::vector<DescriptorAllocator::PoolSizeRatio> DescriptorAllocator::MakePoolSizeRatios(const std::vector<VkDescriptorSetLayoutBinding>& bindings)
+{
+  std::vector<PoolSizeRatio> ratios;
+  for (const auto& binding : bindings)
+  {
+    auto it = std::find_if(ratios.begin(), ratios.end(), [&](const auto& r) { return r.type == binding.descriptorType; });
+    if (it == ratios.end())
+    {
+      ratios.push_back({ binding.descriptorType, 0.0f });
+      it = ratios.end() - 1;
+    }
+    it->ratio += float(binding.descriptorCount);
+  }
+  return ratios;
+}
+
+void DescriptorAllocator::Destroy()
+{
+  for (auto pool : m_readyPools)
+  {
+    vkDestroyDescriptorPool(m_vkDevice, pool, nullptr);
+  }
+  for (auto pool : m_fullPools)
+  {
+    vkDestroyDescriptorPool(m_vkDevice, pool, nullptr);
+  }
+  m_readyPools.clear();
+  m_fullPools.clear();
+  m_stats = Stats{};
+}
+
+VkDescriptorSet DescriptorAllocator::Allocate(VkDescriptorSetLayout layout)
+{
+  VkDescriptorSet descriptorSet = VK_NULL_HANDLE;
+  if (!Allocate(&layout, 1, &descriptorSet))
+  {
+    return VK_NULL_HANDLE;
+  }
+  return descriptorSet;
+}
+
+bool DescriptorAllocator::Allocate(const VkDescriptorSetLayout* layouts, uint32_t count, VkDescriptorSet* outSets)
+{
+  auto pool = AcquirePool();
+  VkDescriptorSetAllocateInfo allocInfo{
+    .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO,
+    .descriptorPool = pool,
+    .descriptorSetCount = count,
+    .pSetLayouts = layouts,
+  };
+  auto res = vkAllocateDescriptorSets(m_vkDevice, &allocInfo, outSets);
+  if (res == VK_ERROR_OUT_OF_POOL_MEMORY || res == VK_ERROR_FRAGMENTED_POOL)
+  {
+    // 現在のプールは使い切ったとして、新しいプールから確保し直す.
+    m_fullPools.push_back(pool);
+    m_stats.growCount++;
+
+    pool = AcquirePool();
+    allocInfo.descriptorPool = pool;
+    res = vkAllocateDescriptorSets(m_vkDevice, &allocInfo, outSets);
+  }
+  m_readyPools.push_back(pool);
+  if (res != VK_SUCCESS)
+  {
+    // 新しいプールでも確保できない場合 (比率に対してレイアウトのディスクリプタが多すぎる等) は失敗を返す.
+    for (uint32_t i = 0; i < count; ++i)
+    {
+      outSets[i] = VK_NULL_HANDLE;
+    }
+    return false;
+  }
+  m_stats.allocatedSets += count;
+  return true;
+}
+
+void DescriptorAllocator::Reset()
+{
+  for (auto pool : m_readyPools)
+  {
+    vkResetDescriptorPool(m_vkDevice, pool, 0);
+  }
+  for (auto pool : m_fullPools)
+  {
+    vkResetDescriptorPool(m_vkDevice, pool, 0);
+    m_readyPools.push_back(pool);
+  }
+  m_fullPools.clear();
+  m_stats.allocatedSets = 0;
+  m_stats.resetCount++;
+}
+
+VkDescriptorPool DescriptorAllocator::AcquirePool()
+{
+  if (!m_readyPools.empty())
+  {
+    auto pool = m_readyPools.back();
+    m_readyPools.pop_back();
+    return pool;
+  }
+
+  // 追加するプールは徐々に大きくしていく.
+  m_setsPerPool = std::min(MaxSetsPerPool, m_setsPerPool + m_setsPerPool / 2);
+  return CreatePool(m_setsPerPool);
+}
+
+VkDescriptorPool DescriptorAllocator::CreatePool(uint32_t setCount)
+{
+  std::vector<VkDescriptorPoolSize> poolSizes;
+  for (const auto& r : m_ratios)
+  {
+    poolSizes.push_back({
+      .type = r.type,
+      .descriptorCount = std::max(1u, uint32_t(r.ratio * setCount)),
+    });
+  }
+  VkDescriptorPoolCreateInfo descriptorPoolCI{
+    .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO,
+    .flags = 0,
+    .maxSets = setCount,
+    .poolSizeCount = uint32_t(poolSizes.size()),
+    .pPoolSizes = poolSizes.data(),
+  };
+  VkDescriptorPool pool = VK_NULL_HANDLE;
+  auto res = vkCreateDescriptorPool(m_vkDevice, &descriptorPoolCI, nullptr, &pool);
+  assert(res == VK_SUCCESS);
+
+  m_stats.poolCount++;
+  m_stats.capacitySets += setCount;
+  return pool;
+}
+
+void SamplerCache::Initialize(VkDevice device)
+{
+  m_vkDevice = device;
+  m_stats = Stats{};
+}
+
+void SamplerCache::Destroy()
+{
+  for (auto& [key, sampler] : m_samplers)
+  {
+    vkDestroySampler(m_vkDevice, sampler, nullptr);
+  }
+  m_samplers.clear();
+  m_stats = Stats{};
+}
+
+VkSampler SamplerCache::Acquire(const VkSamplerCreateInfo& createInfo)
+{
+  assert(createInfo.pNext == nullptr);
+  m_stats.requestCount++;
+
+  auto [itr, inserted] = m_samplers.try_emplace(MakeKey(createInfo), VK_NULL_HANDLE);
+  if (inserted)
+  {
+    auto res = vkCreateSampler(m_vkDevice, &createInfo, nullptr, &itr->second);
+    assert(res == VK_SUCCESS);
+    m_stats.samplerCount++;
+  }
+  return itr->second;
+}
+
+SamplerCache::Key SamplerCache::MakeKey(const VkSamplerCreateInfo& createInfo)
+{
+  // 構造体のパディングを比較に含めないよう、メンバーを1つずつ詰める.
+  auto bits = [](float v) {
+    uint32_t u;
+    memcpy(&u, &v, sizeof(u));
+    return u;
+  };
+  return Key{
+    uint32_t(createInfo.flags),
+    uint32_t(createInfo.magFilter),
+    uint32_t(createInfo.minFilter),
+    uint32_t(createInfo.mipmapMode),
+    uint32_t(createInfo.addressModeU),
+    uint32_t(createInfo.addressModeV),
+    uint32_t(createInfo.addressModeW),
+    bits(createInfo.mipLodBias),
+    uint32_t(createInfo.anisotropyEnable),
+    bits(createInfo.maxAnisotropy),
+    uint32_t(createInfo.compareEnable),
+    uint32_t(createInfo.compareOp),
+    bits(createInfo.minLod),
+    bits(createInfo.maxLod),
+    uint32_t(createInfo.borderColor),
+    uint32_t(createInfo.unnormalizedCoordinates),
+  };
+}
+
+size_t SamplerCache::KeyHash::operator()(const Key& key) const
+{
+  // FNV-1a.
+  uint64_t hash = 14695981039346656037ull;
+  for (auto v : key)
+  {
+    hash = (hash ^ v) * 1099511628211ull;
+  }
+  return size_t(hash);
+}
@@ -2,6 +2,8 @@
 #include <memory>
 #include <vector>
 #include <string>
+#include <array>
+#include <unordered_map>
 
 #include "BasePlatform.h"
 
@@ -40,6 +42,90 @@ struct GpuImage
   VkImageLayout  layout = VK_IMAGE_LAYOUT_UNDEFINED;
 };
 
+// ディスクリプタセットの確保を行うアロケータ.
+//  プールが枯渇したら新しいプールを追加して確保を続ける.
+//  個別の解放は行わず、Reset で全プールをまとめて再利用可能な状態に戻す.
+class DescriptorAllocator
+{
+public:
+  // プールサイズを決めるための比率 (1セットあたりのディスクリプタ数).
+  struct PoolSizeRatio
+  {
+    VkDescriptorType type;
+    float ratio;
+  };
+  struct Stats
+  {
+    uint32_t poolCount = 0;       // 作成済みのプール数.
+    uint32_t allocatedSets = 0;   // 前回の Reset 以降に確保したセット数.
+    uint32_t capacitySets = 0;    // 全プールで確保可能なセット数の合計.
+    uint32_t growCount = 0;       // 枯渇によりプールを追加した回数.
+    uint32_t resetCount = 0;
+  };
+
+  void Initialize(VkDevice device, uint32_t initialSetCount, const std::vector<PoolSizeRatio>& ratios);
+  // セットレイアウトのバインディングから、1セット分のディスクリプタ数を種類ごとに集計した比率を作る.
+  static std::vector<PoolSizeRatio> MakePoolSizeRatios(const std::vector<VkDescriptorSetLayoutBinding>& bindings);
+  void Destroy();
+
+  // 確保できなかった場合は VK_NULL_HANDLE を返す.
+  VkDescriptorSet Allocate(VkDescriptorSetLayout layout);
+  // 確保できなかった場合は false を返し、outSets は全て VK_NULL_HANDLE になる.
+  bool Allocate(const VkDescriptorSetLayout* layouts, uint32_t count, VkDescriptorSet* outSets);
+
+  // 全プールを vkResetDescriptorPool でリセットする. 確保済みのセットは全て無効になる.
+  void Reset();
+
+  const Stats& GetStats() const { return m_stats; }
+
+private:
+  VkDescriptorPool AcquirePool();
+  VkDescriptorPool CreatePool(uint32_t setCount);
+
+  VkDevice m_vkDevice = VK_NULL_HANDLE;
+  std::vector<PoolSizeRatio> m_ratios;
+  std::vector<VkDescriptorPool> m_fullPools;
+  std::vector<VkDescriptorPool> m_readyPools;
+  uint32_t m_setsPerPool = 0;
+  Stats m_stats;
+
+  static const uint32_t MaxSetsPerPool = 4096;
+};
+
+// 作成情報が同じサンプラーを共有するキャッシュ.
+//  作成したサンプラーは Destroy までまとめて保持し、個別の破棄は行わない.
+class SamplerCache
+{
+public:
+  struct Stats
+  {
+    uint32_t samplerCount = 0;    // 作成したサンプラー数.
+    uint32_t requestCount = 0;    // Acquire の呼び出し回数.
+  };
+
+  void Initialize(VkDevice device);
+  void Destroy();
+
+  // 同じ作成情報のサンプラーがあればそれを返し、無ければ作成する.
+  //  pNext による拡張を含む作成情報は扱わない.
+  VkSampler Acquire(const VkSamplerCreateInfo& createInfo);
+
+  const Stats& GetStats() const { return m_stats; }
+
+private:
+  // VkSamplerCreateInfo の sType・pNext 以外のメンバーを 32bit ずつ並べたもの.
+  using Key = std::array<uint32_t, 16>;
+  struct KeyHash
+  {
+    size_t operator()(const Key& key) const;
+  };
+  static Key MakeKey(const VkSamplerCreateInfo& createInfo);
+
+  VkDevice m_vkDevice = VK_NULL_HANDLE;
+  std::unordered_map<Key, VkSampler, KeyHash> m_samplers;
+  Stats m_stats;
+};
+
 class GfxDevice
 {
 public:
@@ -96,8 +182,20 @@ public:
 
   uint32_t GetGraphicsQueueFamily() const;
   VkQueue GetGraphicsQueue() const;
+
+  // ImGui 用のディスクリプタプール (個別解放あり).
   VkDescriptorPool GetDescriptorPool() const;
 
+  // フレーム内でのみ使用するディスクリプタセットの確保用.
+  //  該当フレームのコマンド完了後(NewFrame内)にまとめてリセットされる.
+  DescriptorAllocator& GetFrameDescriptorAllocator();
+
+  // 作成情報ごとに共有するサンプラー. デバイスの破棄時にまとめて破棄される.
+  SamplerCache& GetSamplerCache() { return m_samplerCache; }
+
+  // ディスクリプタアロケータで使用するプールサイズの標準比率.
+  static const std::vector<DescriptorAllocator::PoolSizeRatio>& GetDefaultPoolSizeRatios();
+
   // コマンドバッファを新規に確保する.
   VkCommandBuffer AllocateCommandBuffer();
 
@@ -106,6 +204,14 @@ public:
 
   uint32_t GetMemoryTypeIndex(VkMemoryRequirements reqs, VkMemoryPropertyFlags memoryPropFlags);
   bool IsSupportVulkan13();
+  // GPU で生成した描画コマンドによる間接描画 (vkCmdDrawIndexedIndirectCount) が使えるか.
+  bool IsSupportDrawIndirectCount() const { return m_supportDrawIndirectCount; }
+  // VK_EXT_mesh_shader によるメッシュシェーダー描画が使えるか.
+  bool IsSupportMeshShader() const { return m_supportMeshShader; }
+  // パイプライン統計クエリ (フラグメントシェーダーの起動数など) が使えるか.
+  bool IsSupportPipelineStatistics() const { return m_supportPipelineStatistics; }
+  // タイムスタンプ1カウントあたりのナノ秒. グラフィックスキューで使えない場合は 0.
+  float GetTimestampPeriod() const { return m_timestampPeriod; }
   
   void SetObjectName(uint64_t handle, const char* name, VkObjectType type);
 private:
@@ -157,6 +263,10 @@ private:
   VkCommandPool m_commandPool = VK_NULL_HANDLE;
   VkDescriptorPool m_descriptorPool = VK_NULL_HANDLE;
   uint32_t m_currentFrameIndex = 0;
+  bool m_supportDrawIndirectCount = false;
+  bool m_supportMeshShader = false;
+  bool m_supportPipelineStatistics = false;
+  float m_timestampPeriod = 0.0f;
   uint32_t m_swapchainImageIndex = 0;
 
   struct FrameInfo
@@ -167,8 +277,12 @@ private:
     // 描画完了・Present完了待機のためのセマフォ.
     VkSemaphore renderCompleted = VK_NULL_HANDLE;
     VkSemaphore presentCompleted = VK_NULL_HANDLE;
+
+    DescriptorAllocator descriptorAllocator;
   };
   FrameInfo  m_frameCommandInfos[InflightFrames];
+
+  SamplerCache m_samplerCache;
 };
 
 std::unique_ptr<GfxDevice>& GetGfxDevice();
@@ -0,0 +1,1446 @@
+﻿#include "GltfImporter.h"
+#include "FileLoader.h"
+
+#include <cmath>
+#include <cstring>
+#include <cstdlib>
+#include <string_view>
+#include <algorithm>
+
+namespace
+{
+  // glTF の読み込みに必要な範囲の JSON の値.
+  class JsonValue
+  {
+  public:
+    enum Type : uint8_t
+    {
+      TYPE_NULL = 0,
+      TYPE_BOOL,
+      TYPE_NUMBER,
+      TYPE_STRING,
+      TYPE_ARRAY,
+      TYPE_OBJECT,
+    };
+    using Member = std::pair<std::string, JsonValue>;
+
+    Type GetType() const { return m_type; }
+    bool IsNull() const { return m_type == TYPE_NULL; }
+    bool IsNumber() const { return m_type == TYPE_NUMBER; }
+    bool IsString() const { return m_type == TYPE_STRING; }
+
+    // 配列の要素. 範囲外・配列以外では null を返す.
+    size_t GetSize() const { return m_type == TYPE_ARRAY ? m_items.size() : 0; }
+    const JsonValue& operator[](size_t index) const { return index < GetSize() ? m_items[index] : GetNull(); }
+
+    // オブジェクトのメンバー. 無い場合は null を返す.
+    const JsonValue& operator[](std::string_view key) const
+    {
+      for (const auto& member : m_members)
+      {
+        if (member.first == key)
+        {
+          return member.second;
+        }
+      }
+      return GetNull();
+    }
+    bool Has(std::string_view key) const { return !(*this)[key].IsNull(); }
+    const std::vector<Member>& GetMembers() const { return m_members; }
+
+    double GetNumber(double defaultValue = 0.0) const { return m_type == TYPE_NUMBER ? m_number : defaultValue; }
+    // 数値でない場合は defaultValue を返す. 有限でない、または int64_t の範囲外の数値は不正な値 (-1) とする.
+    int64_t GetInt(int64_t defaultValue = -1) const
+    {
+      if (m_type != TYPE_NUMBER)
+      {
+        return defaultValue;
+      }
+      if (!std::isfinite(m_number) || m_number < -9223372036854775808.0 || m_number >= 9223372036854775808.0)
+      {
+        return -1;
+      }
+      return int64_t(m_number);
+    }
+    bool GetBool(bool defaultValue = false) const { return m_type == TYPE_BOOL ? m_bool : defaultValue; }
+    const std::string& GetString() const { return m_string; }
+
+  private:
+    friend class JsonParser;
+    static const JsonValue& GetNull()
+    {
+      static const JsonValue nullValue;
+      return nullValue;
+    }
+
+    Type m_type = TYPE_NULL;
+    bool m_bool = false;
+    double m_number = 0.0;
+    std::string m_string;
+    std::vector<JsonValue> m_items;
+    std::vector<Member> m_members;
+  };
+
+  // 再帰下降の JSON パーサー. 文字列は NUL 終端されていること. (数値の変換に strtod を使う)
+  class JsonParser
+  {
+  public:
+    bool Parse(const std::string& text, JsonValue& outValue)
+    {
+      m_pos = text.c_str();
+      m_end = m_pos + text.size();
+      if (!ParseValue(outValue, 0))
+      {
+        return false;
+      }
+      SkipSpace();
+      return m_pos == m_end;
+    }
+
+  private:
+    static const int MaxDepth = 256;
+
+    void SkipSpace()
+    {
+      while (m_pos < m_end && (*m_pos == ' ' || *m_pos == '\t' || *m_pos == '\n' || *m_pos == '\r'))
+      {
+        ++m_pos;
+      }
+    }
+    bool Consume(char c)
+    {
+      SkipSpace();
+      if (m_pos < m_end && *m_pos == c)
+      {
+        ++m_pos;
+        return true;
+      }
+      return false;
+    }
+    bool ConsumeLiteral(std::string_view literal)
+    {
+      if (size_t(m_end - m_pos) < literal.size() || std::string_view(m_pos, literal.size()) != literal)
+      {
+        return false;
+      }
+      m_pos += literal.size();
+      return true;
+    }
+
+    bool ParseValue(JsonValue& value, int depth)
+    {
+      if (depth > MaxDepth)
+      {
+        return false;
+      }
+      SkipSpace();
+      if (m_pos >= m_end)
+      {
+        return false;
+      }
+      switch (*m_pos)
+      {
+      case '{':
+        return ParseObject(value, depth);
+      case '[':
+        return ParseArray(value, depth);
+      case '"':
+        value.m_type = JsonValue::TYPE_STRING;
+        return ParseString(value.m_string);
+      case 't':
+        value.m_type = JsonValue::TYPE_BOOL;
+        value.m_bool = true;
+        return ConsumeLiteral("true");
+      case 'f':
+        value.m_type = JsonValue::TYPE_BOOL;
+        value.m_bool = false;
+        return ConsumeLiteral("false");
+      case 'n':
+        value.m_type = JsonValue::TYPE_NULL;
+        return ConsumeLiteral("null");
+      default:
+        return ParseNumber(value);
+      }
+    }
+
+    bool ParseObject(JsonValue& value, int depth)
+    {
+      value.m_type = JsonValue::TYPE_OBJECT;
+      ++m_pos;
+      if (Consume('}'))
+      {
+        return true;
+      }
+      do
+      {
+        SkipSpace();
+        auto& member = value.m_members.emplace_back();
+        if (m_pos >= m_end || *m_pos != '"' || !ParseString(member.first) || !Consume(':'))
+        {
+          return false;
+        }
+        if (!ParseValue(member.second, depth + 1))
+        {
+          return false;
+        }
+      } while (Consume(','));
+      return Consume('}');
+    }
+
+    bool ParseArray(JsonValue& value, int depth)
+    {
+      value.m_type = JsonValue::TYPE_ARRAY;
+      ++m_pos;
+      if (Consume(']'))
+      {
+        return true;
+      }
+      do
+      {
+        if (!ParseValue(value.m_items.emplace_back(), depth + 1))
+        {
+          return false;
+        }
+      } while (Consume(','));
+      return Consume(']');
+    }
+
+    bool ParseNumber(JsonValue& value)
+    {
+      char* last = nullptr;
+      value.m_type = JsonValue::TYPE_NUMBER;
+      value.m_number = std::strtod(m_pos, &last);
+      if (last == m_pos || last > m_end)
+      {
+        return false;
+      }
+      m_pos = last;
+      return true;
+    }
+
+    static int HexValue(char c)
+    {
+      if (c >= '0' && c <= '9') { return c - '0'; }
+      if (c >= 'a' && c <= 'f') { return c - 'a' + 10; }
+      if (c >= 'A' && c <= 'F') { return c - 'A' + 10; }
+      return -1;
+    }
+    bool ParseHex4(uint32_t& code)
+    {
+      if (m_end - m_pos < 4)
+      {
+        return false;
+      }
+      code = 0;
+      for (int i = 0; i < 4; ++i)
+      {
+        int v = HexValue(*m_pos++);
+        if (v < 0)
+        {
+          return false;
+        }
+        code = (code << 4) | uint32_t(v);
+      }
+      return true;
+    }
+    static void AppendUtf8(std::string& str, uint32_t code)
+    {
+      if (code < 0x80)
+      {
+        str += char(code);
+      }
+      else if (code < 0x800)
+      {
+        str += char(0xC0 | (code >> 6));
+        str += char(0x80 | (code & 0x3F));
+      }
+      else if (code < 0x10000)
+      {
+        str += char(0xE0 | (code >> 12));
+        str += char(0x80 | ((code >> 6) & 0x3F));
+        str += char(0x80 | (code & 0x3F));
+      }
+      else
+      {
+        str += char(0xF0 | (code >> 18));
+        str += char(0x80 | ((code >> 12) & 0x3F));
+        str += char(0x80 | ((code >> 6) & 0x3F));
+        str += char(0x80 | (code & 0x3F));
+      }
+    }
+
+    bool ParseString(std::string& str)
+    {
+      ++m_pos;
+      // エスケープを含まない区間はまとめて追加する.
+      const char* run = m_pos;
+      while (m_pos < m_end)
+      {
+        char c = *m_pos;
+        if (c == '"')
+        {
+          str.append(run, m_pos);
+          ++m_pos;
+          return true;
+        }
+        if (c != '\\')
+        {
+          ++m_pos;
+          continue;
+        }
+        str.append(run, m_pos);
+        if (++m_pos >= m_end)
+        {
+          return false;
+        }
+        switch (*m_pos++)
+        {
+        case '"': str += '"'; break;
+        case '\\': str += '\\'; break;
+        case '/': str += '/'; break;
+        case 'b': str += '\b'; break;
+        case 'f': str += '\f'; break;
+        case 'n': str += '\n'; break;
+        case 'r': str += '\r'; break;
+        case 't': str += '\t'; break;
+        case 'u':
+          {
+            uint32_t code;
+            if (!ParseHex4(code))
+            {
+              return false;
+            }
+            // サロゲートペアは続く \uXXXX と合わせて1文字にする.
+            if (code >= 0xD800 && code < 0xDC00 && m_end - m_pos >= 6 && m_pos[0] == '\\' && m_pos[1] == 'u')
+            {
+              m_pos += 2;
+              uint32_t low;
+              if (!ParseHex4(low) || low < 0xDC00 || low >= 0xE000)
+              {
+                return false;
+              }
+              code = 0x10000 + ((code - 0xD800) << 10) + (low - 0xDC00);
+            }
+            AppendUtf8(str, code);
+          }
+          break;
+        default:
+          return false;
+        }
+        run = m_pos;
+      }
+      return false;
+    }
+
+    const char* m_pos = nullptr;
+    const char* m_end = nullptr;
+  };
+
+  // glTF の定数.
+  enum : uint32_t
+  {
+    GLTF_BYTE = 5120,
+    GLTF_UNSIGNED_BYTE = 5121,
+    GLTF_SHORT = 5122,
+    GLTF_UNSIGNED_SHORT = 5123,
+    GLTF_UNSIGNED_INT = 5125,
+    GLTF_FLOAT = 5126,
+
+    GLTF_MODE_TRIANGLES = 4,
+    GLTF_MODE_TRIANGLE_STRIP = 5,
+    GLTF_MODE_TRIANGLE_FAN = 6,
+
+    GLTF_WRAP_CLAMP_TO_EDGE = 33071,
+    GLTF_WRAP_MIRRORED_REPEAT = 33648,
+    GLTF_WRAP_REPEAT = 10497,
+
+    GLB_MAGIC = 0x46546C67,       // "glTF"
+    GLB_CHUNK_JSON = 0x4E4F534A,  // "JSON"
+    GLB_CHUNK_BIN = 0x004E4942,   // "BIN\0"
+  };
+
+  uint32_t GetComponentSize(uint32_t componentType)
+  {
+    switch (componentType)
+    {
+    case GLTF_BYTE:
+    case GLTF_UNSIGNED_BYTE:
+      return 1;
+    case GLTF_SHORT:
+    case GLTF_UNSIGNED_SHORT:
+      return 2;
+    case GLTF_UNSIGNED_INT:
+    case GLTF_FLOAT:
+      return 4;
+    default:
+      return 0;
+    }
+  }
+
+  uint32_t GetComponentCount(const std::string& type)
+  {
+    if (type == "SCALAR") { return 1; }
+    if (type == "VEC2") { return 2; }
+    if (type == "VEC3") { return 3; }
+    if (type == "VEC4") { return 4; }
+    if (type == "MAT2") { return 4; }
+    if (type == "MAT3") { return 9; }
+    if (type == "MAT4") { return 16; }
+    return 0;
+  }
+
+  VkSamplerAddressMode ConvertWrapMode(int64_t wrap)
+  {
+    switch (wrap)
+    {
+    case GLTF_WRAP_CLAMP_TO_EDGE:
+      return VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+    case GLTF_WRAP_MIRRORED_REPEAT:
+      return VK_SAMPLER_ADDRESS_MODE_MIRRORED_REPEAT;
+    default:
+      return VK_SAMPLER_ADDRESS_MODE_REPEAT;
+    }
+  }
+
+  // "data:...;base64," で始まる URI の内容を取り出す.
+  bool DecodeDataUri(const std::string& uri, std::vector<char>& outData)
+  {
+    auto comma = uri.find(',');
+    if (uri.compare(0, 5, "data:") != 0 || comma == std::string::npos || uri.rfind(";base64", comma) == std::string::npos)
+    {
+      return false;
+    }
+    auto decode = [](char c) -> int {
+      if (c >= 'A' && c <= 'Z') { return c - 'A'; }
+      if (c >= 'a' && c <= 'z') { return c - 'a' + 26; }
+      if (c >= '0' && c <= '9') { return c - '0' + 52; }
+      if (c == '+' || c == '-') { return 62; }
+      if (c == '/' || c == '_') { return 63; }
+      return -1;
+    };
+    outData.clear();
+    outData.reserve((uri.size() - comma) / 4 * 3);
+    uint32_t bits = 0;
+    int bitCount = 0;
+    for (size_t i = comma + 1; i < uri.size(); ++i)
+    {
+      int v = decode(uri[i]);
+      if (v < 0)
+      {
+        if (uri[i] == '=')
+        {
+          break;
+        }
+        return false;
+      }
+      bits = (bits << 6) | uint32_t(v);
+      bitCount += 6;
+      if (bitCount >= 8)
+      {
+        bitCount -= 8;
+        outData.push_back(char((bits >> bitCount) & 0xFF));
+      }
+    }
+    return true;
+  }
+
+  // URI の %XX を元の文字に戻す.
+  std::string DecodeUri(const std::string& uri)
+  {
+    std::string result;
+    result.reserve(uri.size());
+    for (size_t i = 0; i < uri.size(); ++i)
+    {
+      auto hex = [](char c) -> int {
+        if (c >= '0' && c <= '9') { return c - '0'; }
+        if (c >= 'a' && c <= 'f') { return c - 'a' + 10; }
+        if (c >= 'A' && c <= 'F') { return c - 'A' + 10; }
+        return -1;
+      };
+      if (uri[i] == '%' && i + 2 < uri.size() && hex(uri[i + 1]) >= 0 && hex(uri[i + 2]) >= 0)
+      {
+        result += char(hex(uri[i + 1]) * 16 + hex(uri[i + 2]));
+        i += 2;
+      }
+      else
+      {
+        result += uri[i];
+      }
+    }
+    return result;
+  }
+
+  // アクセサが指す要素の並び.
+  struct AccessorView
+  {
+    const uint8_t* data = nullptr;  // 最初の要素. バッファビューを持たない場合は nullptr で、全要素が 0.
+    size_t   count = 0;
+    size_t   stride = 0;
+    uint32_t componentType = 0;
+    uint32_t componentCount = 0;
+    bool     normalized = false;
+  };
+
+  // 1成分を float として読む. 正規化された整数は仕様の式で [-1, 1] または [0, 1] にする.
+  float ReadComponent(const uint8_t* src, uint32_t componentType, bool normalized)
+  {
+    switch (componentType)
+    {
+    case GLTF_FLOAT: { float v; memcpy(&v, src, 4); return v; }
+    case GLTF_BYTE: { int8_t v; memcpy(&v, src, 1); return normalized ? std::max(v / 127.0f, -1.0f) : float(v); }
+    case GLTF_UNSIGNED_BYTE: { uint8_t v; memcpy(&v, src, 1); return normalized ? v / 255.0f : float(v); }
+    case GLTF_SHORT: { int16_t v; memcpy(&v, src, 2); return normalized ? std::max(v / 32767.0f, -1.0f) : float(v); }
+    case GLTF_UNSIGNED_SHORT: { uint16_t v; memcpy(&v, src, 2); return normalized ? v / 65535.0f : float(v); }
+    case GLTF_UNSIGNED_INT: { uint32_t v; memcpy(&v, src, 4); return float(v); }
+    default: return 0.0f;
+    }
+  }
+
+  uint32_t ReadUnsigned(const uint8_t* src, uint32_t componentType)
+  {
+    switch (componentType)
+    {
+    case GLTF_UNSIGNED_BYTE: return src[0];
+    case GLTF_UNSIGNED_SHORT: { uint16_t v; memcpy(&v, src, 2); return v; }
+    case GLTF_UNSIGNED_INT: { uint32_t v; memcpy(&v, src, 4); return v; }
+    default: return 0;
+    }
+  }
+
+  // 要素を components 個の float として dst へ書き出す. 足りない成分は 0 とする.
+  //  float で並びが一致していれば、まとめてコピーする.
+  void ReadFloats(const AccessorView& view, uint32_t components, float* dst)
+  {
+    if (view.count == 0)
+    {
+      return;
+    }
+    if (view.data == nullptr)
+    {
+      std::fill(dst, dst + view.count * components, 0.0f);
+      return;
+    }
+    const auto rowBytes = size_t(components) * sizeof(float);
+    if (view.componentType == GLTF_FLOAT && view.componentCount == components)
+    {
+      if (view.stride == rowBytes)
+      {
+        memcpy(dst, view.data, view.count * rowBytes);
+        return;
+      }
+      for (size_t i = 0; i < view.count; ++i)
+      {
+        memcpy(dst + i * components, view.data + i * view.stride, rowBytes);
+      }
+      return;
+    }
+    const auto componentSize = GetComponentSize(view.componentType);
+    for (size_t i = 0; i < view.count; ++i)
+    {
+      const auto* src = view.data + i * view.stride;
+      for (uint32_t c = 0; c < components; ++c)
+      {
+        dst[i * components + c] = c < view.componentCount ? ReadComponent(src + c * componentSize, view.componentType, view.normalized) : 0.0f;
+      }
+    }
+  }
+
+  // 要素を components 個の符号なし整数として dst へ書き出す.
+  void ReadUnsigneds(const AccessorView& view, uint32_t components, uint32_t* dst)
+  {
+    if (view.count == 0)
+    {
+      return;
+    }
+    if (view.data == nullptr)
+    {
+      std::fill(dst, dst + view.count * components, 0u);
+      return;
+    }
+    if (view.componentType == GLTF_UNSIGNED_INT && view.componentCount == components && view.stride == components * sizeof(uint32_t))
+    {
+      memcpy(dst, view.data, view.count * view.stride);
+      return;
+    }
+    const auto componentSize = GetComponentSize(view.componentType);
+    for (size_t i = 0; i < view.count; ++i)
+    {
+      const auto* src = view.data + i * view.stride;
+      for (uint32_t c = 0; c < components; ++c)
+      {
+        dst[i * components + c] = c < view.componentCount ? ReadUnsigned(src + c * componentSize, view.componentType) : 0u;
+      }
+    }
+  }
+
+  // 平行移動・回転 (x, y, z, w)・スケールから T * R * S の行列を作る.
+  glm::mat4 ComposeTransform(const glm::vec3& t, const glm::vec4& q, const glm::vec3& s)
+  {
+    const float xx = q.x * q.x, yy = q.y * q.y, zz = q.z * q.z;
+    const float xy = q.x * q.y, xz = q.x * q.z, yz = q.y * q.z;
+    const float wx = q.w * q.x, wy = q.w * q.y, wz = q.w * q.z;
+
+    glm::mat4 m;
+    m[0] = glm::vec4(1.0f - 2.0f * (yy + zz), 2.0f * (xy + wz), 2.0f * (xz - wy), 0.0f) * s.x;
+    m[1] = glm::vec4(2.0f * (xy - wz), 1.0f - 2.0f * (xx + zz), 2.0f * (yz + wx), 0.0f) * s.y;
+    m[2] = glm::vec4(2.0f * (xz + wy), 2.0f * (yz - wx), 1.0f - 2.0f * (xx + yy), 0.0f) * s.z;
+    m[3] = glm::vec4(t.x, t.y, t.z, 1.0f);
+    return m;
+  }
+
+  // 行列を平行移動・回転・スケールに分ける. (せん断は含まないものとする)
+  void DecomposeTransform(const glm::mat4& m, glm::vec3& t, glm::vec4& q, glm::vec3& s)
+  {
+    t = glm::vec3(m[3]);
+    s = glm::vec3(glm::length(glm::vec3(m[0])), glm::length(glm::vec3(m[1])), glm::length(glm::vec3(m[2])));
+    glm::vec3 axis[3];
+    for (int i = 0; i < 3; ++i)
+    {
+      axis[i] = s[i] > 0.0f ? glm::vec3(m[i]) / s[i] : glm::vec3(0.0f);
+    }
+    // 回転行列からクォータニオンへ. 対角成分の大きいものを基準にして精度を保つ.
+    const float trace = axis[0].x + axis[1].y + axis[2].z;
+    if (trace > 0.0f)
+    {
+      float r = std::sqrt(1.0f + trace) * 2.0f;
+      q = glm::vec4((axis[1].z - axis[2].y) / r, (axis[2].x - axis[0].z) / r, (axis[0].y - axis[1].x) / r, 0.25f * r);
+    }
+    else if (axis[0].x > axis[1].y && axis[0].x > axis[2].z)
+    {
+      float r = std::sqrt(1.0f + axis[0].x - axis[1].y - axis[2].z) * 2.0f;
+      q = glm::vec4(0.25f * r, (axis[1].x + axis[0].y) / r, (axis[2].x + axis[0].z) / r, (axis[1].z - axis[2].y) / r);
+    }
+    else if (axis[1].y > axis[2].z)
+    {
+      float r = std::sqrt(1.0f + axis[1].y - axis[0].x - axis[2].z) * 2.0f;
+      q = glm::vec4((axis[1].x + axis[0].y) / r, 0.25f * r, (axis[2].y + axis[1].z) / r, (axis[2].x - axis[0].z) / r);
+    }
+    else
+    {
+      float r = std::sqrt(1.0f + axis[2].z - axis[0].x - axis[1].y) * 2.0f;
+      q = glm::vec4((axis[2].x + axis[0].z) / r, (axis[2].y + axis[1].z) / r, 0.25f * r, (axis[0].y - axis[1].x) / r);
+    }
+  }
+
+  // 法線を持たないメッシュは、面の法線 (面積で重み付け) を頂点ごとに平均して作る.
+  void GenerateNormals(ModelMesh& mesh)
+  {
+    mesh.normals.assign(mesh.positions.size(), glm::vec3(0.0f));
+    for (size_t i = 0; i + 2 < mesh.indices.size(); i += 3)
+    {
+      const auto i0 = mesh.indices[i + 0], i1 = mesh.indices[i + 1], i2 = mesh.indices[i + 2];
+      const auto& p0 = mesh.positions[i0];
+      const auto faceNormal = glm::cross(mesh.positions[i1] - p0, mesh.positions[i2] - p0);
+      mesh.normals[i0] += faceNormal;
+      mesh.normals[i1] += faceNormal;
+      mesh.normals[i2] += faceNormal;
+    }
+    for (auto& n : mesh.normals)
+    {
+      float length = glm::length(n);
+      n = length > 0.0f ? n / length : glm::vec3(0.0f, 1.0f, 0.0f);
+    }
+  }
+}
+
+struct GltfImporter::Document
+{
+  JsonValue json;
+  std::filesystem::path basePath;
+  std::vector<std::vector<char>> buffers;
+
+  // 三角形のプリミティブ. ModelMesh の並び.
+  struct Primitive
+  {
+    const JsonValue* json;
+    uint32_t materialIndex;
+    int32_t  skin;    // メッシュを置くノードのスキン. (最初に見つかったもの)
+  };
+  std::vector<Primitive> primitives;
+  std::vector<std::vector<uint32_t>> meshPrimitives;  // glTF のメッシュごとのプリミティブ番号.
+  uint32_t materialCount = 0;   // プリミティブがマテリアルを持たない場合は既定のマテリアルを末尾に追加する.
+
+  // 埋め込みテクスチャ (バッファビュー・data URI の画像) の番号. 外部ファイルの画像は -1.
+  std::vector<int32_t> imageEmbeddedIndices;
+  std::vector<uint32_t> embeddedImages;
+
+  // 出力するノード (親が先) と、glTF のノード番号からの対応.
+  std::vector<ModelNode> nodes;
+  std::vector<int32_t> nodeIndices;
+  // ノードの初期姿勢. アニメーションでキーを持たないトラックに使う.
+  struct RestPose
+  {
+    glm::vec3 translation = glm::vec3(0.0f);
+    glm::vec4 rotation = glm::vec4(0.0f, 0.0f, 0.0f, 1.0f);
+    glm::vec3 scale = glm::vec3(1.0f);
+  };
+  std::vector<RestPose> restPoses;
+
+  bool GetAccessor(int64_t accessorIndex, AccessorView& outView) const;
+  bool GetBufferView(int64_t viewIndex, const uint8_t*& outData, size_t& outSize, size_t& outStride) const;
+  void AddNode(int64_t gltfIndex, int32_t parent, std::vector<uint8_t>& visited);
+};
+
+bool GltfImporter::Document::GetBufferView(int64_t viewIndex, const uint8_t*& outData, size_t& outSize, size_t& outStride) const
+{
+  const auto& view = json["bufferViews"][size_t(viewIndex)];
+  const auto bufferIndex = view["buffer"].GetInt();
+  if (view.IsNull() || bufferIndex < 0 || size_t(bufferIndex) >= buffers.size())
+  {
+    return false;
+  }
+  const auto& buffer = buffers[bufferIndex];
+  const auto offset = size_t(view["byteOffset"].GetInt(0));
+  const auto length = size_t(view["byteLength"].GetInt(0));
+  if (offset > buffer.size() || length > buffer.size() - offset)
+  {
+    return false;
+  }
+  outData = reinterpret_cast<const uint8_t*>(buffer.data()) + offset;
+  outSize = length;
+  outStride = size_t(view["byteStride"].GetInt(0));
+  return true;
+}
+
+bool GltfImporter::Document::GetAccessor(int64_t accessorIndex, AccessorView& outView) const
+{
+  const auto& accessor = json["accessors"][size_t(accessorIndex)];
+  // 要素数が不正な場合、バッファビューを持たないアクセサでは範囲の確認が行われないため、ここで弾いておく.
+  if (accessorIndex < 0 || accessor.IsNull() || accessor["count"].GetInt(0) < 0)
+  {
+    return false;
+  }
+  outView = AccessorView{
+    .data = nullptr,
+    .count = size_t(accessor["count"].GetInt(0)),
+    .stride = 0,
+    .componentType = uint32_t(accessor["componentType"].GetInt(0)),
+    .componentCount = GetComponentCount(accessor["type"].GetString()),
+    .normalized = accessor["normalized"].GetBool(false),
+  };
+  const auto componentSize = GetComponentSize(outView.componentType);
+  const auto elementSize = size_t(componentSize) * outView.componentCount;
+  if (elementSize == 0)
+  {
+    return false;
+  }
+  outView.stride = elementSize;
+  if (!accessor.Has("bufferView"))
+  {
+    return true;
+  }
+
+  // 全要素がバッファビューの範囲に収まることを確認しておく.
+  const uint8_t* data = nullptr;
+  size_t size = 0, stride = 0;
+  if (!GetBufferView(accessor["bufferView"].GetInt(), data, size, stride))
+  {
+    return false;
+  }
+  const auto offset = size_t(accessor["byteOffset"].GetInt(0));
+  outView.stride = stride != 0 ? stride : elementSize;
+  if (outView.count > 0)
+  {
+    if (offset > size || (outView.count - 1) > (size - offset) / outView.stride ||
+      (outView.count - 1) * outView.stride + elementSize > size - offset)
+    {
+      return false;
+    }
+  }
+  outView.data = data + offset;
+  return true;
+}
+
+void GltfImporter::Document::AddNode(int64_t gltfIndex, int32_t parent, std::vector<uint8_t>& visited)
+{
+  const auto& srcNode = json["nodes"][size_t(gltfIndex)];
+  if (gltfIndex < 0 || srcNode.IsNull() || visited[gltfIndex])
+  {
+    return;
+  }
+  visited[gltfIndex] = 1;
+
+  // 子の追加で配列が再確保されるため、参照は保持しない.
+  const auto nodeIndex = int32_t(nodes.size());
+  nodeIndices[gltfIndex] = nodeIndex;
+  {
+    auto& node = nodes.emplace_back();
+    auto& rest = restPoses.emplace_back();
+    node.name = srcNode["name"].GetString();
+    node.parent = parent;
+    if (const auto& matrix = srcNode["matrix"]; matrix.GetSize() == 16)
+    {
+      // glTF の行列は列優先.
+      for (int i = 0; i < 16; ++i)
+      {
+        node.transform[i / 4][i % 4] = float(matrix[i].GetNumber());
+      }
+      DecomposeTransform(node.transform, rest.translation, rest.rotation, rest.scale);
+    }
+    else
+    {
+      const auto& t = srcNode["translation"];
+      const auto& r = srcNode["rotation"];
+      const auto& s = srcNode["scale"];
+      if (t.GetSize() == 3)
+      {
+        rest.translation = glm::vec3(float(t[0].GetNumber()), float(t[1].GetNumber()), float(t[2].GetNumber()));
+      }
+      if (r.GetSize() == 4)
+      {
+        rest.rotation = glm::vec4(float(r[0].GetNumber()), float(r[1].GetNumber()), float(r[2].GetNumber()), float(r[3].GetNumber()));
+      }
+      if (s.GetSize() == 3)
+      {
+        rest.scale = glm::vec3(float(s[0].GetNumber()), float(s[1].GetNumber()), float(s[2].GetNumber()));
+      }
+      node.transform = ComposeTransform(rest.translation, rest.rotation, rest.scale);
+    }
+    if (const auto mesh = srcNode["mesh"].GetInt(); mesh >= 0 && size_t(mesh) < meshPrimitives.size())
+    {
+      node.meshes = meshPrimitives[mesh];
+      // 同じメッシュを別のスキンで置くことは想定せず、最初に見つかったスキンを使う.
+      if (const auto skin = srcNode["skin"].GetInt(); skin >= 0)
+      {
+        for (auto primitiveIndex : node.meshes)
+        {
+          if (primitives[primitiveIndex].skin < 0)
+          {
+            primitives[primitiveIndex].skin = int32_t(skin);
+          }
+        }
+      }
+    }
+  }
+  const auto& children = srcNode["children"];
+  for (size_t i = 0; i < children.GetSize(); ++i)
+  {
+    AddNode(children[i].GetInt(), nodeIndex, visited);
+  }
+}
+
+GltfImporter::GltfImporter()
+{
+}
+
+GltfImporter::~GltfImporter()
+{
+}
+
+bool GltfImporter::IsSupportedFile(const std::filesystem::path& filePath)
+{
+  auto extension = filePath.extension().string();
+  std::transform(extension.begin(), extension.end(), extension.begin(), [](char c) { return char(std::tolower(c)); });
+  return extension == ".gltf" || extension == ".glb";
+}
+
+bool GltfImporter::Open(const std::filesystem::path& filePath, const std::vector<char>& fileData, std::vector<ModelCacheDependency>& dependencies)
+{
+  m_document.reset();
+  auto document = std::make_unique<Document>();
+  auto& doc = *document;
+  doc.basePath = filePath.parent_path();
+
+  // GLB は JSON チャンクと、続くバイナリチャンク (最初のバッファ) に分かれる.
+  std::string jsonText;
+  std::vector<char> binaryChunk;
+  bool hasBinaryChunk = false;
+  auto readU32 = [&](size_t offset) {
+    uint32_t v;
+    memcpy(&v, fileData.data() + offset, sizeof(v));
+    return v;
+  };
+  if (fileData.size() >= 12 && readU32(0) == GLB_MAGIC)
+  {
+    const size_t length = std::min<size_t>(readU32(8), fileData.size());
+    if (readU32(4) != 2)
+    {
+      return false;
+    }
+    size_t offset = 12;
+    while (offset + 8 <= length)
+    {
+      const size_t chunkLength = readU32(offset);
+      const auto chunkType = readU32(offset + 4);
+      offset += 8;
+      if (chunkLength > length - offset)
+      {
+        return false;
+      }
+      const auto* chunk = fileData.data() + offset;
+      if (chunkType == GLB_CHUNK_JSON && jsonText.empty())
+      {
+        jsonText.assign(chunk, chunkLength);
+      }
+      else if (chunkType == GLB_CHUNK_BIN && !hasBinaryChunk)
+      {
+        binaryChunk.assign(chunk, chunk + chunkLength);
+        hasBinaryChunk = true;
+      }
+      offset += (chunkLength + 3) & ~size_t(3);
+    }
+  }
+  else
+  {
+    jsonText.assign(fileData.data(), fileData.size());
+    if (jsonText.compare(0, 3, "\xEF\xBB\xBF") == 0)
+    {
+      jsonText.erase(0, 3);
+    }
+  }
+
+  JsonParser parser;
+  if (!parser.Parse(jsonText, doc.json) || doc.json.GetType() != JsonValue::TYPE_OBJECT)
+  {
+    return false;
+  }
+  const auto& json = doc.json;
+  if (json["asset"]["version"].GetString().compare(0, 1, "2") != 0)
+  {
+    return false;
+  }
+  // 必須の拡張は、成分の型を一般化するだけの KHR_mesh_quantization のみ扱える.
+  const auto& required = json["extensionsRequired"];
+  for (size_t i = 0; i < required.GetSize(); ++i)
+  {
+    if (required[i].GetString() != "KHR_mesh_quantization")
+    {
+      return false;
+    }
+  }
+
+  // バッファ. uri を持たないものは GLB のバイナリチャンク.
+  const auto& buffers = json["buffers"];
+  doc.buffers.resize(buffers.GetSize());
+  for (size_t i = 0; i < buffers.GetSize(); ++i)
+  {
+    const auto& buffer = buffers[i];
+    const auto byteLength = size_t(buffer["byteLength"].GetInt(0));
+    auto& data = doc.buffers[i];
+    if (!buffer.Has("uri"))
+    {
+      if (i != 0 || !hasBinaryChunk)
+      {
+        return false;
+      }
+      data = std::move(binaryChunk);
+    }
+    else if (const auto& uri = buffer["uri"].GetString(); uri.compare(0, 5, "data:") == 0)
+    {
+      if (!DecodeDataUri(uri, data))
+      {
+        return false;
+      }
+    }
+    else
+    {
+      const auto path = DecodeUri(uri);
+      if (!GetFileLoader()->Load(doc.basePath / path, data))
+      {
+        return false;
+      }
+      dependencies.push_back({ .path = path, .hash = ComputeContentHash(data.data(), data.size()) });
+    }
+    if (data.size() < byteLength)
+    {
+      return false;
+    }
+  }
+
+  // スパースアクセサは扱わない.
+  const auto& accessors = json["accessors"];
+  for (size_t i = 0; i < accessors.GetSize(); ++i)
+  {
+    if (accessors[i].Has("sparse"))
+    {
+      return false;
+    }
+  }
+
+  // 三角形のプリミティブを並べる. 点・線のプリミティブは描画しないため読み飛ばす.
+  doc.materialCount = uint32_t(json["materials"].GetSize());
+  bool needsDefaultMaterial = false;
+  const auto& meshes = json["meshes"];
+  doc.meshPrimitives.resize(meshes.GetSize());
+  for (size_t meshIndex = 0; meshIndex < meshes.GetSize(); ++meshIndex)
+  {
+    const auto& primitives = meshes[meshIndex]["primitives"];
+    for (size_t i = 0; i < primitives.GetSize(); ++i)
+    {
+      const auto& primitive = primitives[i];
+      const auto mode = primitive["mode"].GetInt(GLTF_MODE_TRIANGLES);
+      if ((mode != GLTF_MODE_TRIANGLES && mode != GLTF_MODE_TRIANGLE_STRIP && mode != GLTF_MODE_TRIANGLE_FAN) ||
+        !primitive["attributes"].Has("POSITION"))
+      {
+        continue;
+      }
+      if (primitive.Has("extensions"))
+      {
+        // Draco などの圧縮されたプリミティブは読めない.
+        return false;
+      }
+      auto material = primitive["material"].GetInt();
+      if (material < 0 || material >= int64_t(doc.materialCount))
+      {
+        needsDefaultMaterial = true;
+        material = -1;
+      }
+      doc.meshPrimitives[meshIndex].push_back(uint32_t(doc.primitives.size()));
+      doc.primitives.push_back({ .json = &primitive, .materialIndex = uint32_t(material), .skin = -1 });
+    }
+  }
+  if (needsDefaultMaterial)
+  {
+    for (auto& primitive : doc.primitives)
+    {
+      if (primitive.materialIndex == uint32_t(-1))
+      {
+        primitive.materialIndex = doc.materialCount;
+      }
+    }
+    doc.materialCount++;
+  }
+
+  // 画像のうち、バッファビュー・data URI で埋め込まれたものを埋め込みテクスチャとする.
+  const auto& images = json["images"];
+  doc.imageEmbeddedIndices.assign(images.GetSize(), -1);
+  for (size_t i = 0; i < images.GetSize(); ++i)
+  {
+    const auto& image = images[i];
+    if (image.Has("bufferView") || image["uri"].GetString().compare(0, 5, "data:") == 0)
+    {
+      doc.imageEmbeddedIndices[i] = int32_t(doc.embeddedImages.size());
+      doc.embeddedImages.push_back(uint32_t(i));
+    }
+  }
+
+  // ノードはシーンのルートからたどり、親が子より前になるように並べる.
+  //  シーンを持たない場合は、どのノードの子でもないものをルートとする.
+  const auto& nodes = json["nodes"];
+  std::vector<int64_t> roots;
+  const auto& scenes = json["scenes"];
+  if (scenes.GetSize() > 0)
+  {
+    const auto& sceneNodes = scenes[size_t(std::max<int64_t>(json["scene"].GetInt(0), 0))]["nodes"];
+    for (size_t i = 0; i < sceneNodes.GetSize(); ++i)
+    {
+      roots.push_back(sceneNodes[i].GetInt());
+    }
+  }
+  else
+  {
+    std::vector<uint8_t> isChild(nodes.GetSize(), 0);
+    for (size_t i = 0; i < nodes.GetSize(); ++i)
+    {
+      const auto& children = nodes[i]["children"];
+      for (size_t c = 0; c < children.GetSize(); ++c)
+      {
+        if (auto child = children[c].GetInt(); child >= 0 && size_t(child) < isChild.size())
+        {
+          isChild[child] = 1;
+        }
+      }
+    }
+    for (size_t i = 0; i < nodes.GetSize(); ++i)
+    {
+      if (!isChild[i])
+      {
+        roots.push_back(int64_t(i));
+      }
+    }
+  }
+  doc.nodeIndices.assign(nodes.GetSize(), -1);
+  std::vector<uint8_t> visited(nodes.GetSize(), 0);
+  int32_t rootParent = -1;
+  if (roots.size() != 1)
+  {
+    auto& root = doc.nodes.emplace_back();
+    root.name = "ROOT";
+    doc.restPoses.emplace_back();
+    rootParent = 0;
+  }
+  for (auto root : roots)
+  {
+    doc.AddNode(root, rootParent, visited);
+  }
+
+  m_document = std::move(document);
+  return true;
+}
+
+uint32_t GltfImporter::GetMeshCount() const
+{
+  return m_document ? uint32_t(m_document->primitives.size()) : 0;
+}
+
+uint32_t GltfImporter::GetMaterialCount() const
+{
+  return m_document ? m_document->materialCount : 0;
+}
+
+uint32_t GltfImporter::GetEmbeddedTextureCount() const
+{
+  return m_document ? uint32_t(m_document->embeddedImages.size()) : 0;
+}
+
+bool GltfImporter::ReadMesh(uint32_t meshIndex, ModelMesh& dstMesh, bool readSkin) const
+{
+  const auto& doc = *m_document;
+  const auto& primitive = doc.primitives[meshIndex];
+  const auto& attributes = (*primitive.json)["attributes"];
+  dstMesh.materialIndex = primitive.materialIndex;
+
+  AccessorView positions;
+  if (!doc.GetAccessor(attributes["POSITION"].GetInt(), positions) || positions.componentCount != 3)
+  {
+    return false;
+  }
+  const auto vertexCount = positions.count;
+  dstMesh.positions.resize(vertexCount);
+  ReadFloats(positions, 3, &dstMesh.positions.data()->x);
+
+  // 頂点属性は位置と同じ数でなければならない.
+  auto readAttribute = [&](const char* name, uint32_t components, float* dst) {
+    AccessorView view;
+    if (!doc.GetAccessor(attributes[name].GetInt(), view) || view.count != vertexCount)
+    {
+      return false;
+    }
+    ReadFloats(view, components, dst);
+    return true;
+  };
+  const bool hasNormals = attributes.Has("NORMAL");
+  if (hasNormals)
+  {
+    dstMesh.normals.resize(vertexCount);
+    if (!readAttribute("NORMAL", 3, &dstMesh.normals.data()->x))
+    {
+      return false;
+    }
+  }
+  dstMesh.texcoords.resize(vertexCount);
+  if (attributes.Has("TEXCOORD_0") && !readAttribute("TEXCOORD_0", 2, &dstMesh.texcoords.data()->x))
+  {
+    return false;
+  }
+
+  // インデックス. 持たない場合は頂点の並び順.
+  std::vector<uint32_t> indices;
+  if (const auto& json = *primitive.json; json.Has("indices"))
+  {
+    AccessorView view;
+    if (!doc.GetAccessor(json["indices"].GetInt(), view) || view.componentCount != 1)
+    {
+      return false;
+    }
+    indices.resize(view.count);
+    ReadUnsigneds(view, 1, indices.data());
+    if (std::any_of(indices.begin(), indices.end(), [&](uint32_t index) { return index >= vertexCount; }))
+    {
+      return false;
+    }
+  }
+  else
+  {
+    indices.resize(vertexCount);
+    for (uint32_t i = 0; i < uint32_t(vertexCount); ++i)
+    {
+      indices[i] = i;
+    }
+  }
+
+  // ストリップ・ファンは三角形のリストにする.
+  const auto mode = (*primitive.json)["mode"].GetInt(GLTF_MODE_TRIANGLES);
+  if (mode == GLTF_MODE_TRIANGLES)
+  {
+    indices.resize(indices.size() / 3 * 3);
+    dstMesh.indices = std::move(indices);
+  }
+  else
+  {
+    const auto triangleCount = indices.size() >= 3 ? indices.size() - 2 : 0;
+    dstMesh.indices.resize(triangleCount * 3);
+    for (size_t i = 0; i < triangleCount; ++i)
+    {
+      auto* dst = &dstMesh.indices[i * 3];
+      if (mode == GLTF_MODE_TRIANGLE_STRIP)
+      {
+        // 奇数番目の三角形は向きを揃えるため入れ替える.
+        dst[0] = indices[i];
+        dst[1] = indices[i + 1 + (i & 1)];
+        dst[2] = indices[i + 2 - (i & 1)];
+      }
+      else
+      {
+        dst[0] = indices[i + 1];
+        dst[1] = indices[i + 2];
+        dst[2] = indices[0];
+      }
+    }
+  }
+
+  if (!hasNormals)
+  {
+    GenerateNormals(dstMesh);
+  }
+
+  if (!readSkin || primitive.skin < 0 || !attributes.Has("JOINTS_0") || !attributes.Has("WEIGHTS_0"))
+  {
+    return true;
+  }
+
+  // スキン. ジョイントの番号はスキンの joints の並びで、ModelMesh::joints と一致する.
+  const auto& skin = doc.json["skins"][size_t(primitive.skin)];
+  const auto& jointNodes = skin["joints"];
+  const auto jointCount = uint32_t(jointNodes.GetSize());
+  if (jointCount == 0)
+  {
+    return true;
+  }
+  std::vector<glm::mat4> inverseBindMatrices(jointCount, glm::mat4(1.0f));
+  if (skin.Has("inverseBindMatrices"))
+  {
+    AccessorView view;
+    if (!doc.GetAccessor(skin["inverseBindMatrices"].GetInt(), view) || view.componentCount != 16 || view.count < jointCount)
+    {
+      return false;
+    }
+    view.count = jointCount;
+    ReadFloats(view, 16, &inverseBindMatrices[0][0].x);
+  }
+  dstMesh.joints.resize(jointCount);
+  for (uint32_t i = 0; i < jointCount; ++i)
+  {
+    const auto node = jointNodes[i].GetInt();
+    if (node < 0 || size_t(node) >= doc.nodeIndices.size() || doc.nodeIndices[node] < 0)
+    {
+      return false;
+    }
+    dstMesh.joints[i] = ModelJoint{
+      .nodeIndex = uint32_t(doc.nodeIndices[node]),
+      .inverseBindMatrix = inverseBindMatrices[i],
+    };
+  }
+
+  dstMesh.jointIndices.resize(vertexCount);
+  dstMesh.jointWeights.resize(vertexCount);
+  AccessorView jointView;
+  if (!doc.GetAccessor(attributes["JOINTS_0"].GetInt(), jointView) || jointView.count != vertexCount)
+  {
+    return false;
+  }
+  ReadUnsigneds(jointView, 4, &dstMesh.jointIndices.data()->x);
+  if (!readAttribute("WEIGHTS_0", 4, &dstMesh.jointWeights.data()->x))
+  {
+    return false;
+  }
+
+  // ウェイトの合計を 1 にする. どのジョイントの影響も受けない頂点は最初のジョイントに従わせる.
+  for (size_t i = 0; i < vertexCount; ++i)
+  {
+    auto& joints = dstMesh.jointIndices[i];
+    auto& weights = dstMesh.jointWeights[i];
+    for (int j = 0; j < 4; ++j)
+    {
+      if (joints[j] >= jointCount)
+      {
+        joints[j] = 0;
+        weights[j] = 0.0f;
+      }
+    }
+    float sum = weights.x + weights.y + weights.z + weights.w;
+    if (sum > 0.0f)
+    {
+      weights /= sum;
+    }
+    else
+    {
+      joints = glm::uvec4(0);
+      weights = glm::vec4(1.0f, 0.0f, 0.0f, 0.0f);
+    }
+  }
+  return true;
+}
+
+bool GltfImporter::ReadMaterial(uint32_t materialIndex, ModelMaterial& dstMaterial) const
+{
+  const auto& doc = *m_document;
+  const auto& material = doc.json["materials"][materialIndex];
+
+  // 既定のマテリアル (範囲外) は白の不透明とする.
+  const auto& pbr = material["pbrMetallicRoughness"];
+  glm::vec4 baseColor(1.0f);
+  if (const auto& factor = pbr["baseColorFactor"]; factor.GetSize() == 4)
+  {
+    baseColor = glm::vec4(float(factor[0].GetNumber()), float(factor[1].GetNumber()), float(factor[2].GetNumber()), float(factor[3].GetNumber()));
+  }
+  dstMaterial.diffuse = glm::vec3(baseColor);
+  dstMaterial.specular = glm::vec3(1.0f);
+  dstMaterial.ambient = glm::vec3(0.0f);
+
+  // アルファは OPAQUE 以外の場合のみ使う.
+  const auto& alphaMode = material["alphaMode"].GetString();
+  dstMaterial.alphaMode = ModelMaterial::ALPHA_MODE_OPAQUE;
+  if (alphaMode == "MASK")
+  {
+    dstMaterial.alphaMode = ModelMaterial::ALPHA_MODE_MASK;
+  }
+  if (alphaMode == "BLEND")
+  {
+    dstMaterial.alphaMode = ModelMaterial::ALPHA_MODE_BLEND;
+  }
+  dstMaterial.alpha = dstMaterial.alphaMode == ModelMaterial::ALPHA_MODE_OPAQUE ? 1.0f : baseColor.w;
+
+  if (const auto& baseColorTexture = pbr["baseColorTexture"]; baseColorTexture.Has("index"))
+  {
+    const auto& texture = doc.json["textures"][size_t(baseColorTexture["index"].GetInt(0))];
+    const auto imageIndex = texture["source"].GetInt();
+    if (imageIndex < 0 || size_t(imageIndex) >= doc.imageEmbeddedIndices.size())
+    {
+      return false;
+    }
+    auto& dstTexture = dstMaterial.texDiffuse;
+    dstTexture.embeddedIndex = doc.imageEmbeddedIndices[imageIndex];
+    if (dstTexture.embeddedIndex >= 0)
+    {
+      dstTexture.filePath = (doc.basePath / ("*" + std::to_string(dstTexture.embeddedIndex))).string();
+    }
+    else
+    {
+      dstTexture.filePath = (doc.basePath / DecodeUri(doc.json["images"][size_t(imageIndex)]["uri"].GetString())).string();
+    }
+    const auto& sampler = doc.json["samplers"][size_t(texture["sampler"].GetInt(-1))];
+    dstTexture.addressModeU = ConvertWrapMode(sampler["wrapS"].GetInt(GLTF_WRAP_REPEAT));
+    dstTexture.addressModeV = ConvertWrapMode(sampler["wrapT"].GetInt(GLTF_WRAP_REPEAT));
+  }
+  return true;
+}
+
+bool GltfImporter::ReadEmbeddedTexture(uint32_t textureIndex, ModelEmbeddedTextureData& dstEmbedded) const
+{
+  const auto& doc = *m_document;
+  const auto& image = doc.json["images"][doc.embeddedImages[textureIndex]];
+  dstEmbedded.name = image["name"].GetString();
+  if (image.Has("bufferView"))
+  {
+    const uint8_t* data = nullptr;
+    size_t size = 0, stride = 0;
+    if (!doc.GetBufferView(image["bufferView"].GetInt(), data, size, stride))
+    {
+      return false;
+    }
+    dstEmbedded.data.assign(reinterpret_cast<const char*>(data), reinterpret_cast<const char*>(data) + size);
+    return true;
+  }
+  return DecodeDataUri(image["uri"].GetString(), dstEmbedded.data);
+}
+
+void GltfImporter::ReadNodes(std::vector<ModelNode>& dstNodes) const
+{
+  dstNodes.insert(dstNodes.end(), m_document->nodes.begin(), m_document->nodes.end());
+}
+
+void GltfImporter::ReadAnimations(std::vector<ModelAnimation>& dstAnimations) const
+{
+  const auto& doc = *m_document;
+  const auto& animations = doc.json["animations"];
+  for (size_t animationIndex = 0; animationIndex < animations.GetSize(); ++animationIndex)
+  {
+    const auto& srcAnimation = animations[animationIndex];
+    const auto& samplers = srcAnimation["samplers"];
+    const auto& channels = srcAnimation["channels"];
+    auto& dstAnimation = dstAnimations.emplace_back();
+    dstAnimation.name = srcAnimation["name"].GetString();
+
+    // チャンネルは対象ノードごとにまとめる.
+    std::vector<int32_t> nodeChannels(doc.nodes.size(), -1);
+    for (size_t i = 0; i < channels.GetSize(); ++i)
+    {
+      const auto& target = channels[i]["target"];
+      const auto& path = target["path"].GetString();
+      const auto gltfNode = target["node"].GetInt();
+      const auto& sampler = samplers[size_t(channels[i]["sampler"].GetInt(-1))];
+      if (gltfNode < 0 || size_t(gltfNode) >= doc.nodeIndices.size() || doc.nodeIndices[gltfNode] < 0 ||
+        (path != "translation" && path != "rotation" && path != "scale"))
+      {
+        continue;
+      }
+      AccessorView input, output;
+      if (!doc.GetAccessor(sampler["input"].GetInt(), input) || !doc.GetAccessor(sampler["output"].GetInt(), output) ||
+        input.componentCount != 1 || input.count == 0)
+      {
+        continue;
+      }
+      // CUBICSPLINE は (入力側の接線, 値, 出力側の接線) の組のため、値だけを線形に補間する.
+      const bool cubic = sampler["interpolation"].GetString() == "CUBICSPLINE";
+      const uint32_t components = path == "rotation" ? 4 : 3;
+      if (output.componentCount != components || output.count != input.count * (cubic ? 3 : 1))
+      {
+        continue;
+      }
+      std::vector<float> times(input.count);
+      std::vector<float> values(output.count * components);
+      ReadFloats(input, 1, times.data());
+      ReadFloats(output, components, values.data());
+      auto value = [&](size_t key) { return &values[(cubic ? key * 3 + 1 : key) * components]; };
+
+      const auto nodeIndex = uint32_t(doc.nodeIndices[gltfNode]);
+      if (nodeChannels[nodeIndex] < 0)
+      {
+        nodeChannels[nodeIndex] = int32_t(dstAnimation.channels.size());
+        dstAnimation.channels.emplace_back().nodeIndex = nodeIndex;
+      }
+      auto& channel = dstAnimation.channels[nodeChannels[nodeIndex]];
+      if (path == "translation")
+      {
+        channel.positionTimes = times;
+        channel.positions.resize(times.size());
+        for (size_t k = 0; k < times.size(); ++k)
+        {
+          channel.positions[k] = glm::vec3(value(k)[0], value(k)[1], value(k)[2]);
+        }
+      }
+      else if (path == "rotation")
+      {
+        channel.rotationTimes = times;
+        channel.rotations.resize(times.size());
+        for (size_t k = 0; k < times.size(); ++k)
+        {
+          channel.rotations[k] = glm::vec4(value(k)[0], value(k)[1], value(k)[2], value(k)[3]);
+        }
+      }
+      else
+      {
+        channel.scaleTimes = times;
+        channel.scales.resize(times.size());
+        for (size_t k = 0; k < times.size(); ++k)
+        {
+          channel.scales[k] = glm::vec3(value(k)[0], value(k)[1], value(k)[2]);
+        }
+      }
+    }
+
+    // キーの無いトラックはノードの初期姿勢を1つだけ持たせる.
+    for (auto& channel : dstAnimation.channels)
+    {
+      const auto& rest = doc.restPoses[channel.nodeIndex];
+      if (channel.positions.empty())
+      {
+        channel.positionTimes.push_back(0.0f);
+        channel.positions.push_back(rest.translation);
+      }
+      if (channel.rotations.empty())
+      {
+        channel.rotationTimes.push_back(0.0f);
+        channel.rotations.push_back(rest.rotation);
+      }
+      if (channel.scales.empty())
+      {
+        channel.scaleTimes.push_back(0.0f);
+        channel.scales.push_back(rest.scale);
+      }
+      dstAnimation.duration = std::max({ dstAnimation.duration,
+        channel.positionTimes.back(), channel.rotationTimes.back(), channel.scaleTimes.back() });
+    }
+  }
+}
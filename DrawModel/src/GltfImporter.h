@@ -0,0 +1,47 @@
+﻿#pragma once
+#include <memory>
+#include <vector>
+#include <string>
+#include <cstdint>
+#include <filesystem>
+
+#include "Model.h"
+#include "ModelCache.h"
+
+// glTF 2.0 (.gltf / .glb) を assimp を介さずに読み込む.
+//  アクセサが指すバッファの内容を直接 ModelMesh などへ写し、型と並びが一致する場合は配列ごとコピーする.
+//  出力は ModelLoader が assimp で読み込んだ場合と同じ規約に揃える.
+//   - プリミティブ1つを1つのメッシュとし、面は三角形のみ. 法線が無ければ面の法線を平均して作る.
+//   - テクスチャ座標は左上原点のまま. 埋め込みテクスチャは "*番号" のパスと embeddedIndex で参照する.
+//  対応しない機能 (Draco 圧縮・スパースアクセサなど) を含むファイルは Open が失敗するため、呼び出し側で assimp に任せる.
+class GltfImporter
+{
+public:
+  GltfImporter();
+  ~GltfImporter();
+
+  // 拡張子で判定する.
+  static bool IsSupportedFile(const std::filesystem::path& filePath);
+
+  // fileData はファイルの内容. .gltf から参照される外部バッファは同じ場所から読み、dependencies に追加する.
+  bool Open(const std::filesystem::path& filePath, const std::vector<char>& fileData, std::vector<ModelCacheDependency>& dependencies);
+
+  uint32_t GetMeshCount() const;
+  uint32_t GetMaterialCount() const;
+  uint32_t GetEmbeddedTextureCount() const;
+
+  // 以下は Open の後であれば、別々のスレッドから同時に呼び出せる.
+
+  // 頂点と三角形を読む. AABB は求めない. readSkin が true の場合はジョイントとウェイトも読む.
+  bool ReadMesh(uint32_t meshIndex, ModelMesh& dstMesh, bool readSkin) const;
+  bool ReadMaterial(uint32_t materialIndex, ModelMaterial& dstMaterial) const;
+  bool ReadEmbeddedTexture(uint32_t textureIndex, ModelEmbeddedTextureData& dstEmbedded) const;
+
+  // ノードの階層. ルートが複数ある場合は、それらをまとめるルートを追加する.
+  void ReadNodes(std::vector<ModelNode>& dstNodes) const;
+  void ReadAnimations(std::vector<ModelAnimation>& dstAnimations) const;
+
+private:
+  struct Document;
+  std::unique_ptr<Document> m_document;
+};
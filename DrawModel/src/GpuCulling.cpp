@@ -0,0 +1,444 @@
+﻿#include "GpuCulling.h"
+#include "DepthPyramid.h"
+#include "FileLoader.h"
+
+#include <cassert>
+#include <cstring>
+#include <iterator>
+
+namespace
+{
+  void CmdMemoryBarrier(VkCommandBuffer commandBuffer,
+    VkPipelineStageFlags2 srcStage, VkAccessFlags2 srcAccess,
+    VkPipelineStageFlags2 dstStage, VkAccessFlags2 dstAccess)
+  {
+    VkMemoryBarrier2 barrier{
+      .sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER_2,
+      .srcStageMask = srcStage,
+      .srcAccessMask = srcAccess,
+      .dstStageMask = dstStage,
+      .dstAccessMask = dstAccess,
+    };
+    VkDependencyInfo info{
+      .sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO,
+      .memoryBarrierCount = 1,
+      .pMemoryBarriers = &barrier,
+    };
+    if (vkCmdPipelineBarrier2)
+    {
+      vkCmdPipelineBarrier2(commandBuffer, &info);
+    }
+    else
+    {
+      vkCmdPipelineBarrier2KHR(commandBuffer, &info);
+    }
+  }
+}
+
+void GpuCulling::Initialize(const std::vector<MeshInfo>& meshes, const std::vector<Bucket>& buckets, const DepthPyramid& depthPyramid)
+{
+  assert(!meshes.empty() && !buckets.empty() && depthPyramid.IsInitialized());
+  auto& gfxDevice = GetGfxDevice();
+  auto vkDevice = gfxDevice->GetVkDevice();
+
+  m_meshes = meshes;
+  m_buckets = buckets;
+  m_depthPyramid = &depthPyramid;
+  m_stats = Stats{};
+  m_stats.meshCount = uint32_t(meshes.size());
+  m_validationRequested = true;
+
+  PreparePipeline();
+
+  m_meshInfoBuffer = gfxDevice->CreateBuffer(
+    sizeof(MeshInfo) * meshes.size(),
+    VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+    VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, meshes.data());
+
+  // 1フレームで UBO 1つとストレージバッファ 5つ、深度ピラミッドを使用する.
+  m_descriptorAllocator.Initialize(vkDevice, GfxDevice::InflightFrames, {
+    { VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 1.0f },
+    { VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 5.0f },
+    { VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 1.0f },
+  });
+
+  // 描画コマンドと描画数は2パス分. 描画数の後ろにパスごとの遮蔽数を置く.
+  const auto commandBufferSize = sizeof(VkDrawIndexedIndirectCommand) * meshes.size() * 2;
+  const auto countBufferSize = sizeof(uint32_t) * (buckets.size() * 2 + 2);
+  std::vector<uint32_t> zeroCounts(buckets.size() * 2 + 2, 0);
+  std::vector<glm::vec4> boundingSpheres;
+  for (const auto& mesh : meshes)
+  {
+    boundingSpheres.push_back(mesh.boundingSphere);
+  }
+  for (auto& frame : m_frames)
+  {
+    frame.parameters = gfxDevice->CreateBuffer(sizeof(CullParameters),
+      VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT,
+      VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+    frame.commands = gfxDevice->CreateBuffer(commandBufferSize,
+      VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT,
+      VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+    frame.counts = gfxDevice->CreateBuffer(countBufferSize,
+      VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+      VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+    frame.occludedMeshes = gfxDevice->CreateBuffer(sizeof(uint32_t) * meshes.size(),
+      VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+      VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+    frame.readback = gfxDevice->CreateBuffer(countBufferSize,
+      VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+      VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, zeroCounts.data());
+    frame.meshBounds = gfxDevice->CreateBuffer(sizeof(glm::vec4) * meshes.size(),
+      VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+      VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, boundingSpheres.data());
+    frame.descriptorSet = m_descriptorAllocator.Allocate(m_descriptorSetLayout);
+    frame.cpuVisibleCount = 0;
+    frame.dispatched = false;
+    frame.validating = false;
+
+    VkDescriptorBufferInfo bufferInfos[] = {
+      { .buffer = frame.parameters.buffer, .offset = 0, .range = VK_WHOLE_SIZE },
+      { .buffer = m_meshInfoBuffer.buffer, .offset = 0, .range = VK_WHOLE_SIZE },
+      { .buffer = frame.commands.buffer, .offset = 0, .range = VK_WHOLE_SIZE },
+      { .buffer = frame.counts.buffer, .offset = 0, .range = VK_WHOLE_SIZE },
+      { .buffer = frame.occludedMeshes.buffer, .offset = 0, .range = VK_WHOLE_SIZE },
+    };
+    std::vector<VkWriteDescriptorSet> writeDescs;
+    for (uint32_t binding = 0; binding < uint32_t(std::size(bufferInfos)); ++binding)
+    {
+      writeDescs.push_back(VkWriteDescriptorSet{
+        .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+        .dstSet = frame.descriptorSet,
+        .dstBinding = binding,
+        .descriptorCount = 1,
+        .descriptorType = binding == 0 ? VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER : VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+        .pBufferInfo = &bufferInfos[binding],
+      });
+    }
+    VkDescriptorImageInfo pyramidInfo{
+      .sampler = depthPyramid.GetSampler(),
+      .imageView = depthPyramid.GetView(),
+      .imageLayout = VK_IMAGE_LAYOUT_GENERAL,
+    };
+    writeDescs.push_back(VkWriteDescriptorSet{
+      .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+      .dstSet = frame.descriptorSet,
+      .dstBinding = uint32_t(std::size(bufferInfos)),
+      .descriptorCount = 1,
+      .descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
+      .pImageInfo = &pyramidInfo,
+    });
+    VkDescriptorBufferInfo boundsInfo{ .buffer = frame.meshBounds.buffer, .offset = 0, .range = VK_WHOLE_SIZE };
+    writeDescs.push_back(VkWriteDescriptorSet{
+      .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+      .dstSet = frame.descriptorSet,
+      .dstBinding = uint32_t(std::size(bufferInfos)) + 1,
+      .descriptorCount = 1,
+      .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+      .pBufferInfo = &boundsInfo,
+    });
+    vkUpdateDescriptorSets(vkDevice, uint32_t(writeDescs.size()), writeDescs.data(), 0, nullptr);
+  }
+}
+
+void GpuCulling::Destroy()
+{
+  if (m_pipeline == VK_NULL_HANDLE)
+  {
+    return;
+  }
+  auto& gfxDevice = GetGfxDevice();
+  auto vkDevice = gfxDevice->GetVkDevice();
+
+  for (auto& frame : m_frames)
+  {
+    gfxDevice->DestroyBuffer(frame.parameters);
+    gfxDevice->DestroyBuffer(frame.commands);
+    gfxDevice->DestroyBuffer(frame.counts);
+    gfxDevice->DestroyBuffer(frame.occludedMeshes);
+    gfxDevice->DestroyBuffer(frame.readback);
+    gfxDevice->DestroyBuffer(frame.meshBounds);
+    frame.descriptorSet = VK_NULL_HANDLE;
+    frame.dispatched = false;
+  }
+  gfxDevice->DestroyBuffer(m_meshInfoBuffer);
+  m_descriptorAllocator.Destroy();
+
+  vkDestroyPipeline(vkDevice, m_pipeline, nullptr);
+  vkDestroyPipelineLayout(vkDevice, m_pipelineLayout, nullptr);
+  vkDestroyDescriptorSetLayout(vkDevice, m_descriptorSetLayout, nullptr);
+  m_pipeline = VK_NULL_HANDLE;
+  m_pipelineLayout = VK_NULL_HANDLE;
+  m_descriptorSetLayout = VK_NULL_HANDLE;
+
+  m_meshes.clear();
+  m_buckets.clear();
+  m_depthPyramid = nullptr;
+}
+
+void GpuCulling::UpdateMeshBounds(const std::vector<glm::vec4>& boundingSpheres)
+{
+  if (m_pipeline == VK_NULL_HANDLE)
+  {
+    return;
+  }
+  assert(boundingSpheres.size() == m_meshes.size());
+  auto& gfxDevice = GetGfxDevice();
+  auto& frame = m_frames[gfxDevice->GetFrameIndex()];
+  memcpy(frame.meshBounds.mapped, boundingSpheres.data(), sizeof(glm::vec4) * boundingSpheres.size());
+  // CPU での検証も同じ境界で行う.
+  for (size_t i = 0; i < m_meshes.size(); ++i)
+  {
+    m_meshes[i].boundingSphere = boundingSpheres[i];
+  }
+}
+
+void GpuCulling::Dispatch(VkCommandBuffer commandBuffer, const glm::mat4& matWorld, const glm::mat4& matView, const glm::mat4& matProj,
+  bool enableCulling, const LodSelection& lod, bool enableOcclusion)
+{
+  auto& gfxDevice = GetGfxDevice();
+  auto& frame = m_frames[gfxDevice->GetFrameIndex()];
+
+  // このフレームスロットの前回の結果は NewFrame でのフェンス待機により完了している.
+  if (frame.dispatched)
+  {
+    const auto bucketCount = m_buckets.size();
+    auto counts = reinterpret_cast<const uint32_t*>(frame.readback.mapped);
+    m_stats.gpuVisibleCount = 0;
+    m_stats.lateVisibleCount = 0;
+    for (size_t i = 0; i < bucketCount; ++i)
+    {
+      m_stats.gpuVisibleCount += counts[i] + counts[bucketCount + i];
+      m_stats.lateVisibleCount += counts[bucketCount + i];
+    }
+    m_stats.earlyOccludedCount = counts[bucketCount * 2];
+    m_stats.occludedCount = counts[bucketCount * 2 + 1];
+    if (frame.validating)
+    {
+      m_stats.validatedGpuCount = m_stats.gpuVisibleCount + m_stats.occludedCount;
+      m_stats.validatedCpuCount = frame.cpuVisibleCount;
+      m_stats.validation = m_stats.validatedGpuCount == m_stats.validatedCpuCount ? VALIDATION_MATCHED : VALIDATION_MISMATCHED;
+      frame.validating = false;
+    }
+  }
+
+  const auto matViewProj = matProj * matView;
+  CullParameters params{
+    .matWorld = matWorld,
+    .meshCount = uint32_t(m_meshes.size()),
+    .enableCulling = enableCulling ? 1u : 0u,
+    .lodPixelError = lod.pixelError,
+    .bucketCount = uint32_t(m_buckets.size()),
+    .lodCamera = glm::vec4(lod.cameraPosition, lod.pixelScale),
+    .matView = matView,
+    .projection = glm::vec4(matProj[0][0], matProj[1][1], matProj[2][2], matProj[3][2]),
+    // 深度 0..1 の射影 (z_clip = [2][2] * z + [3][2], w = -z) では [3][2] / [2][2] がニアクリップ距離となる.
+    .pyramidParams = glm::vec4(
+      float(m_depthPyramid->GetWidth()), float(m_depthPyramid->GetHeight()),
+      float(m_depthPyramid->GetLevelCount()), matProj[3][2] / matProj[2][2]),
+  };
+  auto frustum = ExtractFrustum(matViewProj);
+  memcpy(params.frustumPlanes, frustum.planes, sizeof(frustum.planes));
+  memcpy(frame.parameters.mapped, &params, sizeof(params));
+
+  // 検証を要求されたフレームだけ、読み戻した結果と比較するため CPU でも同じ判定をしておく.
+  //  遮蔽の判定は深度ピラミッドが GPU 上にしかないため比較しない.
+  if (m_validationRequested)
+  {
+    frame.cpuVisibleCount = 0;
+    for (const auto& mesh : m_meshes)
+    {
+      BoundingSphere sphere{ glm::vec3(mesh.boundingSphere), mesh.boundingSphere.w };
+      if (!enableCulling || IsVisible(frustum, TransformBoundingSphere(sphere, matWorld)))
+      {
+        frame.cpuVisibleCount++;
+      }
+    }
+    frame.validating = true;
+    m_validationRequested = false;
+    m_stats.validation = VALIDATION_PENDING;
+  }
+
+  // 描画数をクリアしてからカリングを実行する.
+  vkCmdFillBuffer(commandBuffer, frame.counts.buffer, 0, VK_WHOLE_SIZE, 0);
+  CmdMemoryBarrier(commandBuffer,
+    VK_PIPELINE_STAGE_2_CLEAR_BIT, VK_ACCESS_2_TRANSFER_WRITE_BIT,
+    VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT, VK_ACCESS_2_SHADER_STORAGE_READ_BIT | VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT);
+
+  DispatchPhase(commandBuffer, 0, enableOcclusion);
+
+  // 生成したコマンドを間接描画で参照する.
+  CmdMemoryBarrier(commandBuffer,
+    VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT, VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT,
+    VK_PIPELINE_STAGE_2_DRAW_INDIRECT_BIT | VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT,
+    VK_ACCESS_2_INDIRECT_COMMAND_READ_BIT | VK_ACCESS_2_SHADER_STORAGE_READ_BIT | VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT);
+
+  // 2パス目を行う場合は、描画数の読み戻しもそちらで行う.
+  if (!enableOcclusion)
+  {
+    CopyCountsToReadback(commandBuffer);
+  }
+  frame.dispatched = true;
+}
+
+void GpuCulling::DispatchLate(VkCommandBuffer commandBuffer)
+{
+  auto& gfxDevice = GetGfxDevice();
+  const auto& frame = m_frames[gfxDevice->GetFrameIndex()];
+  assert(frame.dispatched);
+
+  DispatchPhase(commandBuffer, 1, true);
+
+  CmdMemoryBarrier(commandBuffer,
+    VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT, VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT,
+    VK_PIPELINE_STAGE_2_DRAW_INDIRECT_BIT, VK_ACCESS_2_INDIRECT_COMMAND_READ_BIT);
+  CopyCountsToReadback(commandBuffer);
+}
+
+void GpuCulling::DispatchPhase(VkCommandBuffer commandBuffer, uint32_t phase, bool enableOcclusion)
+{
+  auto& gfxDevice = GetGfxDevice();
+  const auto& frame = m_frames[gfxDevice->GetFrameIndex()];
+
+  CullConstants constants{
+    .phase = phase,
+    .enableOcclusion = enableOcclusion ? 1u : 0u,
+  };
+  vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, m_pipeline);
+  vkCmdBindDescriptorSets(commandBuffer,
+    VK_PIPELINE_BIND_POINT_COMPUTE, m_pipelineLayout, 0, 1, &frame.descriptorSet, 0, nullptr);
+  vkCmdPushConstants(commandBuffer, m_pipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(constants), &constants);
+  // 2パス目も遮蔽数が分からないため、メッシュ数分起動してシェーダー側で打ち切る.
+  auto groupCount = (uint32_t(m_meshes.size()) + ThreadGroupSize - 1) / ThreadGroupSize;
+  vkCmdDispatch(commandBuffer, groupCount, 1, 1);
+}
+
+void GpuCulling::CopyCountsToReadback(VkCommandBuffer commandBuffer)
+{
+  auto& gfxDevice = GetGfxDevice();
+  const auto& frame = m_frames[gfxDevice->GetFrameIndex()];
+
+  // 描画数は統計用に読み戻す.
+  CmdMemoryBarrier(commandBuffer,
+    VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT, VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT,
+    VK_PIPELINE_STAGE_2_COPY_BIT, VK_ACCESS_2_TRANSFER_READ_BIT);
+  VkBufferCopy region{
+    .srcOffset = 0, .dstOffset = 0,
+    .size = sizeof(uint32_t) * (m_buckets.size() * 2 + 2),
+  };
+  vkCmdCopyBuffer(commandBuffer, frame.counts.buffer, frame.readback.buffer, 1, &region);
+  CmdMemoryBarrier(commandBuffer,
+    VK_PIPELINE_STAGE_2_COPY_BIT, VK_ACCESS_2_TRANSFER_WRITE_BIT,
+    VK_PIPELINE_STAGE_2_HOST_BIT, VK_ACCESS_2_HOST_READ_BIT);
+}
+
+void GpuCulling::DrawBucket(VkCommandBuffer commandBuffer, uint32_t bucket, uint32_t phase)
+{
+  auto& gfxDevice = GetGfxDevice();
+  const auto& frame = m_frames[gfxDevice->GetFrameIndex()];
+  const auto& info = m_buckets[bucket];
+
+  // 2パス目のコマンド・描画数は1パス目の後ろに置かれている.
+  const auto commandOffset = phase * m_meshes.size() + info.commandOffset;
+  const auto countOffset = phase * m_buckets.size() + bucket;
+  vkCmdDrawIndexedIndirectCount(commandBuffer,
+    frame.commands.buffer, sizeof(VkDrawIndexedIndirectCommand) * commandOffset,
+    frame.counts.buffer, sizeof(uint32_t) * countOffset,
+    info.maxCount, sizeof(VkDrawIndexedIndirectCommand));
+}
+
+void GpuCulling::PreparePipeline()
+{
+  auto& gfxDevice = GetGfxDevice();
+  auto vkDevice = gfxDevice->GetVkDevice();
+
+  std::vector<VkDescriptorSetLayoutBinding> layoutBindings{
+    // カリング用パラメータ.
+    {
+      .binding = 0,
+      .descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER,
+      .descriptorCount = 1,
+      .stageFlags = VK_SHADER_STAGE_COMPUTE_BIT,
+    },
+    // メッシュ情報.
+    {
+      .binding = 1,
+      .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+      .descriptorCount = 1,
+      .stageFlags = VK_SHADER_STAGE_COMPUTE_BIT,
+    },
+    // 出力する描画コマンド.
+    {
+      .binding = 2,
+      .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+      .descriptorCount = 1,
+      .stageFlags = VK_SHADER_STAGE_COMPUTE_BIT,
+    },
+    // バケットごとの描画数.
+    {
+      .binding = 3,
+      .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+      .descriptorCount = 1,
+      .stageFlags = VK_SHADER_STAGE_COMPUTE_BIT,
+    },
+    // 1パス目で遮蔽と判定したメッシュ.
+    {
+      .binding = 4,
+      .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+      .descriptorCount = 1,
+      .stageFlags = VK_SHADER_STAGE_COMPUTE_BIT,
+    },
+    // 深度ピラミッド.
+    {
+      .binding = 5,
+      .descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
+      .descriptorCount = 1,
+      .stageFlags = VK_SHADER_STAGE_COMPUTE_BIT,
+    },
+    // メッシュの境界球.
+    {
+      .binding = 6,
+      .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+      .descriptorCount = 1,
+      .stageFlags = VK_SHADER_STAGE_COMPUTE_BIT,
+    },
+  };
+  VkDescriptorSetLayoutCreateInfo dsLayoutCI{
+    .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO,
+    .bindingCount = uint32_t(layoutBindings.size()),
+    .pBindings = layoutBindings.data(),
+  };
+  vkCreateDescriptorSetLayout(vkDevice, &dsLayoutCI, nullptr, &m_descriptorSetLayout);
+
+  VkPushConstantRange pushConstantRange{
+    .stageFlags = VK_SHADER_STAGE_COMPUTE_BIT,
+    .offset = 0,
+    .size = sizeof(CullConstants),
+  };
+  VkPipelineLayoutCreateInfo layoutCI{
+    .sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO,
+    .setLayoutCount = 1,
+    .pSetLayouts = &m_descriptorSetLayout,
+    .pushConstantRangeCount = 1,
+    .pPushConstantRanges = &pushConstantRange,
+  };
+  vkCreatePipelineLayout(vkDevice, &layoutCI, nullptr, &m_pipelineLayout);
+
+  std::vector<char> computeSpv;
+  GetFileLoader()->Load("res/cull.comp.spv", computeSpv);
+  VkPipelineShaderStageCreateInfo computeStage{
+    .sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO,
+    .stage = VK_SHADER_STAGE_COMPUTE_BIT,
+    .module = gfxDevice->CreateShaderModule(computeSpv.data(), computeSpv.size()),
+    .pName = "main",
+  };
+  VkComputePipelineCreateInfo computePipelineCI{
+    .sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO,
+    .stage = computeStage,
+    .layout = m_pipelineLayout,
+  };
+  auto res = vkCreateComputePipelines(vkDevice, VK_NULL_HANDLE, 1, &computePipelineCI, nullptr, &m_pipeline);
+  assert(res == VK_SUCCESS);
+
+  gfxDevice->DestroyShaderModule(computeStage.module);
+}
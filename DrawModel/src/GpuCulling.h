@@ -0,0 +1,154 @@
+﻿#pragma once
+#include <vector>
+#include <cstdint>
+
+#include "GfxDevice.h"
+#include "Culling.h"
+
+class DepthPyramid;
+
+// コンピュートシェーダーでメッシュ単位の視錐台カリングを行い、
+// 可視メッシュだけを詰めた間接描画コマンドとその数を生成する.
+//  描画コマンドは「バケット」単位に出力される.
+//  バケットは同じパイプライン・ディスクリプタセットで描画できるメッシュの集まりで、
+//  バケットごとに vkCmdDrawIndexedIndirectCount を1回発行する.
+//
+// オクルージョンカリングは2パスで行う.
+//  1パス目: 前フレームの深度ピラミッドで判定し、残ったメッシュを描画する. 遮蔽と判定したメッシュは記録しておく.
+//  2パス目: 1パス目の描画結果から作り直した深度ピラミッドで記録したメッシュを再判定し、見えるものを追加で描画する.
+class GpuCulling
+{
+public:
+  static const uint32_t MaxLodCount = 4;
+
+  // シェーダー側の MeshCullInfo と一致させる (std430).
+  struct MeshInfo
+  {
+    glm::vec4 boundingSphere; // xyz: 中心(モデル空間), w: 半径. 初期値で、判定には UpdateMeshBounds の値を使う.
+    int32_t   vertexOffset;
+    uint32_t  bucket;         // 出力先のバケット番号.
+    uint32_t  commandOffset;  // バケットの描画コマンド格納先の先頭.
+    uint32_t  lodCount;
+    // LOD ごとのインデックス範囲と誤差(モデル空間での距離).
+    uint32_t  firstIndex[MaxLodCount];
+    uint32_t  indexCount[MaxLodCount];
+    float     lodError[MaxLodCount];
+  };
+  struct Bucket
+  {
+    uint32_t commandOffset;
+    uint32_t maxCount;
+  };
+
+  // 描画する LOD の選択条件.
+  //  誤差を画面上のピクセル数に換算し、pixelError 以下となる最も粗い LOD を選ぶ.
+  struct LodSelection
+  {
+    glm::vec3 cameraPosition = glm::vec3(0.0f);
+    float     pixelScale = 0.0f;    // 距離1の位置で1単位が何ピクセルになるか. 0 なら LOD0 のみ.
+    float     pixelError = 1.0f;
+  };
+
+  // depthPyramid はオクルージョンカリングで参照する. GpuCulling より後に破棄すること.
+  void Initialize(const std::vector<MeshInfo>& meshes, const std::vector<Bucket>& buckets, const DepthPyramid& depthPyramid);
+  void Destroy();
+
+  // このフレームで判定に使うメッシュの境界球 (xyz: 中心(モデル空間), w: 半径) を MeshInfo の順に設定する.
+  //  境界はフレームごとに持つため、アニメーションで動く場合は毎フレーム Dispatch の前に呼ぶこと.
+  void UpdateMeshBounds(const std::vector<glm::vec4>& boundingSpheres);
+
+  // カリングと描画コマンドの生成を記録する. (1パス目)
+  //  レンダリング(RenderPass)の開始前に呼ぶこと.
+  //  enableOcclusion の場合は、1パス目の描画と深度ピラミッドの作成後に DispatchLate を呼ぶこと.
+  void Dispatch(VkCommandBuffer commandBuffer, const glm::mat4& matWorld, const glm::mat4& matView, const glm::mat4& matProj,
+    bool enableCulling, const LodSelection& lod, bool enableOcclusion);
+  // 1パス目で遮蔽と判定したメッシュを作り直した深度ピラミッドで再判定する. (2パス目)
+  void DispatchLate(VkCommandBuffer commandBuffer);
+
+  // 指定バケット・パスの描画を記録する.
+  void DrawBucket(VkCommandBuffer commandBuffer, uint32_t bucket, uint32_t phase);
+
+  // 読み戻した描画数を、同じフレームを CPU で判定した数と比較した結果.
+  enum ValidationState
+  {
+    VALIDATION_NONE,
+    VALIDATION_PENDING,   // 判定したフレームの読み戻し待ち.
+    VALIDATION_MATCHED,
+    VALIDATION_MISMATCHED,
+  };
+  struct Stats
+  {
+    uint32_t meshCount = 0;
+    uint32_t gpuVisibleCount = 0;   // GPU が出力した描画数 (読み戻し値).
+    uint32_t lateVisibleCount = 0;  // gpuVisibleCount のうち2パス目で描画した数.
+    uint32_t earlyOccludedCount = 0;  // 1パス目で遮蔽と判定した数.
+    uint32_t occludedCount = 0;     // 2パス目でも遮蔽と判定した数.
+    // 最後に検証したフレームの値. CPU は視錐台カリングのみ判定するため、遮蔽数を足した数と比較する.
+    ValidationState validation = VALIDATION_NONE;
+    uint32_t validatedGpuCount = 0;
+    uint32_t validatedCpuCount = 0;
+  };
+  // 読み戻しは該当フレームのコマンド完了後のため、数フレーム前の値となる.
+  const Stats& GetStats() const { return m_stats; }
+
+  // 次の Dispatch で1フレームだけ CPU でも同じ視錐台カリングを行い、読み戻した描画数と比較する.
+  //  CPU の判定は全メッシュを走査するため、毎フレームは行わない. Initialize 後にも1度行う.
+  void RequestValidation() { m_validationRequested = true; }
+
+private:
+  void PreparePipeline();
+  void DispatchPhase(VkCommandBuffer commandBuffer, uint32_t phase, bool enableOcclusion);
+  void CopyCountsToReadback(VkCommandBuffer commandBuffer);
+
+  // シェーダー側の CullParameters と一致させる.
+  struct CullParameters
+  {
+    glm::mat4 matWorld;
+    glm::vec4 frustumPlanes[Frustum::PLANE_COUNT];
+    uint32_t  meshCount;
+    uint32_t  enableCulling;
+    float     lodPixelError;
+    uint32_t  bucketCount;
+    glm::vec4 lodCamera;    // xyz: カメラ位置, w: LodSelection::pixelScale.
+    glm::mat4 matView;
+    glm::vec4 projection;   // 射影行列の [0][0], [1][1], [2][2], [3][2].
+    glm::vec4 pyramidParams;  // xy: 深度ピラミッドのサイズ, z: レベル数, w: ニアクリップ距離.
+  };
+  // シェーダー側の CullConstants と一致させる.
+  struct CullConstants
+  {
+    uint32_t phase;
+    uint32_t enableOcclusion;
+  };
+
+  struct FrameResource
+  {
+    GpuBuffer parameters;   // CullParameters.
+    GpuBuffer commands;     // VkDrawIndexedIndirectCommand の配列. パスごとにメッシュ数分.
+    GpuBuffer counts;       // パス・バケットごとの描画数と、パスごとの遮蔽数.
+    GpuBuffer occludedMeshes; // 1パス目で遮蔽と判定したメッシュ番号.
+    GpuBuffer meshBounds;   // メッシュの境界球. CPU から書き換える.
+    GpuBuffer readback;     // counts の CPU 読み戻し用.
+    VkDescriptorSet descriptorSet = VK_NULL_HANDLE;
+
+    uint32_t cpuVisibleCount = 0;
+    bool     dispatched = false;
+    bool     validating = false;  // cpuVisibleCount を求めたフレームか.
+  };
+  FrameResource m_frames[GfxDevice::InflightFrames];
+
+  std::vector<MeshInfo> m_meshes;
+  std::vector<Bucket> m_buckets;
+  GpuBuffer m_meshInfoBuffer;
+  const DepthPyramid* m_depthPyramid = nullptr;
+
+  VkDescriptorSetLayout m_descriptorSetLayout = VK_NULL_HANDLE;
+  VkPipelineLayout m_pipelineLayout = VK_NULL_HANDLE;
+  VkPipeline m_pipeline = VK_NULL_HANDLE;
+  DescriptorAllocator m_descriptorAllocator;
+
+  Stats m_stats;
+  bool m_validationRequested = false;
+
+  static const uint32_t ThreadGroupSize = 64;
+};
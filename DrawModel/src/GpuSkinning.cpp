@@ -0,0 +1,223 @@
+﻿#include "GpuSkinning.h"
+#include "FileLoader.h"
+
+#include <cassert>
+#include <cstring>
+#include <iterator>
+#include <algorithm>
+
+namespace
+{
+  void CmdMemoryBarrier(VkCommandBuffer commandBuffer,
+    VkPipelineStageFlags2 srcStage, VkAccessFlags2 srcAccess,
+    VkPipelineStageFlags2 dstStage, VkAccessFlags2 dstAccess)
+  {
+    VkMemoryBarrier2 barrier{
+      .sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER_2,
+      .srcStageMask = srcStage,
+      .srcAccessMask = srcAccess,
+      .dstStageMask = dstStage,
+      .dstAccessMask = dstAccess,
+    };
+    VkDependencyInfo info{
+      .sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO,
+      .memoryBarrierCount = 1,
+      .pMemoryBarriers = &barrier,
+    };
+    if (vkCmdPipelineBarrier2)
+    {
+      vkCmdPipelineBarrier2(commandBuffer, &info);
+    }
+    else
+    {
+      vkCmdPipelineBarrier2KHR(commandBuffer, &info);
+    }
+  }
+
+  // シェーダー側の SkinConstants と一致させる.
+  struct SkinConstants
+  {
+    uint32_t vertexCount;
+  };
+}
+
+void GpuSkinning::Initialize(const std::vector<SourceVertex>& vertices, uint32_t jointCount)
+{
+  auto& gfxDevice = GetGfxDevice();
+
+  m_vertexCount = uint32_t(vertices.size());
+  m_jointCount = jointCount;
+
+  PreparePipeline();
+
+  // 空のバッファは作れないため、最低1要素分は確保しておく.
+  const auto vertexCount = std::max<size_t>(vertices.size(), 1);
+  const auto matrixCount = std::max<size_t>(jointCount, 1);
+  m_sourceVertices = gfxDevice->CreateBuffer(
+    sizeof(SourceVertex) * vertexCount,
+    VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+    VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, vertices.empty() ? nullptr : vertices.data());
+
+  for (auto& frame : m_frames)
+  {
+    frame.jointMatrices = gfxDevice->CreateBuffer(sizeof(glm::mat4) * matrixCount,
+      VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+      VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+    frame.skinnedVertices = gfxDevice->CreateBuffer(sizeof(SkinnedVertex) * vertexCount,
+      VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+      VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+  }
+}
+
+void GpuSkinning::Destroy()
+{
+  if (m_pipeline == VK_NULL_HANDLE)
+  {
+    return;
+  }
+  auto& gfxDevice = GetGfxDevice();
+  auto vkDevice = gfxDevice->GetVkDevice();
+
+  for (auto& frame : m_frames)
+  {
+    gfxDevice->DestroyBuffer(frame.jointMatrices);
+    gfxDevice->DestroyBuffer(frame.skinnedVertices);
+  }
+  gfxDevice->DestroyBuffer(m_sourceVertices);
+
+  vkDestroyPipeline(vkDevice, m_pipeline, nullptr);
+  vkDestroyPipelineLayout(vkDevice, m_pipelineLayout, nullptr);
+  vkDestroyDescriptorSetLayout(vkDevice, m_descriptorSetLayout, nullptr);
+  m_pipeline = VK_NULL_HANDLE;
+  m_pipelineLayout = VK_NULL_HANDLE;
+  m_descriptorSetLayout = VK_NULL_HANDLE;
+
+  m_vertexCount = 0;
+  m_jointCount = 0;
+}
+
+void GpuSkinning::Dispatch(VkCommandBuffer commandBuffer, const glm::mat4* jointMatrices)
+{
+  if (m_vertexCount == 0)
+  {
+    return;
+  }
+  auto& gfxDevice = GetGfxDevice();
+  const auto& frame = m_frames[gfxDevice->GetFrameIndex()];
+
+  // ディスクリプタセットはフレームごとのアロケータから確保する. NewFrame でまとめてリセットされる.
+  auto descriptorSet = gfxDevice->GetFrameDescriptorAllocator().Allocate(m_descriptorSetLayout);
+  if (descriptorSet == VK_NULL_HANDLE)
+  {
+    return;
+  }
+  VkDescriptorBufferInfo bufferInfos[] = {
+    { .buffer = m_sourceVertices.buffer, .offset = 0, .range = VK_WHOLE_SIZE },
+    { .buffer = frame.jointMatrices.buffer, .offset = 0, .range = VK_WHOLE_SIZE },
+    { .buffer = frame.skinnedVertices.buffer, .offset = 0, .range = VK_WHOLE_SIZE },
+  };
+  VkWriteDescriptorSet writeDescs[std::size(bufferInfos)];
+  for (uint32_t binding = 0; binding < uint32_t(std::size(bufferInfos)); ++binding)
+  {
+    writeDescs[binding] = VkWriteDescriptorSet{
+      .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+      .dstSet = descriptorSet,
+      .dstBinding = binding,
+      .descriptorCount = 1,
+      .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+      .pBufferInfo = &bufferInfos[binding],
+    };
+  }
+  vkUpdateDescriptorSets(gfxDevice->GetVkDevice(), uint32_t(std::size(writeDescs)), writeDescs, 0, nullptr);
+
+  // このフレームスロットの前回のコマンドは NewFrame でのフェンス待機により完了している.
+  memcpy(frame.jointMatrices.mapped, jointMatrices, sizeof(glm::mat4) * m_jointCount);
+
+  SkinConstants constants{
+    .vertexCount = m_vertexCount,
+  };
+  vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, m_pipeline);
+  vkCmdBindDescriptorSets(commandBuffer,
+    VK_PIPELINE_BIND_POINT_COMPUTE, m_pipelineLayout, 0, 1, &descriptorSet, 0, nullptr);
+  vkCmdPushConstants(commandBuffer, m_pipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(constants), &constants);
+  auto groupCount = (m_vertexCount + ThreadGroupSize - 1) / ThreadGroupSize;
+  vkCmdDispatch(commandBuffer, groupCount, 1, 1);
+
+  // スキニング結果は頂点シェーダー (メッシュレット描画ではメッシュシェーダー) で読む.
+  VkPipelineStageFlags2 dstStages = VK_PIPELINE_STAGE_2_VERTEX_SHADER_BIT;
+  if (gfxDevice->IsSupportMeshShader())
+  {
+    dstStages |= VK_PIPELINE_STAGE_2_MESH_SHADER_BIT_EXT;
+  }
+  CmdMemoryBarrier(commandBuffer,
+    VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT, VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT,
+    dstStages, VK_ACCESS_2_SHADER_STORAGE_READ_BIT);
+}
+
+void GpuSkinning::PreparePipeline()
+{
+  auto& gfxDevice = GetGfxDevice();
+  auto vkDevice = gfxDevice->GetVkDevice();
+
+  std::vector<VkDescriptorSetLayoutBinding> layoutBindings{
+    // バインドポーズの頂点とジョイント・ウェイト.
+    {
+      .binding = 0,
+      .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+      .descriptorCount = 1,
+      .stageFlags = VK_SHADER_STAGE_COMPUTE_BIT,
+    },
+    // ジョイント行列.
+    {
+      .binding = 1,
+      .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+      .descriptorCount = 1,
+      .stageFlags = VK_SHADER_STAGE_COMPUTE_BIT,
+    },
+    // スキニング後の頂点.
+    {
+      .binding = 2,
+      .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+      .descriptorCount = 1,
+      .stageFlags = VK_SHADER_STAGE_COMPUTE_BIT,
+    },
+  };
+  VkDescriptorSetLayoutCreateInfo dsLayoutCI{
+    .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO,
+    .bindingCount = uint32_t(layoutBindings.size()),
+    .pBindings = layoutBindings.data(),
+  };
+  vkCreateDescriptorSetLayout(vkDevice, &dsLayoutCI, nullptr, &m_descriptorSetLayout);
+
+  VkPushConstantRange pushConstantRange{
+    .stageFlags = VK_SHADER_STAGE_COMPUTE_BIT,
+    .offset = 0,
+    .size = sizeof(SkinConstants),
+  };
+  VkPipelineLayoutCreateInfo layoutCI{
+    .sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO,
+    .setLayoutCount = 1,
+    .pSetLayouts = &m_descriptorSetLayout,
+    .pushConstantRangeCount = 1,
+    .pPushConstantRanges = &pushConstantRange,
+  };
+  vkCreatePipelineLayout(vkDevice, &layoutCI, nullptr, &m_pipelineLayout);
+
+  std::vector<char> computeSpv;
+  GetFileLoader()->Load("res/skin.comp.spv", computeSpv);
+  VkPipelineShaderStageCreateInfo computeStage{
+    .sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO,
+    .stage = VK_SHADER_STAGE_COMPUTE_BIT,
+    .module = gfxDevice->CreateShaderModule(computeSpv.data(), computeSpv.size()),
+    .pName = "main",
+  };
+  VkComputePipelineCreateInfo computePipelineCI{
+    .sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO,
+    .stage = computeStage,
+    .layout = m_pipelineLayout,
+  };
+  auto res = vkCreateComputePipelines(vkDevice, VK_NULL_HANDLE, 1, &computePipelineCI, nullptr, &m_pipeline);
+  assert(res == VK_SUCCESS);
+
+  gfxDevice->DestroyShaderModule(computeStage.module);
+}
@@ -0,0 +1,65 @@
+﻿#pragma once
+#include <vector>
+#include <cstdint>
+
+#define GLM_FORCE_DEPTH_ZERO_TO_ONE
+#include "glm/glm.hpp"
+
+#include "GfxDevice.h"
+
+// コンピュートシェーダーでスキニングを行い、スキニング後の位置・法線をフレームごとのバッファに書き込む.
+//  スキンを持つジオメトリの頂点をフレームに1度だけ変換し、描画では頂点シェーダー・メッシュシェーダーが
+//  gl_VertexIndex からこのバッファを参照する. 深度プリパスやオクルージョンカリングの2パス目、
+//  インスタンス描画で同じメッシュを何度描いても、スキニングの計算は増えない.
+class GpuSkinning
+{
+public:
+  // シェーダー側の SkinVertex と一致させる (std430).
+  struct SourceVertex
+  {
+    glm::vec4  position;  // バインドポーズでのメッシュ空間の位置. w は未使用.
+    glm::vec4  normal;
+    glm::uvec4 joints;    // ジョイント行列の番号. (全スキンを通した番号)
+    glm::vec4  weights;
+  };
+  // シェーダー側の SkinnedVertex と一致させる.
+  struct SkinnedVertex
+  {
+    glm::vec4 position;   // モデル空間.
+    glm::vec4 normal;
+  };
+
+  // vertices はスキンを持つ全ジオメトリの頂点を並べたもの. jointCount はジョイント行列の総数.
+  //  スキンが無い場合も、ディスクリプタに設定できるよう最小サイズのバッファを作る.
+  void Initialize(const std::vector<SourceVertex>& vertices, uint32_t jointCount);
+  void Destroy();
+
+  // ジョイント行列 (jointCount 個) を転送し、スキニングを記録する.
+  //  レンダリング(RenderPass)の開始前に呼ぶこと.
+  void Dispatch(VkCommandBuffer commandBuffer, const glm::mat4* jointMatrices);
+
+  // 描画時に参照するスキニング後の頂点 (SkinnedVertex の配列).
+  VkBuffer GetSkinnedVertexBuffer(uint32_t frameIndex) const { return m_frames[frameIndex].skinnedVertices.buffer; }
+
+  uint32_t GetVertexCount() const { return m_vertexCount; }
+  uint32_t GetJointCount() const { return m_jointCount; }
+
+private:
+  void PreparePipeline();
+
+  struct FrameResource
+  {
+    GpuBuffer jointMatrices;    // CPU で計算したジョイント行列.
+    GpuBuffer skinnedVertices;
+  };
+  FrameResource m_frames[GfxDevice::InflightFrames];
+  GpuBuffer m_sourceVertices;
+  uint32_t m_vertexCount = 0;
+  uint32_t m_jointCount = 0;
+
+  VkDescriptorSetLayout m_descriptorSetLayout = VK_NULL_HANDLE;
+  VkPipelineLayout m_pipelineLayout = VK_NULL_HANDLE;
+  VkPipeline m_pipeline = VK_NULL_HANDLE;
+
+  static const uint32_t ThreadGroupSize = 64;
+};
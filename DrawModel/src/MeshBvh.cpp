@@ -0,0 +1,623 @@
+﻿#include "MeshBvh.h"
+
+#include <cassert>
+#include <cmath>
+#include <cfloat>
+#include <algorithm>
+#include <chrono>
+#include <random>
+
+namespace
+{
+  // Culling.cpp の FrustumCuller と同じ式. 葉の要素の判定結果を一致させるため演算順も揃えている.
+  inline float PlaneDistance(const glm::vec4& plane, float cx, float cy, float cz)
+  {
+    return (plane.x * cx + plane.y * cy) + (plane.z * cz + plane.w);
+  }
+  inline float PlaneRadius(const glm::vec4& plane, float ex, float ey, float ez)
+  {
+    return (std::abs(plane.x) * ex + std::abs(plane.y) * ey) + std::abs(plane.z) * ez;
+  }
+
+  float SurfaceArea(const glm::vec3& boundsMin, const glm::vec3& boundsMax)
+  {
+    auto d = glm::max(boundsMax - boundsMin, glm::vec3(0.0f));
+    return 2.0f * (d.x * d.y + d.y * d.z + d.z * d.x);
+  }
+
+  // レイと AABB のスラブ判定. 交差すれば AABB に入る距離 (0 以上) を outDistance に返す.
+  inline bool IntersectRayBox(
+    const glm::vec3& origin, const glm::vec3& invDir,
+    float minX, float minY, float minZ, float maxX, float maxY, float maxZ,
+    float maxDistance, float& outDistance)
+  {
+    float tx0 = (minX - origin.x) * invDir.x, tx1 = (maxX - origin.x) * invDir.x;
+    float ty0 = (minY - origin.y) * invDir.y, ty1 = (maxY - origin.y) * invDir.y;
+    float tz0 = (minZ - origin.z) * invDir.z, tz1 = (maxZ - origin.z) * invDir.z;
+    float tEnter = std::max(std::max(std::min(tx0, tx1), std::min(ty0, ty1)), std::max(std::min(tz0, tz1), 0.0f));
+    float tExit = std::min(std::min(std::max(tx0, tx1), std::max(ty0, ty1)), std::min(std::max(tz0, tz1), maxDistance));
+    outDistance = tEnter;
+    return tEnter <= tExit;
+  }
+
+  // 方向の成分が 0 の場合も無限大と 0 の積 (NaN) にならないよう、大きな有限値で代用する.
+  glm::vec3 ComputeInverseDirection(const glm::vec3& direction)
+  {
+    glm::vec3 invDir;
+    for (int c = 0; c < 3; ++c)
+    {
+      invDir[c] = (direction[c] != 0.0f) ? 1.0f / direction[c] : std::copysign(1.0e30f, direction[c]);
+    }
+    return invDir;
+  }
+
+  inline float DistanceSquared(const glm::vec3& p, float minX, float minY, float minZ, float maxX, float maxY, float maxZ)
+  {
+    float dx = std::max(std::max(minX - p.x, p.x - maxX), 0.0f);
+    float dy = std::max(std::max(minY - p.y, p.y - maxY), 0.0f);
+    float dz = std::max(std::max(minZ - p.z, p.z - maxZ), 0.0f);
+    return dx * dx + dy * dy + dz * dz;
+  }
+}
+
+void MeshBvh::Clear()
+{
+  for (auto* v : { &m_nodeMinX, &m_nodeMinY, &m_nodeMinZ, &m_nodeMaxX, &m_nodeMaxY, &m_nodeMaxZ,
+                   &m_minX, &m_minY, &m_minZ, &m_maxX, &m_maxY, &m_maxZ })
+  {
+    v->clear();
+  }
+  m_rightChild.clear();
+  m_first.clear();
+  m_count.clear();
+  m_indices.clear();
+  m_depth = 0;
+}
+
+void MeshBvh::Build(const std::vector<glm::vec3>& boundsMin, const std::vector<glm::vec3>& boundsMax)
+{
+  assert(boundsMin.size() == boundsMax.size());
+  Clear();
+  auto count = uint32_t(boundsMin.size());
+  if (count == 0)
+  {
+    return;
+  }
+
+  std::vector<BuildItem> items(count);
+  for (uint32_t i = 0; i < count; ++i)
+  {
+    items[i] = BuildItem{
+      .boundsMin = boundsMin[i],
+      .boundsMax = boundsMax[i],
+      .centroid = (boundsMin[i] + boundsMax[i]) * 0.5f,
+      .index = i,
+    };
+  }
+
+  // 葉に MaxLeafCount 個以下まで分けるため、ノード数は 2n - 1 を超えない.
+  auto maxNodes = size_t(count) * 2;
+  for (auto* v : { &m_nodeMinX, &m_nodeMinY, &m_nodeMinZ, &m_nodeMaxX, &m_nodeMaxY, &m_nodeMaxZ })
+  {
+    v->reserve(maxNodes);
+  }
+  m_rightChild.reserve(maxNodes);
+  m_first.reserve(maxNodes);
+  m_count.reserve(maxNodes);
+
+  BuildNode(items, 0, count, 1);
+
+  // 要素を葉の並びに合わせて詰め直す.
+  m_indices.resize(count);
+  for (auto* v : { &m_minX, &m_minY, &m_minZ, &m_maxX, &m_maxY, &m_maxZ })
+  {
+    v->resize(count);
+  }
+  for (uint32_t i = 0; i < count; ++i)
+  {
+    const auto& item = items[i];
+    m_indices[i] = item.index;
+    m_minX[i] = item.boundsMin.x; m_minY[i] = item.boundsMin.y; m_minZ[i] = item.boundsMin.z;
+    m_maxX[i] = item.boundsMax.x; m_maxY[i] = item.boundsMax.y; m_maxZ[i] = item.boundsMax.z;
+  }
+}
+
+void MeshBvh::Refit(const std::vector<glm::vec3>& boundsMin, const std::vector<glm::vec3>& boundsMax)
+{
+  assert(boundsMin.size() == boundsMax.size() && boundsMin.size() == m_indices.size());
+  for (uint32_t i = 0; i < uint32_t(m_indices.size()); ++i)
+  {
+    const auto& bmin = boundsMin[m_indices[i]];
+    const auto& bmax = boundsMax[m_indices[i]];
+    m_minX[i] = bmin.x; m_minY[i] = bmin.y; m_minZ[i] = bmin.z;
+    m_maxX[i] = bmax.x; m_maxY[i] = bmax.y; m_maxZ[i] = bmax.z;
+  }
+
+  // 子は親より後ろに並ぶため、後ろから処理すれば子の境界は求め終わっている.
+  for (uint32_t node = GetNodeCount(); node-- > 0;)
+  {
+    glm::vec3 nodeMin(FLT_MAX), nodeMax(-FLT_MAX);
+    if (m_rightChild[node] == 0)
+    {
+      for (uint32_t i = m_first[node]; i < m_first[node] + m_count[node]; ++i)
+      {
+        nodeMin = glm::min(nodeMin, glm::vec3(m_minX[i], m_minY[i], m_minZ[i]));
+        nodeMax = glm::max(nodeMax, glm::vec3(m_maxX[i], m_maxY[i], m_maxZ[i]));
+      }
+    }
+    else
+    {
+      for (auto child : { node + 1, m_rightChild[node] })
+      {
+        nodeMin = glm::min(nodeMin, glm::vec3(m_nodeMinX[child], m_nodeMinY[child], m_nodeMinZ[child]));
+        nodeMax = glm::max(nodeMax, glm::vec3(m_nodeMaxX[child], m_nodeMaxY[child], m_nodeMaxZ[child]));
+      }
+    }
+    SetNodeBounds(node, nodeMin, nodeMax);
+  }
+}
+
+void MeshBvh::SetNodeBounds(uint32_t node, const glm::vec3& boundsMin, const glm::vec3& boundsMax)
+{
+  m_nodeMinX[node] = boundsMin.x; m_nodeMinY[node] = boundsMin.y; m_nodeMinZ[node] = boundsMin.z;
+  m_nodeMaxX[node] = boundsMax.x; m_nodeMaxY[node] = boundsMax.y; m_nodeMaxZ[node] = boundsMax.z;
+}
+
+uint32_t MeshBvh::BuildNode(std::vector<BuildItem>& items, uint32_t first, uint32_t count, uint32_t depth)
+{
+  auto node = uint32_t(m_rightChild.size());
+  for (auto* v : { &m_nodeMinX, &m_nodeMinY, &m_nodeMinZ, &m_nodeMaxX, &m_nodeMaxY, &m_nodeMaxZ })
+  {
+    v->push_back(0.0f);
+  }
+  m_rightChild.push_back(0);
+  m_first.push_back(first);
+  m_count.push_back(count);
+  m_depth = std::max(m_depth, depth);
+
+  glm::vec3 nodeMin(FLT_MAX), nodeMax(-FLT_MAX);
+  glm::vec3 centroidMin(FLT_MAX), centroidMax(-FLT_MAX);
+  for (uint32_t i = first; i < first + count; ++i)
+  {
+    nodeMin = glm::min(nodeMin, items[i].boundsMin);
+    nodeMax = glm::max(nodeMax, items[i].boundsMax);
+    centroidMin = glm::min(centroidMin, items[i].centroid);
+    centroidMax = glm::max(centroidMax, items[i].centroid);
+  }
+  SetNodeBounds(node, nodeMin, nodeMax);
+
+  if (count <= MaxLeafCount || depth >= MaxDepth)
+  {
+    return node;
+  }
+
+  // 中心の範囲を軸ごとに最大 SahBinCount 個のビンへ分け、ビンの境界で分割した場合のコストを比べる.
+  //  コストは (左の数 * 左の表面積 + 右の数 * 右の表面積) で、親の表面積と走査の重みは全候補で共通のため省く.
+  struct Bin
+  {
+    glm::vec3 boundsMin = glm::vec3(FLT_MAX);
+    glm::vec3 boundsMax = glm::vec3(-FLT_MAX);
+    uint32_t count = 0;
+  };
+  int bestAxis = -1;
+  uint32_t bestSplit = 0;
+  float bestCost = FLT_MAX;
+  // 要素の少ないノードではビンも減らす.
+  auto binCount = std::min(count, SahBinCount);
+  auto centroidExtent = centroidMax - centroidMin;
+  glm::vec3 scale;
+  for (int axis = 0; axis < 3; ++axis)
+  {
+    scale[axis] = (centroidExtent[axis] > 0.0f) ? binCount / centroidExtent[axis] : 0.0f;
+  }
+  auto binIndex = [&](const BuildItem& item, int axis) {
+    return std::min(uint32_t((item.centroid[axis] - centroidMin[axis]) * scale[axis]), binCount - 1);
+  };
+
+  // 要素を1度だけ読み、3軸のビンへ同時に振り分ける.
+  Bin bins[3][SahBinCount];
+  for (uint32_t i = first; i < first + count; ++i)
+  {
+    const auto& item = items[i];
+    for (int axis = 0; axis < 3; ++axis)
+    {
+      auto& bin = bins[axis][binIndex(item, axis)];
+      bin.boundsMin = glm::min(bin.boundsMin, item.boundsMin);
+      bin.boundsMax = glm::max(bin.boundsMax, item.boundsMax);
+      bin.count++;
+    }
+  }
+
+  for (int axis = 0; axis < 3; ++axis)
+  {
+    if (!(centroidExtent[axis] > 0.0f))
+    {
+      continue;
+    }
+    // 右側から累積した表面積を先に求めておき、左側から走査する.
+    float rightArea[SahBinCount];
+    uint32_t rightCount[SahBinCount];
+    Bin accum;
+    for (uint32_t b = binCount - 1; b > 0; --b)
+    {
+      accum.boundsMin = glm::min(accum.boundsMin, bins[axis][b].boundsMin);
+      accum.boundsMax = glm::max(accum.boundsMax, bins[axis][b].boundsMax);
+      accum.count += bins[axis][b].count;
+      rightArea[b] = SurfaceArea(accum.boundsMin, accum.boundsMax);
+      rightCount[b] = accum.count;
+    }
+    accum = Bin{};
+    for (uint32_t b = 0; b < binCount - 1; ++b)
+    {
+      accum.boundsMin = glm::min(accum.boundsMin, bins[axis][b].boundsMin);
+      accum.boundsMax = glm::max(accum.boundsMax, bins[axis][b].boundsMax);
+      accum.count += bins[axis][b].count;
+      if (accum.count == 0 || rightCount[b + 1] == 0)
+      {
+        continue;
+      }
+      float cost = accum.count * SurfaceArea(accum.boundsMin, accum.boundsMax) + rightCount[b + 1] * rightArea[b + 1];
+      if (cost < bestCost)
+      {
+        bestCost = cost;
+        bestAxis = axis;
+        bestSplit = b + 1;
+      }
+    }
+  }
+
+  uint32_t leftCount = 0;
+  if (bestAxis >= 0)
+  {
+    auto middle = std::partition(items.begin() + first, items.begin() + first + count, [&](const BuildItem& item) {
+      return binIndex(item, bestAxis) < bestSplit;
+    });
+    leftCount = uint32_t(middle - (items.begin() + first));
+  }
+  if (leftCount == 0 || leftCount == count)
+  {
+    // 中心が全て同じ位置にある場合は数で半分に分ける.
+    leftCount = count / 2;
+  }
+
+  BuildNode(items, first, leftCount, depth + 1);
+  m_rightChild[node] = BuildNode(items, first + leftCount, count - leftCount, depth + 1);
+  return node;
+}
+
+uint32_t MeshBvh::Cull(const Frustum& frustum, std::vector<uint32_t>& outVisible) const
+{
+  outVisible.resize(m_indices.size());
+  uint32_t visibleCount = 0;
+  if (m_indices.empty())
+  {
+    return 0;
+  }
+
+  // 平面のマスクはまだ判定が必要な平面. 親が完全に内側にある平面は子でも判定しない.
+  const uint32_t allPlanes = (1u << Frustum::PLANE_COUNT) - 1;
+  struct StackEntry
+  {
+    uint32_t node;
+    uint32_t planeMask;
+  };
+  StackEntry stack[MaxDepth + 1];
+  uint32_t stackSize = 0;
+  stack[stackSize++] = StackEntry{ .node = 0, .planeMask = allPlanes };
+
+  while (stackSize > 0)
+  {
+    auto entry = stack[--stackSize];
+    auto node = entry.node;
+    auto planeMask = entry.planeMask;
+
+    float cx = (m_nodeMinX[node] + m_nodeMaxX[node]) * 0.5f, ex = (m_nodeMaxX[node] - m_nodeMinX[node]) * 0.5f;
+    float cy = (m_nodeMinY[node] + m_nodeMaxY[node]) * 0.5f, ey = (m_nodeMaxY[node] - m_nodeMinY[node]) * 0.5f;
+    float cz = (m_nodeMinZ[node] + m_nodeMaxZ[node]) * 0.5f, ez = (m_nodeMaxZ[node] - m_nodeMinZ[node]) * 0.5f;
+    bool outside = false;
+    for (int p = 0; p < Frustum::PLANE_COUNT; ++p)
+    {
+      if ((planeMask & (1u << p)) == 0)
+      {
+        continue;
+      }
+      const auto& plane = frustum.planes[p];
+      float d = PlaneDistance(plane, cx, cy, cz);
+      float r = PlaneRadius(plane, ex, ey, ez);
+      if (d + r < 0.0f)
+      {
+        outside = true;
+        break;
+      }
+      if (d - r >= 0.0f)
+      {
+        planeMask &= ~(1u << p);
+      }
+    }
+    if (outside)
+    {
+      continue;
+    }
+
+    auto first = m_first[node], count = m_count[node];
+    if (planeMask == 0)
+    {
+      // 全ての平面の内側にあるため、子孫の要素を判定せずに出力する.
+      std::copy(m_indices.begin() + first, m_indices.begin() + first + count, outVisible.begin() + visibleCount);
+      visibleCount += count;
+      continue;
+    }
+    if (m_rightChild[node] == 0)
+    {
+      for (uint32_t i = first; i < first + count; ++i)
+      {
+        float pcx = (m_minX[i] + m_maxX[i]) * 0.5f, pex = (m_maxX[i] - m_minX[i]) * 0.5f;
+        float pcy = (m_minY[i] + m_maxY[i]) * 0.5f, pey = (m_maxY[i] - m_minY[i]) * 0.5f;
+        float pcz = (m_minZ[i] + m_maxZ[i]) * 0.5f, pez = (m_maxZ[i] - m_minZ[i]) * 0.5f;
+        bool visible = true;
+        for (int p = 0; p < Frustum::PLANE_COUNT && visible; ++p)
+        {
+          const auto& plane = frustum.planes[p];
+          visible = PlaneDistance(plane, pcx, pcy, pcz) + PlaneRadius(plane, pex, pey, pez) >= 0.0f;
+        }
+        if (visible)
+        {
+          outVisible[visibleCount++] = m_indices[i];
+        }
+      }
+      continue;
+    }
+    stack[stackSize++] = StackEntry{ .node = m_rightChild[node], .planeMask = planeMask };
+    stack[stackSize++] = StackEntry{ .node = node + 1, .planeMask = planeMask };
+  }
+
+  outVisible.resize(visibleCount);
+  return visibleCount;
+}
+
+bool MeshBvh::Raycast(const glm::vec3& origin, const glm::vec3& direction, float maxDistance, RayHit& outHit) const
+{
+  outHit = RayHit{};
+  if (m_indices.empty())
+  {
+    return false;
+  }
+  auto invDir = ComputeInverseDirection(direction);
+  float nearest = maxDistance;
+
+  float distance;
+  if (!IntersectRayBox(origin, invDir,
+    m_nodeMinX[0], m_nodeMinY[0], m_nodeMinZ[0], m_nodeMaxX[0], m_nodeMaxY[0], m_nodeMaxZ[0], nearest, distance))
+  {
+    return false;
+  }
+
+  // 交差した子のうち近い方を先に辿り、見つかった距離より遠いノードは捨てる.
+  struct StackEntry
+  {
+    uint32_t node;
+    float distance;
+  };
+  StackEntry stack[MaxDepth + 1];
+  uint32_t stackSize = 0;
+  stack[stackSize++] = StackEntry{ .node = 0, .distance = distance };
+  while (stackSize > 0)
+  {
+    auto entry = stack[--stackSize];
+    if (entry.distance > nearest)
+    {
+      continue;
+    }
+    auto node = entry.node;
+    auto right = m_rightChild[node];
+    if (right == 0)
+    {
+      for (uint32_t i = m_first[node]; i < m_first[node] + m_count[node]; ++i)
+      {
+        if (IntersectRayBox(origin, invDir, m_minX[i], m_minY[i], m_minZ[i], m_maxX[i], m_maxY[i], m_maxZ[i], nearest, distance))
+        {
+          if (outHit.index == UINT32_MAX || distance < nearest || (distance == nearest && m_indices[i] < outHit.index))
+          {
+            nearest = distance;
+            outHit = RayHit{ .index = m_indices[i], .distance = distance };
+          }
+        }
+      }
+      continue;
+    }
+
+    auto left = node + 1;
+    float leftDistance, rightDistance;
+    bool hitLeft = IntersectRayBox(origin, invDir,
+      m_nodeMinX[left], m_nodeMinY[left], m_nodeMinZ[left], m_nodeMaxX[left], m_nodeMaxY[left], m_nodeMaxZ[left], nearest, leftDistance);
+    bool hitRight = IntersectRayBox(origin, invDir,
+      m_nodeMinX[right], m_nodeMinY[right], m_nodeMinZ[right], m_nodeMaxX[right], m_nodeMaxY[right], m_nodeMaxZ[right], nearest, rightDistance);
+    if (hitLeft && hitRight)
+    {
+      if (leftDistance <= rightDistance)
+      {
+        stack[stackSize++] = StackEntry{ .node = right, .distance = rightDistance };
+        stack[stackSize++] = StackEntry{ .node = left, .distance = leftDistance };
+      }
+      else
+      {
+        stack[stackSize++] = StackEntry{ .node = left, .distance = leftDistance };
+        stack[stackSize++] = StackEntry{ .node = right, .distance = rightDistance };
+      }
+    }
+    else if (hitLeft)
+    {
+      stack[stackSize++] = StackEntry{ .node = left, .distance = leftDistance };
+    }
+    else if (hitRight)
+    {
+      stack[stackSize++] = StackEntry{ .node = right, .distance = rightDistance };
+    }
+  }
+  return outHit.index != UINT32_MAX;
+}
+
+bool MeshBvh::FindNearest(const glm::vec3& point, RayHit& outHit) const
+{
+  outHit = RayHit{};
+  if (m_indices.empty())
+  {
+    return false;
+  }
+
+  // 距離は2乗のまま比べ、最後に平方根を取る.
+  float nearest = FLT_MAX;
+  struct StackEntry
+  {
+    uint32_t node;
+    float distanceSq;
+  };
+  StackEntry stack[MaxDepth + 1];
+  uint32_t stackSize = 0;
+  stack[stackSize++] = StackEntry{ .node = 0,
+    .distanceSq = DistanceSquared(point, m_nodeMinX[0], m_nodeMinY[0], m_nodeMinZ[0], m_nodeMaxX[0], m_nodeMaxY[0], m_nodeMaxZ[0]) };
+  while (stackSize > 0)
+  {
+    auto entry = stack[--stackSize];
+    if (entry.distanceSq > nearest)
+    {
+      continue;
+    }
+    auto node = entry.node;
+    auto right = m_rightChild[node];
+    if (right == 0)
+    {
+      for (uint32_t i = m_first[node]; i < m_first[node] + m_count[node]; ++i)
+      {
+        float distanceSq = DistanceSquared(point, m_minX[i], m_minY[i], m_minZ[i], m_maxX[i], m_maxY[i], m_maxZ[i]);
+        if (distanceSq < nearest || (distanceSq == nearest && m_indices[i] < outHit.index))
+        {
+          nearest = distanceSq;
+          outHit.index = m_indices[i];
+        }
+      }
+      continue;
+    }
+
+    auto left = node + 1;
+    float leftDistanceSq = DistanceSquared(point,
+      m_nodeMinX[left], m_nodeMinY[left], m_nodeMinZ[left], m_nodeMaxX[left], m_nodeMaxY[left], m_nodeMaxZ[left]);
+    float rightDistanceSq = DistanceSquared(point,
+      m_nodeMinX[right], m_nodeMinY[right], m_nodeMinZ[right], m_nodeMaxX[right], m_nodeMaxY[right], m_nodeMaxZ[right]);
+    if (leftDistanceSq <= rightDistanceSq)
+    {
+      stack[stackSize++] = StackEntry{ .node = right, .distanceSq = rightDistanceSq };
+      stack[stackSize++] = StackEntry{ .node = left, .distanceSq = leftDistanceSq };
+    }
+    else
+    {
+      stack[stackSize++] = StackEntry{ .node = left, .distanceSq = leftDistanceSq };
+      stack[stackSize++] = StackEntry{ .node = right, .distanceSq = rightDistanceSq };
+    }
+  }
+  outHit.distance = std::sqrt(nearest);
+  return true;
+}
+
+BvhBenchmarkResult RunBvhBenchmark(uint32_t boxCount, const Frustum& frustum)
+{
+  // RunCullingBenchmark と同じ配置. 毎回同じ結果になるよう乱数は固定.
+  std::mt19937 rng(12345);
+  std::uniform_real_distribution<float> position(-50.0f, 50.0f);
+  std::uniform_real_distribution<float> size(0.1f, 2.0f);
+  std::uniform_real_distribution<float> direction(-1.0f, 1.0f);
+
+  std::vector<glm::vec3> boundsMin(boxCount), boundsMax(boxCount);
+  FrustumCuller culler;
+  culler.Reserve(boxCount);
+  for (uint32_t i = 0; i < boxCount; ++i)
+  {
+    glm::vec3 center(position(rng), position(rng), position(rng));
+    glm::vec3 extent(size(rng), size(rng), size(rng));
+    boundsMin[i] = center - extent;
+    boundsMax[i] = center + extent;
+    culler.AddBox(boundsMin[i], boundsMax[i]);
+  }
+
+  // レイと点は箱と同じ範囲から作る.
+  const uint32_t queryCount = 4096;
+  std::vector<glm::vec3> rayOrigins(queryCount), rayDirections(queryCount), points(queryCount);
+  for (uint32_t i = 0; i < queryCount; ++i)
+  {
+    rayOrigins[i] = glm::vec3(position(rng), position(rng), position(rng));
+    rayDirections[i] = glm::vec3(direction(rng), direction(rng), direction(rng));
+    points[i] = glm::vec3(position(rng), position(rng), position(rng));
+  }
+
+  const int iterations = 16;
+  auto measure = [&](auto&& func) {
+    auto start = std::chrono::high_resolution_clock::now();
+    for (int i = 0; i < iterations; ++i)
+    {
+      func();
+    }
+    auto end = std::chrono::high_resolution_clock::now();
+    return std::chrono::duration<double, std::milli>(end - start).count() / iterations;
+  };
+
+  MeshBvh bvh;
+  BvhBenchmarkResult result;
+  result.boxCount = boxCount;
+  result.buildMilliseconds = measure([&]() { bvh.Build(boundsMin, boundsMax); });
+  result.nodeCount = bvh.GetNodeCount();
+  result.depth = bvh.GetDepth();
+
+  std::vector<uint32_t> bvhVisible, flatVisible;
+  bvhVisible.reserve(boxCount);
+  flatVisible.reserve(boxCount);
+  result.cullMilliseconds = measure([&]() { bvh.Cull(frustum, bvhVisible); });
+  result.flatCullMilliseconds = measure([&]() { culler.Cull(frustum, flatVisible); });
+  result.visibleCount = uint32_t(bvhVisible.size());
+
+  std::vector<MeshBvh::RayHit> rayHits(queryCount), nearestHits(queryCount);
+  const float rayDistance = 1000.0f;
+  auto rayMilliseconds = measure([&]() {
+    for (uint32_t i = 0; i < queryCount; ++i)
+    {
+      bvh.Raycast(rayOrigins[i], rayDirections[i], rayDistance, rayHits[i]);
+    }
+  });
+  auto nearestMilliseconds = measure([&]() {
+    for (uint32_t i = 0; i < queryCount; ++i)
+    {
+      bvh.FindNearest(points[i], nearestHits[i]);
+    }
+  });
+  result.raysPerSecond = queryCount * 1000.0 / std::max(rayMilliseconds, 1.0e-6);
+  result.nearestPerSecond = queryCount * 1000.0 / std::max(nearestMilliseconds, 1.0e-6);
+
+  // 総当たりの結果と比べる. 視錐台カリングは順序が異なるため並べ替えてから比べる.
+  std::sort(bvhVisible.begin(), bvhVisible.end());
+  bool matched = bvhVisible == flatVisible;
+  for (uint32_t q = 0; q < queryCount && matched; ++q)
+  {
+    auto invDir = ComputeInverseDirection(rayDirections[q]);
+    MeshBvh::RayHit rayHit, nearestHit;
+    float nearestSq = FLT_MAX;
+    for (uint32_t i = 0; i < boxCount; ++i)
+    {
+      float distance;
+      const auto& bmin = boundsMin[i];
+      const auto& bmax = boundsMax[i];
+      if (IntersectRayBox(rayOrigins[q], invDir, bmin.x, bmin.y, bmin.z, bmax.x, bmax.y, bmax.z, rayDistance, distance) &&
+        (rayHit.index == UINT32_MAX || distance < rayHit.distance))
+      {
+        rayHit = MeshBvh::RayHit{ .index = i, .distance = distance };
+      }
+      float distanceSq = DistanceSquared(points[q], bmin.x, bmin.y, bmin.z, bmax.x, bmax.y, bmax.z);
+      if (distanceSq < nearestSq)
+      {
+        nearestSq = distanceSq;
+        nearestHit.index = i;
+      }
+    }
+    matched = rayHit.index == rayHits[q].index && nearestHit.index == nearestHits[q].index;
+  }
+  result.matched = matched;
+  return result;
+}
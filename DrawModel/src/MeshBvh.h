@@ -0,0 +1,88 @@
+﻿#pragma once
+#include <vector>
+#include <cstdint>
+
+#define GLM_FORCE_DEPTH_ZERO_TO_ONE
+#include "glm/glm.hpp"
+
+#include "Culling.h"
+
+// メッシュ (インスタンス) の AABB に対する BVH.
+//  SAH (Surface Area Heuristic) で分割し、ノードは深さ優先の順に1つの配列へ並べる.
+//  左の子は常に直後のノードとなるため、ノードには右の子の番号だけを持つ.
+//  ノード・要素の境界は成分ごとの配列 (SoA) で持ち、走査で参照する値だけを読む.
+//  どのノードも要素の並べ替え後の連続した範囲を持ち、視錐台の内側にあるノードは範囲をそのまま出力する.
+class MeshBvh
+{
+public:
+  void Clear();
+  void Build(const std::vector<glm::vec3>& boundsMin, const std::vector<glm::vec3>& boundsMax);
+  // 木の構造はそのままに、要素の AABB を差し替えてノードの境界を葉から包み直す.
+  //  要素数は Build と同じであること. 動きが大きいと分割の質が落ちるため、その場合は Build し直す.
+  void Refit(const std::vector<glm::vec3>& boundsMin, const std::vector<glm::vec3>& boundsMax);
+
+  uint32_t GetCount() const { return uint32_t(m_indices.size()); }
+  uint32_t GetNodeCount() const { return uint32_t(m_rightChild.size()); }
+  uint32_t GetDepth() const { return m_depth; }
+
+  // 視錐台と交差する要素の番号を outVisible に詰めて出力し、その数を返す.
+  //  判定は FrustumCuller と同じで、出力の順序は番号順ではない.
+  uint32_t Cull(const Frustum& frustum, std::vector<uint32_t>& outVisible) const;
+
+  // レイと交差する要素のうち、最も手前のもの. 距離はレイの始点から AABB に入るまで (始点が内側ならば 0).
+  struct RayHit
+  {
+    uint32_t index = UINT32_MAX;
+    float distance = 0.0f;
+  };
+  //  direction は正規化されていなくても良い. その場合の距離は direction の長さを単位とする.
+  bool Raycast(const glm::vec3& origin, const glm::vec3& direction, float maxDistance, RayHit& outHit) const;
+
+  // 点から AABB までの距離が最も近い要素. (点を含む要素は距離 0)
+  bool FindNearest(const glm::vec3& point, RayHit& outHit) const;
+
+private:
+  struct BuildItem
+  {
+    glm::vec3 boundsMin;
+    glm::vec3 boundsMax;
+    glm::vec3 centroid;
+    uint32_t  index;
+  };
+  uint32_t BuildNode(std::vector<BuildItem>& items, uint32_t first, uint32_t count, uint32_t depth);
+  void SetNodeBounds(uint32_t node, const glm::vec3& boundsMin, const glm::vec3& boundsMax);
+
+  // ノード.
+  std::vector<float> m_nodeMinX, m_nodeMinY, m_nodeMinZ;
+  std::vector<float> m_nodeMaxX, m_nodeMaxY, m_nodeMaxZ;
+  std::vector<uint32_t> m_rightChild;   // 葉は 0. (根は 0 番のため右の子にはならない)
+  std::vector<uint32_t> m_first;        // m_indices 内の範囲.
+  std::vector<uint32_t> m_count;
+
+  // 要素. ノードの範囲の順に並べ替えたもの.
+  std::vector<float> m_minX, m_minY, m_minZ;
+  std::vector<float> m_maxX, m_maxY, m_maxZ;
+  std::vector<uint32_t> m_indices;      // 元の番号.
+
+  uint32_t m_depth = 0;
+
+  static const uint32_t MaxLeafCount = 4;
+  static const uint32_t SahBinCount = 16;
+  static const uint32_t MaxDepth = 64;
+};
+
+// ランダムな AABB で BVH の構築・各問い合わせの速度を計測し、総当たりと結果を比べる.
+struct BvhBenchmarkResult
+{
+  uint32_t boxCount = 0;
+  uint32_t nodeCount = 0;
+  uint32_t depth = 0;
+  double   buildMilliseconds = 0.0;
+  double   cullMilliseconds = 0.0;      // 1回の視錐台カリング.
+  double   flatCullMilliseconds = 0.0;  // FrustumCuller で全 AABB を判定した場合.
+  double   raysPerSecond = 0.0;
+  double   nearestPerSecond = 0.0;
+  uint32_t visibleCount = 0;
+  bool     matched = false;   // 全ての問い合わせが総当たりの結果と一致したか.
+};
+BvhBenchmarkResult RunBvhBenchmark(uint32_t boxCount, const Frustum& frustum);
@@ -0,0 +1,507 @@
+﻿#include "MeshOptimizer.h"
+
+#include <cmath>
+#include <cstring>
+#include <cassert>
+#include <algorithm>
+#include <type_traits>
+#include <unordered_map>
+
+namespace
+{
+  // FIFO キャッシュを時刻で模擬する.
+  //  頂点が入った時刻を記録し、その後 cacheSize 個の頂点が入ると追い出されたものとみなす.
+  class VertexCacheSimulator
+  {
+  public:
+    VertexCacheSimulator(uint32_t vertexCount, uint32_t cacheSize)
+      : m_cacheTimes(vertexCount, 0), m_time(cacheSize + 1), m_cacheSize(cacheSize)
+    {
+    }
+
+    // キャッシュに無ければ追加して true を返す.
+    bool Access(uint32_t v)
+    {
+      if (m_time - m_cacheTimes[v] > m_cacheSize)
+      {
+        m_cacheTimes[v] = m_time++;
+        return true;
+      }
+      return false;
+    }
+    // 全ての頂点を追い出す.
+    void Reset()
+    {
+      m_time += m_cacheSize + 1;
+    }
+
+  private:
+    std::vector<uint32_t> m_cacheTimes;
+    uint32_t m_time;
+    uint32_t m_cacheSize;
+  };
+
+  // 頂点の全要素をビット列として比較・ハッシュするためのキー.
+  //  -0 と +0 は同じ値として扱う. スキンを持たないメッシュではジョイントの分は 0 のまま.
+  struct VertexKey
+  {
+    uint32_t bits[16] = {};
+
+    VertexKey(const ModelMesh& mesh, uint32_t vertex)
+    {
+      const auto& p = mesh.positions[vertex];
+      const auto& n = mesh.normals[vertex];
+      const auto& uv = mesh.texcoords[vertex];
+      const float values[8] = { p.x, p.y, p.z, n.x, n.y, n.z, uv.x, uv.y };
+      for (int i = 0; i < 8; ++i)
+      {
+        float v = values[i] == 0.0f ? 0.0f : values[i];
+        memcpy(&bits[i], &v, sizeof(uint32_t));
+      }
+      if (mesh.IsSkinned())
+      {
+        memcpy(&bits[8], &mesh.jointIndices[vertex], sizeof(glm::uvec4));
+        memcpy(&bits[12], &mesh.jointWeights[vertex], sizeof(glm::vec4));
+      }
+    }
+    bool operator==(const VertexKey& rhs) const { return memcmp(bits, rhs.bits, sizeof(bits)) == 0; }
+  };
+  struct VertexKeyHash
+  {
+    size_t operator()(const VertexKey& key) const
+    {
+      size_t h = 0;
+      for (auto b : key.bits)
+      {
+        h = h * 31 + b;
+      }
+      return h;
+    }
+  };
+
+  // 頂点の各要素を sourceVertices の順に並べ直す. (新しい頂点 i の値は元の頂点 sourceVertices[i])
+  void GatherVertices(ModelMesh& mesh, const std::vector<uint32_t>& sourceVertices)
+  {
+    auto gather = [&](auto& values) {
+      if (values.empty())
+      {
+        return;
+      }
+      std::remove_reference_t<decltype(values)> gathered(sourceVertices.size());
+      for (size_t i = 0; i < sourceVertices.size(); ++i)
+      {
+        gathered[i] = values[sourceVertices[i]];
+      }
+      values.swap(gathered);
+    };
+    gather(mesh.positions);
+    gather(mesh.normals);
+    gather(mesh.texcoords);
+    gather(mesh.jointIndices);
+    gather(mesh.jointWeights);
+  }
+
+  // 頂点ごとに隣接する三角形のリスト.
+  struct VertexAdjacency
+  {
+    std::vector<uint32_t> offsets;    // 頂点ごとの triangles 内の先頭. (頂点数 + 1 個)
+    std::vector<uint32_t> triangles;
+
+    VertexAdjacency(const std::vector<uint32_t>& indices, uint32_t vertexCount)
+    {
+      offsets.assign(vertexCount + 1, 0);
+      for (auto v : indices)
+      {
+        offsets[v + 1]++;
+      }
+      for (uint32_t v = 0; v < vertexCount; ++v)
+      {
+        offsets[v + 1] += offsets[v];
+      }
+      triangles.resize(indices.size());
+      std::vector<uint32_t> cursor(offsets.begin(), offsets.end() - 1);
+      for (uint32_t i = 0; i < indices.size(); ++i)
+      {
+        triangles[cursor[indices[i]]++] = i / 3;
+      }
+    }
+  };
+}
+
+uint32_t WeldVertices(ModelMesh& mesh, const VertexWeldTolerance& tolerance)
+{
+  const auto vertexCount = uint32_t(mesh.positions.size());
+  std::vector<uint32_t> remap(vertexCount);
+  std::vector<uint32_t> uniqueVertices;
+  uniqueVertices.reserve(vertexCount);
+
+  if (tolerance.IsExact())
+  {
+    std::unordered_map<VertexKey, uint32_t, VertexKeyHash> vertexMap;
+    vertexMap.reserve(vertexCount);
+    for (uint32_t v = 0; v < vertexCount; ++v)
+    {
+      auto [itr, inserted] = vertexMap.try_emplace(
+        VertexKey(mesh, v), uint32_t(uniqueVertices.size()));
+      if (inserted)
+      {
+        uniqueVertices.push_back(v);
+      }
+      remap[v] = itr->second;
+    }
+  }
+  else
+  {
+    // 格子の大きさを許容差以上にしておけば、候補は周囲 3x3x3 の格子内に限られる.
+    //  ハッシュが衝突した格子も値で比較するため結果には影響しない.
+    const float cellSize = std::max(tolerance.position, 1.0e-8f);
+    auto cellKey = [](int64_t x, int64_t y, int64_t z) {
+      return uint64_t(x * 73856093) ^ uint64_t(y * 19349663) ^ uint64_t(z * 83492791);
+    };
+    // ジョイントとウェイトは許容差を設けず一致するものだけをまとめる.
+    const bool skinned = mesh.IsSkinned();
+    auto isNear = [&](uint32_t a, uint32_t b) {
+      if (skinned && (mesh.jointIndices[a] != mesh.jointIndices[b] || mesh.jointWeights[a] != mesh.jointWeights[b]))
+      {
+        return false;
+      }
+      auto dp = mesh.positions[a] - mesh.positions[b];
+      auto dn = glm::abs(mesh.normals[a] - mesh.normals[b]);
+      auto dt = glm::abs(mesh.texcoords[a] - mesh.texcoords[b]);
+      return glm::dot(dp, dp) <= tolerance.position * tolerance.position &&
+        dn.x <= tolerance.normal && dn.y <= tolerance.normal && dn.z <= tolerance.normal &&
+        dt.x <= tolerance.texcoord && dt.y <= tolerance.texcoord;
+    };
+
+    std::unordered_map<uint64_t, std::vector<uint32_t>> cells;
+    for (uint32_t v = 0; v < vertexCount; ++v)
+    {
+      const auto& p = mesh.positions[v];
+      const auto cx = int64_t(std::floor(p.x / cellSize));
+      const auto cy = int64_t(std::floor(p.y / cellSize));
+      const auto cz = int64_t(std::floor(p.z / cellSize));
+      uint32_t found = ~0u;
+      for (int64_t z = cz - 1; z <= cz + 1 && found == ~0u; ++z)
+      {
+        for (int64_t y = cy - 1; y <= cy + 1 && found == ~0u; ++y)
+        {
+          for (int64_t x = cx - 1; x <= cx + 1 && found == ~0u; ++x)
+          {
+            auto itr = cells.find(cellKey(x, y, z));
+            if (itr == cells.end())
+            {
+              continue;
+            }
+            for (auto u : itr->second)
+            {
+              if (isNear(uniqueVertices[u], v))
+              {
+                found = u;
+                break;
+              }
+            }
+          }
+        }
+      }
+      if (found == ~0u)
+      {
+        found = uint32_t(uniqueVertices.size());
+        uniqueVertices.push_back(v);
+        cells[cellKey(cx, cy, cz)].push_back(found);
+      }
+      remap[v] = found;
+    }
+  }
+
+  // 最初に現れた頂点の値を代表として残す.
+  const auto uniqueCount = uint32_t(uniqueVertices.size());
+  GatherVertices(mesh, uniqueVertices);
+  for (auto& index : mesh.indices)
+  {
+    index = remap[index];
+  }
+  return uniqueCount;
+}
+
+ModelMeshCacheStats AnalyzeVertexCache(const std::vector<uint32_t>& indices, uint32_t vertexCount, uint32_t cacheSize)
+{
+  ModelMeshCacheStats stats;
+  const auto triangleCount = uint32_t(indices.size() / 3);
+  if (triangleCount == 0)
+  {
+    return stats;
+  }
+
+  VertexCacheSimulator cache(vertexCount, cacheSize);
+  std::vector<uint8_t> referenced(vertexCount, 0);
+  uint32_t misses = 0, uniqueCount = 0;
+  for (auto v : indices)
+  {
+    misses += cache.Access(v) ? 1 : 0;
+    if (!referenced[v])
+    {
+      referenced[v] = 1;
+      uniqueCount++;
+    }
+  }
+  stats.acmr = float(misses) / float(triangleCount);
+  stats.atvr = float(misses) / float(uniqueCount);
+  return stats;
+}
+
+void OptimizeVertexCache(std::vector<uint32_t>& indices, uint32_t vertexCount, uint32_t cacheSize)
+{
+  const auto triangleCount = uint32_t(indices.size() / 3);
+  if (triangleCount == 0)
+  {
+    return;
+  }
+  VertexAdjacency adjacency(indices, vertexCount);
+
+  // 頂点ごとの未出力の三角形数と、キャッシュに入った時刻.
+  std::vector<uint32_t> liveTriangles(vertexCount);
+  for (uint32_t v = 0; v < vertexCount; ++v)
+  {
+    liveTriangles[v] = adjacency.offsets[v + 1] - adjacency.offsets[v];
+  }
+  std::vector<uint32_t> cacheTimes(vertexCount, 0);
+  std::vector<uint8_t> emitted(triangleCount, 0);
+  std::vector<uint32_t> deadEnd;
+  std::vector<uint32_t> candidates;
+  std::vector<uint32_t> result;
+  result.reserve(indices.size());
+
+  uint32_t time = cacheSize + 1;
+  uint32_t cursor = 0;
+  int64_t fanning = 0;
+  while (fanning >= 0)
+  {
+    // 扇の中心となる頂点の周りの三角形を全て出力する.
+    candidates.clear();
+    const auto f = uint32_t(fanning);
+    for (uint32_t i = adjacency.offsets[f]; i < adjacency.offsets[f + 1]; ++i)
+    {
+      const auto t = adjacency.triangles[i];
+      if (emitted[t])
+      {
+        continue;
+      }
+      emitted[t] = 1;
+      for (int c = 0; c < 3; ++c)
+      {
+        const auto v = indices[t * 3 + c];
+        result.push_back(v);
+        deadEnd.push_back(v);
+        candidates.push_back(v);
+        liveTriangles[v]--;
+        if (time - cacheTimes[v] > cacheSize)
+        {
+          cacheTimes[v] = time++;
+        }
+      }
+    }
+
+    // 次の中心は、扇を出力してもキャッシュに残っている見込みのある頂点のうち最も古いもの.
+    fanning = -1;
+    uint32_t bestPriority = 0;
+    for (auto v : candidates)
+    {
+      if (liveTriangles[v] == 0)
+      {
+        continue;
+      }
+      uint32_t priority = 0;
+      if (time - cacheTimes[v] + 2 * liveTriangles[v] <= cacheSize)
+      {
+        priority = time - cacheTimes[v];
+      }
+      if (priority > bestPriority || fanning < 0)
+      {
+        bestPriority = priority;
+        fanning = v;
+      }
+    }
+
+    // 行き止まりでは直近に出力した頂点から、それも無ければ番号順に探す.
+    while (fanning < 0 && !deadEnd.empty())
+    {
+      const auto v = deadEnd.back();
+      deadEnd.pop_back();
+      if (liveTriangles[v] > 0)
+      {
+        fanning = v;
+      }
+    }
+    while (fanning < 0 && cursor < vertexCount)
+    {
+      if (liveTriangles[cursor] > 0)
+      {
+        fanning = cursor;
+      }
+      cursor++;
+    }
+  }
+  assert(result.size() == indices.size());
+  indices.swap(result);
+}
+
+void OptimizeOverdraw(const std::vector<glm::vec3>& positions, std::vector<uint32_t>& indices, float threshold, uint32_t cacheSize)
+{
+  const auto triangleCount = uint32_t(indices.size() / 3);
+  const auto vertexCount = uint32_t(positions.size());
+  if (triangleCount == 0)
+  {
+    return;
+  }
+
+  // 3頂点ともキャッシュに無い三角形は、直前までとのつながりが無いため境界とする.
+  std::vector<uint32_t> hardBoundaries;
+  {
+    VertexCacheSimulator cache(vertexCount, cacheSize);
+    for (uint32_t t = 0; t < triangleCount; ++t)
+    {
+      uint32_t misses = 0;
+      for (int c = 0; c < 3; ++c)
+      {
+        misses += cache.Access(indices[t * 3 + c]) ? 1 : 0;
+      }
+      if (misses == 3)
+      {
+        hardBoundaries.push_back(t);
+      }
+    }
+    if (hardBoundaries.empty() || hardBoundaries[0] != 0)
+    {
+      hardBoundaries.insert(hardBoundaries.begin(), 0);
+    }
+    hardBoundaries.push_back(triangleCount);
+  }
+
+  // 大きなクラスタは、先頭から数えた ACMR がクラスタ全体の threshold 倍以内に収まった位置で更に分割する.
+  //  分割位置でキャッシュを空にして数えるため、並べ替え後の ACMR も同程度に収まる.
+  std::vector<uint32_t> clusters;
+  {
+    VertexCacheSimulator cache(vertexCount, cacheSize);
+    for (size_t h = 0; h + 1 < hardBoundaries.size(); ++h)
+    {
+      const auto begin = hardBoundaries[h];
+      const auto end = hardBoundaries[h + 1];
+      cache.Reset();
+      uint32_t clusterMisses = 0;
+      for (uint32_t i = begin * 3; i < end * 3; ++i)
+      {
+        clusterMisses += cache.Access(indices[i]) ? 1 : 0;
+      }
+      const float targetAcmr = float(clusterMisses) / float(end - begin) * threshold;
+
+      cache.Reset();
+      clusters.push_back(begin);
+      uint32_t misses = 0, count = 0;
+      for (uint32_t t = begin; t < end; ++t)
+      {
+        for (int c = 0; c < 3; ++c)
+        {
+          misses += cache.Access(indices[t * 3 + c]) ? 1 : 0;
+        }
+        count++;
+        if (t + 1 < end && float(misses) <= targetAcmr * float(count))
+        {
+          clusters.push_back(t + 1);
+          cache.Reset();
+          misses = count = 0;
+        }
+      }
+    }
+    clusters.push_back(triangleCount);
+  }
+
+  // クラスタの重心がメッシュの重心から見て法線方向にあるほど外側とみなし、先に描く.
+  //  外側の面が先に深度を書き込むことで、内側の面のシェーディングを省ける.
+  struct ClusterKey
+  {
+    float    sortKey;
+    uint32_t index;
+  };
+  const auto clusterCount = uint32_t(clusters.size() - 1);
+  std::vector<glm::vec3> clusterCentroids(clusterCount), clusterNormals(clusterCount);
+  glm::vec3 meshCentroid(0.0f);
+  float meshArea = 0.0f;
+  for (uint32_t c = 0; c < clusterCount; ++c)
+  {
+    glm::vec3 centroid(0.0f), normal(0.0f);
+    float area = 0.0f;
+    for (uint32_t t = clusters[c]; t < clusters[c + 1]; ++t)
+    {
+      const auto& p0 = positions[indices[t * 3 + 0]];
+      const auto& p1 = positions[indices[t * 3 + 1]];
+      const auto& p2 = positions[indices[t * 3 + 2]];
+      auto n = glm::cross(p1 - p0, p2 - p0);
+      float a = glm::length(n);
+      centroid += (p0 + p1 + p2) * (a / 3.0f);
+      normal += n;
+      area += a;
+    }
+    meshCentroid += centroid;
+    meshArea += area;
+    clusterCentroids[c] = area > 0.0f ? centroid / area : positions[indices[clusters[c] * 3]];
+    clusterNormals[c] = normal;
+  }
+  if (meshArea > 0.0f)
+  {
+    meshCentroid /= meshArea;
+  }
+
+  std::vector<ClusterKey> keys(clusterCount);
+  for (uint32_t c = 0; c < clusterCount; ++c)
+  {
+    float length = glm::length(clusterNormals[c]);
+    float key = 0.0f;
+    if (length > 0.0f)
+    {
+      key = glm::dot(clusterCentroids[c] - meshCentroid, clusterNormals[c] / length);
+    }
+    keys[c] = { key, c };
+  }
+  std::stable_sort(keys.begin(), keys.end(), [](const auto& a, const auto& b) { return a.sortKey > b.sortKey; });
+
+  std::vector<uint32_t> result;
+  result.reserve(indices.size());
+  for (const auto& key : keys)
+  {
+    result.insert(result.end(), indices.begin() + clusters[key.index] * 3, indices.begin() + clusters[key.index + 1] * 3);
+  }
+  indices.swap(result);
+}
+
+void OptimizeVertexFetch(ModelMesh& mesh)
+{
+  const auto vertexCount = uint32_t(mesh.positions.size());
+  const uint32_t Unused = ~0u;
+  std::vector<uint32_t> remap(vertexCount, Unused);
+  uint32_t newCount = 0;
+  for (auto& v : mesh.indices)
+  {
+    if (remap[v] == Unused)
+    {
+      remap[v] = newCount++;
+    }
+    v = remap[v];
+  }
+
+  std::vector<uint32_t> sourceVertices(newCount);
+  for (uint32_t v = 0; v < vertexCount; ++v)
+  {
+    if (remap[v] != Unused)
+    {
+      sourceVertices[remap[v]] = v;
+    }
+  }
+  GatherVertices(mesh, sourceVertices);
+}
+
+void OptimizeMesh(ModelMesh& mesh, float overdrawThreshold)
+{
+  OptimizeVertexCache(mesh.indices, uint32_t(mesh.positions.size()));
+  OptimizeOverdraw(mesh.positions, mesh.indices, overdrawThreshold);
+  OptimizeVertexFetch(mesh);
+}
@@ -0,0 +1,48 @@
+﻿#pragma once
+#include <vector>
+#include <cstdint>
+
+#define GLM_FORCE_DEPTH_ZERO_TO_ONE
+#include "glm/glm.hpp"
+
+#include "Model.h"
+
+// 描画効率のためのインデックス・頂点の並べ替え.
+//  頂点キャッシュ (Tipsify) → オーバードロー (クラスタの並べ替え) → 頂点フェッチの順に適用する.
+//  いずれも三角形の集合と頂点の値は変えず、並び順だけを変える.
+
+// 頂点を同一とみなす許容差. 全て 0 ならばビット単位で一致するものだけをまとめる.
+struct VertexWeldTolerance
+{
+  float position = 0.0f;  // 位置の距離 (モデル空間).
+  float normal = 0.0f;    // 法線の各成分の差.
+  float texcoord = 0.0f;  // テクスチャ座標の各成分の差.
+
+  bool IsExact() const { return position <= 0.0f && normal <= 0.0f && texcoord <= 0.0f; }
+};
+
+// 位置・法線・テクスチャ座標が同じ頂点を1つにまとめ、インデックスを付け替える.
+//  スキンを持つメッシュではジョイントとウェイトも一致するものだけをまとめる.
+//  許容差がある場合は位置を許容差の大きさの格子に登録し、近傍の格子の頂点と比較する.
+//  戻り値はまとめた後の頂点数.
+uint32_t WeldVertices(ModelMesh& mesh, const VertexWeldTolerance& tolerance);
+
+// 評価・最適化で想定する頂点キャッシュ (FIFO) のサイズ.
+static const uint32_t VertexCacheSize = 16;
+
+// FIFO キャッシュを模擬して ACMR / ATVR を求める.
+ModelMeshCacheStats AnalyzeVertexCache(const std::vector<uint32_t>& indices, uint32_t vertexCount, uint32_t cacheSize = VertexCacheSize);
+
+// Tipsify (Sander et al. 2007) で頂点キャッシュのヒット率が上がるように三角形を並べ替える.
+void OptimizeVertexCache(std::vector<uint32_t>& indices, uint32_t vertexCount, uint32_t cacheSize = VertexCacheSize);
+
+// 頂点キャッシュ最適化済みのインデックスをクラスタに分け、外向きのクラスタが先になるように並べ替える.
+//  クラスタの分割は ACMR の悪化が threshold 倍以内に収まる位置で行う.
+void OptimizeOverdraw(const std::vector<glm::vec3>& positions, std::vector<uint32_t>& indices, float threshold, uint32_t cacheSize = VertexCacheSize);
+
+// 頂点を最初に参照される順に並べ直し、インデックスを付け替える.
+//  参照されない頂点は取り除く. LOD・メッシュレットを作る前に行うこと.
+void OptimizeVertexFetch(ModelMesh& mesh);
+
+// 上記を順に適用する.
+void OptimizeMesh(ModelMesh& mesh, float overdrawThreshold = 1.05f);
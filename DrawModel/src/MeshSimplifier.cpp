@@ -0,0 +1,366 @@
+﻿#include "MeshSimplifier.h"
+
+#include <cmath>
+#include <cstring>
+#include <algorithm>
+#include <queue>
+#include <unordered_map>
+
+namespace
+{
+  // 平面までの距離の2乗和を表す対称行列 (10要素) と重み.
+  //  精度を確保するため double で保持する.
+  struct Quadric
+  {
+    double a00 = 0, a01 = 0, a02 = 0, a11 = 0, a12 = 0, a22 = 0;
+    double b0 = 0, b1 = 0, b2 = 0;
+    double c = 0;
+    double weight = 0;
+
+    void AddPlane(const glm::dvec3& n, double d, double w)
+    {
+      a00 += w * n.x * n.x; a01 += w * n.x * n.y; a02 += w * n.x * n.z;
+      a11 += w * n.y * n.y; a12 += w * n.y * n.z; a22 += w * n.z * n.z;
+      b0 += w * n.x * d; b1 += w * n.y * d; b2 += w * n.z * d;
+      c += w * d * d;
+      weight += w;
+    }
+    void Add(const Quadric& q)
+    {
+      a00 += q.a00; a01 += q.a01; a02 += q.a02;
+      a11 += q.a11; a12 += q.a12; a22 += q.a22;
+      b0 += q.b0; b1 += q.b1; b2 += q.b2;
+      c += q.c;
+      weight += q.weight;
+    }
+    // 点 p での誤差. 平面からの距離の重み付き二乗平均の平方根を返す.
+    double Evaluate(const glm::vec3& p) const
+    {
+      double x = p.x, y = p.y, z = p.z;
+      double e =
+        a00 * x * x + a11 * y * y + a22 * z * z +
+        2.0 * (a01 * x * y + a02 * x * z + a12 * y * z) +
+        2.0 * (b0 * x + b1 * y + b2 * z) + c;
+      if (weight <= 0.0)
+      {
+        return 0.0;
+      }
+      return std::sqrt(std::max(e, 0.0) / weight);
+    }
+  };
+
+  // 縮約候補. from を to の位置へ寄せる.
+  struct Collapse
+  {
+    double   error;
+    uint32_t from;
+    uint32_t to;
+    uint32_t fromVersion;
+    uint32_t toVersion;
+
+    bool operator>(const Collapse& rhs) const { return error > rhs.error; }
+  };
+
+  class Simplifier
+  {
+  public:
+    Simplifier(const std::vector<glm::vec3>& positions, const std::vector<uint32_t>& indices)
+      : m_positions(positions), m_indices(indices)
+    {
+      const auto vertexCount = positions.size();
+      const auto triangleCount = indices.size() / 3;
+      m_quadrics.resize(vertexCount);
+      m_triangles.resize(vertexCount);
+      m_locked.assign(vertexCount, 0);
+      m_removed.assign(vertexCount, 0);
+      m_versions.assign(vertexCount, 0);
+      m_triangleAlive.assign(triangleCount, 1);
+      m_aliveCount = uint32_t(triangleCount);
+
+      for (uint32_t t = 0; t < triangleCount; ++t)
+      {
+        const auto* tri = &m_indices[t * 3];
+        if (tri[0] == tri[1] || tri[1] == tri[2] || tri[2] == tri[0])
+        {
+          m_triangleAlive[t] = 0;
+          m_aliveCount--;
+          continue;
+        }
+        // 面積で重み付けした平面を3頂点に加える.
+        glm::dvec3 p0 = m_positions[tri[0]], p1 = m_positions[tri[1]], p2 = m_positions[tri[2]];
+        auto cross = glm::cross(p1 - p0, p2 - p0);
+        double length = glm::length(cross);
+        if (length > 0.0)
+        {
+          auto normal = cross / length;
+          double d = -glm::dot(normal, p0);
+          for (int i = 0; i < 3; ++i)
+          {
+            m_quadrics[tri[i]].AddPlane(normal, d, length * 0.5);
+          }
+        }
+        for (int i = 0; i < 3; ++i)
+        {
+          m_triangles[tri[i]].push_back(t);
+        }
+      }
+      LockBoundaryVertices();
+    }
+
+    float Run(uint32_t targetIndexCount, float maxError)
+    {
+      // 全ての辺について両方向の候補を登録する.
+      for (uint32_t t = 0; t < m_triangleAlive.size(); ++t)
+      {
+        if (!m_triangleAlive[t])
+        {
+          continue;
+        }
+        for (int i = 0; i < 3; ++i)
+        {
+          PushCollapse(m_indices[t * 3 + i], m_indices[t * 3 + (i + 1) % 3]);
+        }
+      }
+
+      double resultError = 0.0;
+      while (m_aliveCount * 3 > targetIndexCount && !m_queue.empty())
+      {
+        auto collapse = m_queue.top();
+        m_queue.pop();
+        if (m_removed[collapse.from] || m_removed[collapse.to] ||
+          m_versions[collapse.from] != collapse.fromVersion ||
+          m_versions[collapse.to] != collapse.toVersion)
+        {
+          continue;
+        }
+        if (collapse.error > maxError)
+        {
+          break;
+        }
+        if (IsFlipped(collapse.from, collapse.to))
+        {
+          continue;
+        }
+        Apply(collapse.from, collapse.to);
+        resultError = std::max(resultError, collapse.error);
+      }
+      return float(resultError);
+    }
+
+    void GetIndices(std::vector<uint32_t>& outIndices) const
+    {
+      outIndices.clear();
+      outIndices.reserve(size_t(m_aliveCount) * 3);
+      for (uint32_t t = 0; t < m_triangleAlive.size(); ++t)
+      {
+        if (m_triangleAlive[t])
+        {
+          outIndices.insert(outIndices.end(), &m_indices[t * 3], &m_indices[t * 3] + 3);
+        }
+      }
+    }
+
+  private:
+    // 隣接する三角形が1つしかない辺(境界)上の頂点と、
+    // 同じ位置に複数の頂点がある(法線やテクスチャ座標の継ぎ目)頂点を固定する.
+    void LockBoundaryVertices()
+    {
+      std::unordered_map<uint64_t, uint32_t> edgeCounts;
+      auto edgeKey = [](uint32_t a, uint32_t b) {
+        return a < b ? (uint64_t(a) << 32) | b : (uint64_t(b) << 32) | a;
+      };
+      for (uint32_t t = 0; t < m_triangleAlive.size(); ++t)
+      {
+        if (!m_triangleAlive[t])
+        {
+          continue;
+        }
+        for (int i = 0; i < 3; ++i)
+        {
+          edgeCounts[edgeKey(m_indices[t * 3 + i], m_indices[t * 3 + (i + 1) % 3])]++;
+        }
+      }
+      for (const auto& [key, count] : edgeCounts)
+      {
+        if (count != 2)
+        {
+          m_locked[uint32_t(key >> 32)] = 1;
+          m_locked[uint32_t(key & 0xFFFFFFFF)] = 1;
+        }
+      }
+
+      struct PositionHash
+      {
+        size_t operator()(const glm::vec3& p) const
+        {
+          uint32_t bits[3];
+          memcpy(bits, &p, sizeof(bits));
+          return size_t(bits[0] * 73856093u ^ bits[1] * 19349663u ^ bits[2] * 83492791u);
+        }
+      };
+      std::unordered_map<glm::vec3, uint32_t, PositionHash> firstVertex;
+      for (uint32_t v = 0; v < m_positions.size(); ++v)
+      {
+        auto [itr, inserted] = firstVertex.emplace(m_positions[v], v);
+        if (!inserted)
+        {
+          m_locked[v] = 1;
+          m_locked[itr->second] = 1;
+        }
+      }
+    }
+
+    void PushCollapse(uint32_t from, uint32_t to)
+    {
+      if (m_locked[from])
+      {
+        return;
+      }
+      Quadric q = m_quadrics[from];
+      q.Add(m_quadrics[to]);
+      m_queue.push(Collapse{
+        .error = q.Evaluate(m_positions[to]),
+        .from = from,
+        .to = to,
+        .fromVersion = m_versions[from],
+        .toVersion = m_versions[to],
+      });
+    }
+
+    // from を to へ寄せた時に面の向きが反転する(または潰れる)三角形があるか.
+    bool IsFlipped(uint32_t from, uint32_t to) const
+    {
+      for (auto t : m_triangles[from])
+      {
+        if (!m_triangleAlive[t])
+        {
+          continue;
+        }
+        const auto* tri = &m_indices[t * 3];
+        if (tri[0] == to || tri[1] == to || tri[2] == to)
+        {
+          continue;   // 縮約で消える三角形.
+        }
+        glm::vec3 before[3], after[3];
+        for (int i = 0; i < 3; ++i)
+        {
+          before[i] = m_positions[tri[i]];
+          after[i] = tri[i] == from ? m_positions[to] : before[i];
+        }
+        auto n0 = glm::cross(before[1] - before[0], before[2] - before[0]);
+        auto n1 = glm::cross(after[1] - after[0], after[2] - after[0]);
+        // 元の向きから大きく傾く場合も反転とみなす.
+        if (glm::dot(n0, n1) <= 0.25f * glm::length(n0) * glm::length(n1))
+        {
+          return true;
+        }
+      }
+      return false;
+    }
+
+    void Apply(uint32_t from, uint32_t to)
+    {
+      for (auto t : m_triangles[from])
+      {
+        if (!m_triangleAlive[t])
+        {
+          continue;
+        }
+        auto* tri = &m_indices[t * 3];
+        if (tri[0] == to || tri[1] == to || tri[2] == to)
+        {
+          m_triangleAlive[t] = 0;
+          m_aliveCount--;
+          continue;
+        }
+        for (int i = 0; i < 3; ++i)
+        {
+          if (tri[i] == from)
+          {
+            tri[i] = to;
+          }
+        }
+        m_triangles[to].push_back(t);
+      }
+      m_triangles[from].clear();
+      m_removed[from] = 1;
+      m_quadrics[to].Add(m_quadrics[from]);
+
+      // 消えた三角形を取り除き、縮約後の周囲の頂点を集める.
+      auto& adjacent = m_triangles[to];
+      adjacent.erase(std::remove_if(adjacent.begin(), adjacent.end(), [&](uint32_t t) { return !m_triangleAlive[t]; }), adjacent.end());
+
+      m_neighbors.clear();
+      for (auto t : adjacent)
+      {
+        for (int i = 0; i < 3; ++i)
+        {
+          auto v = m_indices[t * 3 + i];
+          if (v != to)
+          {
+            m_neighbors.push_back(v);
+          }
+        }
+      }
+      std::sort(m_neighbors.begin(), m_neighbors.end());
+      m_neighbors.erase(std::unique(m_neighbors.begin(), m_neighbors.end()), m_neighbors.end());
+
+      // to の誤差行列が変わったため、to を含む候補だけ登録し直す.
+      m_versions[to]++;
+      for (auto v : m_neighbors)
+      {
+        PushCollapse(to, v);
+        PushCollapse(v, to);
+      }
+    }
+
+    const std::vector<glm::vec3>& m_positions;
+    std::vector<uint32_t> m_indices;
+    std::vector<Quadric> m_quadrics;
+    std::vector<std::vector<uint32_t>> m_triangles;   // 頂点ごとの隣接三角形.
+    std::vector<uint8_t> m_locked;
+    std::vector<uint8_t> m_removed;
+    std::vector<uint32_t> m_versions;
+    std::vector<uint8_t> m_triangleAlive;
+    uint32_t m_aliveCount = 0;
+
+    std::priority_queue<Collapse, std::vector<Collapse>, std::greater<Collapse>> m_queue;
+    std::vector<uint32_t> m_neighbors;
+  };
+}
+
+float SimplifyMesh(
+  const std::vector<glm::vec3>& positions, const std::vector<uint32_t>& indices,
+  uint32_t targetIndexCount, float maxError, std::vector<uint32_t>& outIndices)
+{
+  Simplifier simplifier(positions, indices);
+  auto error = simplifier.Run(targetIndexCount, maxError);
+  simplifier.GetIndices(outIndices);
+  return error;
+}
+
+void GenerateMeshLods(ModelMesh& mesh, uint32_t maxLodCount)
+{
+  mesh.lods.clear();
+
+  // 許容誤差はメッシュの大きさに対する比率で決める.
+  const float meshSize = glm::length(mesh.boundsMax - mesh.boundsMin);
+  const float maxError = meshSize * 0.05f;
+
+  auto indexCount = uint32_t(mesh.indices.size());
+  for (uint32_t lod = 1; lod < maxLodCount; ++lod)
+  {
+    // 各 LOD は元のメッシュから簡略化して誤差の蓄積を防ぐ.
+    auto target = (uint32_t(mesh.indices.size()) >> lod) / 3 * 3;
+    ModelMeshLod dstLod;
+    dstLod.error = SimplifyMesh(mesh.positions, mesh.indices, target, maxError, dstLod.indices);
+
+    // ほとんど減らせなくなったら打ち切る.
+    if (dstLod.indices.empty() || dstLod.indices.size() > indexCount * 3 / 4)
+    {
+      break;
+    }
+    indexCount = uint32_t(dstLod.indices.size());
+    mesh.lods.push_back(std::move(dstLod));
+  }
+}
@@ -0,0 +1,24 @@
+﻿#pragma once
+#include <vector>
+#include <cstdint>
+
+#define GLM_FORCE_DEPTH_ZERO_TO_ONE
+#include "glm/glm.hpp"
+
+#include "Model.h"
+
+// 二次誤差メトリクス (QEM) を使った辺の縮約によるメッシュの簡略化.
+//  頂点は隣接する既存の頂点へ寄せるだけで新たに作らないため、
+//  簡略化後のインデックスは元の頂点バッファをそのまま参照できる.
+//  メッシュの境界やテクスチャ座標の継ぎ目にある頂点は、穴やずれを防ぐため動かさない.
+
+// インデックス数が targetIndexCount 以下になるまで簡略化して outIndices に格納する.
+//  maxError (モデル空間での距離) を超える縮約は行わない.
+//  戻り値は簡略化で生じた誤差の最大値.
+float SimplifyMesh(
+  const std::vector<glm::vec3>& positions, const std::vector<uint32_t>& indices,
+  uint32_t targetIndexCount, float maxError, std::vector<uint32_t>& outIndices);
+
+// 三角形数をおよそ半分ずつ減らした LOD を生成し mesh.lods に格納する.
+//  十分に減らせなくなった時点で打ち切るため、生成数は maxLodCount 未満になることがある.
+void GenerateMeshLods(ModelMesh& mesh, uint32_t maxLodCount);
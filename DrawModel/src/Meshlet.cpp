@@ -0,0 +1,132 @@
+﻿#include "Meshlet.h"
+
+#include <cmath>
+#include <cfloat>
+#include <algorithm>
+
+namespace
+{
+  // メッシュレットの境界球と法線コーンを求める.
+  void ComputeMeshletBounds(const ModelMesh& mesh, ModelMeshlet& meshlet)
+  {
+    const auto* vertices = &mesh.meshletVertices[meshlet.vertexOffset];
+    const auto* triangles = &mesh.meshletTriangles[meshlet.triangleOffset];
+
+    glm::vec3 boundsMin(FLT_MAX), boundsMax(-FLT_MAX);
+    for (uint32_t i = 0; i < meshlet.vertexCount; ++i)
+    {
+      const auto& p = mesh.positions[vertices[i]];
+      boundsMin = glm::min(boundsMin, p);
+      boundsMax = glm::max(boundsMax, p);
+    }
+    meshlet.center = (boundsMin + boundsMax) * 0.5f;
+    meshlet.radius = 0.0f;
+    for (uint32_t i = 0; i < meshlet.vertexCount; ++i)
+    {
+      meshlet.radius = std::max(meshlet.radius, glm::length(mesh.positions[vertices[i]] - meshlet.center));
+    }
+
+    // 法線の平均方向を軸とし、最も離れた法線との角度から閾値を決める.
+    //  視線と軸の角度が (90度 - 広がり角) より小さければ全ての三角形が裏向きとなる.
+    std::vector<glm::vec3> normals;
+    normals.reserve(meshlet.triangleCount);
+    glm::vec3 axis(0.0f);
+    for (uint32_t i = 0; i < meshlet.triangleCount; ++i)
+    {
+      const auto& p0 = mesh.positions[vertices[GetMeshletTriangleVertex(triangles[i], 0)]];
+      const auto& p1 = mesh.positions[vertices[GetMeshletTriangleVertex(triangles[i], 1)]];
+      const auto& p2 = mesh.positions[vertices[GetMeshletTriangleVertex(triangles[i], 2)]];
+      auto n = glm::cross(p1 - p0, p2 - p0);
+      float length = glm::length(n);
+      if (length <= 0.0f)
+      {
+        continue;
+      }
+      n /= length;
+      normals.push_back(n);
+      axis += n;
+    }
+
+    meshlet.coneAxis = glm::vec3(0.0f, 0.0f, 1.0f);
+    meshlet.coneCutoff = 1.0f;
+    float axisLength = glm::length(axis);
+    if (normals.empty() || axisLength <= 1.0e-6f)
+    {
+      return;
+    }
+    axis /= axisLength;
+    float minDot = 1.0f;
+    for (const auto& n : normals)
+    {
+      minDot = std::min(minDot, glm::dot(axis, n));
+    }
+    meshlet.coneAxis = axis;
+    if (minDot > 0.0f)
+    {
+      // sin(広がり角).
+      meshlet.coneCutoff = std::sqrt(1.0f - minDot * minDot);
+    }
+  }
+}
+
+void BuildMeshlets(ModelMesh& mesh)
+{
+  mesh.meshlets.clear();
+  mesh.meshletVertices.clear();
+  mesh.meshletTriangles.clear();
+
+  // 頂点番号 -> 現在のメッシュレット内の番号.
+  std::vector<int32_t> localIndices(mesh.positions.size(), -1);
+  ModelMeshlet current{};
+
+  auto flush = [&]() {
+    if (current.triangleCount == 0)
+    {
+      return;
+    }
+    for (uint32_t i = 0; i < current.vertexCount; ++i)
+    {
+      localIndices[mesh.meshletVertices[current.vertexOffset + i]] = -1;
+    }
+    ComputeMeshletBounds(mesh, current);
+    mesh.meshlets.push_back(current);
+    current = ModelMeshlet{
+      .vertexOffset = uint32_t(mesh.meshletVertices.size()),
+      .triangleOffset = uint32_t(mesh.meshletTriangles.size()),
+    };
+  };
+
+  for (size_t i = 0; i + 2 < mesh.indices.size(); i += 3)
+  {
+    const uint32_t triangle[] = { mesh.indices[i], mesh.indices[i + 1], mesh.indices[i + 2] };
+    if (triangle[0] == triangle[1] || triangle[1] == triangle[2] || triangle[2] == triangle[0])
+    {
+      continue;
+    }
+
+    uint32_t newVertexCount = 0;
+    for (auto v : triangle)
+    {
+      newVertexCount += localIndices[v] < 0 ? 1 : 0;
+    }
+    if (current.vertexCount + newVertexCount > MaxMeshletVertices || current.triangleCount + 1 > MaxMeshletTriangles)
+    {
+      flush();
+    }
+
+    uint32_t packed = 0;
+    for (uint32_t corner = 0; corner < 3; ++corner)
+    {
+      auto v = triangle[corner];
+      if (localIndices[v] < 0)
+      {
+        localIndices[v] = int32_t(current.vertexCount++);
+        mesh.meshletVertices.push_back(v);
+      }
+      packed |= uint32_t(localIndices[v]) << (corner * 8);
+    }
+    mesh.meshletTriangles.push_back(packed);
+    current.triangleCount++;
+  }
+  flush();
+}
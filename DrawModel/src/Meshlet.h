@@ -0,0 +1,19 @@
+﻿#pragma once
+#include <cstdint>
+
+#include "Model.h"
+
+// メッシュレット1つあたりの上限.
+//  メッシュシェーダーの出力上限 (頂点 256 / プリミティブ 256 以上が保証) に収まる値としている.
+static const uint32_t MaxMeshletVertices = 64;
+static const uint32_t MaxMeshletTriangles = 124;
+
+// メッシュのインデックス順に三角形を詰めてメッシュレットへ分割する.
+//  結果は mesh.meshlets / meshletVertices / meshletTriangles に格納される.
+void BuildMeshlets(ModelMesh& mesh);
+
+// メッシュレット内の三角形 (ローカル頂点番号を 8bit ずつ詰めた値) を展開する.
+inline uint32_t GetMeshletTriangleVertex(uint32_t packedTriangle, uint32_t corner)
+{
+  return (packedTriangle >> (corner * 8)) & 0xFF;
+}
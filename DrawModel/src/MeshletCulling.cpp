@@ -0,0 +1,448 @@
+﻿#include "MeshletCulling.h"
+#include "FileLoader.h"
+
+#include <cassert>
+#include <cstring>
+#include <iterator>
+
+namespace
+{
+  void CmdMemoryBarrier(VkCommandBuffer commandBuffer,
+    VkPipelineStageFlags2 srcStage, VkAccessFlags2 srcAccess,
+    VkPipelineStageFlags2 dstStage, VkAccessFlags2 dstAccess)
+  {
+    VkMemoryBarrier2 barrier{
+      .sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER_2,
+      .srcStageMask = srcStage,
+      .srcAccessMask = srcAccess,
+      .dstStageMask = dstStage,
+      .dstAccessMask = dstAccess,
+    };
+    VkDependencyInfo info{
+      .sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO,
+      .memoryBarrierCount = 1,
+      .pMemoryBarriers = &barrier,
+    };
+    if (vkCmdPipelineBarrier2)
+    {
+      vkCmdPipelineBarrier2(commandBuffer, &info);
+    }
+    else
+    {
+      vkCmdPipelineBarrier2KHR(commandBuffer, &info);
+    }
+  }
+
+  // メッシュレットの全ての三角形がカメラから裏向きか判定する. (ワールド空間)
+  bool IsConeBackfacing(const BoundingSphere& sphere, const glm::vec3& axis, float cutoff, const glm::vec3& cameraPosition)
+  {
+    if (cutoff >= 1.0f)
+    {
+      return false;
+    }
+    auto toCenter = sphere.center - cameraPosition;
+    return glm::dot(toCenter, axis) >= cutoff * glm::length(toCenter) + sphere.radius;
+  }
+}
+
+void MeshletCulling::Initialize(
+  const std::vector<MeshletInfo>& meshlets,
+  const std::vector<uint32_t>& meshletVertices,
+  const std::vector<uint32_t>& meshletTriangles,
+  const std::vector<Bucket>& buckets,
+  const std::vector<glm::vec4>& meshBounds,
+  VkBuffer vertexBuffer, VkDescriptorSetLayout drawSetLayout)
+{
+  assert(!meshlets.empty() && !buckets.empty() && !meshBounds.empty());
+  auto& gfxDevice = GetGfxDevice();
+  auto vkDevice = gfxDevice->GetVkDevice();
+
+  m_meshlets = meshlets;
+  m_buckets = buckets;
+  m_meshBounds = meshBounds;
+  m_stats = Stats{};
+  m_stats.meshletCount = uint32_t(meshlets.size());
+  m_validationRequested = true;
+
+  // 描画数は VkDrawMeshTasksIndirectCommandEXT の x として加算していく.
+  //  vkCmdUpdateBuffer で戻すため 65536 バイト以内であること.
+  m_initialCounts.assign(buckets.size(), VkDrawMeshTasksIndirectCommandEXT{ 0, 1, 1 });
+  assert(sizeof(VkDrawMeshTasksIndirectCommandEXT) * m_initialCounts.size() <= 65536);
+
+  PreparePipeline();
+
+  m_meshletInfoBuffer = gfxDevice->CreateBuffer(
+    sizeof(MeshletInfo) * meshlets.size(),
+    VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+    VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, meshlets.data());
+  m_meshletVertexBuffer = GpuBuffer{};
+  m_meshletTriangleBuffer = GpuBuffer{};
+  m_hasDrawResources = drawSetLayout != VK_NULL_HANDLE;
+  if (m_hasDrawResources)
+  {
+    m_meshletVertexBuffer = gfxDevice->CreateBuffer(
+      sizeof(uint32_t) * meshletVertices.size(),
+      VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+      VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, meshletVertices.data());
+    m_meshletTriangleBuffer = gfxDevice->CreateBuffer(
+      sizeof(uint32_t) * meshletTriangles.size(),
+      VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+      VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, meshletTriangles.data());
+  }
+
+  // 1フレームでカリング用と描画用の2セットを使用する.
+  //  カリング用は UBO 1つとストレージバッファ 5つ、描画用はストレージバッファ 5つ.
+  m_descriptorAllocator.Initialize(vkDevice, GfxDevice::InflightFrames * 2, {
+    { VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 1.0f },
+    { VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 5.0f },
+  });
+
+  const auto commandBufferSize = sizeof(VkDrawIndexedIndirectCommand) * meshlets.size();
+  const auto visibleBufferSize = sizeof(uint32_t) * meshlets.size();
+  const auto countBufferSize = sizeof(VkDrawMeshTasksIndirectCommandEXT) * buckets.size();
+  for (auto& frame : m_frames)
+  {
+    frame.parameters = gfxDevice->CreateBuffer(sizeof(CullParameters),
+      VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT,
+      VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+    frame.commands = gfxDevice->CreateBuffer(commandBufferSize,
+      VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT,
+      VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+    frame.visibleMeshlets = gfxDevice->CreateBuffer(visibleBufferSize,
+      VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+      VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+    frame.counts = gfxDevice->CreateBuffer(countBufferSize,
+      VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+      VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+    frame.readback = gfxDevice->CreateBuffer(countBufferSize,
+      VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+      VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, m_initialCounts.data());
+    frame.meshBounds = gfxDevice->CreateBuffer(sizeof(glm::vec4) * meshBounds.size(),
+      VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+      VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, meshBounds.data());
+    frame.descriptorSet = m_descriptorAllocator.Allocate(m_descriptorSetLayout);
+    frame.cpuVisibleCount = 0;
+    frame.cpuFrustumCulled = 0;
+    frame.cpuConeCulled = 0;
+    frame.dispatched = false;
+    frame.validating = false;
+
+    VkDescriptorBufferInfo bufferInfos[] = {
+      { .buffer = frame.parameters.buffer, .offset = 0, .range = VK_WHOLE_SIZE },
+      { .buffer = m_meshletInfoBuffer.buffer, .offset = 0, .range = VK_WHOLE_SIZE },
+      { .buffer = frame.commands.buffer, .offset = 0, .range = VK_WHOLE_SIZE },
+      { .buffer = frame.visibleMeshlets.buffer, .offset = 0, .range = VK_WHOLE_SIZE },
+      { .buffer = frame.counts.buffer, .offset = 0, .range = VK_WHOLE_SIZE },
+      { .buffer = frame.meshBounds.buffer, .offset = 0, .range = VK_WHOLE_SIZE },
+    };
+    std::vector<VkWriteDescriptorSet> writeDescs;
+    for (uint32_t binding = 0; binding < uint32_t(std::size(bufferInfos)); ++binding)
+    {
+      writeDescs.push_back(VkWriteDescriptorSet{
+        .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+        .dstSet = frame.descriptorSet,
+        .dstBinding = binding,
+        .descriptorCount = 1,
+        .descriptorType = binding == 0 ? VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER : VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+        .pBufferInfo = &bufferInfos[binding],
+      });
+    }
+    vkUpdateDescriptorSets(vkDevice, uint32_t(writeDescs.size()), writeDescs.data(), 0, nullptr);
+
+    if (!m_hasDrawResources)
+    {
+      continue;
+    }
+    // メッシュシェーダーから参照するバッファ.
+    frame.drawDescriptorSet = m_descriptorAllocator.Allocate(drawSetLayout);
+    VkDescriptorBufferInfo drawBufferInfos[] = {
+      { .buffer = m_meshletInfoBuffer.buffer, .offset = 0, .range = VK_WHOLE_SIZE },
+      { .buffer = m_meshletVertexBuffer.buffer, .offset = 0, .range = VK_WHOLE_SIZE },
+      { .buffer = m_meshletTriangleBuffer.buffer, .offset = 0, .range = VK_WHOLE_SIZE },
+      { .buffer = frame.visibleMeshlets.buffer, .offset = 0, .range = VK_WHOLE_SIZE },
+      { .buffer = vertexBuffer, .offset = 0, .range = VK_WHOLE_SIZE },
+    };
+    writeDescs.clear();
+    for (uint32_t binding = 0; binding < uint32_t(std::size(drawBufferInfos)); ++binding)
+    {
+      writeDescs.push_back(VkWriteDescriptorSet{
+        .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+        .dstSet = frame.drawDescriptorSet,
+        .dstBinding = binding,
+        .descriptorCount = 1,
+        .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+        .pBufferInfo = &drawBufferInfos[binding],
+      });
+    }
+    vkUpdateDescriptorSets(vkDevice, uint32_t(writeDescs.size()), writeDescs.data(), 0, nullptr);
+  }
+}
+
+void MeshletCulling::Destroy()
+{
+  if (m_pipeline == VK_NULL_HANDLE)
+  {
+    return;
+  }
+  auto& gfxDevice = GetGfxDevice();
+  auto vkDevice = gfxDevice->GetVkDevice();
+
+  for (auto& frame : m_frames)
+  {
+    gfxDevice->DestroyBuffer(frame.parameters);
+    gfxDevice->DestroyBuffer(frame.commands);
+    gfxDevice->DestroyBuffer(frame.visibleMeshlets);
+    gfxDevice->DestroyBuffer(frame.counts);
+    gfxDevice->DestroyBuffer(frame.readback);
+    gfxDevice->DestroyBuffer(frame.meshBounds);
+    frame.descriptorSet = VK_NULL_HANDLE;
+    frame.drawDescriptorSet = VK_NULL_HANDLE;
+    frame.dispatched = false;
+  }
+  gfxDevice->DestroyBuffer(m_meshletInfoBuffer);
+  if (m_hasDrawResources)
+  {
+    gfxDevice->DestroyBuffer(m_meshletVertexBuffer);
+    gfxDevice->DestroyBuffer(m_meshletTriangleBuffer);
+  }
+  m_hasDrawResources = false;
+  m_descriptorAllocator.Destroy();
+
+  vkDestroyPipeline(vkDevice, m_pipeline, nullptr);
+  vkDestroyPipelineLayout(vkDevice, m_pipelineLayout, nullptr);
+  vkDestroyDescriptorSetLayout(vkDevice, m_descriptorSetLayout, nullptr);
+  m_pipeline = VK_NULL_HANDLE;
+  m_pipelineLayout = VK_NULL_HANDLE;
+  m_descriptorSetLayout = VK_NULL_HANDLE;
+
+  m_meshlets.clear();
+  m_buckets.clear();
+  m_meshBounds.clear();
+  m_initialCounts.clear();
+}
+
+void MeshletCulling::UpdateMeshBounds(const std::vector<glm::vec4>& meshBounds)
+{
+  if (m_pipeline == VK_NULL_HANDLE)
+  {
+    return;
+  }
+  assert(meshBounds.size() == m_meshBounds.size());
+  auto& gfxDevice = GetGfxDevice();
+  auto& frame = m_frames[gfxDevice->GetFrameIndex()];
+  memcpy(frame.meshBounds.mapped, meshBounds.data(), sizeof(glm::vec4) * meshBounds.size());
+  m_meshBounds = meshBounds;
+}
+
+void MeshletCulling::Dispatch(VkCommandBuffer commandBuffer, const glm::mat4& matWorld, const glm::mat4& matViewProj,
+  const glm::vec3& cameraPosition, bool enableFrustumCulling, bool enableConeCulling)
+{
+  auto& gfxDevice = GetGfxDevice();
+  auto& frame = m_frames[gfxDevice->GetFrameIndex()];
+
+  // このフレームスロットの前回の結果は NewFrame でのフェンス待機により完了している.
+  if (frame.dispatched)
+  {
+    auto counts = reinterpret_cast<const VkDrawMeshTasksIndirectCommandEXT*>(frame.readback.mapped);
+    m_stats.gpuVisibleCount = 0;
+    for (size_t i = 0; i < m_buckets.size(); ++i)
+    {
+      m_stats.gpuVisibleCount += counts[i].groupCountX;
+    }
+    if (frame.validating)
+    {
+      m_stats.validatedGpuCount = m_stats.gpuVisibleCount;
+      m_stats.cpuVisibleCount = frame.cpuVisibleCount;
+      m_stats.cpuFrustumCulled = frame.cpuFrustumCulled;
+      m_stats.cpuConeCulled = frame.cpuConeCulled;
+      m_stats.validation = m_stats.validatedGpuCount == m_stats.cpuVisibleCount ? VALIDATION_MATCHED : VALIDATION_MISMATCHED;
+      frame.validating = false;
+    }
+  }
+
+  CullParameters params{
+    .matWorld = matWorld,
+    .cameraPosition = glm::vec4(cameraPosition, 0.0f),
+    .meshletCount = uint32_t(m_meshlets.size()),
+    .enableFrustumCulling = enableFrustumCulling ? 1u : 0u,
+    .enableConeCulling = enableConeCulling ? 1u : 0u,
+  };
+  auto frustum = ExtractFrustum(matViewProj);
+  memcpy(params.frustumPlanes, frustum.planes, sizeof(frustum.planes));
+  memcpy(frame.parameters.mapped, &params, sizeof(params));
+
+  // 検証を要求されたフレームだけ、読み戻した結果と比較するため CPU でも同じ判定をしておく.
+  if (m_validationRequested)
+  {
+    frame.cpuVisibleCount = 0;
+    frame.cpuFrustumCulled = 0;
+    frame.cpuConeCulled = 0;
+    const auto matNormal = glm::mat3(matWorld);
+    for (const auto& meshlet : m_meshlets)
+    {
+      const bool useMeshBounds = (meshlet.flags & MESHLET_FLAG_USE_MESH_BOUNDS) != 0;
+      const auto& bounds = useMeshBounds ? m_meshBounds[meshlet.meshIndex] : meshlet.boundingSphere;
+      BoundingSphere sphere{ glm::vec3(bounds), bounds.w };
+      sphere = TransformBoundingSphere(sphere, matWorld);
+      if (enableFrustumCulling && !IsVisible(frustum, sphere))
+      {
+        frame.cpuFrustumCulled++;
+        continue;
+      }
+      auto axis = glm::normalize(matNormal * glm::vec3(meshlet.cone));
+      if (enableConeCulling && !useMeshBounds && IsConeBackfacing(sphere, axis, meshlet.cone.w, cameraPosition))
+      {
+        frame.cpuConeCulled++;
+        continue;
+      }
+      frame.cpuVisibleCount++;
+    }
+    frame.validating = true;
+    m_validationRequested = false;
+    m_stats.validation = VALIDATION_PENDING;
+  }
+
+  // 描画数を戻してからカリングを実行する.
+  vkCmdUpdateBuffer(commandBuffer, frame.counts.buffer, 0,
+    sizeof(VkDrawMeshTasksIndirectCommandEXT) * m_initialCounts.size(), m_initialCounts.data());
+  CmdMemoryBarrier(commandBuffer,
+    VK_PIPELINE_STAGE_2_ALL_TRANSFER_BIT, VK_ACCESS_2_TRANSFER_WRITE_BIT,
+    VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT, VK_ACCESS_2_SHADER_STORAGE_READ_BIT | VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT);
+
+  vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, m_pipeline);
+  vkCmdBindDescriptorSets(commandBuffer,
+    VK_PIPELINE_BIND_POINT_COMPUTE, m_pipelineLayout, 0, 1, &frame.descriptorSet, 0, nullptr);
+  auto groupCount = (uint32_t(m_meshlets.size()) + ThreadGroupSize - 1) / ThreadGroupSize;
+  vkCmdDispatch(commandBuffer, groupCount, 1, 1);
+
+  // 生成したコマンドは間接描画で、可視リストはメッシュシェーダーで参照する. 描画数は統計用に読み戻す.
+  VkPipelineStageFlags2 dstStages = VK_PIPELINE_STAGE_2_DRAW_INDIRECT_BIT | VK_PIPELINE_STAGE_2_COPY_BIT;
+  if (m_hasDrawResources)
+  {
+    dstStages |= VK_PIPELINE_STAGE_2_MESH_SHADER_BIT_EXT;
+  }
+  CmdMemoryBarrier(commandBuffer,
+    VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT, VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT,
+    dstStages, VK_ACCESS_2_INDIRECT_COMMAND_READ_BIT | VK_ACCESS_2_TRANSFER_READ_BIT | VK_ACCESS_2_SHADER_STORAGE_READ_BIT);
+
+  VkBufferCopy region{
+    .srcOffset = 0, .dstOffset = 0,
+    .size = sizeof(VkDrawMeshTasksIndirectCommandEXT) * m_buckets.size(),
+  };
+  vkCmdCopyBuffer(commandBuffer, frame.counts.buffer, frame.readback.buffer, 1, &region);
+  CmdMemoryBarrier(commandBuffer,
+    VK_PIPELINE_STAGE_2_COPY_BIT, VK_ACCESS_2_TRANSFER_WRITE_BIT,
+    VK_PIPELINE_STAGE_2_HOST_BIT, VK_ACCESS_2_HOST_READ_BIT);
+
+  frame.dispatched = true;
+}
+
+void MeshletCulling::DrawBucket(VkCommandBuffer commandBuffer, uint32_t bucket)
+{
+  auto& gfxDevice = GetGfxDevice();
+  const auto& frame = m_frames[gfxDevice->GetFrameIndex()];
+  const auto& info = m_buckets[bucket];
+
+  // 描画数は VkDrawMeshTasksIndirectCommandEXT::groupCountX を参照する.
+  vkCmdDrawIndexedIndirectCount(commandBuffer,
+    frame.commands.buffer, sizeof(VkDrawIndexedIndirectCommand) * info.commandOffset,
+    frame.counts.buffer, sizeof(VkDrawMeshTasksIndirectCommandEXT) * bucket,
+    info.maxCount, sizeof(VkDrawIndexedIndirectCommand));
+}
+
+void MeshletCulling::DrawMeshTasks(VkCommandBuffer commandBuffer, VkPipelineLayout pipelineLayout, uint32_t bucket, DrawConstants constants)
+{
+  auto& gfxDevice = GetGfxDevice();
+  const auto& frame = m_frames[gfxDevice->GetFrameIndex()];
+  assert(frame.drawDescriptorSet != VK_NULL_HANDLE);
+
+  constants.bucketOffset = m_buckets[bucket].commandOffset;
+  vkCmdBindDescriptorSets(commandBuffer,
+    VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayout, 1, 1, &frame.drawDescriptorSet, 0, nullptr);
+  vkCmdPushConstants(commandBuffer, pipelineLayout, VK_SHADER_STAGE_MESH_BIT_EXT, 0, sizeof(constants), &constants);
+  vkCmdDrawMeshTasksIndirectEXT(commandBuffer,
+    frame.counts.buffer, sizeof(VkDrawMeshTasksIndirectCommandEXT) * bucket,
+    1, sizeof(VkDrawMeshTasksIndirectCommandEXT));
+}
+
+void MeshletCulling::PreparePipeline()
+{
+  auto& gfxDevice = GetGfxDevice();
+  auto vkDevice = gfxDevice->GetVkDevice();
+
+  std::vector<VkDescriptorSetLayoutBinding> layoutBindings{
+    // カリング用パラメータ.
+    {
+      .binding = 0,
+      .descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER,
+      .descriptorCount = 1,
+      .stageFlags = VK_SHADER_STAGE_COMPUTE_BIT,
+    },
+    // メッシュレット情報.
+    {
+      .binding = 1,
+      .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+      .descriptorCount = 1,
+      .stageFlags = VK_SHADER_STAGE_COMPUTE_BIT,
+    },
+    // 出力する描画コマンド.
+    {
+      .binding = 2,
+      .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+      .descriptorCount = 1,
+      .stageFlags = VK_SHADER_STAGE_COMPUTE_BIT,
+    },
+    // 出力する可視メッシュレット番号.
+    {
+      .binding = 3,
+      .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+      .descriptorCount = 1,
+      .stageFlags = VK_SHADER_STAGE_COMPUTE_BIT,
+    },
+    // バケットごとの描画数.
+    {
+      .binding = 4,
+      .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+      .descriptorCount = 1,
+      .stageFlags = VK_SHADER_STAGE_COMPUTE_BIT,
+    },
+    // メッシュの境界球.
+    {
+      .binding = 5,
+      .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+      .descriptorCount = 1,
+      .stageFlags = VK_SHADER_STAGE_COMPUTE_BIT,
+    },
+  };
+  VkDescriptorSetLayoutCreateInfo dsLayoutCI{
+    .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO,
+    .bindingCount = uint32_t(layoutBindings.size()),
+    .pBindings = layoutBindings.data(),
+  };
+  vkCreateDescriptorSetLayout(vkDevice, &dsLayoutCI, nullptr, &m_descriptorSetLayout);
+
+  VkPipelineLayoutCreateInfo layoutCI{
+    .sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO,
+    .setLayoutCount = 1,
+    .pSetLayouts = &m_descriptorSetLayout,
+  };
+  vkCreatePipelineLayout(vkDevice, &layoutCI, nullptr, &m_pipelineLayout);
+
+  std::vector<char> computeSpv;
+  GetFileLoader()->Load("res/meshlet_cull.comp.spv", computeSpv);
+  VkPipelineShaderStageCreateInfo computeStage{
+    .sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO,
+    .stage = VK_SHADER_STAGE_COMPUTE_BIT,
+    .module = gfxDevice->CreateShaderModule(computeSpv.data(), computeSpv.size()),
+    .pName = "main",
+  };
+  VkComputePipelineCreateInfo computePipelineCI{
+    .sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO,
+    .stage = computeStage,
+    .layout = m_pipelineLayout,
+  };
+  auto res = vkCreateComputePipelines(vkDevice, VK_NULL_HANDLE, 1, &computePipelineCI, nullptr, &m_pipeline);
+  assert(res == VK_SUCCESS);
+
+  gfxDevice->DestroyShaderModule(computeStage.module);
+}
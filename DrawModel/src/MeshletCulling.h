@@ -0,0 +1,167 @@
+﻿#pragma once
+#include <vector>
+#include <cstdint>
+
+#include "GfxDevice.h"
+#include "Culling.h"
+
+// コンピュートシェーダーでメッシュレット単位の視錐台カリングと法線コーンによる裏面カリングを行う.
+//  可視メッシュレットはバケット単位に詰めて出力し、次のどちらかの方法で描画する.
+//  - メッシュシェーダー: 可視メッシュレット番号のリストを参照し、1ワークグループで1メッシュレットを描く.
+//  - 間接描画: メッシュレット順に並べたインデックスを1メッシュレット1コマンドで描く.
+class MeshletCulling
+{
+public:
+  // シェーダー側の MeshletInfo と一致させる (std430).
+  struct MeshletInfo
+  {
+    glm::vec4 boundingSphere;   // xyz: 中心(モデル空間), w: 半径.
+    glm::vec4 cone;             // xyz: 法線コーンの軸, w: 裏面判定の閾値 (1 なら判定しない).
+    uint32_t  meshIndex;
+    uint32_t  bucket;
+    uint32_t  commandOffset;    // バケットの出力先の先頭.
+    // 間接描画用. メッシュレット順に並べたインデックスの範囲.
+    uint32_t  firstIndex;
+    uint32_t  indexCount;
+    int32_t   vertexOffset;
+    // メッシュシェーダー用. 頂点番号リストと三角形リストの範囲.
+    uint32_t  vertexListOffset;
+    uint32_t  triangleOffset;
+    uint32_t  vertexCount;
+    uint32_t  triangleCount;
+    uint32_t  flags;            // MeshletFlags の組み合わせ.
+    uint32_t  padding;
+  };
+  enum MeshletFlags
+  {
+    // 境界が毎フレーム変わるメッシュ (アニメーションするノードやスキン) のメッシュレット.
+    //  自身の境界球とコーンは使わず、UpdateMeshBounds で与えたメッシュの境界球で判定する.
+    MESHLET_FLAG_USE_MESH_BOUNDS = 1 << 0,
+  };
+  struct Bucket
+  {
+    uint32_t commandOffset;
+    uint32_t maxCount;
+  };
+
+  // メッシュシェーダーへのプッシュ定数. 頂点バッファをストレージバッファとして読み、
+  // VertexLayout の形式に従ってシェーダー内で復元する. (サイズ・オフセットは 4バイト単位)
+  struct DrawConstants
+  {
+    uint32_t vertexStride;
+    uint32_t positionFormat;
+    uint32_t normalFormat;
+    uint32_t texcoordFormat;
+    uint32_t normalOffset;
+    uint32_t texcoordOffset;
+    uint32_t bucketOffset;    // 可視メッシュレットリストのバケットの先頭.
+    uint32_t padding;
+  };
+
+  // meshletVertices には頂点バッファ全体での頂点番号を格納しておく.
+  //  meshBounds は MeshletInfo::meshIndex で参照するメッシュの境界球の初期値.
+  //  drawSetLayout はメッシュシェーダー描画用のセットレイアウトで、非対応なら VK_NULL_HANDLE とする.
+  void Initialize(
+    const std::vector<MeshletInfo>& meshlets,
+    const std::vector<uint32_t>& meshletVertices,
+    const std::vector<uint32_t>& meshletTriangles,
+    const std::vector<Bucket>& buckets,
+    const std::vector<glm::vec4>& meshBounds,
+    VkBuffer vertexBuffer, VkDescriptorSetLayout drawSetLayout);
+  void Destroy();
+  bool IsInitialized() const { return m_pipeline != VK_NULL_HANDLE; }
+
+  // このフレームで MESHLET_FLAG_USE_MESH_BOUNDS のメッシュレットの判定に使う、メッシュの境界球を設定する.
+  //  (xyz: 中心(モデル空間), w: 半径) 境界はフレームごとに持つため、動く場合は毎フレーム Dispatch の前に呼ぶこと.
+  void UpdateMeshBounds(const std::vector<glm::vec4>& meshBounds);
+
+  // カリングと描画コマンドの生成を記録する.
+  //  レンダリング(RenderPass)の開始前に呼ぶこと.
+  void Dispatch(VkCommandBuffer commandBuffer, const glm::mat4& matWorld, const glm::mat4& matViewProj,
+    const glm::vec3& cameraPosition, bool enableFrustumCulling, bool enableConeCulling);
+
+  // 指定バケットの描画を記録する. (間接描画)
+  void DrawBucket(VkCommandBuffer commandBuffer, uint32_t bucket);
+  // 指定バケットの描画を記録する. (メッシュシェーダー)
+  //  パイプラインとセット0 はバインド済みであること. セット1 とプッシュ定数はここで設定する.
+  void DrawMeshTasks(VkCommandBuffer commandBuffer, VkPipelineLayout pipelineLayout, uint32_t bucket, DrawConstants constants);
+
+  // 読み戻したメッシュレット数を、同じフレームを CPU で判定した数と比較した結果.
+  enum ValidationState
+  {
+    VALIDATION_NONE,
+    VALIDATION_PENDING,   // 判定したフレームの読み戻し待ち.
+    VALIDATION_MATCHED,
+    VALIDATION_MISMATCHED,
+  };
+  struct Stats
+  {
+    uint32_t meshletCount = 0;
+    uint32_t gpuVisibleCount = 0;     // GPU が出力したメッシュレット数 (読み戻し値).
+    // 最後に検証したフレームの値.
+    ValidationState validation = VALIDATION_NONE;
+    uint32_t validatedGpuCount = 0;
+    uint32_t cpuVisibleCount = 0;     // 検証したフレームを CPU で判定したメッシュレット数.
+    uint32_t cpuFrustumCulled = 0;
+    uint32_t cpuConeCulled = 0;
+  };
+  // 読み戻しは該当フレームのコマンド完了後のため、数フレーム前の値となる.
+  const Stats& GetStats() const { return m_stats; }
+
+  // 次の Dispatch で1フレームだけ CPU でも同じ判定を行い、読み戻した数と比較する.
+  //  全メッシュレットを変換・判定するため、毎フレームは行わない. Initialize 後にも1度行う.
+  void RequestValidation() { m_validationRequested = true; }
+
+private:
+  void PreparePipeline();
+
+  // シェーダー側の CullParameters と一致させる.
+  struct CullParameters
+  {
+    glm::mat4 matWorld;
+    glm::vec4 frustumPlanes[Frustum::PLANE_COUNT];
+    glm::vec4 cameraPosition;
+    uint32_t  meshletCount;
+    uint32_t  enableFrustumCulling;
+    uint32_t  enableConeCulling;
+    uint32_t  padding;
+  };
+
+  struct FrameResource
+  {
+    GpuBuffer parameters;       // CullParameters.
+    GpuBuffer commands;         // VkDrawIndexedIndirectCommand の配列.
+    GpuBuffer visibleMeshlets;  // 可視メッシュレット番号.
+    GpuBuffer counts;           // バケットごとの VkDrawMeshTasksIndirectCommandEXT. x を描画数として兼用する.
+    GpuBuffer readback;         // counts の CPU 読み戻し用.
+    GpuBuffer meshBounds;       // メッシュの境界球. CPU から書き換える.
+    VkDescriptorSet descriptorSet = VK_NULL_HANDLE;
+    VkDescriptorSet drawDescriptorSet = VK_NULL_HANDLE;
+
+    uint32_t cpuVisibleCount = 0;
+    uint32_t cpuFrustumCulled = 0;
+    uint32_t cpuConeCulled = 0;
+    bool     dispatched = false;
+    bool     validating = false;  // CPU でも判定したフレームか.
+  };
+  FrameResource m_frames[GfxDevice::InflightFrames];
+
+  std::vector<MeshletInfo> m_meshlets;
+  std::vector<Bucket> m_buckets;
+  std::vector<glm::vec4> m_meshBounds;  // CPU での検証用.
+  std::vector<VkDrawMeshTasksIndirectCommandEXT> m_initialCounts;   // 毎フレームのリセット値.
+  GpuBuffer m_meshletInfoBuffer;
+  GpuBuffer m_meshletVertexBuffer;
+  GpuBuffer m_meshletTriangleBuffer;
+  bool m_hasDrawResources = false;  // メッシュシェーダー描画用のバッファを作成したか.
+
+  VkDescriptorSetLayout m_descriptorSetLayout = VK_NULL_HANDLE;
+  VkPipelineLayout m_pipelineLayout = VK_NULL_HANDLE;
+  VkPipeline m_pipeline = VK_NULL_HANDLE;
+  DescriptorAllocator m_descriptorAllocator;
+
+  Stats m_stats;
+  bool m_validationRequested = false;
+
+  static const uint32_t ThreadGroupSize = 64;
+};
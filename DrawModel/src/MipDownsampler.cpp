@@ -0,0 +1,374 @@
+﻿#include "MipDownsampler.h"
+#include "FileLoader.h"
+
+#include <cassert>
+#include <algorithm>
+
+namespace
+{
+  // 各パスのカウンタの間隔. minStorageBufferOffsetAlignment の上限に合わせる.
+  const VkDeviceSize CounterStride = 256;
+
+  void CmdMemoryBarrier(VkCommandBuffer commandBuffer,
+    VkPipelineStageFlags2 srcStage, VkAccessFlags2 srcAccess,
+    VkPipelineStageFlags2 dstStage, VkAccessFlags2 dstAccess)
+  {
+    VkMemoryBarrier2 barrier{
+      .sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER_2,
+      .srcStageMask = srcStage,
+      .srcAccessMask = srcAccess,
+      .dstStageMask = dstStage,
+      .dstAccessMask = dstAccess,
+    };
+    VkDependencyInfo info{
+      .sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO,
+      .memoryBarrierCount = 1,
+      .pMemoryBarriers = &barrier,
+    };
+    if (vkCmdPipelineBarrier2)
+    {
+      vkCmdPipelineBarrier2(commandBuffer, &info);
+    }
+    else
+    {
+      vkCmdPipelineBarrier2KHR(commandBuffer, &info);
+    }
+  }
+}
+
+static std::unique_ptr<MipDownsampler> gMipDownsampler = nullptr;
+
+std::unique_ptr<MipDownsampler>& GetMipDownsampler()
+{
+  if (gMipDownsampler == nullptr)
+  {
+    gMipDownsampler = std::make_unique<MipDownsampler>();
+  }
+  return gMipDownsampler;
+}
+
+VkFormat MipDownsampler::GetFormat(Mode mode)
+{
+  switch (mode)
+  {
+  case MODE_RGBA8: return VK_FORMAT_R8G8B8A8_UNORM;
+  case MODE_RGBA16F: return VK_FORMAT_R16G16B16A16_SFLOAT;
+  case MODE_DEPTH_MAX: return VK_FORMAT_R32_SFLOAT;
+  default: return VK_FORMAT_UNDEFINED;
+  }
+}
+
+void MipDownsampler::Initialize()
+{
+  auto& gfxDevice = GetGfxDevice();
+  auto vkDevice = gfxDevice->GetVkDevice();
+
+  // texelFetch でのみ参照するため、フィルタは使わない.
+  VkSamplerCreateInfo samplerCI{
+    .sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO,
+    .magFilter = VK_FILTER_NEAREST,
+    .minFilter = VK_FILTER_NEAREST,
+    .mipmapMode = VK_SAMPLER_MIPMAP_MODE_NEAREST,
+    .addressModeU = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE,
+    .addressModeV = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE,
+    .addressModeW = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE,
+    .minLod = 0.0f,
+    .maxLod = VK_LOD_CLAMP_NONE,
+  };
+  auto res = vkCreateSampler(vkDevice, &samplerCI, nullptr, &m_sampler);
+  assert(res == VK_SUCCESS);
+
+  std::vector<VkDescriptorSetLayoutBinding> layoutBindings{
+    // 入力の段.
+    {
+      .binding = 0,
+      .descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
+      .descriptorCount = 1,
+      .stageFlags = VK_SHADER_STAGE_COMPUTE_BIT,
+    },
+    // 出力する段. 使わない要素には最後の段を設定しておく.
+    {
+      .binding = 1,
+      .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE,
+      .descriptorCount = MaxLevelsPerDispatch,
+      .stageFlags = VK_SHADER_STAGE_COMPUTE_BIT,
+    },
+    // 終わったワークグループの数.
+    {
+      .binding = 2,
+      .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+      .descriptorCount = 1,
+      .stageFlags = VK_SHADER_STAGE_COMPUTE_BIT,
+    },
+  };
+  VkDescriptorSetLayoutCreateInfo dsLayoutCI{
+    .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO,
+    .bindingCount = uint32_t(layoutBindings.size()),
+    .pBindings = layoutBindings.data(),
+  };
+  vkCreateDescriptorSetLayout(vkDevice, &dsLayoutCI, nullptr, &m_descriptorSetLayout);
+
+  VkPushConstantRange pushConstantRange{
+    .stageFlags = VK_SHADER_STAGE_COMPUTE_BIT,
+    .offset = 0,
+    .size = sizeof(DownsampleParameters),
+  };
+  VkPipelineLayoutCreateInfo layoutCI{
+    .sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO,
+    .setLayoutCount = 1,
+    .pSetLayouts = &m_descriptorSetLayout,
+    .pushConstantRangeCount = 1,
+    .pPushConstantRanges = &pushConstantRange,
+  };
+  vkCreatePipelineLayout(vkDevice, &layoutCI, nullptr, &m_pipelineLayout);
+
+  // クアッド演算がコンピュートシェーダーで使えれば、サブグループ版のシェーダーを使う.
+  //  サブグループの大きさが 4 未満ではクアッドが組めないため使わない.
+  m_useSubgroup = false;
+  VkPhysicalDeviceProperties deviceProps{};
+  vkGetPhysicalDeviceProperties(gfxDevice->GetVkPhysicalDevice(), &deviceProps);
+  if (deviceProps.apiVersion >= VK_API_VERSION_1_1 && vkGetPhysicalDeviceProperties2 != nullptr)
+  {
+    VkPhysicalDeviceSubgroupProperties subgroupProps{
+      .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_SUBGROUP_PROPERTIES,
+    };
+    VkPhysicalDeviceProperties2 deviceProps2{
+      .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2,
+      .pNext = &subgroupProps,
+    };
+    vkGetPhysicalDeviceProperties2(gfxDevice->GetVkPhysicalDevice(), &deviceProps2);
+    m_useSubgroup = (subgroupProps.supportedStages & VK_SHADER_STAGE_COMPUTE_BIT) != 0 &&
+      (subgroupProps.supportedOperations & VK_SUBGROUP_FEATURE_QUAD_BIT) != 0 &&
+      subgroupProps.subgroupSize >= 4;
+  }
+  const char* shaderFiles[MODE_COUNT] = {
+    "res/spd_rgba8.comp.spv",
+    "res/spd_rgba16f.comp.spv",
+    "res/spd_depth_max.comp.spv",
+  };
+  const char* subgroupShaderFiles[MODE_COUNT] = {
+    "res/spd_rgba8_subgroup.comp.spv",
+    "res/spd_rgba16f_subgroup.comp.spv",
+    "res/spd_depth_max_subgroup.comp.spv",
+  };
+  for (int mode = 0; mode < MODE_COUNT; ++mode)
+  {
+    // ストレージイメージに使えないフォーマットはパイプラインを作らない.
+    VkFormatProperties properties{};
+    vkGetPhysicalDeviceFormatProperties(gfxDevice->GetVkPhysicalDevice(), GetFormat(Mode(mode)), &properties);
+    if ((properties.optimalTilingFeatures & VK_FORMAT_FEATURE_STORAGE_IMAGE_BIT) == 0)
+    {
+      continue;
+    }
+
+    std::vector<char> computeSpv;
+    GetFileLoader()->Load(m_useSubgroup ? subgroupShaderFiles[mode] : shaderFiles[mode], computeSpv);
+    VkPipelineShaderStageCreateInfo computeStage{
+      .sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO,
+      .stage = VK_SHADER_STAGE_COMPUTE_BIT,
+      .module = gfxDevice->CreateShaderModule(computeSpv.data(), computeSpv.size()),
+      .pName = "main",
+    };
+    VkComputePipelineCreateInfo computePipelineCI{
+      .sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO,
+      .stage = computeStage,
+      .layout = m_pipelineLayout,
+    };
+    res = vkCreateComputePipelines(vkDevice, VK_NULL_HANDLE, 1, &computePipelineCI, nullptr, &m_pipelines[mode]);
+    assert(res == VK_SUCCESS);
+    gfxDevice->DestroyShaderModule(computeStage.module);
+  }
+}
+
+void MipDownsampler::Destroy()
+{
+  if (!IsInitialized())
+  {
+    return;
+  }
+  auto vkDevice = GetGfxDevice()->GetVkDevice();
+  for (auto& pipeline : m_pipelines)
+  {
+    vkDestroyPipeline(vkDevice, pipeline, nullptr);
+    pipeline = VK_NULL_HANDLE;
+  }
+  vkDestroyPipelineLayout(vkDevice, m_pipelineLayout, nullptr);
+  vkDestroyDescriptorSetLayout(vkDevice, m_descriptorSetLayout, nullptr);
+  vkDestroySampler(vkDevice, m_sampler, nullptr);
+  m_pipelineLayout = VK_NULL_HANDLE;
+  m_descriptorSetLayout = VK_NULL_HANDLE;
+  m_sampler = VK_NULL_HANDLE;
+}
+
+void MipDownsampler::CreateTarget(Target& outTarget, VkImage image, Mode mode, uint32_t width, uint32_t height, uint32_t mipCount)
+{
+  assert(IsSupported(mode) && mipCount > 0);
+  auto& gfxDevice = GetGfxDevice();
+  auto vkDevice = gfxDevice->GetVkDevice();
+
+  outTarget.mode = mode;
+  outTarget.width = width;
+  outTarget.height = height;
+  outTarget.mipCount = mipCount;
+
+  outTarget.levelViews.resize(mipCount);
+  for (uint32_t level = 0; level < mipCount; ++level)
+  {
+    VkImageViewCreateInfo viewCI{
+      .sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO,
+      .image = image,
+      .viewType = VK_IMAGE_VIEW_TYPE_2D,
+      .format = GetFormat(mode),
+      .subresourceRange = {
+        .aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+        .baseMipLevel = level, .levelCount = 1,
+        .baseArrayLayer = 0, .layerCount = 1,
+      },
+    };
+    auto res = vkCreateImageView(vkDevice, &viewCI, nullptr, &outTarget.levelViews[level]);
+    assert(res == VK_SUCCESS);
+  }
+
+  // 1回で作る段数を決める. 入力が大きい場合は、まず6段だけ縮小して次のパスの入力にする.
+  outTarget.passes.clear();
+  for (uint32_t baseLevel = 0; baseLevel + 1 < mipCount;)
+  {
+    auto srcSize = std::max(std::max(width >> baseLevel, 1u), std::max(height >> baseLevel, 1u));
+    uint32_t levelCount = std::min(mipCount - 1 - baseLevel, uint32_t(MaxLevelsPerDispatch));
+    if (srcSize > MaxSingleDispatchSize)
+    {
+      levelCount = std::min(levelCount, MaxLevelsPerDispatch / 2);
+    }
+    outTarget.passes.push_back(Target::Pass{ .baseLevel = baseLevel, .levelCount = levelCount });
+    baseLevel += levelCount;
+  }
+  if (outTarget.passes.empty())
+  {
+    return;
+  }
+
+  const auto passCount = uint32_t(outTarget.passes.size());
+  outTarget.counterBuffer = gfxDevice->CreateBuffer(CounterStride * passCount,
+    VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+
+  outTarget.descriptorAllocator.Initialize(vkDevice, passCount, {
+    { VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 1.0f },
+    { VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, float(MaxLevelsPerDispatch) },
+    { VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1.0f },
+  });
+  for (uint32_t passIndex = 0; passIndex < passCount; ++passIndex)
+  {
+    auto& pass = outTarget.passes[passIndex];
+    pass.descriptorSet = outTarget.descriptorAllocator.Allocate(m_descriptorSetLayout);
+
+    VkDescriptorImageInfo srcInfo{
+      .sampler = m_sampler,
+      .imageView = outTarget.levelViews[pass.baseLevel],
+      .imageLayout = VK_IMAGE_LAYOUT_GENERAL,
+    };
+    VkDescriptorImageInfo dstInfos[MaxLevelsPerDispatch];
+    for (uint32_t i = 0; i < MaxLevelsPerDispatch; ++i)
+    {
+      auto level = pass.baseLevel + 1 + std::min(i, pass.levelCount - 1);
+      dstInfos[i] = VkDescriptorImageInfo{
+        .imageView = outTarget.levelViews[level],
+        .imageLayout = VK_IMAGE_LAYOUT_GENERAL,
+      };
+    }
+    VkDescriptorBufferInfo counterInfo{
+      .buffer = outTarget.counterBuffer.buffer,
+      .offset = CounterStride * passIndex,
+      .range = sizeof(uint32_t),
+    };
+    VkWriteDescriptorSet writeDescs[] = {
+      {
+        .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+        .dstSet = pass.descriptorSet,
+        .dstBinding = 0,
+        .descriptorCount = 1,
+        .descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
+        .pImageInfo = &srcInfo,
+      },
+      {
+        .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+        .dstSet = pass.descriptorSet,
+        .dstBinding = 1,
+        .descriptorCount = MaxLevelsPerDispatch,
+        .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE,
+        .pImageInfo = dstInfos,
+      },
+      {
+        .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+        .dstSet = pass.descriptorSet,
+        .dstBinding = 2,
+        .descriptorCount = 1,
+        .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+        .pBufferInfo = &counterInfo,
+      },
+    };
+    vkUpdateDescriptorSets(vkDevice, 3, writeDescs, 0, nullptr);
+  }
+}
+
+void MipDownsampler::DestroyTarget(Target& target)
+{
+  auto& gfxDevice = GetGfxDevice();
+  auto vkDevice = gfxDevice->GetVkDevice();
+  for (auto& view : target.levelViews)
+  {
+    vkDestroyImageView(vkDevice, view, nullptr);
+  }
+  target.levelViews.clear();
+  if (!target.passes.empty())
+  {
+    target.descriptorAllocator.Destroy();
+    gfxDevice->DestroyBuffer(target.counterBuffer);
+  }
+  target.passes.clear();
+  target.mipCount = 0;
+}
+
+void MipDownsampler::Dispatch(VkCommandBuffer commandBuffer, const Target& target)
+{
+  if (target.passes.empty())
+  {
+    return;
+  }
+  assert(IsSupported(target.mode));
+
+  // カウンタはシェーダーでは戻さないため、毎回 0 にしてから使う.
+  //  前回のディスパッチが使い終わるまで待ってから書き込む.
+  CmdMemoryBarrier(commandBuffer,
+    VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT, VK_ACCESS_2_SHADER_STORAGE_READ_BIT | VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT,
+    VK_PIPELINE_STAGE_2_CLEAR_BIT, VK_ACCESS_2_TRANSFER_WRITE_BIT);
+  vkCmdFillBuffer(commandBuffer, target.counterBuffer.buffer, 0, VK_WHOLE_SIZE, 0);
+  CmdMemoryBarrier(commandBuffer,
+    VK_PIPELINE_STAGE_2_CLEAR_BIT, VK_ACCESS_2_TRANSFER_WRITE_BIT,
+    VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT, VK_ACCESS_2_SHADER_STORAGE_READ_BIT | VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT);
+
+  vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, m_pipelines[target.mode]);
+  for (size_t passIndex = 0; passIndex < target.passes.size(); ++passIndex)
+  {
+    const auto& pass = target.passes[passIndex];
+    if (passIndex > 0)
+    {
+      // 前のパスの最後の段を入力にする.
+      CmdMemoryBarrier(commandBuffer,
+        VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT, VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT,
+        VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT, VK_ACCESS_2_SHADER_SAMPLED_READ_BIT | VK_ACCESS_2_SHADER_STORAGE_READ_BIT);
+    }
+    DownsampleParameters params{
+      .srcWidth = std::max(target.width >> pass.baseLevel, 1u),
+      .srcHeight = std::max(target.height >> pass.baseLevel, 1u),
+      .levelCount = pass.levelCount,
+    };
+    auto groupX = (params.srcWidth + TileSize - 1) / TileSize;
+    auto groupY = (params.srcHeight + TileSize - 1) / TileSize;
+    params.groupCount = groupX * groupY;
+
+    vkCmdBindDescriptorSets(commandBuffer,
+      VK_PIPELINE_BIND_POINT_COMPUTE, m_pipelineLayout, 0, 1, &pass.descriptorSet, 0, nullptr);
+    vkCmdPushConstants(commandBuffer, m_pipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(params), &params);
+    vkCmdDispatch(commandBuffer, groupX, groupY, 1);
+  }
+}
@@ -0,0 +1,85 @@
+﻿#pragma once
+#include <vector>
+#include <memory>
+#include <cstdint>
+
+#include "GfxDevice.h"
+
+// コンピュートシェーダーで、1回のディスパッチにつき最大12段のミップマップを作成する.
+//  ワークグループごとに 64x64 の範囲を共有メモリ上で6段縮小し、最後に終わったワークグループが残りの6段を作る.
+//  段ごとのディスパッチやバリアが要らないため、vkCmdBlitImage を段ごとに繰り返すより GPU が空きにくい.
+//  Vulkan 1.0 の機能の範囲で動作し、コンピュートシェーダーでサブグループのクアッド演算が使える場合は
+//  3段目を共有メモリを介さずに作るシェーダー (*_subgroup.comp, Vulkan 1.1) を使う.
+class MipDownsampler
+{
+public:
+  // 出力のフォーマットと縮小の方法. シェーダーは種類ごとに用意している.
+  enum Mode
+  {
+    MODE_RGBA8,       // R8G8B8A8_UNORM. 2x2 の平均.
+    MODE_RGBA16F,     // R16G16B16A16_SFLOAT. 2x2 の平均.
+    MODE_DEPTH_MAX,   // R32_SFLOAT. 2x2 の最大値 (深度ピラミッド用).
+    MODE_COUNT,
+  };
+  static const uint32_t MaxLevelsPerDispatch = 12;
+
+  void Initialize();
+  void Destroy();
+  bool IsInitialized() const { return m_pipelineLayout != VK_NULL_HANDLE; }
+
+  static VkFormat GetFormat(Mode mode);
+  // ストレージイメージとして書き込めるフォーマットか.
+  bool IsSupported(Mode mode) const { return m_pipelines[mode] != VK_NULL_HANDLE; }
+  // サブグループを使うシェーダーで作成しているか.
+  bool IsUsingSubgroup() const { return m_useSubgroup; }
+
+  // ミップマップを作成するイメージ. 段ごとのビューとディスクリプタセットを持つ.
+  //  入力が 4096 を超える場合や 13 段以上ある場合は、複数回のディスパッチに分ける.
+  struct Target
+  {
+    Mode     mode = MODE_RGBA8;
+    uint32_t width = 0;
+    uint32_t height = 0;
+    uint32_t mipCount = 0;
+    std::vector<VkImageView> levelViews;
+    struct Pass
+    {
+      uint32_t baseLevel;   // 入力とする段.
+      uint32_t levelCount;  // 作成する段数.
+      VkDescriptorSet descriptorSet;
+    };
+    std::vector<Pass> passes;
+    GpuBuffer counterBuffer;  // パスごとに終わったワークグループを数える.
+    DescriptorAllocator descriptorAllocator;
+  };
+  //  image は STORAGE と SAMPLED の用途を持ち、mipCount 段で作成したもの.
+  void CreateTarget(Target& outTarget, VkImage image, Mode mode, uint32_t width, uint32_t height, uint32_t mipCount);
+  void DestroyTarget(Target& target);
+
+  // 0 段目から残りの全段を作るコマンドを記録する.
+  //  全段を GENERAL レイアウトにし、0 段目の書き込みをコンピュートシェーダーから参照できる状態にしておくこと.
+  //  完了後の読み込みに必要なバリアは呼び出し側で設定する.
+  void Dispatch(VkCommandBuffer commandBuffer, const Target& target);
+
+private:
+  // シェーダー側の DownsampleParameters と一致させる.
+  struct DownsampleParameters
+  {
+    uint32_t srcWidth;
+    uint32_t srcHeight;
+    uint32_t levelCount;
+    uint32_t groupCount;
+  };
+
+  VkSampler m_sampler = VK_NULL_HANDLE;
+  VkDescriptorSetLayout m_descriptorSetLayout = VK_NULL_HANDLE;
+  VkPipelineLayout m_pipelineLayout = VK_NULL_HANDLE;
+  VkPipeline m_pipelines[MODE_COUNT] = {};
+  bool m_useSubgroup = false;
+
+  static const uint32_t TileSize = 64;
+  // 後半の6段は1つのワークグループで作るため、6段目が 64x64 に収まる入力までを1回で処理する.
+  static const uint32_t MaxSingleDispatchSize = 4096;
+};
+
+std::unique_ptr<MipDownsampler>& GetMipDownsampler();
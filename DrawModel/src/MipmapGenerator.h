@@ -0,0 +1,48 @@
+﻿#pragma once
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+#include <atomic>
+
+// RGBA 各8bitの画像から、CPU でミップマップを作成する.
+//  全段を1つの配列に詰めたまま作るため、結果をそのままステージングバッファへ転送できる.
+//  各段は1つ上の段の 2x2 (Kaiser の場合は 8x8) から作り、奇数の大きさの最後の列・行は使わない.
+enum MipmapFilter
+{
+  MIPMAP_FILTER_BOX,      // 2x2 の平均. SIMD で処理する.
+  MIPMAP_FILTER_KAISER,   // Kaiser 窓の sinc による 8 タップ. ぼけにくいが遅い.
+};
+
+struct MipmapOptions
+{
+  MipmapFilter filter = MIPMAP_FILTER_BOX;
+  // RGB を sRGB とみなし、リニアに変換してから平均する. アルファはそのまま平均する.
+  bool gammaCorrect = false;
+  // 段ごとに行を分けてスレッドプールで処理する.
+  //  既に ParallelFor で画像ごとに並列に処理している場合は false でよい.
+  bool parallel = false;
+  // 設定されている場合は段・行の区切りごとに確認し、true になれば残りを作らずに戻る. (読み込みの中断用)
+  const std::atomic<bool>* cancel = nullptr;
+};
+
+// pixels は最も詳細な段から順に全段を詰めた配列で、mipOffsets は各段の pixels 内の位置.
+//  firstMipmap 段目以降を、1つ上の段から順に作る.
+void GenerateMipmapLevels(uint8_t* pixels, const std::vector<size_t>& mipOffsets,
+  uint32_t width, uint32_t height, uint32_t firstMipmap, const MipmapOptions& options = {});
+
+// 使用している SIMD 命令セットの名前.
+const char* GetMipmapSimdName();
+
+// 正方形の画像から全段を作る時間を、stb_image_resize と比較する.
+struct CpuMipmapBenchmarkResult
+{
+  uint32_t size = 0;
+  double   stbMilliseconds = 0.0;             // 段ごとに stbir_resize_uint8.
+  double   boxMilliseconds = 0.0;             // 1スレッド.
+  double   parallelBoxMilliseconds = 0.0;
+  double   gammaBoxMilliseconds = 0.0;        // 並列、ガンマ補正あり.
+  double   kaiserMilliseconds = 0.0;          // 並列.
+  bool     matched = false;   // SIMD 版とスカラー版の結果が一致したか.
+};
+//  モデルの読み込み中はスレッドプールを読み込みと分け合うため、並列版の時間は長めに出る.
+std::vector<CpuMipmapBenchmarkResult> RunCpuMipmapBenchmark();
@@ -3,6 +3,13 @@
 
 #include "GfxDevice.h"
 #include "FileLoader.h"
+#include "Meshlet.h"
+#include "MeshOptimizer.h"
+#include "MeshSimplifier.h"
+#include "ModelCache.h"
+#include "GltfImporter.h"
+#include "ThreadPool.h"
+#include "SimdConfig.h"
 
 #include "assimp/scene.h"
 #include "assimp/Importer.hpp"
@@ -13,9 +20,16 @@
 
 #include "assimp/GltfMaterial.h" // for alpha mode,...
 
+#include <cfloat>
+#include <chrono>
+#include <cstdio>
+#include <atomic>
+#include <iterator>
+#include <algorithm>
+
 namespace
 {
-  // assimp  Vulkanpɕϊ邽߂̊֐.
+  // assimp から Vulkan用に変換するための関数.
   glm::mat4 ConvertMatrix(const aiMatrix4x4& from)
   {
     glm::mat4 to;
@@ -35,6 +49,95 @@ namespace
   glm::vec2 Convert(const aiVector2D& v) { return glm::vec2(v.x, v.y); }
   glm::vec3 Convert(const aiVector3D& v) { return glm::vec3(v.x, v.y, v.z); }
   glm::vec3 Convert(const aiColor3D& v) { return glm::vec3(v.r, v.g, v.b); }
+  glm::vec4 Convert(const aiQuaternion& q) { return glm::vec4(q.x, q.y, q.z, q.w); }
+
+  // aiVector3D の配列はそのまま glm::vec3 の配列としてコピーする.
+  static_assert(sizeof(aiVector3D) == sizeof(glm::vec3), "ai_real must be float");
+
+  // 位置の配列の AABB.
+  //  4頂点分 (12 float) を3回のロードで読み、レーンごとに min/max を取ってから最後に x, y, z ごとにまとめる.
+  void ComputeBounds(const glm::vec3* positions, size_t count, glm::vec3& outMin, glm::vec3& outMax)
+  {
+    outMin = glm::vec3(FLT_MAX);
+    outMax = glm::vec3(-FLT_MAX);
+    size_t i = 0;
+#if defined(SIMD_SSE2) || defined(SIMD_NEON)
+    if (count >= 4)
+    {
+      const float* p = &positions[0].x;
+      float laneMin[12], laneMax[12];
+# if defined(SIMD_SSE2)
+      __m128 min0 = _mm_loadu_ps(p + 0), min1 = _mm_loadu_ps(p + 4), min2 = _mm_loadu_ps(p + 8);
+      __m128 max0 = min0, max1 = min1, max2 = min2;
+      for (i = 4; i + 4 <= count; i += 4)
+      {
+        const float* q = p + i * 3;
+        const __m128 v0 = _mm_loadu_ps(q + 0), v1 = _mm_loadu_ps(q + 4), v2 = _mm_loadu_ps(q + 8);
+        min0 = _mm_min_ps(min0, v0); max0 = _mm_max_ps(max0, v0);
+        min1 = _mm_min_ps(min1, v1); max1 = _mm_max_ps(max1, v1);
+        min2 = _mm_min_ps(min2, v2); max2 = _mm_max_ps(max2, v2);
+      }
+      _mm_storeu_ps(laneMin + 0, min0); _mm_storeu_ps(laneMin + 4, min1); _mm_storeu_ps(laneMin + 8, min2);
+      _mm_storeu_ps(laneMax + 0, max0); _mm_storeu_ps(laneMax + 4, max1); _mm_storeu_ps(laneMax + 8, max2);
+# else
+      float32x4_t min0 = vld1q_f32(p + 0), min1 = vld1q_f32(p + 4), min2 = vld1q_f32(p + 8);
+      float32x4_t max0 = min0, max1 = min1, max2 = min2;
+      for (i = 4; i + 4 <= count; i += 4)
+      {
+        const float* q = p + i * 3;
+        const float32x4_t v0 = vld1q_f32(q + 0), v1 = vld1q_f32(q + 4), v2 = vld1q_f32(q + 8);
+        min0 = vminq_f32(min0, v0); max0 = vmaxq_f32(max0, v0);
+        min1 = vminq_f32(min1, v1); max1 = vmaxq_f32(max1, v1);
+        min2 = vminq_f32(min2, v2); max2 = vmaxq_f32(max2, v2);
+      }
+      vst1q_f32(laneMin + 0, min0); vst1q_f32(laneMin + 4, min1); vst1q_f32(laneMin + 8, min2);
+      vst1q_f32(laneMax + 0, max0); vst1q_f32(laneMax + 4, max1); vst1q_f32(laneMax + 8, max2);
+# endif
+      // 12 個のレーンの k 番目は成分 k % 3 を持つ.
+      for (int k = 0; k < 12; ++k)
+      {
+        outMin[k % 3] = std::min(outMin[k % 3], laneMin[k]);
+        outMax[k % 3] = std::max(outMax[k % 3], laneMax[k]);
+      }
+    }
+#endif
+    for (; i < count; ++i)
+    {
+      outMin = glm::min(outMin, positions[i]);
+      outMax = glm::max(outMax, positions[i]);
+    }
+  }
+
+  // 頂点がある場合のみ AABB を求める. 空のメッシュは原点の大きさ 0 の箱とする.
+  void ComputeMeshBounds(ModelMesh& mesh)
+  {
+    ComputeBounds(mesh.positions.data(), mesh.positions.size(), mesh.boundsMin, mesh.boundsMax);
+    if (mesh.positions.empty())
+    {
+      mesh.boundsMin = mesh.boundsMax = glm::vec3(0.0f);
+    }
+  }
+
+  // 頂点をノードの変換でモデル空間へ移す. 法線は逆転置行列で変換し、裏返る変換では三角形の向きを戻す.
+  void TransformMesh(ModelMesh& mesh, const glm::mat4& transform)
+  {
+    const auto normalMatrix = glm::transpose(glm::inverse(glm::mat3(transform)));
+    for (auto& position : mesh.positions)
+    {
+      position = glm::vec3(transform * glm::vec4(position, 1.0f));
+    }
+    for (auto& normal : mesh.normals)
+    {
+      normal = glm::normalize(normalMatrix * normal);
+    }
+    if (glm::determinant(glm::mat3(transform)) < 0.0f)
+    {
+      for (size_t i = 0; i + 2 < mesh.indices.size(); i += 3)
+      {
+        std::swap(mesh.indices[i + 1], mesh.indices[i + 2]);
+      }
+    }
+  }
 
   VkSamplerAddressMode ConvertAddressMode(aiTextureMapMode mode) {
     switch (mode)
@@ -77,7 +180,7 @@ public:
 
   size_t Write(const void* pvBuffer, size_t pSize, size_t pCount) override
   {
-    return 0; // T|[gȂ.
+    return 0; // サポートしない.
   }
 
   aiReturn Seek(size_t pOffset, aiOrigin pOrigin) override
@@ -116,11 +219,14 @@ class MemoryIOSystem : public Assimp::IOSystem
 {
 private:
   std::filesystem::path m_basePath;
+  std::vector<ModelCacheDependency>* m_dependencies;
 
 public:
-  MemoryIOSystem(std::filesystem::path basePath)
+  // dependencies には開いたファイルとその内容のハッシュを追加する. (キャッシュの確認用)
+  MemoryIOSystem(std::filesystem::path basePath, std::vector<ModelCacheDependency>* dependencies = nullptr)
   {
     m_basePath = basePath;
+    m_dependencies = dependencies;
   }
 
   bool Exists(const char* file) const override
@@ -142,6 +248,10 @@ public:
     {
       return nullptr;
     }
+    if (m_dependencies)
+    {
+      m_dependencies->push_back({ .path = file, .hash = ComputeContentHash(fileData.data(), fileData.size()) });
+    }
 
     return new MemoryIOStream(std::move(fileData));
   }
@@ -155,17 +265,16 @@ bool ModelLoader::Load(
   std::filesystem::path filePath, 
   std::vector<ModelMesh>& meshes,
   std::vector<ModelMaterial>& materials,
-  std::vector<ModelEmbeddedTextureData>& embeddedData)
+  std::vector<ModelEmbeddedTextureData>& embeddedData,
+  std::vector<ModelNode>& nodes,
+  std::vector<ModelAnimation>& animations)
 {
-  Assimp::Importer importer;
-  uint32_t flags = 0;
-  flags |= aiProcess_Triangulate;   // 3p`.
-  flags |= aiProcess_RemoveRedundantMaterials;  // 璷ȃ}eA폜.
-  flags |= aiProcess_FlipUVs;         // eNX`Wn:_Ƃ.
-  flags |= aiProcess_GenUVCoords;     // UV𐶐.
-  flags |= aiProcess_PreTransformVertices;    // ff[^̒_ϊς݂ɂ.
-  flags |= aiProcess_GenSmoothNormals;
-  flags |= aiProcess_OptimizeMeshes;
+  using Clock = std::chrono::high_resolution_clock;
+  const auto startTime = Clock::now();
+  auto elapsedMilliseconds = [](Clock::time_point from) {
+    return std::chrono::duration<double, std::milli>(Clock::now() - from).count();
+  };
+  m_loadStats = LoadStats{};
 
   std::vector<char> fileData;
   if (GetFileLoader()->Load(filePath, fileData) == false)
@@ -175,9 +284,103 @@ bool ModelLoader::Load(
 
   m_basePath = filePath.parent_path();
 
-  // ̃[ĥ߂ɁAJX^̃nhݒ肵Ă.
-  // ̃nh importer j̎ɉ.
-  importer.SetIOHandler(new MemoryIOSystem(m_basePath));
+  // 元ファイル・読み込み設定が同じキャッシュがあれば、assimp を使わずにそちらから読む.
+  //  読み込み設定ごとに別のファイルとし、設定を切り替えても互いに上書きしないようにする.
+  std::filesystem::path cachePath;
+  if (m_useCache)
+  {
+    char suffix[32];
+    snprintf(suffix, sizeof(suffix), ".%08x.mcache", uint32_t(GetCacheOptionsKey()));
+    cachePath = GetFileLoader()->GetCachePath(filePath.filename().string() + suffix);
+    if (LoadCache(cachePath, fileData, meshes, materials, embeddedData, nodes, animations))
+    {
+      m_loadStats.cacheHit = true;
+      m_loadStats.milliseconds = elapsedMilliseconds(startTime);
+      return true;
+    }
+  }
+  // 読み込むファイル自身も依存ファイルとして先頭に入れておく.
+  std::vector<ModelCacheDependency> dependencies;
+  dependencies.push_back({ .path = filePath.filename().string(), .hash = ComputeContentHash(fileData.data(), fileData.size()) });
+
+  // 書き出すのはこの Load で追加した分だけとする.
+  const auto meshStart = meshes.size();
+  const auto materialStart = materials.size();
+  const auto embeddedStart = embeddedData.size();
+  const auto nodeStart = nodes.size();
+  const auto animationStart = animations.size();
+
+  // glTF は GltfImporter で直接読む. 扱えないファイルであれば、途中までの結果を捨てて assimp で読み直す.
+  bool imported = false;
+  if (m_useNativeGltf && GltfImporter::IsSupportedFile(filePath))
+  {
+    imported = ImportGltf(filePath, fileData, dependencies, meshes, materials, embeddedData, nodes, animations);
+    if (!imported)
+    {
+      meshes.resize(meshStart);
+      materials.resize(materialStart);
+      embeddedData.resize(embeddedStart);
+      nodes.resize(nodeStart);
+      animations.resize(animationStart);
+      dependencies.resize(1);
+    }
+  }
+  if (!imported && !ImportAssimp(fileData, dependencies, meshes, materials, embeddedData, nodes, animations))
+  {
+    return false;
+  }
+
+  if (m_useCache)
+  {
+    const auto writeStartTime = Clock::now();
+    auto tail = [](const auto& values, size_t start) {
+      return std::span(values).subspan(start);
+    };
+    WriteModelCache(cachePath, GetCacheOptionsKey(), dependencies,
+      tail(meshes, meshStart), tail(materials, materialStart), tail(embeddedData, embeddedStart),
+      tail(nodes, nodeStart), tail(animations, animationStart));
+    m_loadStats.cacheWriteMilliseconds = elapsedMilliseconds(writeStartTime);
+  }
+  m_loadStats.milliseconds = elapsedMilliseconds(startTime);
+  return true;
+}
+
+bool ModelLoader::ImportAssimp(
+  const std::vector<char>& fileData,
+  std::vector<ModelCacheDependency>& dependencies,
+  std::vector<ModelMesh>& meshes,
+  std::vector<ModelMaterial>& materials,
+  std::vector<ModelEmbeddedTextureData>& embeddedData,
+  std::vector<ModelNode>& nodes,
+  std::vector<ModelAnimation>& animations)
+{
+  using Clock = std::chrono::high_resolution_clock;
+
+  Assimp::Importer importer;
+  uint32_t flags = 0;
+  flags |= aiProcess_Triangulate;   // 3角形化する.
+  flags |= aiProcess_RemoveRedundantMaterials;  // 冗長なマテリアルを削除.
+  flags |= aiProcess_FlipUVs;         // テクスチャ座標系:左上を原点とする.
+  flags |= aiProcess_GenUVCoords;     // UVを生成.
+  if (!m_preserveHierarchy)
+  {
+    flags |= aiProcess_PreTransformVertices;  // モデルデータ内の頂点を変換済みにする.
+  }
+  else
+  {
+    flags |= aiProcess_LimitBoneWeights;  // 1頂点に影響するボーンを4つまでにする.
+  }
+  flags |= aiProcess_GenSmoothNormals;
+  flags |= aiProcess_OptimizeMeshes;
+
+  const auto meshStart = meshes.size();
+  const auto materialStart = materials.size();
+  const auto embeddedStart = embeddedData.size();
+
+  // メモリからのロードのために、カスタムのハンドラを設定しておく.
+  // このハンドラは importer 破棄の時に解放される.
+  importer.SetIOHandler(new MemoryIOSystem(m_basePath, &dependencies));
+  const auto importStartTime = Clock::now();
   const auto scene = importer.ReadFileFromMemory(fileData.data(), fileData.size(), flags);
   if (scene == nullptr)
   {
@@ -189,34 +392,254 @@ bool ModelLoader::Load(
     return false;
   }
 
-  for (uint32_t i = 0; i < scene->mNumMaterials; ++i)
+  const auto convertStartTime = Clock::now();
+  m_loadStats.importMilliseconds = std::chrono::duration<double, std::milli>(convertStartTime - importStartTime).count();
+
+  // マテリアル・メッシュ・埋め込みテクスチャはそれぞれ独立しているため、出力先を先に確保して並列に変換する.
+  m_loadStats.threadCount = m_parallelImport ? GetThreadPool()->GetThreadCount() : 1;
+  std::atomic<bool> failed = false;
+
+  materials.resize(materialStart + scene->mNumMaterials);
+  ParallelFor(scene->mNumMaterials, [&](size_t i) {
+    if (!ReadMaterial(materials[materialStart + i], scene->mMaterials[i]))
+    {
+      failed = true;
+    }
+  });
+
+  // ノードの変換はそのまま残し、描画時にメッシュごとのワールド行列へ反映する.
+  //  ボーンはノード名で参照されるため、メッシュより先に読んでおく.
+  m_nodeIndices.clear();
+  if (scene->mRootNode != nullptr)
+  {
+    ReadNodes(nodes, scene->mRootNode, -1);
+  }
+  for (uint32_t i = 0; i < nodes.size(); ++i)
   {
-    auto& material = materials.emplace_back();
-    if (!ReadMaterial(material, scene->mMaterials[i]))
+    m_nodeIndices.try_emplace(nodes[i].name, i);
+  }
+
+  // メッシュごとの処理 (まとめる・並べ替え・メッシュレット分割) が最も重いため、1メッシュを1つの処理とする.
+  meshes.resize(meshStart + scene->mNumMeshes);
+  ParallelFor(scene->mNumMeshes, [&](size_t i) {
+    if (!ImportMesh(meshes[meshStart + i], scene->mMeshes[i]))
     {
-      return false;
+      failed = true;
+    }
+  });
+
+  if (m_preserveHierarchy)
+  {
+    for (uint32_t i = 0; i < scene->mNumAnimations; ++i)
+    {
+      ReadAnimation(animations.emplace_back(), scene->mAnimations[i], scene);
     }
   }
 
-  for (uint32_t i = 0; i < scene->mNumMeshes; ++i)
+  embeddedData.resize(embeddedStart + scene->mNumTextures);
+  ParallelFor(scene->mNumTextures, [&](size_t i) {
+    if (!ReadEmbeddedTexture(embeddedData[embeddedStart + i], scene->mTextures[i]))
+    {
+      failed = true;
+    }
+  });
+  m_loadStats.convertMilliseconds = std::chrono::duration<double, std::milli>(Clock::now() - convertStartTime).count();
+  if (failed)
+  {
+    return false;
+  }
+  
+  importer.FreeScene();
+  return true;
+}
+
+bool ModelLoader::ImportGltf(
+  const std::filesystem::path& filePath,
+  const std::vector<char>& fileData,
+  std::vector<ModelCacheDependency>& dependencies,
+  std::vector<ModelMesh>& meshes,
+  std::vector<ModelMaterial>& materials,
+  std::vector<ModelEmbeddedTextureData>& embeddedData,
+  std::vector<ModelNode>& nodes,
+  std::vector<ModelAnimation>& animations)
+{
+  using Clock = std::chrono::high_resolution_clock;
+
+  const auto importStartTime = Clock::now();
+  GltfImporter importer;
+  if (!importer.Open(filePath, fileData, dependencies))
   {
-    auto& mesh = meshes.emplace_back();
-    if (!ReadMeshes(mesh, scene->mMeshes[i]))
+    return false;
+  }
+  const auto convertStartTime = Clock::now();
+  m_loadStats.importMilliseconds = std::chrono::duration<double, std::milli>(convertStartTime - importStartTime).count();
+  m_loadStats.threadCount = m_parallelImport ? GetThreadPool()->GetThreadCount() : 1;
+
+  const auto meshStart = meshes.size();
+  const auto materialStart = materials.size();
+  const auto embeddedStart = embeddedData.size();
+  std::atomic<bool> failed = false;
+
+  materials.resize(materialStart + importer.GetMaterialCount());
+  ParallelFor(importer.GetMaterialCount(), [&](size_t i) {
+    if (!importer.ReadMaterial(uint32_t(i), materials[materialStart + i]))
     {
-      return false;
+      failed = true;
+    }
+  });
+
+  // assimp で読んだ場合と同じく、ノードはスキン・アニメーションと合わせて階層を保つ場合のみ使う.
+  std::vector<ModelNode> sceneNodes;
+  importer.ReadNodes(sceneNodes);
+  if (m_preserveHierarchy)
+  {
+    meshes.resize(meshStart + importer.GetMeshCount());
+    ParallelFor(importer.GetMeshCount(), [&](size_t i) {
+      auto& mesh = meshes[meshStart + i];
+      if (!importer.ReadMesh(uint32_t(i), mesh, true))
+      {
+        failed = true;
+        return;
+      }
+      ComputeMeshBounds(mesh);
+      ProcessMesh(mesh);
+    });
+    nodes.insert(nodes.end(), sceneNodes.begin(), sceneNodes.end());
+    importer.ReadAnimations(animations);
+  }
+  else
+  {
+    // aiProcess_PreTransformVertices と同じく、置かれたノードごとに頂点を変換したメッシュを作り、
+    //  全てのメッシュをルートノード1つに置く.
+    std::vector<glm::mat4> transforms;
+    ComputeNodeTransforms(sceneNodes, transforms);
+    std::vector<std::pair<uint32_t, uint32_t>> instances;   // (メッシュ, ノード)
+    for (uint32_t nodeIndex = 0; nodeIndex < uint32_t(sceneNodes.size()); ++nodeIndex)
+    {
+      for (auto meshIndex : sceneNodes[nodeIndex].meshes)
+      {
+        instances.emplace_back(meshIndex, nodeIndex);
+      }
+    }
+    meshes.resize(meshStart + instances.size());
+    ParallelFor(instances.size(), [&](size_t i) {
+      auto& mesh = meshes[meshStart + i];
+      if (!importer.ReadMesh(instances[i].first, mesh, false))
+      {
+        failed = true;
+        return;
+      }
+      TransformMesh(mesh, transforms[instances[i].second]);
+      ComputeMeshBounds(mesh);
+      ProcessMesh(mesh);
+    });
+
+    auto& root = nodes.emplace_back();
+    root.name = sceneNodes.empty() ? std::string("ROOT") : sceneNodes[0].name;
+    for (uint32_t i = 0; i < uint32_t(instances.size()); ++i)
+    {
+      root.meshes.push_back(i);
+    }
+  }
+
+  embeddedData.resize(embeddedStart + importer.GetEmbeddedTextureCount());
+  ParallelFor(importer.GetEmbeddedTextureCount(), [&](size_t i) {
+    if (!importer.ReadEmbeddedTexture(uint32_t(i), embeddedData[embeddedStart + i]))
+    {
+      failed = true;
+    }
+  });
+  m_loadStats.convertMilliseconds = std::chrono::duration<double, std::milli>(Clock::now() - convertStartTime).count();
+  m_loadStats.nativeGltf = !failed;
+  return !failed;
+}
+
+void ModelLoader::ParallelFor(size_t count, const std::function<void(size_t)>& func)
+{
+  // スレッドプールを使わない場合も同じ順序で1つずつ処理するだけで、結果は変わらない.
+  if (m_parallelImport)
+  {
+    GetThreadPool()->ParallelFor(count, func);
+  }
+  else
+  {
+    for (size_t i = 0; i < count; ++i)
+    {
+      func(i);
     }
   }
+}
+
+uint64_t ModelLoader::GetCacheOptionsKey() const
+{
+  // 読み込み結果が変わる設定を詰めたもの.
+  uint64_t key = 0;
+  key |= m_preserveHierarchy ? 0x01 : 0;
+  key |= m_buildMeshlets ? 0x02 : 0;
+  key |= m_optimizeMeshes ? 0x04 : 0;
+  key |= m_useNativeGltf ? 0x08 : 0;
+  key |= uint64_t(m_weldMode) << 4;
+  key |= uint64_t(m_lodCount) << 8;
+  return key;
+}
 
-  for (uint32_t i = 0; i < scene->mNumTextures; ++i)
+bool ModelLoader::LoadCache(
+  const std::filesystem::path& cachePath,
+  const std::vector<char>& fileData,
+  std::vector<ModelMesh>& meshes,
+  std::vector<ModelMaterial>& materials,
+  std::vector<ModelEmbeddedTextureData>& embeddedData,
+  std::vector<ModelNode>& nodes,
+  std::vector<ModelAnimation>& animations)
+{
+  ModelCacheReader reader;
+  if (!reader.Open(cachePath, GetCacheOptionsKey()))
   {
-    auto& tex = embeddedData.emplace_back();
-    if (!ReadEmbeddedTexture(tex, scene->mTextures[i]))
+    return false;
+  }
+
+  // 作成時に読んだファイル (.gltf から参照される .bin など) の内容が変わっていないか確認する.
+  //  先頭は読み込むファイル自身で、既に読んである内容と比べる.
+  const auto& dependencies = reader.GetDependencies();
+  for (size_t i = 0; i < dependencies.size(); ++i)
+  {
+    uint64_t hash = 0;
+    if (i == 0)
+    {
+      hash = ComputeContentHash(fileData.data(), fileData.size());
+    }
+    else
+    {
+      std::vector<char> data;
+      if (!GetFileLoader()->Load(m_basePath / dependencies[i].path, data))
+      {
+        return false;
+      }
+      hash = ComputeContentHash(data.data(), data.size());
+    }
+    if (hash != dependencies[i].hash)
     {
       return false;
     }
   }
-  
-  importer.FreeScene();
+  if (dependencies.empty())
+  {
+    return false;
+  }
+
+  ModelCacheData data;
+  if (!reader.Read(data))
+  {
+    return false;
+  }
+  auto append = [](auto& dst, auto& src) {
+    dst.insert(dst.end(), std::make_move_iterator(src.begin()), std::make_move_iterator(src.end()));
+  };
+  append(meshes, data.meshes);
+  append(materials, data.materials);
+  append(embeddedData, data.embeddedData);
+  append(nodes, data.nodes);
+  append(animations, data.animations);
   return true;
 }
 
@@ -261,7 +684,7 @@ bool ModelLoader::ReadMaterial(ModelMaterial& dstMaterial, const aiMaterial* src
     {
       dstMaterial.alphaMode = ModelMaterial::ALPHA_MODE_MASK;
     }
-    if (mode == "ALPHA")
+    if (mode == "BLEND")
     {
       dstMaterial.alphaMode = ModelMaterial::ALPHA_MODE_BLEND;
     }
@@ -305,36 +728,252 @@ bool ModelLoader::ReadMaterial(ModelMaterial& dstMaterial, const aiMaterial* src
   return true;
 }
 
+bool ModelLoader::ImportMesh(ModelMesh& mesh, const aiMesh* srcMesh)
+{
+  if (!ReadMeshes(mesh, srcMesh))
+  {
+    return false;
+  }
+  if (m_preserveHierarchy && srcMesh->HasBones())
+  {
+    if (!ReadSkin(mesh, srcMesh))
+    {
+      return false;
+    }
+  }
+  ProcessMesh(mesh);
+  return true;
+}
+
+void ModelLoader::ProcessMesh(ModelMesh& mesh)
+{
+  // 分割されたままの頂点をまとめてから並べ替える. メッシュレットは並べ替えた後の三角形の順に作る.
+  mesh.sourceVertexCount = uint32_t(mesh.positions.size());
+  mesh.sourceCacheStats = AnalyzeVertexCache(mesh.indices, uint32_t(mesh.positions.size()));
+  if (m_weldMode != WELD_NONE)
+  {
+    VertexWeldTolerance tolerance;
+    if (m_weldMode == WELD_EPSILON)
+    {
+      tolerance.position = glm::length(mesh.boundsMax - mesh.boundsMin) * 1.0e-5f;
+      tolerance.normal = 1.0e-3f;
+      tolerance.texcoord = 1.0e-5f;
+    }
+    WeldVertices(mesh, tolerance);
+  }
+  if (m_optimizeMeshes)
+  {
+    OptimizeMesh(mesh);
+  }
+  mesh.optimizedCacheStats = AnalyzeVertexCache(mesh.indices, uint32_t(mesh.positions.size()));
+  if (m_buildMeshlets)
+  {
+    BuildMeshlets(mesh);
+  }
+  // 距離に応じて切り替える簡略化メッシュを生成する. 頂点は元のメッシュと共有する.
+  //  簡略化後のインデックスも頂点キャッシュ向けに並べ替える.
+  if (m_lodCount > 0)
+  {
+    GenerateMeshLods(mesh, m_lodCount);
+    if (m_optimizeMeshes)
+    {
+      for (auto& lod : mesh.lods)
+      {
+        OptimizeVertexCache(lod.indices, uint32_t(mesh.positions.size()));
+      }
+    }
+  }
+}
+
 bool ModelLoader::ReadMeshes(ModelMesh& dstMesh, const aiMesh* srcMesh)
 {
   dstMesh.materialIndex = srcMesh->mMaterialIndex;
   
+  // 位置・法線は配列ごとまとめてコピーし、AABB は SIMD でまとめて求める.
   auto vertexCount = srcMesh->mNumVertices;
   dstMesh.positions.resize(vertexCount);
   dstMesh.normals.resize(vertexCount);
   dstMesh.texcoords.resize(vertexCount);
-  for (uint32_t i = 0; i < vertexCount; ++i)
+  if (vertexCount > 0)
+  {
+    memcpy(dstMesh.positions.data(), srcMesh->mVertices, sizeof(glm::vec3) * vertexCount);
+    if (srcMesh->HasNormals())
+    {
+      memcpy(dstMesh.normals.data(), srcMesh->mNormals, sizeof(glm::vec3) * vertexCount);
+    }
+  }
+  if (srcMesh->HasTextureCoords(0))
   {
-    dstMesh.positions[i] = Convert(srcMesh->mVertices[i]);
-    dstMesh.normals[i] = Convert(srcMesh->mNormals[i]);
-    dstMesh.texcoords[i] = Convert(srcMesh->mTextureCoords[0][i]);
+    const auto* texcoords = srcMesh->mTextureCoords[0];
+    for (uint32_t i = 0; i < vertexCount; ++i)
+    {
+      dstMesh.texcoords[i] = glm::vec2(texcoords[i].x, texcoords[i].y);
+    }
   }
+  ComputeMeshBounds(dstMesh);
 
-  auto indexCount = srcMesh->mNumFaces * 3;
-  dstMesh.indices.resize(indexCount);
+  // 三角形化済みのため面は3頂点. 点・線の面は描画しないため読み飛ばす.
+  dstMesh.indices.resize(size_t(srcMesh->mNumFaces) * 3);
+  auto* dstIndex = dstMesh.indices.data();
   for (uint32_t i = 0; i < srcMesh->mNumFaces; ++i)
   {
-    auto& face = srcMesh->mFaces[i];
-    dstMesh.indices.push_back(face.mIndices[0]);
-    dstMesh.indices.push_back(face.mIndices[1]);
-    dstMesh.indices.push_back(face.mIndices[2]);
+    const auto& face = srcMesh->mFaces[i];
+    if (face.mNumIndices != 3)
+    {
+      continue;
+    }
+    dstIndex[0] = face.mIndices[0];
+    dstIndex[1] = face.mIndices[1];
+    dstIndex[2] = face.mIndices[2];
+    dstIndex += 3;
+  }
+  dstMesh.indices.resize(size_t(dstIndex - dstMesh.indices.data()));
+  return true;
+}
+
+bool ModelLoader::ReadSkin(ModelMesh& dstMesh, const aiMesh* srcMesh)
+{
+  const auto vertexCount = srcMesh->mNumVertices;
+  dstMesh.jointIndices.assign(vertexCount, glm::uvec4(0));
+  dstMesh.jointWeights.assign(vertexCount, glm::vec4(0.0f));
+  for (uint32_t boneIndex = 0; boneIndex < srcMesh->mNumBones; ++boneIndex)
+  {
+    const auto bone = srcMesh->mBones[boneIndex];
+    auto itr = m_nodeIndices.find(bone->mName.C_Str());
+    if (itr == m_nodeIndices.end())
+    {
+      return false;
+    }
+    const auto jointIndex = uint32_t(dstMesh.joints.size());
+    dstMesh.joints.push_back(ModelJoint{
+      .nodeIndex = itr->second,
+      .inverseBindMatrix = ConvertMatrix(bone->mOffsetMatrix),
+    });
+
+    // 4つを超えた場合は最も小さいウェイトと入れ替える. (aiProcess_LimitBoneWeights で通常は超えない)
+    for (uint32_t i = 0; i < bone->mNumWeights; ++i)
+    {
+      const auto& weight = bone->mWeights[i];
+      auto& indices = dstMesh.jointIndices[weight.mVertexId];
+      auto& weights = dstMesh.jointWeights[weight.mVertexId];
+      int slot = 0;
+      for (int j = 1; j < 4; ++j)
+      {
+        if (weights[j] < weights[slot])
+        {
+          slot = j;
+        }
+      }
+      if (weight.mWeight > weights[slot])
+      {
+        indices[slot] = jointIndex;
+        weights[slot] = weight.mWeight;
+      }
+    }
+  }
+
+  // ウェイトの合計を 1 にする. どのボーンの影響も受けない頂点は最初のジョイントに従わせる.
+  for (uint32_t i = 0; i < vertexCount; ++i)
+  {
+    auto& weights = dstMesh.jointWeights[i];
+    float sum = weights.x + weights.y + weights.z + weights.w;
+    if (sum > 0.0f)
+    {
+      weights /= sum;
+    }
+    else
+    {
+      dstMesh.jointIndices[i] = glm::uvec4(0);
+      weights = glm::vec4(1.0f, 0.0f, 0.0f, 0.0f);
+    }
   }
   return true;
 }
 
+void ModelLoader::ReadAnimation(ModelAnimation& dstAnimation, const aiAnimation* srcAnimation, const aiScene* scene)
+{
+  // キーの時刻はティック単位. ティックレートを持たない形式は assimp の既定値 (25) とみなす.
+  const double ticksPerSecond = srcAnimation->mTicksPerSecond > 0.0 ? srcAnimation->mTicksPerSecond : 25.0;
+  dstAnimation.name = srcAnimation->mName.C_Str();
+  dstAnimation.duration = float(srcAnimation->mDuration / ticksPerSecond);
+
+  for (uint32_t i = 0; i < srcAnimation->mNumChannels; ++i)
+  {
+    const auto srcChannel = srcAnimation->mChannels[i];
+    auto itr = m_nodeIndices.find(srcChannel->mNodeName.C_Str());
+    if (itr == m_nodeIndices.end())
+    {
+      continue;
+    }
+    auto& channel = dstAnimation.channels.emplace_back();
+    channel.nodeIndex = itr->second;
+    for (uint32_t k = 0; k < srcChannel->mNumPositionKeys; ++k)
+    {
+      channel.positionTimes.push_back(float(srcChannel->mPositionKeys[k].mTime / ticksPerSecond));
+      channel.positions.push_back(Convert(srcChannel->mPositionKeys[k].mValue));
+    }
+    for (uint32_t k = 0; k < srcChannel->mNumRotationKeys; ++k)
+    {
+      channel.rotationTimes.push_back(float(srcChannel->mRotationKeys[k].mTime / ticksPerSecond));
+      channel.rotations.push_back(Convert(srcChannel->mRotationKeys[k].mValue));
+    }
+    for (uint32_t k = 0; k < srcChannel->mNumScalingKeys; ++k)
+    {
+      channel.scaleTimes.push_back(float(srcChannel->mScalingKeys[k].mTime / ticksPerSecond));
+      channel.scales.push_back(Convert(srcChannel->mScalingKeys[k].mValue));
+    }
+
+    // キーの無いトラックはノードの初期姿勢を1つだけ持たせる.
+    if (channel.positions.empty() || channel.rotations.empty() || channel.scales.empty())
+    {
+      aiVector3D scale(1.0f), position(0.0f);
+      aiQuaternion rotation;
+      if (auto node = scene->mRootNode->FindNode(srcChannel->mNodeName); node != nullptr)
+      {
+        node->mTransformation.Decompose(scale, rotation, position);
+      }
+      if (channel.positions.empty())
+      {
+        channel.positionTimes.push_back(0.0f);
+        channel.positions.push_back(Convert(position));
+      }
+      if (channel.rotations.empty())
+      {
+        channel.rotationTimes.push_back(0.0f);
+        channel.rotations.push_back(Convert(rotation));
+      }
+      if (channel.scales.empty())
+      {
+        channel.scaleTimes.push_back(0.0f);
+        channel.scales.push_back(Convert(scale));
+      }
+    }
+    // 長さが正しく設定されていないファイルもあるため、最後のキーまでは含める.
+    dstAnimation.duration = std::max({ dstAnimation.duration,
+      channel.positionTimes.back(), channel.rotationTimes.back(), channel.scaleTimes.back() });
+  }
+}
+
+void ModelLoader::ReadNodes(std::vector<ModelNode>& dstNodes, const aiNode* srcNode, int32_t parent)
+{
+  // 子の読み込みで配列が再確保されるため、参照は保持しない.
+  const auto nodeIndex = int32_t(dstNodes.size());
+  {
+    auto& node = dstNodes.emplace_back();
+    node.name = srcNode->mName.C_Str();
+    node.transform = ConvertMatrix(srcNode->mTransformation);
+    node.parent = parent;
+    node.meshes.assign(srcNode->mMeshes, srcNode->mMeshes + srcNode->mNumMeshes);
+  }
+  for (uint32_t i = 0; i < srcNode->mNumChildren; ++i)
+  {
+    ReadNodes(dstNodes, srcNode->mChildren[i], nodeIndex);
+  }
+}
+
 bool ModelLoader::ReadEmbeddedTexture(ModelEmbeddedTextureData& dstEmbedded, const aiTexture* srcTexture)
 {
-  // oCiߍ݃eNX`݂̂ΏۂƂ.
+  // バイナリ埋め込みテクスチャのみを対象とする.
   assert(srcTexture->mHeight == 0 && srcTexture->mWidth > 0);
   auto head = reinterpret_cast<const char*>(srcTexture->pcData);
   auto last = head + srcTexture->mWidth;
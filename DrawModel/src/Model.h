@@ -1,8 +1,11 @@
 ﻿#pragma once
 #include <memory>
 #include <vector>
+#include <string>
 #include <cstdint>
 #include <filesystem>
+#include <functional>
+#include <unordered_map>
 
 #define GLM_FORCE_DEPTH_ZERO_TO_ONE
 #include "glm/glm.hpp"
@@ -11,6 +14,42 @@
 
 #include "assimp/scene.h"
 
+// 簡略化したメッシュのインデックス. 頂点は元のメッシュと共有する.
+struct ModelMeshLod
+{
+  std::vector<uint32_t> indices;
+  float error = 0.0f;   // 元の形状からの誤差 (モデル空間での距離).
+};
+
+// 頂点数・三角形数を制限した小さな三角形のまとまり (メッシュレット).
+//  境界球と法線コーンを持ち、まとめてカリングできる.
+struct ModelMeshlet
+{
+  uint32_t vertexOffset;    // ModelMesh::meshletVertices 内の先頭.
+  uint32_t triangleOffset;  // ModelMesh::meshletTriangles 内の先頭.
+  uint32_t vertexCount;
+  uint32_t triangleCount;
+
+  glm::vec3 center;         // 境界球 (モデル空間).
+  float     radius;
+  glm::vec3 coneAxis;       // 含まれる三角形の法線の平均方向.
+  float     coneCutoff;     // 裏面判定の閾値. 1 ならば判定しない.
+};
+
+// インデックス順による頂点シェーダーの実行効率.
+struct ModelMeshCacheStats
+{
+  float acmr = 0.0f;  // 三角形あたりの頂点シェーダー実行数 (Average Cache Miss Ratio). 0.5 付近が下限.
+  float atvr = 0.0f;  // 頂点あたりの頂点シェーダー実行数 (Average Transformed Vertex Ratio). 1 が下限.
+};
+
+// スキンの影響を与えるジョイント.
+struct ModelJoint
+{
+  uint32_t nodeIndex;           // ジョイントとなるノード.
+  glm::mat4 inverseBindMatrix;  // メッシュ空間からバインドポーズのジョイント空間への変換.
+};
+
 struct ModelMesh
 {
   std::vector<glm::vec3> positions;
@@ -19,13 +58,81 @@ struct ModelMesh
   std::vector<uint32_t>  indices;
 
   uint32_t materialIndex;
+
+  // 頂点を包む AABB (モデル空間).
+  glm::vec3 boundsMin;
+  glm::vec3 boundsMax;
+
+  // LOD1 以降のインデックス. (LOD0 は indices)
+  std::vector<ModelMeshLod> lods;
+
+  // メッシュレット分割の結果. (ModelLoader::SetBuildMeshlets で有効にした場合のみ)
+  std::vector<ModelMeshlet> meshlets;
+  std::vector<uint32_t> meshletVertices;    // メッシュレットが参照する頂点番号.
+  std::vector<uint32_t> meshletTriangles;   // メッシュレット内の頂点番号(8bit)を3つ詰めたもの.
+
+  // 読み込んだ時点と、並べ替え後 (ModelLoader::SetOptimizeMeshes で有効にした場合) の値.
+  ModelMeshCacheStats sourceCacheStats;
+  ModelMeshCacheStats optimizedCacheStats;
+  // 読み込んだ時点 (頂点をまとめる前) の頂点数.
+  uint32_t sourceVertexCount = 0;
+
+  // スキニング用. スキンを持たないメッシュでは全て空.
+  //  頂点ごとに最大4つのジョイント (joints の番号) と、合計が 1 となるウェイトを持つ.
+  //  スキンを持つメッシュの頂点はノードの変換ではなく、ジョイントの変換でモデル空間に置かれる.
+  std::vector<glm::uvec4> jointIndices;
+  std::vector<glm::vec4>  jointWeights;
+  std::vector<ModelJoint> joints;
+
+  bool IsSkinned() const { return !joints.empty(); }
+};
+
+// シーンのノード. 親は必ず子より前に並ぶ.
+//  同じメッシュを複数のノードが参照する場合も、メッシュのデータは1つだけ持つ.
+struct ModelNode
+{
+  std::string name;
+  glm::mat4 transform = glm::mat4(1.0f);  // 親ノードからの相対変換.
+  int32_t parent = -1;
+  std::vector<uint32_t> meshes;  // このノードに置かれるメッシュの番号.
+};
+
+// ノードの相対変換を親から順に掛け合わせ、モデル空間での変換を求める.
+inline void ComputeNodeTransforms(const std::vector<ModelNode>& nodes, std::vector<glm::mat4>& outTransforms)
+{
+  outTransforms.resize(nodes.size());
+  for (size_t i = 0; i < nodes.size(); ++i)
+  {
+    const auto& node = nodes[i];
+    outTransforms[i] = node.parent < 0 ? node.transform : outTransforms[node.parent] * node.transform;
+  }
+}
+
+// ノード1つ分のキーフレーム. 時刻は秒で、各トラックは1つ以上のキーを持つ.
+struct ModelAnimationChannel
+{
+  uint32_t nodeIndex;
+  std::vector<float>     positionTimes;
+  std::vector<glm::vec3> positions;
+  std::vector<float>     rotationTimes;
+  std::vector<glm::vec4> rotations;   // クォータニオン (x, y, z, w).
+  std::vector<float>     scaleTimes;
+  std::vector<glm::vec3> scales;
+};
+
+// ノードの相対変換を時間で変化させるアニメーション.
+struct ModelAnimation
+{
+  std::string name;
+  float duration = 0.0f;  // 秒.
+  std::vector<ModelAnimationChannel> channels;
 };
 
 struct ModelTexture
 {
   std::string filePath;
-  VkSamplerAddressMode addressModeU;
-  VkSamplerAddressMode addressModeV;
+  VkSamplerAddressMode addressModeU = VK_SAMPLER_ADDRESS_MODE_REPEAT;
+  VkSamplerAddressMode addressModeV = VK_SAMPLER_ADDRESS_MODE_REPEAT;
 
   GpuImage texture;
   VkSampler sampler;
@@ -58,15 +165,84 @@ struct ModelMaterial
   ModelTexture texSpecular; 
 };
 
+struct ModelCacheDependency;
+
 class ModelLoader
 {
 public:
-  bool Load(std::filesystem::path filePath, std::vector<ModelMesh>& meshes, std::vector<ModelMaterial>& materials, std::vector<ModelEmbeddedTextureData>& embeddedData);
+  bool Load(std::filesystem::path filePath, std::vector<ModelMesh>& meshes, std::vector<ModelMaterial>& materials, std::vector<ModelEmbeddedTextureData>& embeddedData, std::vector<ModelNode>& nodes, std::vector<ModelAnimation>& animations);
+
+  // ノードの階層を保ち、メッシュはノードから参照させるか.
+  //  無効にすると頂点をノードの変換で変換済みにし (aiProcess_PreTransformVertices)、ルートノードだけになる.
+  //  スキンとアニメーションはノードを参照するため、有効な場合のみ読み込む.
+  void SetPreserveHierarchy(bool enable) { m_preserveHierarchy = enable; }
+
+  // 読み込み時に各メッシュをメッシュレットへ分割するか.
+  void SetBuildMeshlets(bool enable) { m_buildMeshlets = enable; }
+  // 読み込み時に頂点キャッシュ・オーバードロー・頂点フェッチのためにインデックスと頂点を並べ替えるか.
+  void SetOptimizeMeshes(bool enable) { m_optimizeMeshes = enable; }
+  // 読み込み時に生成する簡略化メッシュ (LOD) の最大数. 0 なら生成しない.
+  //  キャッシュにも含めるため、キャッシュから読む場合は簡略化を行わない.
+  void SetLodCount(uint32_t count) { m_lodCount = count; }
+
+  // 読み込み時に位置・法線・テクスチャ座標が同じ頂点をまとめる方法.
+  //  WELD_EPSILON では位置はメッシュの大きさに対する比率、法線・テクスチャ座標は固定の許容差で比較する.
+  enum WeldMode
+  {
+    WELD_NONE = 0,
+    WELD_EXACT,
+    WELD_EPSILON,
+  };
+  void SetWeldMode(WeldMode mode) { m_weldMode = mode; }
+
+  // 読み込み結果をバイナリキャッシュに保存し、次回以降は元ファイルと読み込み設定が同じであればそちらから読むか.
+  void SetUseCache(bool enable) { m_useCache = enable; }
+
+  // マテリアル・メッシュ・埋め込みテクスチャの変換をスレッドプールで並列に行うか.
+  void SetParallelImport(bool enable) { m_parallelImport = enable; }
+
+  // glTF (.gltf / .glb) を assimp を介さずに GltfImporter で読むか.
+  //  GltfImporter が扱えない機能を含むファイルは assimp で読み直す.
+  void SetUseNativeGltf(bool enable) { m_useNativeGltf = enable; }
+
+  // 直前の Load の所要時間.
+  struct LoadStats
+  {
+    bool cacheHit = false;          // キャッシュから読み込んだか.
+    bool nativeGltf = false;        // GltfImporter で読み込んだか.
+    double milliseconds = 0.0;      // Load 全体 (キャッシュの書き出しを含む).
+    double importMilliseconds = 0.0;    // assimp での読み込み. (GltfImporter では JSON の解析とバッファの読み込み)
+    double convertMilliseconds = 0.0;   // 読み込んだデータからの変換 (まとめる・並べ替え・メッシュレット分割を含む).
+    double cacheWriteMilliseconds = 0.0;
+    uint32_t threadCount = 0;       // 変換に使ったスレッド数.
+  };
+  const LoadStats& GetLoadStats() const { return m_loadStats; }
 
 private:
+  bool LoadCache(const std::filesystem::path& cachePath, const std::vector<char>& fileData, std::vector<ModelMesh>& meshes, std::vector<ModelMaterial>& materials, std::vector<ModelEmbeddedTextureData>& embeddedData, std::vector<ModelNode>& nodes, std::vector<ModelAnimation>& animations);
+  uint64_t GetCacheOptionsKey() const;
+  bool ImportAssimp(const std::vector<char>& fileData, std::vector<ModelCacheDependency>& dependencies, std::vector<ModelMesh>& meshes, std::vector<ModelMaterial>& materials, std::vector<ModelEmbeddedTextureData>& embeddedData, std::vector<ModelNode>& nodes, std::vector<ModelAnimation>& animations);
+  bool ImportGltf(const std::filesystem::path& filePath, const std::vector<char>& fileData, std::vector<ModelCacheDependency>& dependencies, std::vector<ModelMesh>& meshes, std::vector<ModelMaterial>& materials, std::vector<ModelEmbeddedTextureData>& embeddedData, std::vector<ModelNode>& nodes, std::vector<ModelAnimation>& animations);
+  void ProcessMesh(ModelMesh& mesh);
+  void ParallelFor(size_t count, const std::function<void(size_t)>& func);
   bool ReadMaterial(ModelMaterial& dstMaterial, const aiMaterial* srcMaterial);
+  bool ImportMesh(ModelMesh& mesh, const aiMesh* srcMesh);
   bool ReadMeshes(ModelMesh& dstMesh, const aiMesh* srcMesh);
+  bool ReadSkin(ModelMesh& dstMesh, const aiMesh* srcMesh);
+  void ReadAnimation(ModelAnimation& dstAnimation, const aiAnimation* srcAnimation, const aiScene* scene);
   bool ReadEmbeddedTexture(ModelEmbeddedTextureData& dstEmbeddedTex, const aiTexture* srcTexture);
+  void ReadNodes(std::vector<ModelNode>& dstNodes, const aiNode* srcNode, int32_t parent);
 
   std::filesystem::path m_basePath;
+  // ノード名からノード番号への対応. ボーン・アニメーションのチャンネルはノード名で参照される.
+  std::unordered_map<std::string, uint32_t> m_nodeIndices;
+  bool m_buildMeshlets = false;
+  bool m_preserveHierarchy = true;
+  bool m_optimizeMeshes = false;
+  uint32_t m_lodCount = 0;
+  WeldMode m_weldMode = WELD_NONE;
+  bool m_useCache = false;
+  bool m_parallelImport = true;
+  bool m_useNativeGltf = true;
+  LoadStats m_loadStats;
 };
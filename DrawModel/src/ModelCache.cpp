@@ -0,0 +1,325 @@
+﻿#include "ModelCache.h"
+
+#include <cstring>
+#include <type_traits>
+
+namespace
+{
+  const char CacheMagic[4] = { 'M', 'D', 'L', 'C' };
+  const size_t SectionAlignment = 16;
+
+  // 書き出し側. 値はそのまま、配列は要素数の後に 16 バイト境界からまとめて書く.
+  class CacheWriter
+  {
+  public:
+    template<class T> void Value(const T& value)
+    {
+      static_assert(std::is_trivially_copyable_v<T>);
+      Append(&value, sizeof(T));
+    }
+    template<class T> void Array(const std::vector<T>& values)
+    {
+      static_assert(std::is_trivially_copyable_v<T>);
+      Value(uint64_t(values.size()));
+      m_data.resize((m_data.size() + SectionAlignment - 1) & ~(SectionAlignment - 1), 0);
+      Append(values.data(), sizeof(T) * values.size());
+    }
+    void String(const std::string& str)
+    {
+      Value(uint64_t(str.size()));
+      Append(str.data(), str.size());
+    }
+    // 構造体の配列は要素数だけを書き、要素は呼び出し側で1つずつ書く.
+    template<class T> void Count(const T& values)
+    {
+      Value(uint64_t(values.size()));
+    }
+
+    const std::vector<uint8_t>& GetData() const { return m_data; }
+
+  private:
+    void Append(const void* src, size_t size)
+    {
+      if (size > 0)
+      {
+        auto offset = m_data.size();
+        m_data.resize(offset + size);
+        memcpy(m_data.data() + offset, src, size);
+      }
+    }
+    std::vector<uint8_t> m_data;
+  };
+
+  // 読み込み側. 範囲外を読もうとした時点で失敗とし、以降は何も読まない.
+  class CacheReader
+  {
+  public:
+    CacheReader(const uint8_t* data, size_t size, size_t offset) : m_data(data), m_size(size), m_offset(offset) { }
+
+    template<class T> void Value(T& value)
+    {
+      static_assert(std::is_trivially_copyable_v<T>);
+      if (Check(sizeof(T)))
+      {
+        memcpy(&value, m_data + m_offset, sizeof(T));
+        m_offset += sizeof(T);
+      }
+    }
+    template<class T> void Array(std::vector<T>& values)
+    {
+      static_assert(std::is_trivially_copyable_v<T>);
+      uint64_t count = 0;
+      Value(count);
+      const auto aligned = (m_offset + SectionAlignment - 1) & ~(SectionAlignment - 1);
+      if (m_valid && aligned <= m_size && count <= (m_size - aligned) / sizeof(T))
+      {
+        m_offset = aligned;
+        values.resize(size_t(count));
+        if (count > 0)
+        {
+          memcpy(values.data(), m_data + m_offset, sizeof(T) * size_t(count));
+        }
+        m_offset += sizeof(T) * size_t(count);
+      }
+      else
+      {
+        m_valid = false;
+      }
+    }
+    void String(std::string& str)
+    {
+      uint64_t length = 0;
+      Value(length);
+      if (Check(length))
+      {
+        str.assign(reinterpret_cast<const char*>(m_data + m_offset), size_t(length));
+        m_offset += size_t(length);
+      }
+    }
+    template<class T> void Count(std::vector<T>& values)
+    {
+      uint64_t count = 0;
+      Value(count);
+      // 1要素は少なくとも1バイトは使うため、残りより多い数は壊れたデータとみなす.
+      if (Check(0) && count <= m_size - m_offset)
+      {
+        values.resize(size_t(count));
+      }
+      else
+      {
+        m_valid = false;
+      }
+    }
+
+    bool IsValid() const { return m_valid; }
+    size_t GetOffset() const { return m_offset; }
+
+  private:
+    bool Check(uint64_t size)
+    {
+      m_valid = m_valid && size <= m_size - m_offset;
+      return m_valid;
+    }
+    const uint8_t* m_data;
+    size_t m_size;
+    size_t m_offset;
+    bool m_valid = true;
+  };
+
+  // 書き出し・読み込みで同じ順序になるよう、各データの並びはここでだけ定義する.
+  //  Stream は CacheWriter (const なデータ) か CacheReader.
+  template<class Stream, class Mesh> void TransferMesh(Stream& s, Mesh& mesh)
+  {
+    s.Array(mesh.positions);
+    s.Array(mesh.normals);
+    s.Array(mesh.texcoords);
+    s.Array(mesh.indices);
+    s.Value(mesh.materialIndex);
+    s.Value(mesh.boundsMin);
+    s.Value(mesh.boundsMax);
+    s.Count(mesh.lods);
+    for (auto& lod : mesh.lods)
+    {
+      s.Array(lod.indices);
+      s.Value(lod.error);
+    }
+    s.Array(mesh.meshlets);
+    s.Array(mesh.meshletVertices);
+    s.Array(mesh.meshletTriangles);
+    s.Value(mesh.sourceCacheStats);
+    s.Value(mesh.optimizedCacheStats);
+    s.Value(mesh.sourceVertexCount);
+    s.Array(mesh.jointIndices);
+    s.Array(mesh.jointWeights);
+    s.Array(mesh.joints);
+  }
+
+  // GPU のリソースは持たず、読み込んだ時点の情報だけを保存する.
+  template<class Stream, class Texture> void TransferTexture(Stream& s, Texture& texture)
+  {
+    s.String(texture.filePath);
+    s.Value(texture.addressModeU);
+    s.Value(texture.addressModeV);
+    s.Value(texture.embeddedIndex);
+  }
+
+  template<class Stream, class Material> void TransferMaterial(Stream& s, Material& material)
+  {
+    s.Value(material.diffuse);
+    s.Value(material.specular);
+    s.Value(material.ambient);
+    s.Value(material.shininess);
+    s.Value(material.alpha);
+    s.Value(material.alphaMode);
+    TransferTexture(s, material.texDiffuse);
+    TransferTexture(s, material.texSpecular);
+  }
+
+  template<class Stream, class Node> void TransferNode(Stream& s, Node& node)
+  {
+    s.String(node.name);
+    s.Value(node.transform);
+    s.Value(node.parent);
+    s.Array(node.meshes);
+  }
+
+  template<class Stream, class Animation> void TransferAnimation(Stream& s, Animation& animation)
+  {
+    s.String(animation.name);
+    s.Value(animation.duration);
+    s.Count(animation.channels);
+    for (auto& channel : animation.channels)
+    {
+      s.Value(channel.nodeIndex);
+      s.Array(channel.positionTimes);
+      s.Array(channel.positions);
+      s.Array(channel.rotationTimes);
+      s.Array(channel.rotations);
+      s.Array(channel.scaleTimes);
+      s.Array(channel.scales);
+    }
+  }
+
+  template<class Stream, class EmbeddedData> void TransferEmbeddedData(Stream& s, EmbeddedData& data)
+  {
+    s.String(data.name);
+    s.Array(data.data);
+  }
+
+  template<class Stream, class T, class Func> void TransferList(Stream& s, T& values, Func func)
+  {
+    s.Count(values);
+    for (auto& value : values)
+    {
+      func(s, value);
+    }
+  }
+}
+
+uint64_t ComputeContentHash(const void* data, size_t size)
+{
+  // 8 バイト単位の FNV-1a に、最後に上位ビットを下位へ混ぜる処理を加えたもの.
+  const uint64_t prime = 0x100000001b3ull;
+  uint64_t hash = 0xcbf29ce484222325ull;
+  const auto bytes = static_cast<const uint8_t*>(data);
+  size_t i = 0;
+  for (; i + sizeof(uint64_t) <= size; i += sizeof(uint64_t))
+  {
+    uint64_t word;
+    memcpy(&word, bytes + i, sizeof(word));
+    hash = (hash ^ word) * prime;
+  }
+  for (; i < size; ++i)
+  {
+    hash = (hash ^ bytes[i]) * prime;
+  }
+  hash ^= uint64_t(size);
+  hash ^= hash >> 33;
+  hash *= 0xff51afd7ed558ccdull;
+  hash ^= hash >> 33;
+  return hash;
+}
+
+bool WriteModelCache(std::filesystem::path cachePath, uint64_t optionsKey,
+  const std::vector<ModelCacheDependency>& dependencies,
+  std::span<const ModelMesh> meshes,
+  std::span<const ModelMaterial> materials,
+  std::span<const ModelEmbeddedTextureData> embeddedData,
+  std::span<const ModelNode> nodes,
+  std::span<const ModelAnimation> animations)
+{
+  CacheWriter writer;
+  writer.Value(CacheMagic);
+  writer.Value(ModelCacheVersion);
+  writer.Value(optionsKey);
+  writer.Count(dependencies);
+  for (const auto& dependency : dependencies)
+  {
+    writer.String(dependency.path);
+    writer.Value(dependency.hash);
+  }
+
+  TransferList(writer, meshes, [](auto& s, const auto& v) { TransferMesh(s, v); });
+  TransferList(writer, materials, [](auto& s, const auto& v) { TransferMaterial(s, v); });
+  TransferList(writer, embeddedData, [](auto& s, const auto& v) { TransferEmbeddedData(s, v); });
+  TransferList(writer, nodes, [](auto& s, const auto& v) { TransferNode(s, v); });
+  TransferList(writer, animations, [](auto& s, const auto& v) { TransferAnimation(s, v); });
+
+  const auto& data = writer.GetData();
+  return GetFileLoader()->Save(cachePath, data.data(), data.size());
+}
+
+bool ModelCacheReader::Open(std::filesystem::path cachePath, uint64_t optionsKey)
+{
+  m_dependencies.clear();
+  if (!GetFileLoader()->Map(cachePath, m_file))
+  {
+    return false;
+  }
+
+  CacheReader reader(m_file.GetData(), m_file.GetSize(), 0);
+  char magic[4] = {};
+  uint32_t version = 0;
+  uint64_t key = 0;
+  reader.Value(magic);
+  reader.Value(version);
+  reader.Value(key);
+  if (!reader.IsValid() || memcmp(magic, CacheMagic, sizeof(magic)) != 0 || version != ModelCacheVersion || key != optionsKey)
+  {
+    m_file.Unmap();
+    return false;
+  }
+
+  reader.Count(m_dependencies);
+  for (auto& dependency : m_dependencies)
+  {
+    reader.String(dependency.path);
+    reader.Value(dependency.hash);
+  }
+  if (!reader.IsValid())
+  {
+    m_file.Unmap();
+    return false;
+  }
+  m_bodyOffset = reader.GetOffset();
+  return true;
+}
+
+bool ModelCacheReader::Read(ModelCacheData& data)
+{
+  if (m_file.GetData() == nullptr)
+  {
+    return false;
+  }
+  CacheReader reader(m_file.GetData(), m_file.GetSize(), m_bodyOffset);
+  TransferList(reader, data.meshes, [](auto& s, auto& v) { TransferMesh(s, v); });
+  TransferList(reader, data.materials, [](auto& s, auto& v) { TransferMaterial(s, v); });
+  TransferList(reader, data.embeddedData, [](auto& s, auto& v) { TransferEmbeddedData(s, v); });
+  TransferList(reader, data.nodes, [](auto& s, auto& v) { TransferNode(s, v); });
+  TransferList(reader, data.animations, [](auto& s, auto& v) { TransferAnimation(s, v); });
+
+  // 末尾まで過不足なく読めた場合のみ成功とする. 読み終えたらマップは不要.
+  const bool success = reader.IsValid() && reader.GetOffset() == m_file.GetSize();
+  m_file.Unmap();
+  return success;
+}
@@ -0,0 +1,61 @@
+﻿#pragma once
+#include <vector>
+#include <string>
+#include <span>
+#include <cstdint>
+#include <filesystem>
+
+#include "Model.h"
+#include "FileLoader.h"
+
+// ModelLoader の読み込み結果 (メッシュ・マテリアル・ノード・アニメーション・埋め込みテクスチャ) を保存するバイナリキャッシュ.
+//  ヘッダ・依存ファイル表の後に、各配列をメモリ上と同じ形のまま 16 バイト境界に揃えたセクションとして並べる.
+//  読み込みはファイルをメモリマップし、セクション単位でまとめて配列へコピーするだけで済む.
+//  リトルエンディアンの環境のみを対象とする.
+
+// 読み込みに使ったファイルと、その内容のハッシュ. 内容が変わった場合はキャッシュを使わない.
+struct ModelCacheDependency
+{
+  std::string path;   // 読み込むファイルのディレクトリからの相対パス.
+  uint64_t hash = 0;
+};
+
+// 変更検出用のハッシュ (暗号用ではない).
+uint64_t ComputeContentHash(const void* data, size_t size);
+
+// 形式や読み込み結果を変えた場合は上げること. 古いキャッシュは読まずに作り直す.
+static const uint32_t ModelCacheVersion = 3;
+
+struct ModelCacheData
+{
+  std::vector<ModelMesh> meshes;
+  std::vector<ModelMaterial> materials;
+  std::vector<ModelEmbeddedTextureData> embeddedData;
+  std::vector<ModelNode> nodes;
+  std::vector<ModelAnimation> animations;
+};
+
+// optionsKey は読み込み設定を表す値. 一致しないキャッシュは使わない.
+bool WriteModelCache(std::filesystem::path cachePath, uint64_t optionsKey,
+  const std::vector<ModelCacheDependency>& dependencies,
+  std::span<const ModelMesh> meshes,
+  std::span<const ModelMaterial> materials,
+  std::span<const ModelEmbeddedTextureData> embeddedData,
+  std::span<const ModelNode> nodes,
+  std::span<const ModelAnimation> animations);
+
+class ModelCacheReader
+{
+public:
+  // キャッシュをマップし、ヘッダ (形式・バージョン・設定) と依存ファイル表を読む.
+  bool Open(std::filesystem::path cachePath, uint64_t optionsKey);
+  const std::vector<ModelCacheDependency>& GetDependencies() const { return m_dependencies; }
+
+  // 本体を読む. 依存ファイルの確認は呼び出し側で行う.
+  bool Read(ModelCacheData& data);
+
+private:
+  MappedFile m_file;
+  size_t m_bodyOffset = 0;
+  std::vector<ModelCacheDependency> m_dependencies;
+};
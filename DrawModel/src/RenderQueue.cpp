@@ -0,0 +1,78 @@
+﻿#include "RenderQueue.h"
+
+#include <cstring>
+#include <algorithm>
+
+namespace
+{
+  // 正の float はビット列をそのまま整数として比較しても大小関係が保たれる.
+  uint32_t DepthToBits(float viewDepth)
+  {
+    viewDepth = std::max(viewDepth, 0.0f);
+    uint32_t bits;
+    memcpy(&bits, &viewDepth, sizeof(bits));
+    return bits;
+  }
+
+  const uint64_t MaterialMask = (1ull << 24) - 1;
+}
+
+uint64_t RenderQueue::MakeOpaqueKey(uint32_t pass, uint32_t material, float viewDepth)
+{
+  return (uint64_t(pass) << PassShift) |
+    ((uint64_t(material) & MaterialMask) << 32) |
+    uint64_t(DepthToBits(viewDepth));
+}
+
+uint64_t RenderQueue::MakeBlendKey(uint32_t pass, uint32_t material, float viewDepth)
+{
+  // 奥のものから描くため深度を反転する.
+  return (uint64_t(pass) << PassShift) |
+    (uint64_t(~DepthToBits(viewDepth)) << 24) |
+    (uint64_t(material) & MaterialMask);
+}
+
+void RenderQueue::Sort()
+{
+  // 8bit ずつの LSD 基数ソート.
+  //  全要素で同じ値になっている桁はスキップする.
+  const size_t count = m_items.size();
+  if (count < 2)
+  {
+    return;
+  }
+  m_work.resize(count);
+
+  auto* src = m_items.data();
+  auto* dst = m_work.data();
+  for (int shift = 0; shift < 64; shift += 8)
+  {
+    size_t histogram[256] = {};
+    for (size_t i = 0; i < count; ++i)
+    {
+      histogram[(src[i].key >> shift) & 0xFF]++;
+    }
+    if (histogram[(src[0].key >> shift) & 0xFF] == count)
+    {
+      continue;
+    }
+
+    size_t offset = 0;
+    for (auto& h : histogram)
+    {
+      auto n = h;
+      h = offset;
+      offset += n;
+    }
+    for (size_t i = 0; i < count; ++i)
+    {
+      dst[histogram[(src[i].key >> shift) & 0xFF]++] = src[i];
+    }
+    std::swap(src, dst);
+  }
+
+  if (src != m_items.data())
+  {
+    memcpy(m_items.data(), src, sizeof(DrawItem) * count);
+  }
+}
@@ -0,0 +1,37 @@
+﻿#pragma once
+#include <vector>
+#include <cstdint>
+
+// 描画要求をソートキーで並べ替えるためのキュー.
+//  キーの上位からパス(パイプライン)、マテリアル、深度の順に詰めることで、
+//  並べ替えた順に発行すればステートの切り替えが最小になる.
+class RenderQueue
+{
+public:
+  struct DrawItem
+  {
+    uint64_t key;
+    uint32_t index;   // 呼び出し側で使う番号 (メッシュ番号など).
+  };
+
+  // 不透明系のキー: [pass:2][material:24][depth:32] 手前から奥へ.
+  //  半透明のキー: [pass:2][depth:32][material:24] 奥から手前へ.
+  static uint64_t MakeOpaqueKey(uint32_t pass, uint32_t material, float viewDepth);
+  static uint64_t MakeBlendKey(uint32_t pass, uint32_t material, float viewDepth);
+
+  static uint32_t GetPass(uint64_t key) { return uint32_t(key >> PassShift); }
+
+  void Clear() { m_items.clear(); }
+  void Push(uint64_t key, uint32_t index) { m_items.push_back({ key, index }); }
+
+  // キーの昇順に基数ソートする.
+  void Sort();
+
+  const std::vector<DrawItem>& GetItems() const { return m_items; }
+
+private:
+  std::vector<DrawItem> m_items;
+  std::vector<DrawItem> m_work;
+
+  static const int PassShift = 62;
+};
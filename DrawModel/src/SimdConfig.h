@@ -0,0 +1,18 @@
+﻿#pragma once
+
+// 使用する SIMD 命令セットを選び、対応する組み込み関数のヘッダーを読み込む.
+//  SIMD_AVX2 : AVX2 でコンパイルされている場合. (CMake の DRAWMODEL_ENABLE_AVX2、msbuild の /p:DrawModelEnableAVX2=true)
+//  SIMD_SSE2 : x64/x86 の場合. AVX2 の場合も定義されるため、SSE2 の実装はそのまま使える.
+//  SIMD_NEON : arm64/arm の場合.
+//  既定のビルドでは AVX2 は有効にならず、x64 は SSE2、arm64 は NEON の実装が使われる.
+#if defined(__AVX2__)
+# include <immintrin.h>
+# define SIMD_AVX2
+# define SIMD_SSE2
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+# include <emmintrin.h>
+# define SIMD_SSE2
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+# include <arm_neon.h>
+# define SIMD_NEON
+#endif
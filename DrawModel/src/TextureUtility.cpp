@@ -1,18 +1,147 @@
 ﻿#include "TextureUtility.h"
 #include "GfxDevice.h"
 #include "FileLoader.h"
+#include "MipDownsampler.h"
 
 #include "stb_image.h"
-#include "stb_image_resize.h"
 
 #include <cstring>
 #include <cassert>
 #include <cmath>
+#include <chrono>
 
 #ifdef max
 #undef max
 #endif
 
+namespace
+{
+  // RGBA各8bitのフォーマットをここでは対象とする.
+  const int Channels = 4;
+  const int PixelBytes = sizeof(uint32_t);
+
+  size_t GetMipBytes(uint32_t width, uint32_t height, uint32_t mipmap)
+  {
+    return size_t(std::max(1u, width >> mipmap)) * size_t(std::max(1u, height >> mipmap)) * PixelBytes;
+  }
+
+  // 持っている最後の段に続けて、1つ上の段を縮小して次の段を作る. 長辺が 1 になるまで (短辺は 1 で止めて) 続ける.
+  //  全段の領域を先に確保し、そのまま転送できる並びで書き込む.
+  void GenerateMipmaps(DecodedTexture& texture, const MipmapOptions& options = {})
+  {
+    auto start = std::chrono::high_resolution_clock::now();
+    const auto firstMipmap = texture.GetStoredMipCount();
+    const auto mipmapCount = texture.GetMipCount();
+    assert(firstMipmap > 0);
+    size_t totalBufferSize = texture.pixels.size();
+    for (uint32_t mipmap = firstMipmap; mipmap < mipmapCount; ++mipmap)
+    {
+      texture.mipOffsets.push_back(totalBufferSize);
+      totalBufferSize += GetMipBytes(texture.width, texture.height, mipmap);
+    }
+    texture.pixels.resize(totalBufferSize);
+
+    GenerateMipmapLevels(texture.pixels.data(), texture.mipOffsets, texture.width, texture.height, firstMipmap, options);
+    auto end = std::chrono::high_resolution_clock::now();
+    texture.mipMilliseconds += std::chrono::duration<double, std::milli>(end - start).count();
+  }
+
+  void PipelineBarrier(VkCommandBuffer commandBuffer, const VkImageMemoryBarrier2& barrierInfo)
+  {
+    VkDependencyInfo dependencyInfo{
+      .sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO,
+      .imageMemoryBarrierCount = 1,
+      .pImageMemoryBarriers = &barrierInfo,
+    };
+    if (GetGfxDevice()->IsSupportVulkan13())
+    {
+      vkCmdPipelineBarrier2(commandBuffer, &dependencyInfo);
+    }
+    else
+    {
+      vkCmdPipelineBarrier2KHR(commandBuffer, &dependencyInfo);
+    }
+  }
+
+  // firstMipmap 段目以降を、1つ上の段から線形フィルタのブリットで半分に縮小して作る.
+  //  全段が TRANSFER_DST_OPTIMAL の状態から始め、終了時は全段が TRANSFER_SRC_OPTIMAL になる.
+  uint32_t RecordBlitMipmaps(VkCommandBuffer commandBuffer, VkImage image,
+    uint32_t width, uint32_t height, uint32_t firstMipmap, uint32_t mipmapCount)
+  {
+    uint32_t blitCount = 0;
+    VkImageMemoryBarrier2 mipBarrier{
+      .sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER_2,
+      .srcStageMask = VK_PIPELINE_STAGE_2_TRANSFER_BIT,
+      .srcAccessMask = VK_ACCESS_2_TRANSFER_WRITE_BIT,
+      .dstStageMask = VK_PIPELINE_STAGE_2_TRANSFER_BIT,
+      .dstAccessMask = VK_ACCESS_2_TRANSFER_READ_BIT,
+      .oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+      .newLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+      .image = image,
+      .subresourceRange = {
+        .aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+        .baseMipLevel = 0, .levelCount = 1,
+        .baseArrayLayer = 0, .layerCount = 1,
+      }
+    };
+    for (uint32_t mipmap = 0; mipmap < mipmapCount; ++mipmap)
+    {
+      mipBarrier.subresourceRange.baseMipLevel = mipmap;
+      PipelineBarrier(commandBuffer, mipBarrier);
+      if (mipmap + 1 < firstMipmap || mipmap + 1 == mipmapCount)
+      {
+        continue;
+      }
+      VkImageBlit blit{
+        .srcSubresource = {
+          .aspectMask = VK_IMAGE_ASPECT_COLOR_BIT, .mipLevel = mipmap, .baseArrayLayer = 0, .layerCount = 1,
+        },
+        .srcOffsets = {
+          { 0, 0, 0 },
+          { int32_t(std::max(1u, width >> mipmap)), int32_t(std::max(1u, height >> mipmap)), 1 },
+        },
+        .dstSubresource = {
+          .aspectMask = VK_IMAGE_ASPECT_COLOR_BIT, .mipLevel = mipmap + 1, .baseArrayLayer = 0, .layerCount = 1,
+        },
+        .dstOffsets = {
+          { 0, 0, 0 },
+          { int32_t(std::max(1u, width >> (mipmap + 1))), int32_t(std::max(1u, height >> (mipmap + 1))), 1 },
+        },
+      };
+      vkCmdBlitImage(commandBuffer,
+        image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+        image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+        1, &blit, VK_FILTER_LINEAR);
+      blitCount++;
+    }
+    return blitCount;
+  }
+
+  // 0 段目から残りの段を MipDownsampler で作る.
+  //  全段が TRANSFER_DST_OPTIMAL の状態から始め、終了時は全段が GENERAL になる.
+  void RecordComputeMipmaps(VkCommandBuffer commandBuffer, VkImage image, uint32_t mipmapCount,
+    const MipDownsampler::Target& target)
+  {
+    VkImageMemoryBarrier2 barrierInfo{
+      .sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER_2,
+      .srcStageMask = VK_PIPELINE_STAGE_2_TRANSFER_BIT,
+      .srcAccessMask = VK_ACCESS_2_TRANSFER_WRITE_BIT,
+      .dstStageMask = VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT,
+      .dstAccessMask = VK_ACCESS_2_SHADER_SAMPLED_READ_BIT | VK_ACCESS_2_SHADER_STORAGE_READ_BIT | VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT,
+      .oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+      .newLayout = VK_IMAGE_LAYOUT_GENERAL,
+      .image = image,
+      .subresourceRange = {
+        .aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+        .baseMipLevel = 0, .levelCount = mipmapCount,
+        .baseArrayLayer = 0, .layerCount = 1,
+      }
+    };
+    PipelineBarrier(commandBuffer, barrierInfo);
+    GetMipDownsampler()->Dispatch(commandBuffer, target);
+  }
+}
+
 bool CreateTextureFromFile(GpuImage& outImage, std::filesystem::path filePath)
 {
   std::vector<char> fileData;
@@ -26,67 +155,163 @@ bool CreateTextureFromFile(GpuImage& outImage, std::filesystem::path filePath)
 
 bool CreateTextureFromMemory(GpuImage& outImage, const void* srcBuffer, size_t bufferSize)
 {
-  using namespace std;
+  // 1枚だけを読む経路のため、ミップマップは行ごとに分けて並列に作る.
+  DecodedTexture texture;
+  if (!DecodeTexture(texture, srcBuffer, bufferSize, true, MipmapOptions{ .parallel = true }))
+  {
+    return false;
+  }
+  return CreateTextureFromDecoded(outImage, texture);
+}
 
-  auto buffer = reinterpret_cast<const stbi_uc*>(srcBuffer);
-  int imageWidth, imageHeight, comp;
-  int result = stbi_info_from_memory(buffer, int(bufferSize), &imageWidth, &imageHeight, &comp);
+uint32_t DecodedTexture::GetMipCount() const
+{
+  if (width == 0 || height == 0)
+  {
+    return 0;
+  }
+  return uint32_t(std::floor(std::log2(std::max(width, height)))) + 1;
+}
 
-  if (result == 0)
+bool DecodeTexture(DecodedTexture& outTexture, const void* srcBuffer, size_t bufferSize, bool generateMipmaps, const MipmapOptions& mipOptions)
+{
+  auto buffer = reinterpret_cast<const stbi_uc*>(srcBuffer);
+  int imageWidth, imageHeight;
+  auto srcImage = stbi_load_from_memory(buffer, int(bufferSize), &imageWidth, &imageHeight, nullptr, Channels);
+  if (srcImage == nullptr)
   {
     // 失敗.
     return false;
   }
   assert(imageWidth != 0 && imageHeight != 0);
 
+  outTexture.width = uint32_t(imageWidth);
+  outTexture.height = uint32_t(imageHeight);
+  outTexture.mipOffsets.assign(1, 0);
+  outTexture.pixels.assign(srcImage, srcImage + size_t(imageWidth) * imageHeight * PixelBytes);
+  stbi_image_free(srcImage);
+
+  if (generateMipmaps)
+  {
+    GenerateMipmaps(outTexture, mipOptions);
+  }
+  // 中断された場合はミップマップが揃っていないため使えない.
+  return !(mipOptions.cancel && mipOptions.cancel->load());
+}
+
+bool IsGpuMipmapSupported(VkFormat format)
+{
+  VkFormatProperties properties{};
+  vkGetPhysicalDeviceFormatProperties(GetGfxDevice()->GetVkPhysicalDevice(), format, &properties);
+  const VkFormatFeatureFlags required =
+    VK_FORMAT_FEATURE_BLIT_SRC_BIT | VK_FORMAT_FEATURE_BLIT_DST_BIT | VK_FORMAT_FEATURE_SAMPLED_IMAGE_FILTER_LINEAR_BIT;
+  return (properties.optimalTilingFeatures & required) == required;
+}
+
+bool IsComputeMipmapSupported()
+{
+  auto& downsampler = GetMipDownsampler();
+  return downsampler->IsInitialized() && downsampler->IsSupported(MipDownsampler::MODE_RGBA8);
+}
+
+bool CreateTextureFromDecoded(GpuImage& outImage, const DecodedTexture& texture, TextureUploadStats* outStats, GpuMipmapMethod method)
+{
+  if (texture.GetMipCount() == 0 || texture.GetStoredMipCount() == 0)
+  {
+    return false;
+  }
   auto& gfxDevice = GetGfxDevice();
-  // 完全なミップマップを生成したときの段数を求める.
-  auto mipmapCount = uint32_t(floor(log2(max(imageWidth, imageHeight))) + 1);
+  auto start = std::chrono::high_resolution_clock::now();
 
-  // テクスチャを生成する.
-  outImage = gfxDevice->CreateImage2D(
-    uint32_t(imageWidth), uint32_t(imageHeight), VK_FORMAT_R8G8B8A8_UNORM, VK_IMAGE_USAGE_SAMPLED_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, mipmapCount);
+  auto commandBuffer = gfxDevice->AllocateCommandBuffer();
+  TextureUploadResources resources;
+  TextureUploadStats stats;
+  auto result = RecordTextureUpload(commandBuffer, outImage, texture, resources, &stats, method);
+  gfxDevice->SubmitOneShot(commandBuffer);
+  ReleaseTextureUpload(resources);
 
-  // RGBA各8bitのフォーマットをここでは対象とする.
-  int channels = 4;
-  auto srcImage = stbi_load_from_memory(buffer, int(bufferSize), &imageWidth, &imageHeight, nullptr, channels);
+  auto end = std::chrono::high_resolution_clock::now();
+  stats.milliseconds = std::chrono::duration<double, std::milli>(end - start).count();
+  if (outStats)
+  {
+    *outStats = stats;
+  }
+  return result;
+}
 
-  const int pixelBytes = sizeof(uint32_t);
-  int width = imageWidth, height = imageHeight;
-  unsigned char* resizeSrc = srcImage;
-  int mipLevel = 0;
-  size_t totalBufferSize = imageWidth * imageHeight * pixelBytes;
-  std::vector<unsigned char*> workImages;
-  while (width > 1 && height > 1)
+bool RecordTextureUpload(VkCommandBuffer commandBuffer, GpuImage& outImage, const DecodedTexture& texture,
+  TextureUploadResources& outResources, TextureUploadStats* outStats, GpuMipmapMethod method)
+{
+  auto& gfxDevice = GetGfxDevice();
+  const auto mipmapCount = texture.GetMipCount();
+  if (mipmapCount == 0 || texture.GetStoredMipCount() == 0)
   {
-    int mipWidth = std::max(1, width / 2);
-    int mipHeight = std::max(1, height / 2);
-    int surfaceByteSize = mipWidth * mipHeight * pixelBytes;
-    unsigned char* dstImage = new unsigned char[surfaceByteSize];
-    workImages.push_back(dstImage);
+    return false;
+  }
+  auto start = std::chrono::high_resolution_clock::now();
+  const VkFormat format = VK_FORMAT_R8G8B8A8_UNORM;
 
-    stbir_resize_uint8(resizeSrc, width, height, 0, dstImage, mipWidth, mipHeight, 0, channels);
+  // コンピュートシェーダーは 0 段目から全段を作るため、1段のみ持っている場合に使う.
+  const bool useCompute = method == GPU_MIPMAP_COMPUTE &&
+    texture.GetStoredMipCount() == 1 && mipmapCount > 1 && IsComputeMipmapSupported();
 
-    resizeSrc = dstImage;
-    width = mipWidth;
-    height = mipHeight;
-    totalBufferSize += surfaceByteSize;
+  // 足りない段を GPU で作れなければ、ここで CPU で作ってから転送する.
+  TextureUploadStats stats;
+  if (texture.GetStoredMipCount() < mipmapCount && !useCompute && !IsGpuMipmapSupported(format))
+  {
+    DecodedTexture completed = texture;
+    completed.mipMilliseconds = 0.0;
+    GenerateMipmaps(completed);
+    auto result = RecordTextureUpload(commandBuffer, outImage, completed, outResources, outStats, method);
+    if (outStats)
+    {
+      outStats->cpuMipMilliseconds = completed.mipMilliseconds;
+      outStats->milliseconds += completed.mipMilliseconds;
+    }
+    return result;
+  }
+  const auto storedMipCount = texture.GetStoredMipCount();
+
+  // テクスチャを生成する. ブリットで縮小する場合は転送元、コンピュートシェーダーで縮小する場合は書き込み先にもなる.
+  VkImageUsageFlags usage = VK_IMAGE_USAGE_SAMPLED_BIT;
+  if (useCompute)
+  {
+    usage |= VK_IMAGE_USAGE_STORAGE_BIT;
+  }
+  else if (storedMipCount < mipmapCount)
+  {
+    usage |= VK_IMAGE_USAGE_TRANSFER_SRC_BIT;
+  }
+  outImage = gfxDevice->CreateImage2D(
+    texture.width, texture.height, format, usage, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, mipmapCount);
+  auto& mipTarget = outResources.mipTarget;
+  if (useCompute)
+  {
+    GetMipDownsampler()->CreateTarget(mipTarget, outImage.image, MipDownsampler::MODE_RGBA8, texture.width, texture.height, mipmapCount);
   }
 
   // GPU転送元のステージングバッファを用意する.
-  auto stagingBuffer = gfxDevice->CreateBuffer(
-    totalBufferSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT, nullptr);
-  auto writePtr = reinterpret_cast<unsigned char*>(stagingBuffer.mapped);
-  uint64_t offset = 0;
+  auto& stagingBuffer = outResources.stagingBuffer;
+  stagingBuffer = gfxDevice->CreateBuffer(
+    texture.pixels.size(), VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT, nullptr);
+  memcpy(stagingBuffer.mapped, texture.pixels.data(), texture.pixels.size());
+  VkMappedMemoryRange memRange{
+    .sType = VK_STRUCTURE_TYPE_MAPPED_MEMORY_RANGE,
+    .memory = stagingBuffer.memory,
+    .offset = 0,
+    .size = VK_WHOLE_SIZE,
+  };
+  vkFlushMappedMemoryRanges(gfxDevice->GetVkDevice(), 1, &memRange);
+  stats.stagingBytes = texture.pixels.size();
+
+  // 転送コマンド発行用に各段の情報を記録しておく.
   std::vector<VkBufferImageCopy> imageCopyInfos;
-  for (uint32_t mipmap = 0; mipmap < mipmapCount; ++mipmap)
+  for (uint32_t mipmap = 0; mipmap < storedMipCount; ++mipmap)
   {
-    width = std::max(1, imageWidth >> mipmap );
-    height = std::max(1, imageHeight >> mipmap );
-
-    // 転送コマンド発行用に情報を記録しておく.
+    auto width = std::max(1u, texture.width >> mipmap);
+    auto height = std::max(1u, texture.height >> mipmap);
     auto& info = imageCopyInfos.emplace_back();
-    info.bufferOffset = offset;
+    info.bufferOffset = texture.mipOffsets[mipmap];
     info.bufferRowLength = width;
     info.bufferImageHeight = height;
     info.imageSubresource = {
@@ -97,41 +322,20 @@ bool CreateTextureFromMemory(GpuImage& outImage, const void* srcBuffer, size_t b
     };
     info.imageOffset = { .x = 0, .y = 0, .z = 0 };
     info.imageExtent = {
-      .width = uint32_t(width),
-      .height = uint32_t(height),
+      .width = width,
+      .height = height,
       .depth  = 1,
     };
-    
-    // ステージングバッファ内へ画像情報を記録.
-    int surfaceByteSize = width * height * 4;
-    if (mipmap == 0)
-    {
-      memcpy(writePtr + offset, srcImage, surfaceByteSize);
-    } else
-    {
-      memcpy(writePtr + offset, workImages[mipmap-1], surfaceByteSize);
-    }
-    totalBufferSize -= surfaceByteSize;
-    offset += surfaceByteSize;
   }
-  VkMappedMemoryRange memRange{
-    .sType = VK_STRUCTURE_TYPE_MAPPED_MEMORY_RANGE,
-    .memory = stagingBuffer.memory,
-    .offset = 0,
-    .size = VK_WHOLE_SIZE,
-  };
-  vkFlushMappedMemoryRanges(gfxDevice->GetVkDevice(), 1, &memRange);
-
-  // GPUへ転送処理.
-  auto commandBuffer = gfxDevice->AllocateCommandBuffer();
 
   // 転送先となるテクスチャのバリア設定.
+  //  描画と同じコマンドバッファに記録されることがあるため、転送のステージを明示して前後の処理と同期する.
   VkImageMemoryBarrier2 barrierInfo{
     .sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER_2,
     .pNext = nullptr,
     .srcStageMask = VK_PIPELINE_STAGE_2_ALL_GRAPHICS_BIT,
     .srcAccessMask = VK_ACCESS_NONE,
-    .dstStageMask = VK_PIPELINE_STAGE_2_ALL_GRAPHICS_BIT,
+    .dstStageMask = VK_PIPELINE_STAGE_2_TRANSFER_BIT,
     .dstAccessMask = VK_ACCESS_2_TRANSFER_WRITE_BIT,
     .oldLayout = VK_IMAGE_LAYOUT_UNDEFINED,
     .newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
@@ -142,53 +346,175 @@ bool CreateTextureFromMemory(GpuImage& outImage, const void* srcBuffer, size_t b
       .baseArrayLayer = 0, .layerCount = 1,
     }
   };
-  VkDependencyInfo dependencyInfo{
-    .sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO,
-    .imageMemoryBarrierCount = 1,
-    .pImageMemoryBarriers = &barrierInfo,
-  };
+  PipelineBarrier(commandBuffer, barrierInfo);
 
-  if (gfxDevice->IsSupportVulkan13())
+  vkCmdCopyBufferToImage(commandBuffer, stagingBuffer.buffer, outImage.image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+    uint32_t(imageCopyInfos.size()), imageCopyInfos.data());
+
+  if (useCompute)
   {
-    vkCmdPipelineBarrier2(commandBuffer, &dependencyInfo);
+    RecordComputeMipmaps(commandBuffer, outImage.image, mipmapCount, mipTarget);
+    stats.gpuMipCount = mipmapCount - 1;
+    barrierInfo.srcStageMask = VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT;
+    barrierInfo.oldLayout = VK_IMAGE_LAYOUT_GENERAL;
+    barrierInfo.srcAccessMask = VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT;
+  }
+  else if (storedMipCount < mipmapCount)
+  {
+    stats.gpuMipCount = RecordBlitMipmaps(commandBuffer, outImage.image, texture.width, texture.height, storedMipCount, mipmapCount);
+    barrierInfo.srcStageMask = VK_PIPELINE_STAGE_2_TRANSFER_BIT;
+    barrierInfo.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+    barrierInfo.srcAccessMask = VK_ACCESS_2_TRANSFER_READ_BIT;
   }
   else
   {
-    vkCmdPipelineBarrier2KHR(commandBuffer, &dependencyInfo);
+    barrierInfo.srcStageMask = VK_PIPELINE_STAGE_2_TRANSFER_BIT;
+    barrierInfo.oldLayout = barrierInfo.newLayout;
+    barrierInfo.srcAccessMask = barrierInfo.dstAccessMask;
   }
 
-  vkCmdCopyBufferToImage(commandBuffer, stagingBuffer.buffer, outImage.image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 
-    uint32_t(imageCopyInfos.size()), imageCopyInfos.data());
-
   // テクスチャとして使えるように後バリアを設定.
-  barrierInfo.oldLayout = barrierInfo.newLayout;
-  barrierInfo.srcAccessMask = barrierInfo.dstAccessMask;
+  barrierInfo.dstStageMask = VK_PIPELINE_STAGE_2_ALL_GRAPHICS_BIT;
   barrierInfo.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
   barrierInfo.dstAccessMask = VK_ACCESS_2_SHADER_READ_BIT;
+  PipelineBarrier(commandBuffer, barrierInfo);
+
+  outImage.accessFlags = barrierInfo.dstAccessMask;
+  outImage.layout = barrierInfo.newLayout;
 
-  if (gfxDevice->IsSupportVulkan13())
+  auto end = std::chrono::high_resolution_clock::now();
+  stats.milliseconds = std::chrono::duration<double, std::milli>(end - start).count();
+  if (outStats)
   {
-    vkCmdPipelineBarrier2(commandBuffer, &dependencyInfo);
+    *outStats = stats;
   }
-  else
+  return true;
+}
+
+void ReleaseTextureUpload(TextureUploadResources& resources)
+{
+  auto& gfxDevice = GetGfxDevice();
+  if (resources.stagingBuffer.buffer != VK_NULL_HANDLE)
+  {
+    gfxDevice->DestroyBuffer(resources.stagingBuffer);
+  }
+  if (resources.mipTarget.mipCount > 0)
   {
-    vkCmdPipelineBarrier2KHR(commandBuffer, &dependencyInfo);
+    GetMipDownsampler()->DestroyTarget(resources.mipTarget);
   }
+}
 
-  gfxDevice->SubmitOneShot(commandBuffer);
+std::vector<MipmapBenchmarkResult> RunMipmapBenchmark()
+{
+  std::vector<MipmapBenchmarkResult> results;
+  auto& gfxDevice = GetGfxDevice();
+  auto vkDevice = gfxDevice->GetVkDevice();
+  auto& downsampler = GetMipDownsampler();
+  const auto timestampPeriod = gfxDevice->GetTimestampPeriod();
+  if (timestampPeriod <= 0.0f || !downsampler->IsInitialized())
+  {
+    return results;
+  }
 
-  outImage.accessFlags = barrierInfo.dstAccessMask;
-  outImage.layout = barrierInfo.newLayout;
+  struct FormatEntry
+  {
+    VkFormat format;
+    MipDownsampler::Mode mode;
+    const char* name;
+  };
+  const FormatEntry formats[] = {
+    { VK_FORMAT_R8G8B8A8_UNORM, MipDownsampler::MODE_RGBA8, "RGBA8" },
+    { VK_FORMAT_R16G16B16A16_SFLOAT, MipDownsampler::MODE_RGBA16F, "RGBA16F" },
+  };
+  const uint32_t sizes[] = { 512, 1024, 2048, 4096 };
+  const uint32_t iterationCount = 8;
 
-  // ホスト側メモリの後始末.
-  stbi_image_free(srcImage);
-  for (auto& v : workImages)
+  // 1回につき、ブリットの開始・終了とコンピュートの開始・終了の4つを記録する.
+  VkQueryPoolCreateInfo timestampCI{
+    .sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO,
+    .queryType = VK_QUERY_TYPE_TIMESTAMP,
+    .queryCount = iterationCount * 4,
+  };
+  VkQueryPool queryPool = VK_NULL_HANDLE;
+  auto res = vkCreateQueryPool(vkDevice, &timestampCI, nullptr, &queryPool);
+  assert(res == VK_SUCCESS);
+
+  for (const auto& entry : formats)
   {
-    delete[] v;
-  }
+    if (!downsampler->IsSupported(entry.mode) || !IsGpuMipmapSupported(entry.format))
+    {
+      continue;
+    }
+    for (auto size : sizes)
+    {
+      const auto mipmapCount = uint32_t(std::floor(std::log2(size))) + 1;
+      auto image = gfxDevice->CreateImage2D(size, size, entry.format,
+        VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_STORAGE_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT,
+        VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, mipmapCount);
+      MipDownsampler::Target target;
+      downsampler->CreateTarget(target, image.image, entry.mode, size, size, mipmapCount);
 
-  gfxDevice->DestroyBuffer(stagingBuffer);
+      auto commandBuffer = gfxDevice->AllocateCommandBuffer();
+      vkCmdResetQueryPool(commandBuffer, queryPool, 0, iterationCount * 4);
+      VkImageMemoryBarrier2 barrierInfo{
+        .sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER_2,
+        .srcStageMask = VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT,
+        .srcAccessMask = VK_ACCESS_2_MEMORY_WRITE_BIT,
+        .dstStageMask = VK_PIPELINE_STAGE_2_TRANSFER_BIT,
+        .dstAccessMask = VK_ACCESS_2_TRANSFER_WRITE_BIT,
+        .oldLayout = VK_IMAGE_LAYOUT_UNDEFINED,
+        .newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+        .image = image.image,
+        .subresourceRange = {
+          .aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+          .baseMipLevel = 0, .levelCount = mipmapCount,
+          .baseArrayLayer = 0, .layerCount = 1,
+        }
+      };
+      VkClearColorValue clearColor{ .float32 = { 0.5f, 0.25f, 0.75f, 1.0f } };
+      for (uint32_t i = 0; i < iterationCount; ++i)
+      {
+        // 毎回 0 段目を書き直し、全段を TRANSFER_DST_OPTIMAL に戻してから計測する.
+        PipelineBarrier(commandBuffer, barrierInfo);
+        vkCmdClearColorImage(commandBuffer, image.image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, &clearColor, 1, &barrierInfo.subresourceRange);
 
-  return true;
-}
+        vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, queryPool, i * 4 + 0);
+        RecordBlitMipmaps(commandBuffer, image.image, size, size, 1, mipmapCount);
+        vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, queryPool, i * 4 + 1);
+
+        // ブリットの結果を捨てて、同じ状態からコンピュートシェーダーで作り直す.
+        PipelineBarrier(commandBuffer, barrierInfo);
+        vkCmdClearColorImage(commandBuffer, image.image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, &clearColor, 1, &barrierInfo.subresourceRange);
+
+        vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, queryPool, i * 4 + 2);
+        RecordComputeMipmaps(commandBuffer, image.image, mipmapCount, target);
+        vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, queryPool, i * 4 + 3);
+      }
+      gfxDevice->SubmitOneShot(commandBuffer);
 
+      std::vector<uint64_t> timestamps(iterationCount * 4);
+      vkGetQueryPoolResults(vkDevice, queryPool, 0, iterationCount * 4,
+        timestamps.size() * sizeof(uint64_t), timestamps.data(), sizeof(uint64_t), VK_QUERY_RESULT_64_BIT | VK_QUERY_RESULT_WAIT_BIT);
+      // 初回は除いて平均を取る.
+      uint64_t blitTicks = 0, computeTicks = 0;
+      for (uint32_t i = 1; i < iterationCount; ++i)
+      {
+        blitTicks += timestamps[i * 4 + 1] - timestamps[i * 4 + 0];
+        computeTicks += timestamps[i * 4 + 3] - timestamps[i * 4 + 2];
+      }
+      const double ticksToMilliseconds = double(timestampPeriod) / 1.0e6 / double(iterationCount - 1);
+      results.push_back(MipmapBenchmarkResult{
+        .size = size,
+        .formatName = entry.name,
+        .levelCount = mipmapCount,
+        .blitMilliseconds = double(blitTicks) * ticksToMilliseconds,
+        .computeMilliseconds = double(computeTicks) * ticksToMilliseconds,
+      });
+
+      downsampler->DestroyTarget(target);
+      gfxDevice->DestroyImage(image);
+    }
+  }
+  vkDestroyQueryPool(vkDevice, queryPool, nullptr);
+  return results;
+}
@@ -1,12 +1,97 @@
 ﻿#pragma once
 
 #include "GfxDevice.h"
+#include "MipmapGenerator.h"
+#include "MipDownsampler.h"
+#include <vector>
+#include <cstdint>
 #include <filesystem>
 
+// デコード済みのテクスチャ (RGBA 各8bit). ミップマップを詳細な段から順に詰めて持つ.
+//  GPU を使わないため、ワーカースレッドで作成できる.
+//  持っている段が完全なミップマップより少ない場合、残りは転送時に作成する.
+struct DecodedTexture
+{
+  uint32_t width = 0;
+  uint32_t height = 0;
+  std::vector<uint8_t> pixels;
+  std::vector<size_t> mipOffsets;  // 各段の pixels 内の位置.
+  double mipMilliseconds = 0.0;    // CPU でミップマップを作成した時間.
+
+  // 完全なミップマップの段数.
+  uint32_t GetMipCount() const;
+  // pixels に入っている段数.
+  uint32_t GetStoredMipCount() const { return uint32_t(mipOffsets.size()); }
+};
+
+// CreateTextureFromDecoded の処理内容.
+struct TextureUploadStats
+{
+  size_t   stagingBytes = 0;
+  uint32_t gpuMipCount = 0;           // GPU で作成した段数.
+  double   cpuMipMilliseconds = 0.0;  // GPU で作成できずに CPU で作成した時間.
+  double   milliseconds = 0.0;        // 転送の完了まで. (RecordTextureUpload では記録まで)
+};
+
+// RecordTextureUpload が記録したコマンドの参照するリソース.
+//  コマンドの完了後に ReleaseTextureUpload で破棄する.
+struct TextureUploadResources
+{
+  GpuBuffer stagingBuffer{};
+  MipDownsampler::Target mipTarget;
+};
+
+// GPU で足りない段を作る方法.
+enum GpuMipmapMethod
+{
+  GPU_MIPMAP_BLIT,      // 段ごとに vkCmdBlitImage で縮小する.
+  GPU_MIPMAP_COMPUTE,   // MipDownsampler で全段を1回のディスパッチで作る.
+};
+
 // ファイルからテクスチャを生成.
 // テクスチャは GPU 転送済み、ミップマップ作成ありで生成される.
 bool CreateTextureFromFile(GpuImage& outImage, std::filesystem::path filePath);
 
 // メモリからテクスチャを生成.
 // テクスチャは GPU 転送済み、ミップマップ作成ありで生成される.
-bool CreateTextureFromMemory(GpuImage& outImage, const void* srcBuffer, size_t bufferSize);
\ No newline at end of file
+// ミップマップはスレッドプールで作る.
+bool CreateTextureFromMemory(GpuImage& outImage, const void* srcBuffer, size_t bufferSize);
+
+// 画像ファイルの内容をデコードする.
+//  generateMipmaps が false の場合は最も詳細な段のみとし、残りは CreateTextureFromDecoded で GPU に作らせる.
+//  mipOptions は CPU でミップマップを作る場合の設定. mipOptions.cancel で中断された場合は false を返す.
+bool DecodeTexture(DecodedTexture& outTexture, const void* srcBuffer, size_t bufferSize,
+  bool generateMipmaps = true, const MipmapOptions& mipOptions = {});
+
+// デコード済みのテクスチャから GPU のテクスチャを生成する. 転送の完了まで待つ.
+//  足りない段は、フォーマットが線形フィルタでのブリットに対応していれば GPU で縮小して作り、
+//  対応していなければ CPU で作ってから転送する.
+//  GPU_MIPMAP_COMPUTE は 0 段目のみを持つ場合に使い、それ以外や MipDownsampler が使えない場合はブリットで作る.
+bool CreateTextureFromDecoded(GpuImage& outImage, const DecodedTexture& texture,
+  TextureUploadStats* outStats = nullptr, GpuMipmapMethod method = GPU_MIPMAP_BLIT);
+
+// CreateTextureFromDecoded と同じ転送・ミップマップ作成を commandBuffer へ記録する. 完了は待たない.
+//  フレームのコマンドバッファへ記録すれば、描画を止めずに転送できる.
+//  outResources はコマンドの完了後 (同じフレームスロットの次の NewFrame 以降) に ReleaseTextureUpload で破棄すること.
+bool RecordTextureUpload(VkCommandBuffer commandBuffer, GpuImage& outImage, const DecodedTexture& texture,
+  TextureUploadResources& outResources, TextureUploadStats* outStats = nullptr, GpuMipmapMethod method = GPU_MIPMAP_BLIT);
+void ReleaseTextureUpload(TextureUploadResources& resources);
+
+// 線形フィルタの vkCmdBlitImage でミップマップを作成できるフォーマットか.
+bool IsGpuMipmapSupported(VkFormat format);
+
+// MipDownsampler で RGBA8 のミップマップを作成できるか.
+bool IsComputeMipmapSupported();
+
+// ブリットとコンピュートシェーダーでミップマップを作る GPU 時間の比較.
+struct MipmapBenchmarkResult
+{
+  uint32_t    size = 0;         // 正方形の一辺.
+  const char* formatName = "";
+  uint32_t    levelCount = 0;
+  double      blitMilliseconds = 0.0;
+  double      computeMilliseconds = 0.0;
+};
+// 大きさとフォーマットを変えて計測する. タイムスタンプが使えない場合は空.
+//  完了まで待つため、描画していない時に呼ぶこと.
+std::vector<MipmapBenchmarkResult> RunMipmapBenchmark();
@@ -0,0 +1,117 @@
+﻿#include "ThreadPool.h"
+
+#include <algorithm>
+
+static std::unique_ptr<ThreadPool> gThreadPool = nullptr;
+
+std::unique_ptr<ThreadPool>& GetThreadPool()
+{
+  if (gThreadPool == nullptr)
+  {
+    gThreadPool = std::make_unique<ThreadPool>();
+  }
+  return gThreadPool;
+}
+
+ThreadPool::ThreadPool(uint32_t threadCount)
+{
+  if (threadCount == 0)
+  {
+    threadCount = std::max(std::thread::hardware_concurrency(), 1u) - 1;
+  }
+  for (uint32_t i = 0; i < threadCount; ++i)
+  {
+    m_workers.emplace_back([this]() { WorkerMain(); });
+  }
+}
+
+ThreadPool::~ThreadPool()
+{
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_quit = true;
+  }
+  m_wakeup.notify_all();
+  for (auto& worker : m_workers)
+  {
+    worker.join();
+  }
+}
+
+void ThreadPool::ParallelFor(size_t count, const std::function<void(size_t)>& func)
+{
+  if (count == 0)
+  {
+    return;
+  }
+  if (m_workers.empty() || count == 1)
+  {
+    for (size_t i = 0; i < count; ++i)
+    {
+      func(i);
+    }
+    return;
+  }
+
+  Job job;
+  job.func = &func;
+  job.count = count;
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_jobs.push_back(&job);
+  }
+  m_wakeup.notify_all();
+
+  RunTasks(job);
+
+  // 全ての番号は取り出し済みのため、新たなワーカーが加わらないよう外してから、
+  //  実行中のワーカーが抜けるまで待つ. それまで job は参照される.
+  std::unique_lock<std::mutex> lock(m_mutex);
+  m_jobs.erase(std::find(m_jobs.begin(), m_jobs.end(), &job));
+  m_done.wait(lock, [&job]() { return job.workers == 0; });
+}
+
+void ThreadPool::WorkerMain()
+{
+  std::unique_lock<std::mutex> lock(m_mutex);
+  for (;;)
+  {
+    Job* job = nullptr;
+    m_wakeup.wait(lock, [&]() { return m_quit || (job = FindJob()) != nullptr; });
+    if (m_quit)
+    {
+      return;
+    }
+    job->workers++;
+    lock.unlock();
+
+    RunTasks(*job);
+
+    lock.lock();
+    if (--job->workers == 0)
+    {
+      m_done.notify_all();
+    }
+  }
+}
+
+ThreadPool::Job* ThreadPool::FindJob() const
+{
+  for (auto itr = m_jobs.rbegin(); itr != m_jobs.rend(); ++itr)
+  {
+    if ((*itr)->next.load() < (*itr)->count)
+    {
+      return *itr;
+    }
+  }
+  return nullptr;
+}
+
+void ThreadPool::RunTasks(Job& job)
+{
+  // 番号を1つずつ取り出すため、処理時間に偏りがあっても空いたスレッドが次を受け持つ.
+  for (size_t i = job.next.fetch_add(1); i < job.count; i = job.next.fetch_add(1))
+  {
+    (*job.func)(i);
+  }
+}
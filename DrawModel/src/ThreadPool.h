@@ -0,0 +1,55 @@
+﻿#pragma once
+#include <memory>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <condition_variable>
+
+// ワーカースレッドを常駐させ、番号ごとの独立した処理を並列に実行する.
+class ThreadPool
+{
+public:
+  // threadCount が 0 の場合は (論理コア数 - 1) 個のワーカーを作る. 呼び出し元のスレッドも処理を行う.
+  explicit ThreadPool(uint32_t threadCount = 0);
+  ~ThreadPool();
+  ThreadPool(const ThreadPool&) = delete;
+  ThreadPool& operator=(const ThreadPool&) = delete;
+
+  // func(0) ～ func(count - 1) を並列に実行し、全て終わるまで待つ.
+  //  各呼び出しは互いに異なる出力先へ書き込むこと.
+  //  複数のスレッドから同時に呼んでもよく、func の中から呼んでもよい.
+  //  呼び出し元のスレッドは自身の処理を必ず受け持つため、他の ParallelFor の終了を待つことはない.
+  void ParallelFor(size_t count, const std::function<void(size_t)>& func);
+
+  // 呼び出し元を含めた、同時に処理を行うスレッドの数.
+  uint32_t GetThreadCount() const { return uint32_t(m_workers.size()) + 1; }
+
+private:
+  // ParallelFor 1回分の処理. 呼び出し元のスタックに置かれる.
+  struct Job
+  {
+    const std::function<void(size_t)>* func = nullptr;
+    size_t count = 0;
+    std::atomic<size_t> next = 0;
+    uint32_t workers = 0;   // この処理を実行中のワーカー数. m_mutex で保護する.
+  };
+
+  void WorkerMain();
+  Job* FindJob() const;
+  static void RunTasks(Job& job);
+
+  std::vector<std::thread> m_workers;
+
+  std::mutex m_mutex;
+  std::condition_variable m_wakeup;
+  std::condition_variable m_done;
+
+  // 未着手の番号が残っている可能性のある処理. 後から追加したものを優先して手伝う.
+  std::vector<Job*> m_jobs;
+  bool m_quit = false;
+};
+
+std::unique_ptr<ThreadPool>& GetThreadPool();
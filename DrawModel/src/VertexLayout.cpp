@@ -0,0 +1,253 @@
+﻿#include "VertexLayout.h"
+#include "Meshlet.h"
+
+#include <algorithm>
+#include <cstring>
+#include <cmath>
+#include <type_traits>
+
+#include "glm/gtc/packing.hpp"
+
+namespace
+{
+  // 八面体エンコード. 単位ベクトルを [-1,1] の2次元に写す.
+  glm::vec2 EncodeOctahedral(glm::vec3 n)
+  {
+    float length = std::abs(n.x) + std::abs(n.y) + std::abs(n.z);
+    if (length <= 0.0f)
+    {
+      return glm::vec2(0.0f);
+    }
+    n /= length;
+    glm::vec2 p(n.x, n.y);
+    if (n.z < 0.0f)
+    {
+      glm::vec2 signNotZero(p.x >= 0.0f ? 1.0f : -1.0f, p.y >= 0.0f ? 1.0f : -1.0f);
+      p = (glm::vec2(1.0f) - glm::abs(glm::vec2(p.y, p.x))) * signNotZero;
+    }
+    return p;
+  }
+
+  template<class T>
+  void Write(uint8_t* dst, const T& v)
+  {
+    memcpy(dst, &v, sizeof(T));
+  }
+
+  VkFormat GetPositionVkFormat(VertexLayout::PositionFormat position)
+  {
+    switch (position)
+    {
+    default:
+    case VertexLayout::POSITION_FLOAT32: return VK_FORMAT_R32G32B32_SFLOAT;
+    case VertexLayout::POSITION_FLOAT16: return VK_FORMAT_R16G16B16A16_SFLOAT;
+    case VertexLayout::POSITION_SNORM16: return VK_FORMAT_R16G16B16A16_SNORM;
+    }
+  }
+}
+
+uint32_t VertexLayout::GetPositionSize() const
+{
+  return position == POSITION_FLOAT32 ? sizeof(float) * 3 : sizeof(uint16_t) * 4;
+}
+
+uint32_t VertexLayout::GetNormalSize() const
+{
+  return normal == NORMAL_FLOAT32 ? sizeof(float) * 3 : sizeof(uint16_t) * 2;
+}
+
+uint32_t VertexLayout::GetTexcoordSize() const
+{
+  return texcoord == TEXCOORD_FLOAT32 ? sizeof(float) * 2 : sizeof(uint16_t) * 2;
+}
+
+uint32_t VertexLayout::GetStride() const
+{
+  return GetPositionSize() + GetNormalSize() + GetTexcoordSize();
+}
+
+void VertexLayout::GetVertexInputDescriptions(
+  uint32_t binding,
+  VkVertexInputBindingDescription& outBinding,
+  std::vector<VkVertexInputAttributeDescription>& outAttributes) const
+{
+  outBinding = {
+    .binding = binding, .stride = GetStride(), .inputRate = VK_VERTEX_INPUT_RATE_VERTEX,
+  };
+
+  VkFormat positionFormat = GetPositionVkFormat(position);
+  VkFormat normalFormat = normal == NORMAL_FLOAT32 ? VK_FORMAT_R32G32B32_SFLOAT : VK_FORMAT_R16G16_SNORM;
+  VkFormat texcoordFormat = texcoord == TEXCOORD_FLOAT32 ? VK_FORMAT_R32G32_SFLOAT : VK_FORMAT_R16G16_SFLOAT;
+
+  outAttributes = {
+    { // POSITION
+      .location = 0, .binding = binding, .format = positionFormat, .offset = 0,
+    },
+    { // NORMAL
+      .location = 1, .binding = binding, .format = normalFormat, .offset = GetPositionSize(),
+    },
+    { // UV
+      .location = 2, .binding = binding, .format = texcoordFormat, .offset = GetPositionSize() + GetNormalSize(),
+    },
+  };
+}
+
+void VertexLayout::GetPositionInputDescriptions(
+  uint32_t binding,
+  VkVertexInputBindingDescription& outBinding,
+  std::vector<VkVertexInputAttributeDescription>& outAttributes) const
+{
+  outBinding = {
+    .binding = binding, .stride = GetPositionSize(), .inputRate = VK_VERTEX_INPUT_RATE_VERTEX,
+  };
+  outAttributes = {
+    { // POSITION
+      .location = 0, .binding = binding, .format = GetPositionVkFormat(position), .offset = 0,
+    },
+  };
+}
+
+VertexLayout VertexLayout::Float32()
+{
+  VertexLayout layout;
+  layout.position = POSITION_FLOAT32;
+  layout.normal = NORMAL_FLOAT32;
+  layout.texcoord = TEXCOORD_FLOAT32;
+  layout.allowIndex16 = false;
+  return layout;
+}
+
+VertexLayout VertexLayout::Packed()
+{
+  return VertexLayout();
+}
+
+void PlanPackedMesh(const ModelMesh& mesh, const VertexLayout& layout, PackedMesh& outMesh)
+{
+  const auto vertexCount = uint32_t(mesh.positions.size());
+  outMesh.vertexCount = vertexCount;
+  outMesh.decodeFlags = 0;
+
+  // 位置の量子化にはメッシュの範囲 (読み込み時に求めた AABB) を使用する.
+  glm::vec3 center(0.0f), extent(1.0f);
+  if (layout.position != VertexLayout::POSITION_FLOAT32 && vertexCount > 0)
+  {
+    center = (mesh.boundsMin + mesh.boundsMax) * 0.5f;
+    extent = glm::max((mesh.boundsMax - mesh.boundsMin) * 0.5f, glm::vec3(1.0e-6f));
+  }
+  outMesh.positionScale = glm::vec4(extent, 1.0f);
+  outMesh.positionOffset = glm::vec4(center, 0.0f);
+  if (layout.position == VertexLayout::POSITION_FLOAT16)
+  {
+    // half は中心からの相対値にするだけでスケールはしない.
+    outMesh.positionScale = glm::vec4(1.0f);
+  }
+  if (layout.normal == VertexLayout::NORMAL_OCT16)
+  {
+    outMesh.decodeFlags |= VERTEX_DECODE_NORMAL_OCT16;
+  }
+
+  // インデックスバッファ.
+  //  LOD のインデックスは LOD0 の後ろに続けて格納し、その後ろにメッシュレット順のインデックスを置く.
+  outMesh.indexCount = uint32_t(mesh.indices.size());
+  outMesh.lods.clear();
+  outMesh.lods.push_back({ .firstIndex = 0, .indexCount = outMesh.indexCount, .error = 0.0f });
+  uint32_t totalIndexCount = outMesh.indexCount;
+  for (const auto& lod : mesh.lods)
+  {
+    outMesh.lods.push_back({ .firstIndex = totalIndexCount, .indexCount = uint32_t(lod.indices.size()), .error = lod.error });
+    totalIndexCount += uint32_t(lod.indices.size());
+  }
+  outMesh.meshletFirstIndex = totalIndexCount;
+  outMesh.meshletIndexCount = uint32_t(mesh.meshletTriangles.size() * 3);
+  totalIndexCount += outMesh.meshletIndexCount;
+  outMesh.totalIndexCount = totalIndexCount;
+  outMesh.indexType = layout.allowIndex16 && vertexCount < 65536 ? VK_INDEX_TYPE_UINT16 : VK_INDEX_TYPE_UINT32;
+}
+
+void WritePackedVertices(const ModelMesh& mesh, const VertexLayout& layout, const PackedMesh& packed, uint8_t* dstVertices, uint8_t* dstPositions)
+{
+  const auto stride = layout.GetStride();
+  const auto positionSize = layout.GetPositionSize();
+  const auto normalOffset = positionSize;
+  const auto texcoordOffset = normalOffset + layout.GetNormalSize();
+  const auto center = glm::vec3(packed.positionOffset);
+  const auto extent = glm::vec3(packed.positionScale);
+  for (uint32_t i = 0; i < packed.vertexCount; ++i)
+  {
+    auto dst = dstVertices + size_t(i) * stride;
+
+    const auto& p = mesh.positions[i];
+    switch (layout.position)
+    {
+    default:
+    case VertexLayout::POSITION_FLOAT32:
+      Write(dst, p);
+      break;
+    case VertexLayout::POSITION_FLOAT16:
+      Write(dst, glm::packHalf4x16(glm::vec4(p - center, 1.0f)));
+      break;
+    case VertexLayout::POSITION_SNORM16:
+      Write(dst, glm::packSnorm4x16(glm::vec4((p - center) / extent, 1.0f)));
+      break;
+    }
+    // 位置は各頂点の先頭に置かれているため、そのまま複製する.
+    if (dstPositions != nullptr)
+    {
+      memcpy(dstPositions + size_t(i) * positionSize, dst, positionSize);
+    }
+
+    const auto& n = mesh.normals[i];
+    if (layout.normal == VertexLayout::NORMAL_FLOAT32)
+    {
+      Write(dst + normalOffset, n);
+    }
+    else
+    {
+      Write(dst + normalOffset, glm::packSnorm2x16(EncodeOctahedral(n)));
+    }
+
+    const auto& uv = mesh.texcoords[i];
+    if (layout.texcoord == VertexLayout::TEXCOORD_FLOAT32)
+    {
+      Write(dst + texcoordOffset, uv);
+    }
+    else
+    {
+      Write(dst + texcoordOffset, glm::packHalf2x16(uv));
+    }
+  }
+}
+
+void WritePackedIndices(const ModelMesh& mesh, const PackedMesh& packed, uint8_t* dstIndices)
+{
+  auto writeIndices = [&](auto* dst) {
+    using IndexType = std::remove_pointer_t<decltype(dst)>;
+    for (uint32_t i = 0; i < packed.lods.size(); ++i)
+    {
+      const auto& src = i == 0 ? mesh.indices : mesh.lods[i - 1].indices;
+      std::transform(src.begin(), src.end(), dst + packed.lods[i].firstIndex, [](uint32_t v) { return IndexType(v); });
+    }
+    auto meshletDst = dst + packed.meshletFirstIndex;
+    for (const auto& meshlet : mesh.meshlets)
+    {
+      const auto* vertices = &mesh.meshletVertices[meshlet.vertexOffset];
+      for (uint32_t i = 0; i < meshlet.triangleCount; ++i)
+      {
+        auto triangle = mesh.meshletTriangles[meshlet.triangleOffset + i];
+        for (uint32_t corner = 0; corner < 3; ++corner)
+        {
+          *meshletDst++ = IndexType(vertices[GetMeshletTriangleVertex(triangle, corner)]);
+        }
+      }
+    }
+  };
+  if (packed.indexType == VK_INDEX_TYPE_UINT16)
+  {
+    writeIndices(reinterpret_cast<uint16_t*>(dstIndices));
+  }
+  else
+  {
+    writeIndices(reinterpret_cast<uint32_t*>(dstIndices));
+  }
+}
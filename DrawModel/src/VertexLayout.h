@@ -0,0 +1,102 @@
+﻿#pragma once
+#include <vector>
+#include <cstdint>
+
+#include "GfxDevice.h"
+#include "Model.h"
+
+// メッシュ頂点を GPU へ送る際のレイアウト設定.
+//  各要素はひとつの頂点バッファにインターリーブして格納する.
+struct VertexLayout
+{
+  enum PositionFormat {
+    POSITION_FLOAT32 = 0,   // R32G32B32_SFLOAT
+    POSITION_FLOAT16,       // R16G16B16A16_SFLOAT (メッシュ中心からの相対値)
+    POSITION_SNORM16,       // R16G16B16A16_SNORM (メッシュの範囲で正規化)
+  };
+  enum NormalFormat {
+    NORMAL_FLOAT32 = 0,     // R32G32B32_SFLOAT
+    NORMAL_OCT16,           // R16G16_SNORM (八面体エンコード)
+  };
+  enum TexcoordFormat {
+    TEXCOORD_FLOAT32 = 0,   // R32G32_SFLOAT
+    TEXCOORD_FLOAT16,       // R16G16_SFLOAT
+  };
+
+  PositionFormat position = POSITION_SNORM16;
+  NormalFormat normal = NORMAL_OCT16;
+  TexcoordFormat texcoord = TEXCOORD_FLOAT16;
+
+  // 頂点数が 65536 未満のメッシュでは 16bit インデックスを使用する.
+  bool allowIndex16 = true;
+
+  uint32_t GetPositionSize() const;
+  uint32_t GetNormalSize() const;
+  uint32_t GetTexcoordSize() const;
+  uint32_t GetStride() const;
+
+  void GetVertexInputDescriptions(
+    uint32_t binding,
+    VkVertexInputBindingDescription& outBinding,
+    std::vector<VkVertexInputAttributeDescription>& outAttributes) const;
+  // 位置だけを詰めた頂点ストリーム用 (深度プリパス). ストライドは GetPositionSize().
+  void GetPositionInputDescriptions(
+    uint32_t binding,
+    VkVertexInputBindingDescription& outBinding,
+    std::vector<VkVertexInputAttributeDescription>& outAttributes) const;
+
+  // 全て 32bit float で格納する従来のレイアウト.
+  static VertexLayout Float32();
+  // 量子化して詰め込んだレイアウト.
+  static VertexLayout Packed();
+};
+
+// シェーダーへ渡す頂点デコード用フラグ.
+enum VertexDecodeFlags : uint32_t
+{
+  VERTEX_DECODE_NORMAL_OCT16 = 0x01,
+  VERTEX_DECODE_SKINNED = 0x02,   // 位置・法線をスキニング後の頂点バッファから読む.
+};
+
+// GPU へ転送する形に変換したメッシュの配置.
+//  データ自体は持たず、WritePackedVertices / WritePackedIndices で書き込み先へ直接変換する.
+struct PackedMesh
+{
+  uint32_t vertexCount = 0;
+  uint32_t indexCount = 0;    // LOD0 のインデックス数.
+  uint32_t totalIndexCount = 0; // LOD・メッシュレット順を含めた全インデックス数.
+  VkIndexType indexType = VK_INDEX_TYPE_UINT32;
+
+  size_t GetIndexStride() const { return indexType == VK_INDEX_TYPE_UINT16 ? sizeof(uint16_t) : sizeof(uint32_t); }
+  size_t GetIndexBytes() const { return totalIndexCount * GetIndexStride(); }
+
+  // LOD ごとのインデックスの範囲 (indices 内の位置). 先頭が LOD0.
+  struct LodRange
+  {
+    uint32_t firstIndex;
+    uint32_t indexCount;
+    float    error;
+  };
+  std::vector<LodRange> lods;
+
+  // メッシュレット順に並べ直した LOD0 のインデックスの範囲 (indices 内の位置).
+  //  メッシュレット i の三角形は meshletFirstIndex + triangleOffset * 3 から続く.
+  uint32_t meshletFirstIndex = 0;
+  uint32_t meshletIndexCount = 0;
+
+  // 量子化した位置の復元用パラメータ.
+  //  position = quantized * positionScale + positionOffset
+  glm::vec4 positionScale = glm::vec4(1.0f);
+  glm::vec4 positionOffset = glm::vec4(0.0f);
+  uint32_t decodeFlags = 0;
+};
+
+// 変換後のサイズ・インデックスの範囲・位置の復元用パラメータを求める. データは書き込まない.
+void PlanPackedMesh(const ModelMesh& mesh, const VertexLayout& layout, PackedMesh& outMesh);
+
+// PlanPackedMesh の結果に従い、頂点を dstVertices (vertexCount * ストライド バイト) へ書き込む.
+//  dstPositions が null でなければ、位置だけを詰めたストリーム (ストライド GetPositionSize()) も書き込む.
+//  書き込み先はマップしたステージングメモリなどで良く、メッシュごとに別の範囲であれば並列に呼んでも良い.
+void WritePackedVertices(const ModelMesh& mesh, const VertexLayout& layout, const PackedMesh& packed, uint8_t* dstVertices, uint8_t* dstPositions);
+// PlanPackedMesh の結果に従い、インデックスを dstIndices (GetIndexBytes() バイト) へ書き込む.
+void WritePackedIndices(const ModelMesh& mesh, const PackedMesh& packed, uint8_t* dstIndices);
@@ -0,0 +1,120 @@
+﻿#include "Culling.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+
+#include "glm/gtc/matrix_transform.hpp"
+
+// FrustumCuller の SIMD 版の結果が、スカラー版 (CullScalar) と一致することを確認する.
+//  SIMD の幅で割り切れない個数や、SetBox で置き換えた後の結果も比べる.
+namespace
+{
+  struct Scene
+  {
+    std::vector<glm::vec3> boundsMin;
+    std::vector<glm::vec3> boundsMax;
+  };
+
+  // RunCullingBenchmark と同じ範囲に、ランダムな AABB を配置する.
+  Scene CreateScene(uint32_t boxCount, std::mt19937& rng)
+  {
+    std::uniform_real_distribution<float> position(-50.0f, 50.0f);
+    std::uniform_real_distribution<float> size(0.1f, 2.0f);
+    Scene scene;
+    for (uint32_t i = 0; i < boxCount; ++i)
+    {
+      glm::vec3 center(position(rng), position(rng), position(rng));
+      glm::vec3 extent(size(rng), size(rng), size(rng));
+      scene.boundsMin.push_back(center - extent);
+      scene.boundsMax.push_back(center + extent);
+    }
+    return scene;
+  }
+
+  // 箱の範囲の中から、ランダムな向きのカメラの視錐台を作る.
+  Frustum CreateFrustum(std::mt19937& rng)
+  {
+    std::uniform_real_distribution<float> position(-60.0f, 60.0f);
+    const glm::vec3 eye(position(rng), position(rng), position(rng));
+    const glm::vec3 target(position(rng), position(rng), position(rng));
+    auto matView = glm::lookAt(eye, target, glm::vec3(0, 1, 0));
+    auto matProj = glm::perspective(glm::radians(60.0f), 16.0f / 9.0f, 0.1f, 100.0f);
+    return ExtractFrustum(matProj * matView);
+  }
+
+  bool Compare(const char* label, const FrustumCuller& culler, const Frustum& frustum)
+  {
+    std::vector<uint32_t> simdVisible, scalarVisible;
+    const auto simdCount = culler.Cull(frustum, simdVisible);
+    const auto scalarCount = culler.CullScalar(frustum, scalarVisible);
+    if (simdCount != scalarCount || simdVisible != scalarVisible)
+    {
+      printf("%-12s boxes %6u: MISMATCH (%s %u, Scalar %u)\n",
+        label, culler.GetCount(), FrustumCuller::GetSimdName(), simdCount, scalarCount);
+      return false;
+    }
+    return true;
+  }
+}
+
+int main()
+{
+  std::mt19937 rng(12345);
+  const uint32_t boxCounts[] = { 0, 1, 3, 4, 5, 7, 8, 9, 15, 16, 17, 1000, 4099, 100000 };
+  const int frustumCount = 16;
+  bool passed = true;
+  for (auto boxCount : boxCounts)
+  {
+    auto scene = CreateScene(boxCount, rng);
+    FrustumCuller culler;
+    culler.Reserve(boxCount);
+    for (uint32_t i = 0; i < boxCount; ++i)
+    {
+      culler.AddBox(scene.boundsMin[i], scene.boundsMax[i]);
+    }
+    for (int f = 0; f < frustumCount; ++f)
+    {
+      passed = Compare("AddBox", culler, CreateFrustum(rng)) && passed;
+    }
+
+    // 半分の箱を置き換え、作り直したものと同じ結果になることを確認する.
+    auto moved = CreateScene(boxCount, rng);
+    FrustumCuller rebuilt;
+    for (uint32_t i = 0; i < boxCount; ++i)
+    {
+      if (i % 2 == 0)
+      {
+        culler.SetBox(i, moved.boundsMin[i], moved.boundsMax[i]);
+        rebuilt.AddBox(moved.boundsMin[i], moved.boundsMax[i]);
+      }
+      else
+      {
+        rebuilt.AddBox(scene.boundsMin[i], scene.boundsMax[i]);
+      }
+    }
+    for (int f = 0; f < frustumCount; ++f)
+    {
+      const auto frustum = CreateFrustum(rng);
+      std::vector<uint32_t> updatedVisible, rebuiltVisible;
+      culler.CullScalar(frustum, updatedVisible);
+      rebuilt.CullScalar(frustum, rebuiltVisible);
+      if (updatedVisible != rebuiltVisible)
+      {
+        printf("%-12s boxes %6u: MISMATCH (SetBox and AddBox differ)\n", "SetBox", boxCount);
+        passed = false;
+      }
+      passed = Compare("SetBox", culler, frustum) && passed;
+    }
+  }
+
+  // ベンチマークの比較も通ること.
+  const auto bench = RunCullingBenchmark(100000, CreateFrustum(rng));
+  printf("Benchmark: %s %.3f ms, Scalar %.3f ms, Visible %u %s\n",
+    FrustumCuller::GetSimdName(), bench.simdMilliseconds, bench.scalarMilliseconds, bench.visibleCount,
+    bench.matched ? "OK" : "MISMATCH");
+  passed = passed && bench.matched;
+
+  printf("CullingTest (%s): %s\n", FrustumCuller::GetSimdName(), passed ? "passed" : "FAILED");
+  return passed ? EXIT_SUCCESS : EXIT_FAILURE;
+}
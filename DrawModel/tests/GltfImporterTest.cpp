@@ -0,0 +1,217 @@
+﻿#include "GltfImporter.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+
+// 壊れた glTF / GLB を GltfImporter に渡し、落ちずに失敗を返すことを確認する.
+//  正しい三角形1つのファイルから、値を1か所ずつ書き換えたものを読み込む.
+namespace
+{
+  std::string EncodeBase64(const std::vector<uint8_t>& data)
+  {
+    static const char table[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+    std::string result;
+    for (size_t i = 0; i < data.size(); i += 3)
+    {
+      uint32_t bits = uint32_t(data[i]) << 16;
+      bits |= i + 1 < data.size() ? uint32_t(data[i + 1]) << 8 : 0;
+      bits |= i + 2 < data.size() ? uint32_t(data[i + 2]) : 0;
+      result += table[(bits >> 18) & 63];
+      result += table[(bits >> 12) & 63];
+      result += i + 1 < data.size() ? table[(bits >> 6) & 63] : '=';
+      result += i + 2 < data.size() ? table[bits & 63] : '=';
+    }
+    return result;
+  }
+
+  // 頂点 3つ (float x3) とインデックス 3つ (uint16) を詰めたバッファ. 44 バイト.
+  std::vector<uint8_t> CreateTriangleBuffer(uint16_t lastIndex = 2)
+  {
+    const float positions[] = { 0.0f, 0.0f, 0.0f, 1.0f, 0.0f, 0.0f, 0.0f, 1.0f, 0.0f };
+    const uint16_t indices[] = { 0, 1, lastIndex, 0 };
+    std::vector<uint8_t> data(sizeof(positions) + sizeof(indices));
+    memcpy(data.data(), positions, sizeof(positions));
+    memcpy(data.data() + sizeof(positions), indices, sizeof(indices));
+    return data;
+  }
+
+  const char* TriangleJson =
+    R"({"asset":{"version":"2.0"},"scene":0,"scenes":[{"nodes":[0]}],)"
+    R"("nodes":[{"mesh":0,"children":[1]},{"name":"child"}],)"
+    R"("meshes":[{"primitives":[{"attributes":{"POSITION":0},"indices":1}]}],)"
+    R"("buffers":[{"uri":"data:application/octet-stream;base64,@DATA@","byteLength":44}],)"
+    R"("bufferViews":[{"buffer":0,"byteOffset":0,"byteLength":36},{"buffer":0,"byteOffset":36,"byteLength":6}],)"
+    R"("accessors":[{"bufferView":0,"componentType":5126,"count":3,"type":"VEC3"},)"
+    R"({"bufferView":1,"componentType":5123,"count":3,"type":"SCALAR"}]})";
+
+  // text 内にただ1つある from を to に置き換える.
+  std::string Replace(std::string text, const std::string& from, const std::string& to)
+  {
+    const auto pos = text.find(from);
+    if (pos == std::string::npos || text.find(from, pos + 1) != std::string::npos)
+    {
+      printf("Replace: \"%s\" is not unique.\n", from.c_str());
+      exit(EXIT_FAILURE);
+    }
+    return text.replace(pos, from.size(), to);
+  }
+
+  std::string CreateGltf(const std::vector<uint8_t>& buffer = CreateTriangleBuffer())
+  {
+    return Replace(TriangleJson, "@DATA@", EncodeBase64(buffer));
+  }
+
+  // JSON チャンクとバイナリチャンクを持つ GLB. バッファは uri を持たないものにする.
+  std::vector<char> CreateGlb(uint32_t version = 2, int32_t jsonLengthDelta = 0, bool withBinaryChunk = true)
+  {
+    std::string json = Replace(TriangleJson, R"("uri":"data:application/octet-stream;base64,@DATA@",)", "");
+    json.resize((json.size() + 3) & ~size_t(3), ' ');
+    const auto binary = CreateTriangleBuffer();
+    std::vector<char> glb;
+    auto append = [&](const void* data, size_t size) {
+      glb.insert(glb.end(), static_cast<const char*>(data), static_cast<const char*>(data) + size);
+    };
+    auto appendU32 = [&](uint32_t v) { append(&v, sizeof(v)); };
+    const uint32_t totalLength = uint32_t(12 + 8 + json.size() + (withBinaryChunk ? 8 + binary.size() : 0));
+    appendU32(0x46546C67);  // "glTF"
+    appendU32(version);
+    appendU32(totalLength);
+    appendU32(uint32_t(int32_t(json.size()) + jsonLengthDelta));
+    appendU32(0x4E4F534A);  // "JSON"
+    append(json.data(), json.size());
+    if (withBinaryChunk)
+    {
+      appendU32(uint32_t(binary.size()));
+      appendU32(0x004E4942);  // "BIN\0"
+      append(binary.data(), binary.size());
+    }
+    return glb;
+  }
+
+  std::vector<char> ToData(const std::string& text)
+  {
+    return std::vector<char>(text.begin(), text.end());
+  }
+
+  struct TestCase
+  {
+    const char* name;
+    std::vector<char> data;
+    bool expectOpen;
+    bool expectMesh;    // Open が成功した場合に、全てのメッシュの ReadMesh が成功するか.
+  };
+
+  // 読み込める部分は全て読み、落ちないことを確認する.
+  bool Run(const TestCase& test)
+  {
+    GltfImporter importer;
+    std::vector<ModelCacheDependency> dependencies;
+    const bool opened = importer.Open("test.gltf", test.data, dependencies);
+    bool meshRead = true;
+    if (opened)
+    {
+      for (uint32_t i = 0; i < importer.GetMeshCount(); ++i)
+      {
+        ModelMesh mesh;
+        meshRead = importer.ReadMesh(i, mesh, true) && meshRead;
+      }
+      for (uint32_t i = 0; i < importer.GetMaterialCount(); ++i)
+      {
+        ModelMaterial material;
+        importer.ReadMaterial(i, material);
+      }
+      for (uint32_t i = 0; i < importer.GetEmbeddedTextureCount(); ++i)
+      {
+        ModelEmbeddedTextureData embedded;
+        importer.ReadEmbeddedTexture(i, embedded);
+      }
+      std::vector<ModelNode> nodes;
+      importer.ReadNodes(nodes);
+      std::vector<ModelAnimation> animations;
+      importer.ReadAnimations(animations);
+    }
+    const bool passed = opened == test.expectOpen && (!opened || meshRead == test.expectMesh);
+    printf("%-32s Open %-5s Mesh %-5s %s\n", test.name, opened ? "true" : "false",
+      opened ? (meshRead ? "true" : "false") : "-", passed ? "OK" : "FAILED");
+    return passed;
+  }
+}
+
+int main()
+{
+  const auto gltf = CreateGltf();
+  auto glbHeader = CreateGlb();
+  glbHeader.resize(12);
+  const std::vector<TestCase> tests = {
+    { "Valid glTF", ToData(gltf), true, true },
+    { "Valid GLB", CreateGlb(), true, true },
+
+    // JSON の構文.
+    { "Empty", {}, false, false },
+    { "Truncated JSON", ToData(gltf.substr(0, gltf.size() / 2)), false, false },
+    { "Not an object", ToData("[1,2,3]"), false, false },
+    { "Deep nesting", ToData(std::string(100000, '[')), false, false },
+    { "Bad escape", ToData(Replace(gltf, R"("child")", R"("ch\u12")")), false, false },
+    { "Unsupported version", ToData(Replace(gltf, R"("version":"2.0")", R"("version":"1.0")")), false, false },
+
+    // バッファ.
+    { "Buffer shorter than length", ToData(Replace(gltf, R"("byteLength":44)", R"("byteLength":45)")), false, false },
+    { "Buffer length 1e999", ToData(Replace(gltf, R"("byteLength":44)", R"("byteLength":1e999)")), false, false },
+    { "Buffer without uri", ToData(Replace(gltf, R"("uri":"data:application/octet-stream;base64,)", R"("name":")")), false, false },
+    { "Bad base64", ToData(Replace(gltf, EncodeBase64(CreateTriangleBuffer()), "!!!!")), false, false },
+
+    // バッファビュー.
+    { "View buffer out of range", ToData(Replace(gltf, R"({"buffer":0,"byteOffset":0,)", R"({"buffer":5,"byteOffset":0,)")), true, false },
+    { "View offset negative", ToData(Replace(gltf, R"("byteOffset":36)", R"("byteOffset":-4)")), true, false },
+    { "View offset 1e999", ToData(Replace(gltf, R"("byteOffset":36)", R"("byteOffset":1e999)")), true, false },
+    { "View offset NaN", ToData(Replace(gltf, R"("byteOffset":36)", R"("byteOffset":-nan)")), true, false },
+    { "View length past buffer", ToData(Replace(gltf, R"("byteLength":36)", R"("byteLength":100)")), true, false },
+
+    // アクセサ.
+    { "Position accessor missing", ToData(Replace(gltf, R"("POSITION":0)", R"("POSITION":9)")), true, false },
+    { "Position accessor 1e999", ToData(Replace(gltf, R"("POSITION":0)", R"("POSITION":1e999)")), true, false },
+    { "Count past view", ToData(Replace(gltf, R"("count":3,"type":"VEC3")", R"("count":4,"type":"VEC3")")), true, false },
+    { "Count 1e15", ToData(Replace(gltf, R"("count":3,"type":"VEC3")", R"("count":1e15,"type":"VEC3")")), true, false },
+    { "Count inf", ToData(Replace(gltf, R"("count":3,"type":"VEC3")", R"("count":inf,"type":"VEC3")")), true, false },
+    { "Count inf without view", ToData(Replace(gltf, R"({"bufferView":0,"componentType":5126,"count":3,)",
+      R"({"componentType":5126,"count":inf,)")), true, false },
+    { "Unknown component type", ToData(Replace(gltf, R"("componentType":5126)", R"("componentType":1234)")), true, false },
+    { "Unknown type", ToData(Replace(gltf, R"("type":"VEC3")", R"("type":"VEC9")")), true, false },
+    { "Index out of range", ToData(CreateGltf(CreateTriangleBuffer(7))), true, false },
+
+    // ノード・シーン. 不正な番号は無視する.
+    { "Node cycle", ToData(Replace(gltf, R"({"name":"child"})", R"({"name":"child","children":[0,1]})")), true, true },
+    { "Node mesh 1e999", ToData(Replace(gltf, R"("mesh":0)", R"("mesh":1e999)")), true, true },
+    { "Scene 1e999", ToData(Replace(gltf, R"("scene":0)", R"("scene":1e999)")), true, true },
+    { "Mode NaN", ToData(Replace(gltf, R"("indices":1})", R"("indices":1,"mode":-nan})")), true, true },
+
+    // GLB のヘッダ・チャンク.
+    { "GLB version 1", CreateGlb(1), false, false },
+    { "GLB chunk past end", CreateGlb(2, 64), false, false },
+    { "GLB without binary chunk", CreateGlb(2, 0, false), false, false },
+    { "GLB header only", glbHeader, false, false },
+  };
+
+  bool passed = true;
+  for (const auto& test : tests)
+  {
+    passed = Run(test) && passed;
+  }
+
+  // 正しいファイルは三角形1つとして読めること.
+  GltfImporter importer;
+  std::vector<ModelCacheDependency> dependencies;
+  ModelMesh mesh;
+  if (!importer.Open("test.gltf", ToData(gltf), dependencies) || importer.GetMeshCount() != 1 ||
+    !importer.ReadMesh(0, mesh, false) || mesh.positions.size() != 3 || mesh.indices.size() != 3 ||
+    mesh.positions[1].x != 1.0f || mesh.indices[2] != 2)
+  {
+    printf("Valid glTF: unexpected contents\n");
+    passed = false;
+  }
+
+  printf("GltfImporterTest: %s\n", passed ? "passed" : "FAILED");
+  return passed ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,188 @@
+﻿#include "MeshBvh.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cmath>
+#include <cfloat>
+#include <random>
+#include <algorithm>
+
+#include "glm/gtc/matrix_transform.hpp"
+
+// MeshBvh の視錐台カリング・レイ・最近傍の問い合わせが、全ての AABB を調べた結果と一致することを確認する.
+//  Refit で AABB を差し替えた後の結果も比べる.
+namespace
+{
+  struct Boxes
+  {
+    std::vector<glm::vec3> boundsMin;
+    std::vector<glm::vec3> boundsMax;
+  };
+
+  Boxes CreateBoxes(uint32_t boxCount, std::mt19937& rng)
+  {
+    std::uniform_real_distribution<float> position(-50.0f, 50.0f);
+    std::uniform_real_distribution<float> size(0.1f, 2.0f);
+    Boxes boxes;
+    for (uint32_t i = 0; i < boxCount; ++i)
+    {
+      glm::vec3 center(position(rng), position(rng), position(rng));
+      glm::vec3 extent(size(rng), size(rng), size(rng));
+      boxes.boundsMin.push_back(center - extent);
+      boxes.boundsMax.push_back(center + extent);
+    }
+    return boxes;
+  }
+
+  // 総当たりのレイ判定. 距離は AABB に入るまで (始点が内側ならば 0) で、同じ距離ならば番号の小さいものを選ぶ.
+  MeshBvh::RayHit RaycastBruteForce(const Boxes& boxes, const glm::vec3& origin, const glm::vec3& direction, float maxDistance)
+  {
+    MeshBvh::RayHit hit;
+    for (uint32_t i = 0; i < uint32_t(boxes.boundsMin.size()); ++i)
+    {
+      float tEnter = 0.0f, tExit = maxDistance;
+      for (int c = 0; c < 3; ++c)
+      {
+        const float invDir = direction[c] != 0.0f ? 1.0f / direction[c] : std::copysign(1.0e30f, direction[c]);
+        const float t0 = (boxes.boundsMin[i][c] - origin[c]) * invDir;
+        const float t1 = (boxes.boundsMax[i][c] - origin[c]) * invDir;
+        tEnter = std::max(tEnter, std::min(t0, t1));
+        tExit = std::min(tExit, std::max(t0, t1));
+      }
+      if (tEnter <= tExit && (hit.index == UINT32_MAX || tEnter < hit.distance))
+      {
+        hit = MeshBvh::RayHit{ .index = i, .distance = tEnter };
+      }
+    }
+    return hit;
+  }
+
+  MeshBvh::RayHit FindNearestBruteForce(const Boxes& boxes, const glm::vec3& point)
+  {
+    MeshBvh::RayHit hit;
+    float nearestSq = FLT_MAX;
+    for (uint32_t i = 0; i < uint32_t(boxes.boundsMin.size()); ++i)
+    {
+      const auto d = glm::max(glm::max(boxes.boundsMin[i] - point, point - boxes.boundsMax[i]), glm::vec3(0.0f));
+      const float distanceSq = glm::dot(d, d);
+      if (distanceSq < nearestSq)
+      {
+        nearestSq = distanceSq;
+        hit.index = i;
+      }
+    }
+    hit.distance = hit.index != UINT32_MAX ? std::sqrt(nearestSq) : 0.0f;
+    return hit;
+  }
+
+  // 距離の計算順序が異なると最後の桁が変わりうるため、距離は許容誤差付きで比べる.
+  //  番号が異なる場合は、同じ距離の別の AABB を選んでいれば一致とみなす.
+  bool IsSameHit(bool found, const MeshBvh::RayHit& hit, const MeshBvh::RayHit& expected)
+  {
+    if (found != (expected.index != UINT32_MAX))
+    {
+      return false;
+    }
+    if (!found)
+    {
+      return true;
+    }
+    const float tolerance = 1.0e-4f * std::max(1.0f, expected.distance);
+    return std::abs(hit.distance - expected.distance) <= tolerance;
+  }
+
+  bool CheckQueries(const char* label, const MeshBvh& bvh, const Boxes& boxes, std::mt19937& rng)
+  {
+    std::uniform_real_distribution<float> position(-60.0f, 60.0f);
+    std::uniform_real_distribution<float> direction(-1.0f, 1.0f);
+    const auto boxCount = uint32_t(boxes.boundsMin.size());
+    bool passed = true;
+
+    // 視錐台カリングは FrustumCuller (スカラー版) と比べる.
+    FrustumCuller culler;
+    for (uint32_t i = 0; i < boxCount; ++i)
+    {
+      culler.AddBox(boxes.boundsMin[i], boxes.boundsMax[i]);
+    }
+    for (int f = 0; f < 16; ++f)
+    {
+      const glm::vec3 eye(position(rng), position(rng), position(rng));
+      const glm::vec3 target(position(rng), position(rng), position(rng));
+      const auto matViewProj = glm::perspective(glm::radians(60.0f), 16.0f / 9.0f, 0.1f, 100.0f) *
+        glm::lookAt(eye, target, glm::vec3(0, 1, 0));
+      const auto frustum = ExtractFrustum(matViewProj);
+      std::vector<uint32_t> bvhVisible, flatVisible;
+      bvh.Cull(frustum, bvhVisible);
+      culler.CullScalar(frustum, flatVisible);
+      std::sort(bvhVisible.begin(), bvhVisible.end());
+      if (bvhVisible != flatVisible)
+      {
+        printf("%-8s boxes %6u: Cull MISMATCH (BVH %zu, Flat %zu)\n", label, boxCount, bvhVisible.size(), flatVisible.size());
+        passed = false;
+      }
+    }
+
+    // レイは軸に平行なもの (方向の成分が 0) と、AABB の内側から出るものも含める.
+    const float maxDistance = 1000.0f;
+    for (uint32_t q = 0; q < 2048; ++q)
+    {
+      glm::vec3 origin(position(rng), position(rng), position(rng));
+      glm::vec3 dir(direction(rng), direction(rng), direction(rng));
+      if (q % 8 == 1)
+      {
+        dir = glm::vec3(0.0f);
+        dir[q % 3] = (q & 16) ? 1.0f : -1.0f;
+      }
+      if (q % 8 == 2 && boxCount > 0)
+      {
+        const auto i = q % boxCount;
+        origin = (boxes.boundsMin[i] + boxes.boundsMax[i]) * 0.5f;
+      }
+      MeshBvh::RayHit rayHit;
+      const bool rayFound = bvh.Raycast(origin, dir, maxDistance, rayHit);
+      if (!IsSameHit(rayFound, rayHit, RaycastBruteForce(boxes, origin, dir, maxDistance)))
+      {
+        printf("%-8s boxes %6u: Raycast MISMATCH (query %u)\n", label, boxCount, q);
+        passed = false;
+      }
+
+      const glm::vec3 point(position(rng), position(rng), position(rng));
+      MeshBvh::RayHit nearestHit;
+      const bool nearestFound = bvh.FindNearest(point, nearestHit);
+      if (!IsSameHit(nearestFound, nearestHit, FindNearestBruteForce(boxes, point)))
+      {
+        printf("%-8s boxes %6u: FindNearest MISMATCH (query %u)\n", label, boxCount, q);
+        passed = false;
+      }
+    }
+    return passed;
+  }
+}
+
+int main()
+{
+  std::mt19937 rng(12345);
+  const uint32_t boxCounts[] = { 0, 1, 2, 5, 17, 100, 10000 };
+  bool passed = true;
+  for (auto boxCount : boxCounts)
+  {
+    auto boxes = CreateBoxes(boxCount, rng);
+    MeshBvh bvh;
+    bvh.Build(boxes.boundsMin, boxes.boundsMax);
+    passed = CheckQueries("Build", bvh, boxes, rng) && passed;
+
+    // 全ての AABB を動かして包み直す.
+    std::uniform_real_distribution<float> offset(-5.0f, 5.0f);
+    for (uint32_t i = 0; i < boxCount; ++i)
+    {
+      const glm::vec3 move(offset(rng), offset(rng), offset(rng));
+      boxes.boundsMin[i] += move;
+      boxes.boundsMax[i] += move;
+    }
+    bvh.Refit(boxes.boundsMin, boxes.boundsMax);
+    passed = CheckQueries("Refit", bvh, boxes, rng) && passed;
+  }
+
+  printf("MeshBvhTest: %s\n", passed ? "passed" : "FAILED");
+  return passed ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,121 @@
+﻿#include "MipmapGenerator.h"
+#include "ThreadPool.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <algorithm>
+
+// MipmapGenerator.cpp のベンチマークが参照するため、stb_image_resize の実装をここに置く.
+//  (アプリケーションでは SingleHeaderImpl.cpp に置いている)
+#define STB_IMAGE_RESIZE_IMPLEMENTATION
+#include "stb_image_resize.h"
+
+// ボックスフィルタの SIMD 版が、2x2 の平均 (a + b + c + d + 2) >> 2 で作った段と一致することを確認する.
+//  SIMD の幅で割り切れない幅、奇数の大きさ、幅・高さが 1 の画像も含める.
+namespace
+{
+  const uint32_t PixelBytes = 4;
+
+  size_t ComputeMipOffsets(uint32_t width, uint32_t height, std::vector<size_t>& outOffsets)
+  {
+    outOffsets.clear();
+    size_t totalBytes = 0;
+    for (uint32_t mipmap = 0; ; ++mipmap)
+    {
+      const uint32_t w = std::max(1u, width >> mipmap);
+      const uint32_t h = std::max(1u, height >> mipmap);
+      outOffsets.push_back(totalBytes);
+      totalBytes += size_t(w) * h * PixelBytes;
+      if (w == 1 && h == 1)
+      {
+        break;
+      }
+    }
+    return totalBytes;
+  }
+
+  // 1つ上の段の 2x2 を平均する. 奇数の大きさの最後の列・行は使わず、大きさが 1 の方向は同じ列・行を2回使う.
+  void GenerateReference(uint8_t* pixels, const std::vector<size_t>& mipOffsets, uint32_t width, uint32_t height)
+  {
+    for (size_t mipmap = 1; mipmap < mipOffsets.size(); ++mipmap)
+    {
+      const uint32_t srcWidth = std::max(1u, width >> (mipmap - 1));
+      const uint32_t srcHeight = std::max(1u, height >> (mipmap - 1));
+      const uint32_t dstWidth = std::max(1u, width >> mipmap);
+      const uint32_t dstHeight = std::max(1u, height >> mipmap);
+      const uint8_t* src = pixels + mipOffsets[mipmap - 1];
+      uint8_t* dst = pixels + mipOffsets[mipmap];
+      for (uint32_t y = 0; y < dstHeight; ++y)
+      {
+        const uint8_t* row0 = src + size_t(std::min(y * 2, srcHeight - 1)) * srcWidth * PixelBytes;
+        const uint8_t* row1 = src + size_t(std::min(y * 2 + 1, srcHeight - 1)) * srcWidth * PixelBytes;
+        for (uint32_t x = 0; x < dstWidth; ++x)
+        {
+          const uint32_t x0 = std::min(x * 2, srcWidth - 1) * PixelBytes;
+          const uint32_t x1 = std::min(x * 2 + 1, srcWidth - 1) * PixelBytes;
+          for (uint32_t c = 0; c < PixelBytes; ++c)
+          {
+            const uint32_t a = row0[x0 + c], b = row0[x1 + c], d = row1[x0 + c], e = row1[x1 + c];
+            dst[(size_t(y) * dstWidth + x) * PixelBytes + c] = uint8_t((a + b + d + e + 2) >> 2);
+          }
+        }
+      }
+    }
+  }
+}
+
+int main()
+{
+  struct Size
+  {
+    uint32_t width, height;
+  };
+  const Size sizes[] = {
+    { 1, 1 }, { 2, 2 }, { 3, 3 }, { 1, 64 }, { 64, 1 }, { 7, 5 }, { 9, 17 }, { 16, 16 },
+    { 17, 33 }, { 37, 19 }, { 255, 129 }, { 256, 256 }, { 513, 257 }, { 1024, 1024 },
+  };
+  std::mt19937 rng(12345);
+  std::uniform_int_distribution<int> noise(0, 255);
+  bool passed = true;
+  for (const auto& size : sizes)
+  {
+    std::vector<size_t> mipOffsets;
+    const size_t totalBytes = ComputeMipOffsets(size.width, size.height, mipOffsets);
+    const size_t baseBytes = mipOffsets.size() > 1 ? mipOffsets[1] : totalBytes;
+    std::vector<uint8_t> reference(totalBytes);
+    // 端の値で飽和や桁あふれが起きないよう、0 と 255 も多めに混ぜる.
+    for (size_t i = 0; i < baseBytes; ++i)
+    {
+      const int v = noise(rng);
+      reference[i] = uint8_t(v < 16 ? 0 : (v >= 240 ? 255 : v));
+    }
+    std::vector<uint8_t> pixels = reference;
+    GenerateReference(reference.data(), mipOffsets, size.width, size.height);
+
+    for (bool parallel : { false, true })
+    {
+      std::fill(pixels.begin() + ptrdiff_t(baseBytes), pixels.end(), uint8_t(0));
+      MipmapOptions options;
+      options.parallel = parallel;
+      GenerateMipmapLevels(pixels.data(), mipOffsets, size.width, size.height, 1, options);
+      if (pixels != reference)
+      {
+        printf("%4u x %4u (%s): MISMATCH\n", size.width, size.height, parallel ? "parallel" : "serial");
+        passed = false;
+      }
+    }
+  }
+
+  // ベンチマークの比較 (SIMD 版とスカラー版) も通ること.
+  for (const auto& result : RunCpuMipmapBenchmark())
+  {
+    printf("Benchmark %4u: Box %.3f ms, Parallel %.3f ms %s\n",
+      result.size, result.boxMilliseconds, result.parallelBoxMilliseconds, result.matched ? "OK" : "MISMATCH");
+    passed = passed && result.matched;
+  }
+
+  printf("MipmapGeneratorTest (%s, %u threads): %s\n", GetMipmapSimdName(), GetThreadPool()->GetThreadCount(),
+    passed ? "passed" : "FAILED");
+  return passed ? EXIT_SUCCESS : EXIT_FAILURE;
+}